@@ -0,0 +1,689 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "AtEmulator.h"
+
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+enum class Input
+{
+    COMMAND     = 0, // AT commands terminated by CR LF
+    DATA        = 1, // the payload announced by AT+CIPSEND=<len>
+    PASSTHROUGH = 2  // the transparent transmission, left by "+++"
+};
+
+class Link
+{
+public:
+
+    bool connected;
+    std::string server;
+};
+
+Esp11 * esp = NULL;
+GPIO_TypeDef * powerPort = NULL;
+uint16_t powerPin = 0;
+bool powered = false;
+
+// the circular buffer of the RX DMA stream
+char * ring = NULL;
+size_t ringSize = 0, ringPos = 0;
+
+Input input = Input::COMMAND;
+std::string line, response;
+size_t dataRest = 0, dataLink = 0;
+bool multiConnection = false, transparentMode = false, transparent = false, reachable = true;
+bool promptHeld = false, promptPending = false, scripted = false;
+int wifiMode = 0;
+
+// the module starts at the default baud rate, AT+UART_CUR switches it after its response
+bool uartSwitchAccepted = true;
+uint32_t baudRate = 0, pendingBaudRate = 0;
+int flowControl = 0;
+uint32_t hostBaudRate = 0, hostFlowControl = UART_HWCONTROL_NONE;
+uint32_t powerOns = 0;
+Link links[AtEmulator::MAX_LINKS];
+uint32_t connects = 0;
+
+std::map<std::string, std::string> serverData;
+std::vector<std::string> commands;
+
+void reset ()
+{
+    input = Input::COMMAND;
+    line.clear();
+    dataRest = dataLink = 0;
+    multiConnection = transparentMode = transparent = promptPending = false;
+    wifiMode = 0;
+    baudRate = Esp11::ESP_BAUDRATE;
+    pendingBaudRate = 0;
+    flowControl = 0;
+    for (auto & l : links)
+    {
+        l.connected = false;
+    }
+}
+
+/**
+ * @brief The transfer of the given number of bytes over the line takes its time: the cycle counter
+ *        advances by 10 bits per byte at the baud rate of USART2.
+ */
+void passLineTime (size_t len)
+{
+    if (hostBaudRate != 0)
+    {
+        DWT->CYCCNT = DWT->CYCCNT + (uint32_t)(((uint64_t)len * 10 * SystemCoreClock) / hostBaudRate);
+    }
+}
+
+/**
+ * @brief Plays the RX DMA stream and the USART: writes the data into the circular buffer, serves
+ *        the half and complete transfer interrupts and finally the IDLE-line interrupt.
+ */
+void emit (const char * data, size_t len)
+{
+    if (esp == NULL || ring == NULL || len == 0 || hostBaudRate != baudRate)
+    {
+        // the reception is not started or the baud rates differ: the data is lost
+        return;
+    }
+    passLineTime(len);
+    HostIrq_enter();
+    for (size_t i = 0; i < len; ++i)
+    {
+        ring[ringPos++] = data[i];
+        uint32_t flags = 0;
+        if (ringPos == ringSize / 2)
+        {
+            flags = DMA_FLAG_HTIF1_5;
+        }
+        else if (ringPos == ringSize)
+        {
+            ringPos = 0;
+            flags = DMA_FLAG_TCIF1_5;
+        }
+        DMA1_Stream5->NDTR = ringSize - ringPos;
+        if (flags != 0)
+        {
+            // the flags are cleared by writing HIFCR, that is plain memory here
+            DMA1->HISR |= flags;
+            esp->processDmaRxInterrupt();
+            DMA1->HISR = 0;
+        }
+    }
+    USART2->SR |= USART_SR_IDLE;
+    esp->processInterrupt();
+    USART2->SR &= ~USART_SR_IDLE;
+    HostIrq_leave();
+}
+
+void emit (const std::string & data)
+{
+    emit(data.data(), data.size());
+}
+
+void closeLink (size_t id)
+{
+    links[id].connected = false;
+    response += multiConnection? std::to_string(id) + ",CLOSED\r\n" : std::string("CLOSED\r\n");
+}
+
+/**
+ * @brief Parses the optional "<id>," prefix of the multiple connection mode.
+ */
+bool parseLinkId (const char * & args, size_t & id)
+{
+    id = 0;
+    if (!multiConnection)
+    {
+        return true;
+    }
+    char * end = NULL;
+    id = ::strtoul(args, &end, 10);
+    if (end == args || *end != ',' || id >= AtEmulator::MAX_LINKS)
+    {
+        return false;
+    }
+    args = end + 1;
+    return true;
+}
+
+bool startConnection (const char * args)
+{
+    size_t id;
+    if (!parseLinkId(args, id))
+    {
+        return false;
+    }
+    // "<protocol>","<server>",<port>[,<local port>,<mode>]
+    const char * s = ::strchr(args, ',');
+    if (s == NULL || s[1] != '"')
+    {
+        return false;
+    }
+    const char * e = ::strchr(s + 2, '"');
+    if (e == NULL)
+    {
+        return false;
+    }
+    if (links[id].connected)
+    {
+        response += "ALREADY CONNECTED\r\n";
+        return false;
+    }
+    if (!reachable)
+    {
+        return false;
+    }
+    links[id].connected = true;
+    links[id].server.assign(s + 2, e - s - 2);
+    ++connects;
+    response += multiConnection? std::to_string(id) + ",CONNECT\r\n" : std::string("CONNECT\r\n");
+    return true;
+}
+
+bool startSend (const char * args)
+{
+    size_t id;
+    if (!parseLinkId(args, id))
+    {
+        return false;
+    }
+    char * end = NULL;
+    size_t len = ::strtoul(args, &end, 10);
+    if (end == args || len == 0 || len > 2048)
+    {
+        return false;
+    }
+    if (!links[id].connected)
+    {
+        response += "link is not valid\r\n";
+        return false;
+    }
+    input = Input::DATA;
+    dataLink = id;
+    dataRest = len;
+    return true;
+}
+
+bool closeConnection (const char * args)
+{
+    if (*args == 0)
+    {
+        if (!links[0].connected)
+        {
+            return false;
+        }
+        closeLink(0);
+        return true;
+    }
+    size_t id = ::strtoul(args + 1, NULL, 10);
+    if (id == AtEmulator::MAX_LINKS + 1)
+    {
+        for (size_t i = 0; i < AtEmulator::MAX_LINKS; ++i)
+        {
+            if (links[i].connected)
+            {
+                closeLink(i);
+            }
+        }
+        return true;
+    }
+    if (id >= AtEmulator::MAX_LINKS || !links[id].connected)
+    {
+        return false;
+    }
+    closeLink(id);
+    return true;
+}
+
+bool anyLinkConnected ()
+{
+    for (auto & l : links)
+    {
+        if (l.connected)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool startsWith (const std::string & s, const char * prefix)
+{
+    return s.compare(0, ::strlen(prefix), prefix) == 0;
+}
+
+/**
+ * @brief Executes a command and appends its response. Returns false if the command failed.
+ */
+bool execute (const std::string & cmd)
+{
+    commands.push_back(cmd);
+    if (cmd == "AT" || cmd == "ATE0" || cmd == "ATE1" || startsWith(cmd, "AT+CIPSTA_CUR=")
+        || startsWith(cmd, "AT+SLEEP="))
+    {
+        return true;
+    }
+    if (startsWith(cmd, "AT+UART_CUR="))
+    {
+        // AT+UART_CUR=<baudrate>,<databits>,<stopbits>,<parity>,<flow control>
+        const char * args = cmd.c_str() + 12;
+        uint32_t rate = ::strtoul(args, NULL, 10);
+        const char * fc = ::strrchr(args, ',');
+        if (!uartSwitchAccepted || rate == 0 || fc == NULL)
+        {
+            return false;
+        }
+        pendingBaudRate = rate;
+        flowControl = ::atoi(fc + 1);
+        return true;
+    }
+    if (startsWith(cmd, "AT+CWMODE="))
+    {
+        wifiMode = ::atoi(cmd.c_str() + 10);
+        return true;
+    }
+    if (cmd == "AT+CWMODE?")
+    {
+        response += "+CWMODE:" + std::to_string(wifiMode) + "\r\n";
+        return true;
+    }
+    if (startsWith(cmd, "AT+CWLAP="))
+    {
+        response += "+CWLAP:(3," + cmd.substr(9) + ",-60,\"00:00:00:00:00:00\",1)\r\n";
+        return true;
+    }
+    if (startsWith(cmd, "AT+CWJAP_CUR="))
+    {
+        response += "WIFI CONNECTED\r\nWIFI GOT IP\r\n";
+        return true;
+    }
+    if (startsWith(cmd, "AT+PING="))
+    {
+        response += reachable? "+5\r\n" : "+timeout\r\n";
+        return reachable;
+    }
+    if (startsWith(cmd, "AT+CIPMODE="))
+    {
+        transparentMode = (cmd[11] == '1');
+        return true;
+    }
+    if (startsWith(cmd, "AT+CIPMUX="))
+    {
+        if (anyLinkConnected())
+        {
+            response += "link is builded\r\n";
+            return false;
+        }
+        multiConnection = (cmd[10] == '1');
+        return true;
+    }
+    if (startsWith(cmd, "AT+CIPSTART="))
+    {
+        return startConnection(cmd.c_str() + 12);
+    }
+    if (cmd == "AT+CIPSEND")
+    {
+        if (!transparentMode || multiConnection || !links[0].connected)
+        {
+            return false;
+        }
+        // the prompt follows OK, the data is sent from now on
+        response += "\r\nOK\r\n";
+        promptPending = promptHeld;
+        if (!promptHeld)
+        {
+            response += "\r\n>";
+        }
+        transparent = true;
+        input = Input::PASSTHROUGH;
+        return true;
+    }
+    if (startsWith(cmd, "AT+CIPSEND="))
+    {
+        if (!startSend(cmd.c_str() + 11))
+        {
+            return false;
+        }
+        response += "\r\nOK\r\n> ";
+        return true;
+    }
+    if (startsWith(cmd, "AT+CIPCLOSE"))
+    {
+        return closeConnection(cmd.c_str() + 11);
+    }
+    return false;
+}
+
+void receive (const char * data, size_t len)
+{
+    if (!powered || hostBaudRate != baudRate)
+    {
+        // the module receives garbage if the baud rates differ
+        return;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        switch (input)
+        {
+        case Input::COMMAND:
+            line += data[i];
+            if (line.size() >= 2 && line.compare(line.size() - 2, 2, "\r\n") == 0)
+            {
+                line.resize(line.size() - 2);
+                bool ok = execute(line);
+                if (input != Input::PASSTHROUGH)
+                {
+                    response += ok? "\r\nOK\r\n" : "\r\nERROR\r\n";
+                }
+                line.clear();
+            }
+            break;
+
+        case Input::DATA:
+            serverData[links[dataLink].server] += data[i];
+            if (--dataRest == 0)
+            {
+                input = Input::COMMAND;
+                response += links[dataLink].connected? "\r\nRecv\r\n\r\nSEND OK\r\n" : "\r\nSEND FAIL\r\n";
+            }
+            break;
+
+        case Input::PASSTHROUGH:
+            if (len == 3 && ::strncmp(data, "+++", 3) == 0)
+            {
+                // the escape sequence is a separate packet surrounded by the guard times
+                input = Input::COMMAND;
+                transparent = false;
+                return;
+            }
+            if (links[0].connected)
+            {
+                serverData[links[0].server].append(data + i, len - i);
+            }
+            return;
+        }
+    }
+}
+
+void onGpioWrite (void * port, uint16_t pin, uint32_t state)
+{
+    if (port != powerPort || (pin & powerPin) == 0 || (state != 0) == powered)
+    {
+        return;
+    }
+    powered = (state != 0);
+    reset();
+    powerOns += powered? 1 : 0;
+    if (powered && !scripted)
+    {
+        emit(std::string("\r\n\r\nready\r\n"));
+    }
+}
+
+} // end of anonymous namespace
+
+void AtEmulator::attach (Esp11 & _esp, GPIO_TypeDef * _powerPort, uint16_t _powerPin)
+{
+    esp = &_esp;
+    powerPort = _powerPort;
+    powerPin = _powerPin;
+    powered = false;
+    reachable = true;
+    scripted = false;
+    uartSwitchAccepted = true;
+    powerOns = 0;
+    reset();
+    clear();
+    HostHal_setGpioHandler(onGpioWrite);
+}
+
+void AtEmulator::detach ()
+{
+    HostHal_setGpioHandler(NULL);
+    esp = NULL;
+}
+
+void AtEmulator::setServersReachable (bool _reachable)
+{
+    reachable = _reachable;
+    if (reachable)
+    {
+        return;
+    }
+    for (size_t i = 0; i < MAX_LINKS; ++i)
+    {
+        if (links[i].connected)
+        {
+            closeLink(i);
+        }
+    }
+    emit(response);
+    response.clear();
+}
+
+void AtEmulator::sendFromServer (size_t linkId, const char * data)
+{
+    if (!links[linkId].connected)
+    {
+        return;
+    }
+    size_t len = ::strlen(data);
+    if (transparent)
+    {
+        emit(data, len);
+        return;
+    }
+    std::string ipd = "\r\n+IPD,";
+    if (multiConnection)
+    {
+        ipd += std::to_string(linkId) + ",";
+    }
+    ipd += std::to_string(len) + ":";
+    ipd.append(data, len);
+    emit(ipd);
+}
+
+void AtEmulator::sendRaw (const char * data)
+{
+    emit(data, ::strlen(data));
+}
+
+void AtEmulator::setUartSwitchAccepted (bool accepted)
+{
+    uartSwitchAccepted = accepted;
+}
+
+uint32_t AtEmulator::getBaudRate ()
+{
+    return baudRate;
+}
+
+int AtEmulator::getFlowControl ()
+{
+    return flowControl;
+}
+
+uint32_t AtEmulator::getHostBaudRate ()
+{
+    return hostBaudRate;
+}
+
+uint32_t AtEmulator::getHostFlowControl ()
+{
+    return hostFlowControl;
+}
+
+uint32_t AtEmulator::getPowerOns ()
+{
+    return powerOns;
+}
+
+void AtEmulator::setPromptHeld (bool held)
+{
+    promptHeld = held;
+}
+
+void AtEmulator::setScripted (bool _scripted)
+{
+    scripted = _scripted;
+}
+
+void AtEmulator::releasePrompt ()
+{
+    if (promptPending)
+    {
+        promptPending = false;
+        emit(std::string("\r\n>"));
+    }
+}
+
+std::string AtEmulator::getServerData (const char * server)
+{
+    return serverData[server];
+}
+
+const std::vector<std::string> & AtEmulator::getCommands ()
+{
+    return commands;
+}
+
+void AtEmulator::clear ()
+{
+    serverData.clear();
+    commands.clear();
+    connects = 0;
+}
+
+int AtEmulator::findLink (const char * server)
+{
+    for (size_t i = 0; i < MAX_LINKS; ++i)
+    {
+        if (links[i].connected && links[i].server == server)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool AtEmulator::isTransparent ()
+{
+    return transparent;
+}
+
+bool AtEmulator::isLinkConnected (size_t linkId)
+{
+    return links[linkId].connected;
+}
+
+uint32_t AtEmulator::getConnects ()
+{
+    return connects;
+}
+
+/************************************************************************
+ * HAL functions of USART2 and its RX DMA stream
+ ************************************************************************/
+
+extern "C" HAL_StatusTypeDef HAL_UART_Init (UART_HandleTypeDef * huart)
+{
+    if (huart->Instance == USART2)
+    {
+        hostBaudRate = huart->Init.BaudRate;
+        hostFlowControl = huart->Init.HwFlowCtl;
+    }
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_DMA_Start (DMA_HandleTypeDef * hdma, uint32_t SrcAddress, uint32_t DstAddress,
+                                            uint32_t DataLength)
+{
+    // the stream registers as programmed by the HAL, for the streams of the other tests
+    hdma->Instance->NDTR = DataLength;
+    hdma->Instance->PAR = (hdma->Init.Direction == DMA_MEMORY_TO_PERIPH)? DstAddress : SrcAddress;
+    hdma->Instance->M0AR = (hdma->Init.Direction == DMA_MEMORY_TO_PERIPH)? SrcAddress : DstAddress;
+    if (hdma->Instance == DMA1_Stream5)
+    {
+        ring = (char *)(uintptr_t)DstAddress;
+        ringSize = DataLength;
+        ringPos = 0;
+        DMA1_Stream5->NDTR = DataLength;
+        DMA1->HISR = 0;
+    }
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_DMA_Abort (DMA_HandleTypeDef * hdma)
+{
+    if (hdma->Instance == DMA1_Stream5)
+    {
+        ring = NULL;
+    }
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_UART_Transmit_DMA (UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size)
+{
+    if (esp == NULL || huart->Instance != USART2)
+    {
+        return HAL_OK;
+    }
+    response.clear();
+    passLineTime(Size);
+    if (scripted)
+    {
+        std::string t((const char *)pData, Size);
+        if (t.size() >= 2 && t.compare(t.size() - 2, 2, "\r\n") == 0)
+        {
+            t.resize(t.size() - 2);
+        }
+        commands.push_back(t);
+    }
+    else
+    {
+        receive((const char *)pData, Size);
+    }
+
+    // the transmission is complete before the module responds
+    HostIrq_enter();
+    esp->processTxCpltCallback();
+    HostIrq_leave();
+
+    std::string r;
+    r.swap(response);
+    emit(r);
+    if (pendingBaudRate != 0)
+    {
+        // the response of AT+UART_CUR is sent at the old baud rate
+        baudRate = pendingBaudRate;
+        pendingBaudRate = 0;
+    }
+    return HAL_OK;
+}
@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef ATEMULATOR_H_
+#define ATEMULATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "StmPlusPlus/Devices/Esp11.h"
+
+/**
+ * @brief ESP module behind USART2: answers the AT commands sent by the real Esp11 driver and
+ *        plays the servers it connects to.
+ *
+ * The transmission is captured from HAL_UART_Transmit_DMA() and answered at once: the response
+ * is written into the circular receive buffer of the driver like the RX DMA stream does, with
+ * the DMA and the IDLE-line interrupts served in between. The echo is assumed to be off.
+ * The module answers at once, but the transfers in both directions advance the cycle counter
+ * by their time on the line at the baud rate of USART2.
+ */
+class AtEmulator
+{
+public:
+
+    static const size_t MAX_LINKS = StmPlusPlus::Devices::Esp11::MAX_LINKS;
+
+    /**
+     * @brief Connects the module to the given driver. The module boots when the power pin is set.
+     */
+    static void attach (StmPlusPlus::Devices::Esp11 & esp, GPIO_TypeDef * powerPort, uint16_t powerPin);
+
+    static void detach ();
+
+    /**
+     * @brief Simulates a network outage: the connected links are closed by the remote side and
+     *        no new connection can be opened while the servers are not reachable.
+     */
+    static void setServersReachable (bool reachable);
+
+    /**
+     * @brief The server connected to the given link sends a message to the device.
+     */
+    static void sendFromServer (size_t linkId, const char * data);
+
+    /**
+     * @brief Sends the given data as it is, e.g. an unsolicited notification.
+     */
+    static void sendRaw (const char * data);
+
+    /**
+     * @brief AT+UART_CUR is either answered by OK, and the module switches to the new baud rate
+     *        after the response, or refused by ERROR. The module starts at Esp11::ESP_BAUDRATE on
+     *        every power-on. While the baud rates of the module and USART2 differ, the data is
+     *        lost in both directions.
+     */
+    static void setUartSwitchAccepted (bool accepted);
+
+    /**
+     * @brief Returns the baud rate and the flow control (bit 0: RTS, bit 1: CTS of the module)
+     *        of the module.
+     */
+    static uint32_t getBaudRate ();
+    static int getFlowControl ();
+
+    /**
+     * @brief Returns the baud rate and the hardware flow control of USART2.
+     */
+    static uint32_t getHostBaudRate ();
+    static uint32_t getHostFlowControl ();
+
+    static uint32_t getPowerOns ();
+
+    /**
+     * @brief The data prompt of the transparent transmission is held back after OK until
+     *        releasePrompt() is called: it arrives as a separate burst.
+     */
+    static void setPromptHeld (bool held);
+
+    static void releasePrompt ();
+
+    /**
+     * @brief In the scripted mode the module does not answer: the transmissions are recorded as
+     *        they are, without the trailing CR LF, and the test sends the responses by sendRaw().
+     */
+    static void setScripted (bool scripted);
+
+    /**
+     * @brief Returns all data received by the given server since the last clear().
+     */
+    static std::string getServerData (const char * server);
+
+    /**
+     * @brief Returns the AT commands received since the last clear(), without CR LF.
+     */
+    static const std::vector<std::string> & getCommands ();
+
+    static void clear ();
+
+    /**
+     * @brief Returns the ID of the link connected to the given server, or -1.
+     */
+    static int findLink (const char * server);
+
+    static bool isTransparent ();
+    static bool isLinkConnected (size_t linkId);
+    static uint32_t getConnects ();
+};
+
+#endif
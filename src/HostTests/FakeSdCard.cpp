@@ -0,0 +1,213 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstring>
+
+#include "FakeSdCard.h"
+
+namespace
+{
+
+std::vector<uint8_t> disk;
+GPIO_TypeDef * detectPort = NULL;
+uint16_t detectPin = 0;
+uint32_t serialNumber = 0, writeDelay = 0, timeouts = 0, writtenBlocks = 0, checks = 0, minClockDiv = 0;
+bool failing = false;
+
+HAL_SD_ErrorTypedef transfer (uint32_t * pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks, bool write)
+{
+    if (failing || detectPort == NULL || (detectPort->IDR & detectPin) != 0)
+    {
+        return SD_CMD_RSP_TIMEOUT;
+    }
+    if (addr + (uint64_t)blockSize * numOfBlocks > disk.size())
+    {
+        return SD_ADDR_OUT_OF_RANGE;
+    }
+    if (write)
+    {
+        if (writeDelay > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(writeDelay));
+        }
+        ::memcpy(&disk[addr], pData, blockSize * numOfBlocks);
+        writtenBlocks += numOfBlocks;
+    }
+    else
+    {
+        ::memcpy(pData, &disk[addr], blockSize * numOfBlocks);
+    }
+    return SD_OK;
+}
+
+HAL_SD_ErrorTypedef check ()
+{
+    ++checks;
+    if (timeouts > 0)
+    {
+        --timeouts;
+        return SD_DATA_TIMEOUT;
+    }
+    return failing? SD_DATA_CRC_FAIL : SD_OK;
+}
+
+} // end of anonymous namespace
+
+void FakeSdCard::insert (GPIO_TypeDef * _detectPort, uint16_t _detectPin, uint32_t _serialNumber)
+{
+    disk.assign((size_t)SECTORS * StmPlusPlus::Devices::SdCard::SDHC_BLOCK_SIZE, 0);
+    detectPort = _detectPort;
+    detectPin = _detectPin;
+    serialNumber = _serialNumber;
+    detectPort->IDR &= ~detectPin;
+    writeDelay = timeouts = writtenBlocks = checks = minClockDiv = 0;
+    failing = false;
+}
+
+void FakeSdCard::remove ()
+{
+    detectPort->IDR |= detectPin;
+}
+
+bool FakeSdCard::format (StmPlusPlus::Devices::SdCard & sdCard)
+{
+    if (!sdCard.start(StmPlusPlus::Devices::SdCard::SAFE_CLOCK_DIV))
+    {
+        return false;
+    }
+    // links the FAT FS driver, the mount itself fails on the empty card
+    sdCard.mountFatFs();
+    FATFS fs;
+    bool retValue = f_mount(&fs, "", 0) == FR_OK && f_mkfs("", 1, 0) == FR_OK && f_mount(NULL, "", 0) == FR_OK;
+    sdCard.stop();
+    return retValue;
+}
+
+void FakeSdCard::setWriteDelay (uint32_t us)
+{
+    writeDelay = us;
+}
+
+void FakeSdCard::setTimeouts (uint32_t n)
+{
+    timeouts = n;
+}
+
+void FakeSdCard::setFailing (bool _failing)
+{
+    failing = _failing;
+}
+
+void FakeSdCard::setMinClockDiv (uint32_t clockDiv)
+{
+    minClockDiv = clockDiv;
+}
+
+uint32_t FakeSdCard::getWrittenBlocks ()
+{
+    return writtenBlocks;
+}
+
+uint32_t FakeSdCard::getChecks ()
+{
+    return checks;
+}
+
+uint8_t * FakeSdCard::getSector (uint32_t sector)
+{
+    return &disk[(size_t)sector * StmPlusPlus::Devices::SdCard::SDHC_BLOCK_SIZE];
+}
+
+/************************************************************************
+ * Fixture
+ ************************************************************************/
+
+using namespace StmPlusPlus;
+
+SdCardFixture::SdCardFixture () :
+    pinSdPower(IOPort::A, GPIO_PIN_15, GPIO_MODE_OUTPUT_PP),
+    pinSdDetect(IOPort::B, GPIO_PIN_3, GPIO_MODE_INPUT, GPIO_PULLUP),
+    portSd1(IOPort::C, GPIO_MODE_OUTPUT_PP, GPIO_PULLUP, GPIO_SPEED_FREQ_VERY_HIGH,
+            GPIO_PIN_8 | GPIO_PIN_9 | GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12, false),
+    portSd2(IOPort::D, GPIO_MODE_OUTPUT_PP, GPIO_PULLUP, GPIO_SPEED_FREQ_VERY_HIGH, GPIO_PIN_2, false),
+    sdCard(pinSdDetect, portSd1, portSd2),
+    storage(sdCard, pinSdPower, false, Devices::SdCard::SAFE_CLOCK_DIV)
+{
+    // empty
+}
+
+bool SdCardFixture::start (bool format)
+{
+    sdCard.initInstance();
+    return insert(format);
+}
+
+bool SdCardFixture::insert (bool format)
+{
+    FakeSdCard::insert(GPIOB, GPIO_PIN_3);
+    return !format || FakeSdCard::format(sdCard);
+}
+
+/************************************************************************
+ * HAL_SD functions
+ ************************************************************************/
+
+extern "C" HAL_SD_ErrorTypedef HAL_SD_Init (SD_HandleTypeDef *, HAL_SD_CardInfoTypedef * info)
+{
+    if (detectPort == NULL || (detectPort->IDR & detectPin) != 0)
+    {
+        return SD_CMD_RSP_TIMEOUT;
+    }
+    ::memset(info, 0, sizeof(HAL_SD_CardInfoTypedef));
+    info->CardCapacity = disk.size();
+    info->CardBlockSize = StmPlusPlus::Devices::SdCard::SDHC_BLOCK_SIZE;
+    info->CardType = HIGH_CAPACITY_SD_CARD;
+    info->SD_cid.ProdSN = serialNumber;
+    return SD_OK;
+}
+
+extern "C" HAL_SD_ErrorTypedef HAL_SD_ReadBlocks_DMA (SD_HandleTypeDef * hsd, uint32_t * pReadBuffer, uint64_t ReadAddr,
+                                                      uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    if (minClockDiv > 0 && (hsd->Init.ClockBypass == SDIO_CLOCK_BYPASS_ENABLE || hsd->Init.ClockDiv < minClockDiv))
+    {
+        return SD_DATA_CRC_FAIL;
+    }
+    return transfer(pReadBuffer, ReadAddr, BlockSize, NumberOfBlocks, false);
+}
+
+extern "C" HAL_SD_ErrorTypedef HAL_SD_WriteBlocks_DMA (SD_HandleTypeDef *, uint32_t * pWriteBuffer, uint64_t WriteAddr,
+                                                       uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    return transfer(pWriteBuffer, WriteAddr, BlockSize, NumberOfBlocks, true);
+}
+
+extern "C" HAL_SD_ErrorTypedef HAL_SD_CheckReadOperation (SD_HandleTypeDef *, uint32_t)
+{
+    return check();
+}
+
+extern "C" HAL_SD_ErrorTypedef HAL_SD_CheckWriteOperation (SD_HandleTypeDef *, uint32_t)
+{
+    return check();
+}
@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef FAKESDCARD_H_
+#define FAKESDCARD_H_
+
+#include "StmPlusPlus/Devices/SdCard.h"
+#include "StmPlusPlus/StorageManager.h"
+
+/**
+ * @brief RAM disk behind the HAL_SD functions: the real SdCard driver, FAT FS and the
+ *        storage users run on top of it.
+ *
+ * The card detect pin is active low: the card is inserted while the pin reads 0.
+ */
+class FakeSdCard
+{
+public:
+
+    static const uint32_t SECTORS = 131072; // 64 MB
+
+    /**
+     * @brief Creates an empty card: format() shall be called before it is mounted.
+     */
+    static void insert (GPIO_TypeDef * detectPort, uint16_t detectPin, uint32_t serialNumber = 1);
+
+    static void remove ();
+
+    /**
+     * @brief Creates a new FAT volume, the FAT FS driver of the given card is linked if necessary.
+     */
+    static bool format (StmPlusPlus::Devices::SdCard & sdCard);
+
+    /**
+     * @brief Delays every write operation by the given time: simulates a write stall of the card.
+     */
+    static void setWriteDelay (uint32_t us);
+
+    /**
+     * @brief The next n checks of a transfer report a data timeout.
+     */
+    static void setTimeouts (uint32_t n);
+
+    /**
+     * @brief All following transfers fail.
+     */
+    static void setFailing (bool failing);
+
+    /**
+     * @brief The reads at a faster SDIO clock than the given divider (including the bypass)
+     *        fail with a CRC error: the card is not reliable at high clock. 0: no limit.
+     */
+    static void setMinClockDiv (uint32_t clockDiv);
+
+    static uint32_t getWrittenBlocks ();
+    static uint32_t getChecks ();
+    static uint8_t * getSector (uint32_t sector);
+};
+
+/**
+ * @brief The SD card wiring of PI405RG on the fake card: the detect pin PB3, the power pin PA15,
+ *        the SDIO ports, the driver and the storage manager. A test defines it at file scope.
+ */
+class SdCardFixture
+{
+public:
+
+    StmPlusPlus::IOPin pinSdPower, pinSdDetect;
+    StmPlusPlus::IOPort portSd1, portSd2;
+    StmPlusPlus::Devices::SdCard sdCard;
+    StmPlusPlus::StorageManager storage;
+
+    SdCardFixture ();
+
+    /**
+     * @brief Registers the driver instance and inserts a card.
+     */
+    bool start (bool format = true);
+
+    /**
+     * @brief Inserts an empty card, formatted if requested.
+     */
+    bool insert (bool format = true);
+};
+
+#endif
@@ -0,0 +1,427 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Weak host stubs of the HAL functions referenced by the library: each one succeeds without any
+ * effect, except the RTC backup registers that are kept in the mapped RTC registers. A test
+ * overrides the functions it observes by its own (strong) definition.
+ */
+
+#include "stm32f4xx_hal.h"
+#include "stm32f4xx_hal_adc.h"
+#include "stm32f4xx_ll_sdmmc.h"
+
+__weak HAL_StatusTypeDef HAL_ADC_ConfigChannel (ADC_HandleTypeDef* hadc, ADC_ChannelConfTypeDef* sConfig)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_ADC_DeInit (ADC_HandleTypeDef *hadc)
+{
+    return HAL_OK;
+}
+
+__weak uint32_t HAL_ADC_GetValue (ADC_HandleTypeDef* hadc)
+{
+    return 0;
+}
+
+__weak HAL_StatusTypeDef HAL_ADC_Init (ADC_HandleTypeDef* hadc)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_ADC_PollForConversion (ADC_HandleTypeDef* hadc, uint32_t Timeout)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_ADC_Start (ADC_HandleTypeDef* hadc)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_ADC_Stop (ADC_HandleTypeDef* hadc)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_DMA_Abort (DMA_HandleTypeDef *hdma)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_DMA_DeInit (DMA_HandleTypeDef *hdma)
+{
+    return HAL_OK;
+}
+
+__weak void HAL_DMA_IRQHandler (DMA_HandleTypeDef *hdma)
+{
+}
+
+__weak HAL_StatusTypeDef HAL_DMA_Init (DMA_HandleTypeDef *hdma)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_DMA_Start (DMA_HandleTypeDef *hdma, uint32_t SrcAddress, uint32_t DstAddress, uint32_t DataLength)
+{
+    return HAL_OK;
+}
+
+__weak void HAL_GPIO_DeInit (GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin)
+{
+}
+
+__weak void HAL_GPIO_Init (GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+}
+
+__weak uint32_t HAL_GetREVID (void)
+{
+    return 0;
+}
+
+__weak HAL_StatusTypeDef HAL_I2S_DeInit (I2S_HandleTypeDef *hi2s)
+{
+    return HAL_OK;
+}
+
+__weak void HAL_I2S_IRQHandler (I2S_HandleTypeDef *hi2s)
+{
+}
+
+__weak HAL_StatusTypeDef HAL_I2S_Init (I2S_HandleTypeDef *hi2s)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_I2S_Transmit_DMA (I2S_HandleTypeDef *hi2s, uint16_t *pData, uint16_t Size)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_Init (void)
+{
+    return HAL_OK;
+}
+
+__weak void HAL_NVIC_DisableIRQ (IRQn_Type IRQn)
+{
+}
+
+__weak void HAL_NVIC_EnableIRQ (IRQn_Type IRQn)
+{
+}
+
+__weak void HAL_NVIC_SetPriority (IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+}
+
+__weak void HAL_NVIC_SetPriorityGrouping (uint32_t PriorityGroup)
+{
+}
+
+__weak HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig (RCC_PeriphCLKInitTypeDef *PeriphClkInit)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_RCC_ClockConfig (RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency)
+{
+    return HAL_OK;
+}
+
+__weak uint32_t HAL_RCC_GetHCLKFreq (void)
+{
+    return 0;
+}
+
+__weak uint32_t HAL_RCC_GetPCLK1Freq (void)
+{
+    return 0;
+}
+
+__weak uint32_t HAL_RCC_GetPCLK2Freq (void)
+{
+    return 0;
+}
+
+__weak void HAL_RCC_MCOConfig (uint32_t RCC_MCOx, uint32_t RCC_MCOSource, uint32_t RCC_MCODiv)
+{
+}
+
+__weak HAL_StatusTypeDef HAL_RCC_OscConfig (RCC_OscInitTypeDef *RCC_OscInitStruct)
+{
+    return HAL_OK;
+}
+
+__weak uint32_t HAL_RTCEx_BKUPRead (RTC_HandleTypeDef *hrtc, uint32_t BackupRegister)
+{
+    return (&hrtc->Instance->BKP0R)[BackupRegister];
+}
+
+__weak void HAL_RTCEx_BKUPWrite (RTC_HandleTypeDef *hrtc, uint32_t BackupRegister, uint32_t Data)
+{
+    (&hrtc->Instance->BKP0R)[BackupRegister] = Data;
+}
+
+__weak uint32_t HAL_RTCEx_DeactivateWakeUpTimer (RTC_HandleTypeDef *hrtc)
+{
+    return 0;
+}
+
+__weak HAL_StatusTypeDef HAL_RTCEx_SetWakeUpTimer_IT (RTC_HandleTypeDef *hrtc, uint32_t WakeUpCounter, uint32_t WakeUpClock)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_RTC_DeInit (RTC_HandleTypeDef *hrtc)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_RTC_Init (RTC_HandleTypeDef *hrtc)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_RTC_SetDate (RTC_HandleTypeDef *hrtc, RTC_DateTypeDef *sDate, uint32_t Format)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_RTC_SetTime (RTC_HandleTypeDef *hrtc, RTC_TimeTypeDef *sTime, uint32_t Format)
+{
+    return HAL_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_CheckReadOperation (SD_HandleTypeDef *hsd, uint32_t Timeout)
+{
+    return SD_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_CheckWriteOperation (SD_HandleTypeDef *hsd, uint32_t Timeout)
+{
+    return SD_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SD_DeInit (SD_HandleTypeDef *hsd)
+{
+    return HAL_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_GetCardStatus (SD_HandleTypeDef *hsd, HAL_SD_CardStatusTypedef *pCardStatus)
+{
+    return SD_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_HighSpeed (SD_HandleTypeDef *hsd)
+{
+    return SD_OK;
+}
+
+__weak void HAL_SD_IRQHandler (SD_HandleTypeDef *hsd)
+{
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_Init (SD_HandleTypeDef *hsd, HAL_SD_CardInfoTypedef *SDCardInfo)
+{
+    return SD_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_ReadBlocks_DMA (SD_HandleTypeDef *hsd, uint32_t *pReadBuffer, uint64_t ReadAddr, uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    return SD_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_StopTransfer (SD_HandleTypeDef *hsd)
+{
+    return SD_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_WideBusOperation_Config (SD_HandleTypeDef *hsd, uint32_t WideMode)
+{
+    return SD_OK;
+}
+
+__weak HAL_SD_ErrorTypedef HAL_SD_WriteBlocks_DMA (SD_HandleTypeDef *hsd, uint32_t *pWriteBuffer, uint64_t WriteAddr, uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    return SD_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_DeInit (SPI_HandleTypeDef *hspi)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_Init (SPI_HandleTypeDef *hspi)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_Receive (SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_Receive_DMA (SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_Transmit (SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_TransmitReceive (SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA (SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_SPI_Transmit_DMA (SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+    return HAL_OK;
+}
+
+__weak void HAL_SYSTICK_CLKSourceConfig (uint32_t CLKSource)
+{
+}
+
+__weak uint32_t HAL_SYSTICK_Config (uint32_t TicksNumb)
+{
+    return 0;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_Base_DeInit (TIM_HandleTypeDef *htim)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_Base_Init (TIM_HandleTypeDef *htim)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_Base_Start (TIM_HandleTypeDef *htim)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_Base_Start_IT (TIM_HandleTypeDef *htim)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_Base_Stop (TIM_HandleTypeDef *htim)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_Base_Stop_IT (TIM_HandleTypeDef *htim)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_OC_ConfigChannel (TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef* sConfig, uint32_t Channel)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_OC_Start (TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_OC_Stop (TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel (TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef* sConfig, uint32_t Channel)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_PWM_Init (TIM_HandleTypeDef *htim)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_PWM_Start (TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_TIM_PWM_Stop (TIM_HandleTypeDef *htim, uint32_t Channel)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_UART_DeInit (UART_HandleTypeDef *huart)
+{
+    return HAL_OK;
+}
+
+__weak void HAL_UART_IRQHandler (UART_HandleTypeDef *huart)
+{
+}
+
+__weak HAL_StatusTypeDef HAL_UART_Init (UART_HandleTypeDef *huart)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_UART_Receive (UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_UART_Receive_IT (UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_UART_Transmit (UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_UART_Transmit_DMA (UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef HAL_UART_Transmit_IT (UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+    return HAL_OK;
+}
+
+__weak HAL_StatusTypeDef SDIO_Init (SDIO_TypeDef *SDIOx, SDIO_InitTypeDef Init)
+{
+    return HAL_OK;
+}
@@ -0,0 +1,205 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <sys/mman.h>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "stm32f4xx_hal.h"
+
+uint32_t SystemCoreClock = 168000000;
+
+/************************************************************************
+ * Peripheral registers
+ ************************************************************************/
+
+namespace
+{
+
+void mapRegion (uintptr_t base, size_t size)
+{
+    void * p = ::mmap((void *)base, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void *)base)
+    {
+        ::fprintf(stderr, "Can not map the peripheral registers at %lx\n", (unsigned long)base);
+        ::exit(1);
+    }
+}
+
+// runs before the static objects of the tests are constructed
+__attribute__((constructor(101))) void mapPeripherals ()
+{
+    mapRegion(PERIPH_BASE, 0x80000);   // APB1, APB2 and AHB1
+    mapRegion(PERIPH_BB_BASE, 0x2000000); // bit-band alias, e.g. __HAL_RCC_RTC_DISABLE(): not mirrored
+    mapRegion(0xE0000000UL, 0x100000); // DWT, NVIC, SysTick, SCB and CoreDebug
+}
+
+/************************************************************************
+ * Interrupt mask
+ ************************************************************************/
+
+std::recursive_mutex irqLock;
+thread_local uint32_t irqDepth = 0;
+
+} // end of anonymous namespace
+
+extern "C" void HostIrq_disable (void)
+{
+    if (irqDepth == 0)
+    {
+        irqLock.lock();
+        irqDepth = 1;
+    }
+}
+
+extern "C" void HostIrq_enable (void)
+{
+    if (irqDepth == 1)
+    {
+        irqDepth = 0;
+        irqLock.unlock();
+    }
+}
+
+extern "C" uint32_t HostIrq_isDisabled (void)
+{
+    return irqDepth != 0;
+}
+
+extern "C" void HostIrq_enter (void)
+{
+    // an interrupt service routine can not start while the interrupts are disabled
+    irqLock.lock();
+    ++irqDepth;
+}
+
+extern "C" void HostIrq_leave (void)
+{
+    --irqDepth;
+    irqLock.unlock();
+}
+
+/************************************************************************
+ * System tick
+ ************************************************************************/
+
+static std::atomic<uint32_t> tick(0);
+
+extern "C" void HostHal_setTick (uint32_t t)
+{
+    tick = t;
+}
+
+extern "C" void HostHal_advanceTick (uint32_t ms)
+{
+    tick += ms;
+}
+
+extern "C" uint32_t HAL_GetTick (void)
+{
+    return tick;
+}
+
+extern "C" void HAL_IncTick (void)
+{
+    ++tick;
+}
+
+extern "C" void HAL_Delay (__IO uint32_t Delay)
+{
+    // the simulated time passes without waiting
+    tick += Delay;
+}
+
+/************************************************************************
+ * GPIO: the input data register is set by the test, the output data
+ * register keeps the written value
+ ************************************************************************/
+
+static HostHal_GpioHandler gpioHandler = NULL;
+
+extern "C" void HostHal_setGpioHandler (HostHal_GpioHandler handler)
+{
+    gpioHandler = handler;
+}
+
+extern "C" GPIO_PinState HAL_GPIO_ReadPin (GPIO_TypeDef * GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->IDR & GPIO_Pin)? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+extern "C" void HAL_GPIO_WritePin (GPIO_TypeDef * GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    if (PinState != GPIO_PIN_RESET)
+    {
+        GPIOx->ODR |= GPIO_Pin;
+    }
+    else
+    {
+        GPIOx->ODR &= ~GPIO_Pin;
+    }
+    if (gpioHandler != NULL)
+    {
+        gpioHandler(GPIOx, GPIO_Pin, PinState);
+    }
+}
+
+extern "C" void HAL_GPIO_TogglePin (GPIO_TypeDef * GPIOx, uint16_t GPIO_Pin)
+{
+    GPIOx->ODR ^= GPIO_Pin;
+}
+
+/************************************************************************
+ * C library extensions
+ ************************************************************************/
+
+extern "C" char * utoa (unsigned value, char * str, int base)
+{
+    char digits[33];
+    size_t n = 0;
+    do
+    {
+        unsigned d = value % base;
+        digits[n++] = (char)((d < 10)? '0' + d : 'a' + d - 10);
+        value /= base;
+    }
+    while (value != 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        str[i] = digits[n - 1 - i];
+    }
+    str[n] = 0;
+    return str;
+}
+
+extern "C" char * itoa (int value, char * str, int base)
+{
+    if (value < 0 && base == 10)
+    {
+        str[0] = '-';
+        utoa(0U - (unsigned)value, str + 1, base);
+        return str;
+    }
+    return utoa((unsigned)value, str, base);
+}
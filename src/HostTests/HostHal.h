@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Host replacement of the Cortex-M core intrinsics, included before any other header when the
+ * library is compiled for the host tests.
+ *
+ * The peripheral registers are plain memory mapped at their real addresses (see HostHal.cpp),
+ * so the library code runs unchanged. Disabling the interrupts takes a global lock: a test
+ * thread that plays an interrupt service routine takes the same lock using HostIrq_enter().
+ */
+
+#ifndef HOSTHAL_H_
+#define HOSTHAL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ARM C library extensions used by the library */
+char * itoa (int value, char * str, int base);
+char * utoa (unsigned value, char * str, int base);
+#define __itoa itoa
+#define __utoa utoa
+
+/* Interrupt mask emulation */
+void HostIrq_disable (void);
+void HostIrq_enable (void);
+uint32_t HostIrq_isDisabled (void);
+void HostIrq_enter (void);
+void HostIrq_leave (void);
+
+/* System tick used by HAL_GetTick() and HAL_Delay() */
+void HostHal_setTick (uint32_t tick);
+void HostHal_advanceTick (uint32_t ms);
+
+/* Observer of the GPIO writes, e.g. the power pin of an emulated module. NULL removes it */
+typedef void (*HostHal_GpioHandler) (void * port, uint16_t pin, uint32_t state);
+void HostHal_setGpioHandler (HostHal_GpioHandler handler);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* The core intrinsics: replace cmsis_gcc.h */
+#define __CMSIS_GCC_H
+
+#define __ASM __asm
+#define __INLINE inline
+#define __STATIC_INLINE static inline
+
+static inline void __enable_irq (void)
+{
+    HostIrq_enable();
+}
+
+static inline void __disable_irq (void)
+{
+    HostIrq_disable();
+}
+
+static inline uint32_t __get_PRIMASK (void)
+{
+    return HostIrq_isDisabled();
+}
+
+static inline void __set_PRIMASK (uint32_t priMask)
+{
+    if (priMask)
+    {
+        HostIrq_disable();
+    }
+    else
+    {
+        HostIrq_enable();
+    }
+}
+
+static inline uint32_t __get_IPSR (void)
+{
+    return 0;
+}
+
+static inline void __NOP (void)
+{
+    __sync_synchronize();
+}
+
+static inline void __WFI (void)
+{
+    // empty
+}
+
+static inline void __DSB (void)
+{
+    __sync_synchronize();
+}
+
+static inline void __ISB (void)
+{
+    __sync_synchronize();
+}
+
+static inline void __DMB (void)
+{
+    __sync_synchronize();
+}
+
+static inline uint32_t __REV (uint32_t value)
+{
+    return __builtin_bswap32(value);
+}
+
+static inline uint32_t __RBIT (uint32_t value)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 32; ++i, value >>= 1)
+    {
+        result = (result << 1) | (value & 1);
+    }
+    return result;
+}
+
+static inline uint8_t __CLZ (uint32_t value)
+{
+    return (value == 0)? 32 : (uint8_t)__builtin_clz(value);
+}
+
+#endif
@@ -0,0 +1,42 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef TESTUTILS_H_
+#define TESTUTILS_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * Minimal test helpers: a failed check prints its location and terminates the test program.
+ */
+
+#define CHECK(cond) \
+    do { if (!(cond)) { ::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ::exit(1); } } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do { long long e_ = (long long)(expected), a_ = (long long)(actual); \
+         if (e_ != a_) { ::fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", \
+                                   __FILE__, __LINE__, #expected, #actual, e_, a_); ::exit(1); } } while (0)
+
+#define RUN_TEST(test) \
+    do { ::printf("  %s\n", #test); test(); } while (0)
+
+#endif
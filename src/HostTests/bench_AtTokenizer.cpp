@@ -0,0 +1,170 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Benchmark of the AT response parsing: the incremental AtTokenizer against the former
+ * approach that searched the accumulated response using strstr() after every received chunk.
+ *
+ * Usage: make bench
+ */
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "StmPlusPlus/Devices/Esp11.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const size_t CHUNK_SIZE = 32; // bytes received between two calls of periodic()
+const size_t REPEATS = 2000;
+const size_t IDLE_CALLS = 10; // calls of periodic() without new data between two chunks
+
+const char * PATTERNS[] = { "\nOK\r\n", "\nSEND OK\r\n", "\nERROR\r\n", "ready\r\n", "CONNECT", "+CWMODE:",
+                            "+CWLAP:", "+IPD,", "WIFI DISCONNECT", "0,CLOSED" };
+const size_t PATTERNS_NUMBER = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+
+/**
+ * @brief A typical session: bring-up responses, sent messages and received server messages.
+ */
+std::string makeTranscript ()
+{
+    std::string t;
+    t += "\r\nready\r\n";
+    t += "AT+CWMODE?\r\n+CWMODE:1\r\n\r\nOK\r\n";
+    t += "+CWLAP:(3,\"MyNetwork\",-61,\"a0:f3:c1:12:34:56\",6,-12,0)\r\n\r\nOK\r\n";
+    t += "0,CONNECT\r\n\r\nOK\r\n";
+    for (int i = 0; i < 8; ++i)
+    {
+        t += "\r\nOK\r\n> \r\nRecv 96 bytes\r\n\r\nSEND OK\r\n";
+        t += "\r\n+IPD,0,64:";
+        t += std::string(64, 'a' + i);
+        t += "\r\nOK\r\n";
+    }
+    t += "0,CLOSED\r\n";
+    return t;
+}
+
+class Counter : public AtTokenizer::EventHandler
+{
+public:
+
+    size_t tokens = 0, payloadBytes = 0;
+
+    virtual void onToken (AtTokenizer::Token, int32_t)
+    {
+        ++tokens;
+    }
+
+    virtual void onPayload (const char *, size_t len, bool)
+    {
+        payloadBytes += len;
+    }
+};
+
+/**
+ * @brief The former parsing: the chunk is appended to the response buffer, that is searched
+ *        for every pattern. The buffer is restarted after a final response. While listening,
+ *        the buffer was searched for "+IPD," again on every call of periodic().
+ */
+size_t parseUsingStrstr (const std::string & transcript, size_t idleCalls)
+{
+    static char buffer[4096];
+    size_t fill = 0, found = 0;
+    for (size_t pos = 0; pos < transcript.size(); pos += CHUNK_SIZE)
+    {
+        size_t n = std::min(CHUNK_SIZE, transcript.size() - pos);
+        ::memcpy(buffer + fill, transcript.data() + pos, n);
+        fill += n;
+        buffer[fill] = 0;
+        bool final = false;
+        for (size_t p = 0; p < PATTERNS_NUMBER; ++p)
+        {
+            if (::strstr(buffer, PATTERNS[p]) != NULL)
+            {
+                ++found;
+                final = final || p < 3;
+            }
+        }
+        for (size_t i = 0; i < idleCalls; ++i)
+        {
+            found += (::strstr(buffer, "+IPD,") != NULL)? 1 : 0;
+        }
+        if (final || fill > sizeof(buffer) - CHUNK_SIZE - 1)
+        {
+            fill = 0;
+        }
+    }
+    return found;
+}
+
+size_t parseUsingTokenizer (AtTokenizer & tokenizer, Counter & counter, const std::string & transcript)
+{
+    for (size_t pos = 0; pos < transcript.size(); pos += CHUNK_SIZE)
+    {
+        tokenizer.feed(transcript.data() + pos, std::min(CHUNK_SIZE, transcript.size() - pos));
+    }
+    return counter.tokens;
+}
+
+template<typename F> double measure (F f, size_t bytes)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < REPEATS; ++r)
+    {
+        f();
+    }
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+    return d.count() / (bytes * REPEATS);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    AtTokenizer tokenizer;
+    Counter counter;
+    for (size_t p = 0; p < PATTERNS_NUMBER; ++p)
+    {
+        bool withNumber = (::strcmp(PATTERNS[p], "+CWMODE:") == 0 || ::strcmp(PATTERNS[p], "+IPD,") == 0);
+        CHECK(tokenizer.addPattern(PATTERNS[p], (AtTokenizer::Token)(p + 1), withNumber));
+    }
+    tokenizer.build();
+    tokenizer.setHandler(&counter);
+
+    const std::string transcript = makeTranscript();
+    volatile size_t sink = 0;
+    double strstrNs = measure([&]() { sink = sink + parseUsingStrstr(transcript, 0); }, transcript.size());
+    double strstrIdleNs = measure([&]() { sink = sink + parseUsingStrstr(transcript, IDLE_CALLS); },
+                                  transcript.size());
+    double tokenizerNs = measure([&]() { sink = sink + parseUsingTokenizer(tokenizer, counter, transcript); },
+                                 transcript.size());
+    CHECK_EQUAL(8 * 64 * REPEATS, counter.payloadBytes);
+
+    ::printf("Transcript: %zu bytes, chunks of %zu bytes\n", transcript.size(), CHUNK_SIZE);
+    ::printf("  strstr, data only:                 %6.2f ns/byte\n", strstrNs);
+    ::printf("  strstr, %2zu idle calls per chunk:   %6.2f ns/byte\n", IDLE_CALLS, strstrIdleNs);
+    ::printf("  AtTokenizer (idle calls are free): %6.2f ns/byte\n", tokenizerNs);
+    return 0;
+}
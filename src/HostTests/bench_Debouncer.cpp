@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Benchmark of the input debouncing: the cost of one sample of 32 inputs using the vertical
+ * counters of Debouncer against one counter per input.
+ *
+ * Usage: make bench
+ */
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "StmPlusPlus/Devices/Debouncer.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const size_t SAMPLES = 1 << 16;
+const size_t REPEATS = 100;
+const uint32_t COUNTER_BITS = 2;
+
+/**
+ * @brief The former approach: a counter of differing samples per input.
+ */
+class ScalarDebouncer
+{
+public:
+
+    ScalarDebouncer (): state{0}
+    {
+        for (size_t i = 0; i < Debouncer::MAX_INPUTS; ++i)
+        {
+            counters[i] = 0;
+        }
+    }
+
+    inline void sample (uint32_t levels)
+    {
+        for (size_t i = 0; i < Debouncer::MAX_INPUTS; ++i)
+        {
+            uint32_t bit = 1UL << i;
+            if ((levels & bit) == (state & bit))
+            {
+                counters[i] = 0;
+            }
+            else if (++counters[i] == (1UL << COUNTER_BITS))
+            {
+                counters[i] = 0;
+                state ^= bit;
+            }
+        }
+    }
+
+    uint32_t state;
+    uint8_t counters[Debouncer::MAX_INPUTS];
+};
+
+template<typename F> double measure (F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < REPEATS; ++r)
+    {
+        f();
+    }
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+    return d.count() / (SAMPLES * REPEATS);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    // noisy inputs: each bit toggles with the probability of 1/8 per sample
+    std::mt19937 random(1);
+    std::vector<uint32_t> levels(SAMPLES);
+    uint32_t l = 0;
+    for (auto & s : levels)
+    {
+        for (size_t i = 0; i < Debouncer::MAX_INPUTS; ++i)
+        {
+            l ^= (random() % 8 == 0) ? (1UL << i) : 0;
+        }
+        s = l;
+    }
+
+    RealTimeClock rtc;
+    Debouncer vertical(rtc, 1000, COUNTER_BITS);
+    ScalarDebouncer scalar;
+    volatile uint32_t sink = 0;
+    double verticalNs = measure([&]()
+    {
+        for (auto s : levels)
+        {
+            vertical.sample(s);
+        }
+        sink = sink + vertical.getState();
+    });
+    double scalarNs = measure([&]()
+    {
+        for (auto s : levels)
+        {
+            scalar.sample(s);
+        }
+        sink = sink + scalar.state;
+    });
+    CHECK_EQUAL(scalar.state, vertical.getState());
+
+    ::printf("One sample of %zu inputs, %u counter bits\n", Debouncer::MAX_INPUTS, COUNTER_BITS);
+    ::printf("  counter per input: %6.2f ns/sample\n", scalarNs);
+    ::printf("  vertical counters: %6.2f ns/sample\n", verticalNs);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Benchmark of the ESP baud rates: every rate is configured by ESP_BAUDRATE, negotiated by
+ * AT+UART_CUR after power-on and measured by the payload throughput of Esp11, from AT+CIPSEND
+ * up to SEND OK. The emulated module answers at once: the cycle counter advances by the time
+ * of the transfers on the line, so the numbers show the UART transfer time including the command
+ * and the response overhead of every message, not the processing time of a real module.
+ *
+ * Usage: make bench
+ */
+
+#include <string>
+
+#include "EspSender.h"
+#include "AtEmulator.h"
+#include "FakeSdCard.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const char * CONFIG_FILE = "conf.txt";
+const char * CONFIG = "WLAN_NAME=wlan\nWLAN_PASS=secret\nTHIS_IP=192.168.1.10\nGATE_IP=192.168.1.1\n"
+                      "IP_MASK=255.255.255.0\nSERVER_IP=report.server\nSERVER_PORT=5000\n"
+                      "REPEAT_DELAY=1\nTURN_OFF_DELAY=2\nESP_TRANSPARENT=0\n";
+
+const uint32_t BAUD_RATES[] = { 115200, 230400, 460800, 921600, 1500000, 2000000 };
+const size_t MESSAGE_SIZES[] = { 32, 240 };
+const size_t MESSAGES = 200;
+
+SdCardFixture sd;
+Config config(sd.storage, CONFIG_FILE);
+
+RealTimeClock rtc;
+InterruptPriority prio(5, 0);
+Esp11 esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, prio, IOPort::A, GPIO_PIN_1);
+IOPin errorLed(IOPort::B, GPIO_PIN_0, GPIO_MODE_OUTPUT_PP);
+
+void writeConfig (uint32_t baudRate)
+{
+    std::string text = std::string(CONFIG) + "ESP_BAUDRATE=" + std::to_string(baudRate) + "\n";
+    CHECK(sd.storage.acquire());
+    FIL file;
+    UINT bw = 0;
+    CHECK_EQUAL(FR_OK, f_open(&file, CONFIG_FILE, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_EQUAL(FR_OK, f_write(&file, text.data(), text.size(), &bw));
+    CHECK_EQUAL(FR_OK, f_close(&file));
+    sd.storage.release();
+    config.readConfiguration();
+}
+
+void runUntilSent (EspSender & sender)
+{
+    for (int i = 0; i < 60000 && !sender.isOutputMessageSent(); ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+        sender.periodic();
+    }
+    CHECK(sender.isOutputMessageSent());
+}
+
+void powerOff (EspSender & sender)
+{
+    for (int i = 0; i < 5000; ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+        sender.periodic();
+    }
+}
+
+/**
+ * @brief Sends the messages of the given size one after another and returns the payload
+ *        throughput of Esp11 in KB/s. The first message powers the module on.
+ */
+uint32_t measure (uint32_t baudRate, size_t messageSize)
+{
+    writeConfig(baudRate);
+    EspSender sender(rtc, esp, config, errorLed);
+    std::string msg(messageSize, 'x');
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        CHECK(sender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), msg.c_str()));
+        runUntilSent(sender);
+    }
+    CHECK_EQUAL(baudRate, AtEmulator::getBaudRate());
+    CHECK_EQUAL(MESSAGES, sender.getMessagesSent());
+    uint32_t throughput = esp.getPayloadThroughput();
+    powerOff(sender);
+    return throughput;
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CHECK(sd.start());
+    AtEmulator::attach(esp, GPIOA, GPIO_PIN_1);
+    ::printf("%zu messages sent one after another, payload throughput in KB/s (%% of the line rate)\n",
+             MESSAGES);
+    ::printf("  %9s", "baud rate");
+    for (size_t size : MESSAGE_SIZES)
+    {
+        ::printf("  %5zu bytes/msg", size);
+    }
+    ::printf("\n");
+    for (uint32_t rate : BAUD_RATES)
+    {
+        // 10 bits per byte on the line
+        const double lineRate = rate / 10.0 / 1024.0;
+        ::printf("  %9u", (unsigned)rate);
+        for (size_t size : MESSAGE_SIZES)
+        {
+            uint32_t throughput = measure(rate, size);
+            ::printf("  %6u (%3.0f%%)   ", (unsigned)throughput, 100.0 * throughput / lineRate);
+        }
+        ::printf("\n");
+    }
+    AtEmulator::detach();
+    return 0;
+}
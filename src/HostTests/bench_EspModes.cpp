@@ -0,0 +1,203 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Benchmark of the normal (AT+CIPSEND=<len> per message) and the transparent (AT+CIPMODE=1,
+ * AT+CIPSEND once) transmission of EspSender against the emulated ESP module: the message rate
+ * and the latency from sendMessage() up to the delivery, in the simulated time, and the AT
+ * commands per message. The module answers at once: the numbers show the round trips of the
+ * command sequence, not the UART transfer time.
+ *
+ * Usage: make bench
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "EspSender.h"
+#include "AtEmulator.h"
+#include "FakeSdCard.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const char * CONFIG_FILE = "conf.txt";
+const char * CONFIG = "WLAN_NAME=wlan\nWLAN_PASS=secret\nTHIS_IP=192.168.1.10\nGATE_IP=192.168.1.1\n"
+                      "IP_MASK=255.255.255.0\nSERVER_IP=report.server\nSERVER_PORT=5000\n"
+                      "REPEAT_DELAY=1\nTURN_OFF_DELAY=2\n";
+
+const size_t MESSAGES = 1000;
+
+SdCardFixture sd;
+Config config(sd.storage, CONFIG_FILE);
+
+RealTimeClock rtc;
+InterruptPriority prio(5, 0);
+Esp11 esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, prio, IOPort::A, GPIO_PIN_1);
+IOPin errorLed(IOPort::B, GPIO_PIN_0, GPIO_MODE_OUTPUT_PP);
+
+void writeConfig (bool transparent)
+{
+    std::string text = std::string(CONFIG) + "ESP_TRANSPARENT=" + (transparent? "1" : "0") + "\n";
+    CHECK(sd.storage.acquire());
+    FIL file;
+    UINT bw = 0;
+    CHECK_EQUAL(FR_OK, f_open(&file, CONFIG_FILE, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_EQUAL(FR_OK, f_write(&file, text.data(), text.size(), &bw));
+    CHECK_EQUAL(FR_OK, f_close(&file));
+    sd.storage.release();
+    config.readConfiguration();
+}
+
+void powerOff (EspSender & sender)
+{
+    // the module is turned off before the next measurement
+    for (int i = 0; i < 5000; ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+        sender.periodic();
+    }
+}
+
+void print (bool transparent, std::vector<time_ms> latency, time_ms elapsed, const char * details)
+{
+    std::sort(latency.begin(), latency.end());
+    time_ms sum = 0;
+    for (time_ms l : latency)
+    {
+        sum += l;
+    }
+    ::printf("  %-11s: %6.1f msg/s, latency %5.2f ms (median %2u, max %2u), %s\n",
+             transparent? "transparent" : "normal", 1000.0 * latency.size() / elapsed,
+             (double)sum / latency.size(), (unsigned)latency[latency.size() / 2],
+             (unsigned)latency.back(), details);
+}
+
+time_ms runUntilSent (EspSender & sender)
+{
+    time_ms start = rtc.getUpTimeMillisec();
+    for (int i = 0; i < 60000 && !sender.isOutputMessageSent(); ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+        sender.periodic();
+    }
+    CHECK(sender.isOutputMessageSent());
+    return rtc.getUpTimeMillisec() - start;
+}
+
+void measure (bool transparent)
+{
+    writeConfig(transparent);
+    EspSender sender(rtc, esp, config, errorLed);
+
+    // the first message powers the module on: the stream of the following ones is measured
+    CHECK(sender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), "start"));
+    runUntilSent(sender);
+    AtEmulator::clear();
+
+    std::vector<time_ms> latency;
+    time_ms start = rtc.getUpTimeMillisec();
+    auto hostStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        std::string msg = "{\"seq\":" + std::to_string(i) + ",\"pins\":\"0x5a5a\"}";
+        CHECK(sender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), msg.c_str()));
+        latency.push_back(runUntilSent(sender));
+    }
+    std::chrono::duration<double, std::micro> hostTime = std::chrono::steady_clock::now() - hostStart;
+    time_ms elapsed = rtc.getUpTimeMillisec() - start;
+    CHECK_EQUAL(MESSAGES + 1, sender.getMessagesSent());
+    CHECK_EQUAL(transparent, esp.isTransparent());
+
+    char details[64];
+    ::snprintf(details, sizeof(details), "%4.2f AT commands/msg, %4.1f us/msg host",
+               (double)AtEmulator::getCommands().size() / MESSAGES, hostTime.count() / MESSAGES);
+    print(transparent, latency, elapsed, details);
+    powerOff(sender);
+}
+
+/**
+ * @brief A new message every interval: the messages that arrive during a transmission are
+ *        batched into the next one.
+ */
+void measureStream (bool transparent, time_ms interval)
+{
+    writeConfig(transparent);
+    EspSender sender(rtc, esp, config, errorLed);
+    CHECK(sender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), "start"));
+    runUntilSent(sender);
+
+    const uint32_t sentBefore = sender.getMessagesSent();
+    std::vector<time_ms> sendTime, latency;
+    size_t dropped = 0;
+    time_ms start = rtc.getUpTimeMillisec();
+    for (size_t n = 0; n < MESSAGES || latency.size() < sendTime.size();)
+    {
+        if (n < MESSAGES && rtc.getUpTimeMillisec() - start == n * interval)
+        {
+            // a message that does not fit into the full queue is lost
+            std::string msg = "{\"seq\":" + std::to_string(n++) + ",\"pins\":\"0x5a5a\"}";
+            if (sender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), msg.c_str()))
+            {
+                sendTime.push_back(rtc.getUpTimeMillisec());
+            }
+            else
+            {
+                ++dropped;
+            }
+        }
+        rtc.onMilliSecondInterrupt();
+        sender.periodic();
+        while (latency.size() < sender.getMessagesSent() - sentBefore)
+        {
+            latency.push_back(rtc.getUpTimeMillisec() - sendTime[latency.size()]);
+        }
+    }
+    CHECK_EQUAL(dropped, sender.getMessagesDropped());
+    char details[64];
+    ::snprintf(details, sizeof(details), "%zu of %zu dropped", dropped, MESSAGES);
+    print(transparent, latency, rtc.getUpTimeMillisec() - start, details);
+    powerOff(sender);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CHECK(sd.start());
+    AtEmulator::attach(esp, GPIOA, GPIO_PIN_1);
+    ::printf("%zu messages sent one after another\n", MESSAGES);
+    measure(false);
+    measure(true);
+    for (time_ms interval : { 10, 2 })
+    {
+        ::printf("%zu messages, a new one every %u ms\n", MESSAGES, (unsigned)interval);
+        measureStream(false, interval);
+        measureStream(true, interval);
+    }
+    AtEmulator::detach();
+    return 0;
+}
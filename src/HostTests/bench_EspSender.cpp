@@ -0,0 +1,173 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Benchmark of the EspSender command sequence against the emulated ESP module: the delivery
+ * latency per start type and the cost of the coroutine dispatch per periodic() call. The
+ * benchmark is built twice, with the fallback (bench_EspSender) and with the native C++20
+ * coroutines of Coroutine.h (bench_EspSender_cxx20), so that both back ends can be compared.
+ *
+ * Usage: make bench
+ */
+
+#include <chrono>
+#include <string>
+
+#include "EspSender.h"
+#include "AtEmulator.h"
+#include "FakeSdCard.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const char * CONFIG_FILE = "conf.txt";
+const char * CONFIG = "WLAN_NAME=wlan\nWLAN_PASS=secret\nTHIS_IP=192.168.1.10\nGATE_IP=192.168.1.1\n"
+                      "IP_MASK=255.255.255.0\nSERVER_IP=report.server\nSERVER_PORT=5000\n"
+                      "REPEAT_DELAY=1\nTURN_OFF_DELAY=2\nESP_STANDBY=10\n";
+
+const size_t ROUNDS = 50;
+const size_t HOT_MESSAGES = 4;
+const time_ms HOT_INTERVAL = 50;
+
+SdCardFixture sd;
+Config config(sd.storage, CONFIG_FILE);
+
+RealTimeClock rtc;
+InterruptPriority prio(5, 0);
+Esp11 esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, prio, IOPort::A, GPIO_PIN_1);
+IOPin errorLed(IOPort::B, GPIO_PIN_0, GPIO_MODE_OUTPUT_PP);
+
+/**
+ * @brief The host time spent in EspSender::periodic(), separately while a message is in
+ *        transmission and while the sender is idle.
+ */
+class Dispatch
+{
+public:
+
+    double busyNs = 0, idleNs = 0;
+    uint64_t busyCalls = 0, idleCalls = 0;
+
+    void run (EspSender & sender, time_ms ms)
+    {
+        for (time_ms i = 0; i < ms; ++i)
+        {
+            rtc.onMilliSecondInterrupt();
+            call(sender);
+        }
+    }
+
+    time_ms runUntilSent (EspSender & sender)
+    {
+        time_ms start = rtc.getUpTimeMillisec();
+        for (int i = 0; i < 60000 && !sender.isOutputMessageSent(); ++i)
+        {
+            rtc.onMilliSecondInterrupt();
+            call(sender);
+        }
+        CHECK(sender.isOutputMessageSent());
+        return rtc.getUpTimeMillisec() - start;
+    }
+
+private:
+
+    void call (EspSender & sender)
+    {
+        bool busy = !sender.isOutputMessageSent();
+        auto start = std::chrono::steady_clock::now();
+        sender.periodic();
+        std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+        (busy? busyNs : idleNs) += d.count();
+        ++(busy? busyCalls : idleCalls);
+    }
+};
+
+void writeConfig ()
+{
+    CHECK(sd.storage.acquire());
+    FIL file;
+    UINT bw = 0;
+    CHECK_EQUAL(FR_OK, f_open(&file, CONFIG_FILE, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_EQUAL(FR_OK, f_write(&file, CONFIG, ::strlen(CONFIG), &bw));
+    CHECK_EQUAL(FR_OK, f_close(&file));
+    sd.storage.release();
+    config.readConfiguration();
+}
+
+bool sendReport (EspSender & sender, size_t seq)
+{
+    std::string msg = "{\"seq\":" + std::to_string(seq) + "}";
+    return sender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), msg.c_str());
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CHECK(sd.start());
+    AtEmulator::attach(esp, GPIOA, GPIO_PIN_1);
+    writeConfig();
+    AtEmulator::clear();
+    EspSender sender(rtc, esp, config, errorLed);
+    Dispatch dispatch;
+
+    // each round starts cold or warm and continues hot; the idle time between the rounds puts the
+    // module into the standby (warm start) or powers it off (cold start)
+    time_ms latencySum[EspSender::START_TYPES] = { 0 };
+    size_t latencyCount[EspSender::START_TYPES] = { 0 };
+    size_t seq = 0;
+    for (size_t round = 0; round < ROUNDS; ++round)
+    {
+        for (size_t i = 0; i <= HOT_MESSAGES; ++i)
+        {
+            size_t t = (i > 0)? (size_t)EspSender::StartType::HOT : (round % 2 == 0)?
+                       (size_t)EspSender::StartType::COLD : (size_t)EspSender::StartType::WARM;
+            CHECK(sendReport(sender, seq++));
+            latencySum[t] += dispatch.runUntilSent(sender);
+            ++latencyCount[t];
+            dispatch.run(sender, HOT_INTERVAL);
+        }
+        dispatch.run(sender, (round % 2 == 0)? 3000 : 15000);
+    }
+    CHECK_EQUAL(seq, sender.getMessagesSent());
+
+#ifdef STMPLUSPLUS_CO_NATIVE
+    ::printf("Coroutine back end: native C++20 (frame failures: %u)\n", (unsigned)CoFramePool::getFailures());
+#else
+    ::printf("Coroutine back end: fallback (resume points)\n");
+#endif
+    const char * names[EspSender::START_TYPES] = { "cold", "warm", "hot" };
+    ::printf("%zu messages, %zu AT commands\n", seq, AtEmulator::getCommands().size());
+    for (size_t t = 0; t < EspSender::START_TYPES; ++t)
+    {
+        ::printf("  %s start: latency %5.1f ms, time to first byte %3u ms\n", names[t],
+                 (double)latencySum[t] / latencyCount[t],
+                 (unsigned)sender.getAverageTimeToFirstByte((EspSender::StartType)t));
+    }
+    ::printf("  periodic() in transmission: %8.1f ns/call, %6.1f calls/message\n",
+             dispatch.busyNs / dispatch.busyCalls, (double)dispatch.busyCalls / seq);
+    ::printf("  periodic() while idle:      %8.1f ns/call\n", dispatch.idleNs / dispatch.idleCalls);
+    AtEmulator::detach();
+    return 0;
+}
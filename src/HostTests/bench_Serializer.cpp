@@ -0,0 +1,202 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Benchmark of the state report encoding: the former XML message built with strcat() against
+ * the JSON and the CBOR report of MyApplication::encodeReport(), with the same fields and with
+ * the full report that also contains the sender and the journal counters. The XML message is
+ * built twice: with the strcat() of the host C library, and with a byte-wise strcat() like the
+ * size-optimized one of newlib on the target, that scans the growing message on every call.
+ *
+ * Usage: make bench
+ */
+
+#include <chrono>
+#include <cstring>
+
+#include "StmPlusPlus/Serializer.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+
+namespace
+{
+
+const size_t REPEATS = 2000000;
+const size_t INPUT_PINS = 8;
+
+static const uint32_t KEY_NAME = 0;
+static const uint32_t KEY_BOARD = 1;
+static const uint32_t KEY_TIME = 2;
+static const uint32_t KEY_PINS = 3;
+static const uint32_t KEY_COUNTERS = 4;
+static const uint32_t KEY_SENT = 0;
+static const uint32_t KEY_COALESCED = 1;
+static const uint32_t KEY_DROPPED = 2;
+static const uint32_t KEY_LOST = 3;
+
+/**
+ * @brief The reported state. The fields are volatile, so that the encoding is not folded.
+ */
+struct State
+{
+    const char * volatile boardId = "PI405RG-01";
+    volatile uint32_t timeSec = 1363896240;
+    volatile uint8_t pins[INPUT_PINS] = { 1, 0, 1, 0, 0, 1, 0, 1 };
+    volatile uint32_t sent = 1234, coalesced = 56, dropped = 0, lost = 0;
+
+    uint32_t getPinBits () const
+    {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < INPUT_PINS; ++i)
+        {
+            bits |= (uint32_t)pins[i] << i;
+        }
+        return bits;
+    }
+};
+
+State state;
+char messageBuffer[512];
+uint8_t reportBuffer[512];
+
+char * bytewiseStrcat (char * dst, const char * src)
+{
+    char * d = dst;
+    while (*d != 0)
+    {
+        ++d;
+    }
+    while ((*d++ = *src++) != 0)
+    {
+    }
+    return dst;
+}
+
+/**
+ * @brief The former MyApplication::fillMessage(): the time digits were converted, but not sent.
+ */
+template<char * (*STRCAT)(char *, const char *)> const char * fillMessage ()
+{
+    char digits[11];
+    ::__utoa(state.timeSec, digits, 10);
+    ::strcpy(messageBuffer, "<message>");
+    STRCAT(messageBuffer, "<name>BOARD_STATE</name>");
+    // the first parameter: board ID
+    STRCAT(messageBuffer, "<p>");
+    STRCAT(messageBuffer, state.boardId);
+    STRCAT(messageBuffer, "</p>");
+    // the second parameter: state
+    STRCAT(messageBuffer, "<p>");
+    for (auto &p : state.pins)
+    {
+        ::__itoa(p, digits, 10);
+        STRCAT(messageBuffer, digits);
+    }
+    STRCAT(messageBuffer, "</p>");
+    STRCAT(messageBuffer, "</message>");
+    return &messageBuffer[0];
+}
+
+/**
+ * @brief MyApplication::encodeReport() without the shift register inputs; the counters are optional.
+ */
+void encodeReport (Encoder & e, bool counters)
+{
+    e.reset();
+    e.beginMap(counters? 5 : 4);
+    e.putKey(KEY_NAME, "name");
+    e.putString("BOARD_STATE");
+    e.putKey(KEY_BOARD, "board");
+    e.putString(state.boardId);
+    e.putKey(KEY_TIME, "time");
+    e.putTimestamp(state.timeSec);
+    e.putKey(KEY_PINS, "pins");
+    e.putUInt(state.getPinBits());
+    if (counters)
+    {
+        e.putKey(KEY_COUNTERS, "counters");
+        e.beginMap(4);
+        e.putKey(KEY_SENT, "sent");
+        e.putUInt(state.sent);
+        e.putKey(KEY_COALESCED, "coalesced");
+        e.putUInt(state.coalesced);
+        e.putKey(KEY_DROPPED, "dropped");
+        e.putUInt(state.dropped);
+        e.putKey(KEY_LOST, "lost");
+        e.putUInt(state.lost);
+        e.endMap();
+    }
+    e.endMap();
+}
+
+template<typename F> double measure (F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < REPEATS; ++r)
+    {
+        f();
+    }
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+    return d.count() / REPEATS;
+}
+
+void report (const char * name, size_t size, double ns)
+{
+    ::printf("  %-26s %4zu bytes  %6.1f ns\n", name, size, ns);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    volatile size_t sink = 0;
+    CborEncoder cbor(reportBuffer, sizeof(reportBuffer));
+    JsonEncoder json(reportBuffer, sizeof(reportBuffer));
+
+    double xmlNs = measure([&]() { sink = sink + ::strlen(fillMessage<::strcat>()); });
+    double xmlBytewiseNs = measure([&]() { sink = sink + ::strlen(fillMessage<bytewiseStrcat>()); });
+    size_t xmlSize = ::strlen(fillMessage<::strcat>());
+    CHECK(::strcmp(messageBuffer, "<message><name>BOARD_STATE</name><p>PI405RG-01</p><p>10100101</p></message>") == 0);
+
+    double jsonNs = measure([&]() { encodeReport(json, false); sink = sink + json.getSize(); });
+    size_t jsonSize = json.getSize();
+    CHECK(::strcmp(json.getString(),
+                   "{\"name\":\"BOARD_STATE\",\"board\":\"PI405RG-01\",\"time\":1363896240,\"pins\":165}") == 0);
+
+    double cborNs = measure([&]() { encodeReport(cbor, false); sink = sink + cbor.getSize(); });
+    size_t cborSize = cbor.getSize();
+
+    double jsonFullNs = measure([&]() { encodeReport(json, true); sink = sink + json.getSize(); });
+    size_t jsonFullSize = json.getSize();
+
+    double cborFullNs = measure([&]() { encodeReport(cbor, true); sink = sink + cbor.getSize(); });
+    size_t cborFullSize = cbor.getSize();
+    CHECK(!json.isOverflow() && !cbor.isOverflow());
+
+    ::printf("State report, %zu input pins, %zu iterations\n", INPUT_PINS, REPEATS);
+    report("old XML (no time stamp)", xmlSize, xmlNs);
+    report("old XML, byte-wise strcat", xmlSize, xmlBytewiseNs);
+    report("JSON, same fields + time", jsonSize, jsonNs);
+    report("CBOR, same fields + time", cborSize, cborNs);
+    report("JSON, full report", jsonFullSize, jsonFullNs);
+    report("CBOR, full report", cborFullSize, cborFullNs);
+    return 0;
+}
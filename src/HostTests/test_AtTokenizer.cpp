@@ -0,0 +1,210 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * AtTokenizer: the token and payload events do not depend on how the input is split into chunks.
+ */
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "StmPlusPlus/Devices/Esp11.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+typedef AtTokenizer::Token Token;
+
+/**
+ * @brief Collects the events as text: a token with its value and the number prefix, and
+ *        a complete payload. The payload parts are joined, since their split follows the chunks.
+ */
+class Recorder : public AtTokenizer::EventHandler
+{
+public:
+
+    AtTokenizer * tokenizer = NULL;
+    std::vector<std::string> events;
+    std::string payload;
+
+    virtual void onToken (Token token, int32_t value)
+    {
+        events.push_back("T" + std::to_string((int)token) + ":" + std::to_string(value)
+                         + ((token == Token::IPD)? "@" + std::to_string(tokenizer->getPrefixNumber()) : ""));
+    }
+
+    virtual void onPayload (const char * data, size_t len, bool complete)
+    {
+        CHECK(len > 0 || complete);
+        payload.append(data, len);
+        if (complete)
+        {
+            events.push_back("P:" + payload);
+            payload.clear();
+        }
+    }
+};
+
+/**
+ * @brief The patterns of Esp11, in the same order.
+ */
+void addEspPatterns (AtTokenizer & tokenizer)
+{
+    CHECK(tokenizer.addPattern("\nOK\r\n", Token::OK));
+    CHECK(tokenizer.addPattern("\nSEND OK\r\n", Token::SEND_OK));
+    CHECK(tokenizer.addPattern("\nERROR\r\n", Token::ERROR));
+    CHECK(tokenizer.addPattern("ready\r\n", Token::READY));
+    CHECK(tokenizer.addPattern("CONNECT", Token::CONNECT));
+    CHECK(tokenizer.addPattern("+CWMODE:", Token::CWMODE, true));
+    CHECK(tokenizer.addPattern("+CWLAP:", Token::CWLAP));
+    CHECK(tokenizer.addPattern("+IPD,", Token::IPD, true));
+    CHECK(tokenizer.addPattern("WIFI DISCONNECT", Token::WIFI_DISCONNECT));
+    CHECK(tokenizer.addPattern("\n>", Token::PROMPT));
+    for (int i = 0; i < (int)Esp11::MAX_LINKS; ++i)
+    {
+        std::string closed = std::string(1, AtTokenizer::LINE_START) + std::to_string(i) + ",CLOSED";
+        CHECK(tokenizer.addPattern(closed.c_str(), Token::CLOSED, false, i));
+    }
+    tokenizer.build();
+}
+
+/**
+ * @brief A session with every token, payloads that contain response patterns and line breaks,
+ *        and the patterns that overlap each other.
+ */
+std::string makeTranscript ()
+{
+    std::string t;
+    t += "\r\nready\r\n";
+    t += "AT+CWMODE?\r\n+CWMODE:3\r\n\r\nOK\r\n";
+    t += "+CWLAP:(3,\"MyNetwork\",-61,\"a0:f3:c1:12:34:56\",6,-12,0)\r\n\r\nOK\r\n";
+    t += "0,CONNECT\r\n\r\nOK\r\n";
+    t += "\r\nOK\r\n> \r\nRecv 7 bytes\r\n\r\nSEND OK\r\n";
+    t += "\r\n+IPD,0,11:\r\nOK\r\nERROR";
+    t += "\r\n+IPD,5:hello";
+    t += "\r\n+IPD,3,1:>";
+    t += "\r\n\r\nERROR\r\n";
+    t += "\r\nSEND FAIL\r\n\r\nOK\r\n";
+    t += "\r\n+IPD,1,19:+IPD,0,5:1,CLOSED\r\n";
+    t += "2,CLOSED\r\n";
+    t += "WIFI DISCONNECT\r\n";
+    for (int i = 0; i < 4; ++i)
+    {
+        t += "\r\n+IPD," + std::to_string(i) + ",40:" + std::string(40, 'a' + i);
+    }
+    t += "\r\nOK\r\n";
+    return t;
+}
+
+std::vector<std::string> parse (const std::string & transcript, const std::vector<size_t> & chunks)
+{
+    AtTokenizer tokenizer;
+    Recorder recorder;
+    recorder.tokenizer = &tokenizer;
+    addEspPatterns(tokenizer);
+    tokenizer.setHandler(&recorder);
+    size_t pos = 0;
+    for (size_t c : chunks)
+    {
+        tokenizer.feed(transcript.data() + pos, c);
+        pos += c;
+    }
+    CHECK_EQUAL(transcript.size(), pos);
+    CHECK(recorder.payload.empty());
+    return recorder.events;
+}
+
+std::vector<size_t> splitBytewise (size_t size)
+{
+    return std::vector<size_t>(size, 1);
+}
+
+void testBytewiseEvents ()
+{
+    const std::string t = makeTranscript();
+    std::vector<std::string> events = parse(t, splitBytewise(t.size()));
+    const char * expected[] = {
+        "T4:0", "T6:3", "T1:0", "T7:0", "T1:0", "T5:0", "T1:0",
+        "T1:0", "T11:0", "T2:0",
+        "T8:11@0", "P:\r\nOK\r\nERROR",
+        "T8:5@-1", "P:hello",
+        "T8:1@3", "P:>",
+        "T3:0",
+        "T1:0",
+        "T8:19@1", "P:+IPD,0,5:1,CLOSED\r\n",
+        "T9:2",
+        "T10:0",
+        "T8:40@0", "P:aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+        "T8:40@1", "P:bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb",
+        "T8:40@2", "P:cccccccccccccccccccccccccccccccccccccccc",
+        "T8:40@3", "P:dddddddddddddddddddddddddddddddddddddddd",
+        "T1:0" };
+    const size_t expectedNumber = sizeof(expected) / sizeof(expected[0]);
+    CHECK_EQUAL(expectedNumber, events.size());
+    for (size_t i = 0; i < expectedNumber && i < events.size(); ++i)
+    {
+        if (events[i] != expected[i])
+        {
+            ::printf("event %zu: \"%s\", expected \"%s\"\n", i, events[i].c_str(), expected[i]);
+        }
+        CHECK(events[i] == expected[i]);
+    }
+}
+
+void testRandomChunks ()
+{
+    const std::string t = makeTranscript();
+    const std::vector<std::string> reference = parse(t, splitBytewise(t.size()));
+    CHECK(parse(t, std::vector<size_t>(1, t.size())) == reference);
+
+    std::mt19937 random(32);
+    std::uniform_int_distribution<size_t> chunkSize(1, 48);
+    for (int run = 0; run < 500; ++run)
+    {
+        std::vector<size_t> chunks;
+        for (size_t rest = t.size(); rest > 0;)
+        {
+            size_t c = std::min(chunkSize(random), rest);
+            chunks.push_back(c);
+            rest -= c;
+        }
+        CHECK(parse(t, chunks) == reference);
+    }
+
+    // every single split point, e.g. inside "+IPD,<id>,<len>:" and inside the payloads
+    for (size_t split = 1; split < t.size(); ++split)
+    {
+        std::vector<size_t> chunks = { split, t.size() - split };
+        CHECK(parse(t, chunks) == reference);
+    }
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    RUN_TEST(testBytewiseEvents);
+    RUN_TEST(testRandomChunks);
+    return 0;
+}
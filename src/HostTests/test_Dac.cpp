@@ -0,0 +1,347 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Dac_MCP49x1 and WaveformGenerator: the command words, the waveform buffer builders, the sample
+ * rate limit and the timer and DMA setup of the output, and the frames written by putValue() in
+ * the 8 bit and in the 16 bit mode of the SPI. A thread plays the SPI: it takes every word
+ * written into the data register and signals TXE.
+ */
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "StmPlusPlus/Devices/Dac_MCP49x1.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const uint32_t EMPTY = 0xFFFFFFFF; // the data register holds no word to shift
+const size_t CAPACITY = 64;
+
+uint32_t pclk2 = 84000000;
+
+IOPin pinCs(IOPort::A, GPIO_PIN_8, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, true, true);
+
+// the SPI thread
+std::atomic<bool> running(false), csLow(false);
+std::vector<uint32_t> frames;
+size_t framesOutsideCs = 0;
+
+void spiDevice ()
+{
+    while (running)
+    {
+        uint32_t dr = SPI1->DR;
+        if (dr != EMPTY)
+        {
+            frames.push_back(dr);
+            framesOutsideCs += csLow? 0 : 1;
+            SPI1->DR = EMPTY;
+            SPI1->SR |= SPI_FLAG_TXE;
+        }
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * @brief The rising chip select latches the DAC: the shifted words are complete.
+ */
+void onGpioWrite (void * port, uint16_t pin, uint32_t state)
+{
+    if (port != GPIOA || pin != GPIO_PIN_8)
+    {
+        return;
+    }
+    if (state != GPIO_PIN_RESET)
+    {
+        while (SPI1->DR != EMPTY)
+        {
+            std::this_thread::yield();
+        }
+    }
+    csLow = state == GPIO_PIN_RESET;
+}
+
+/**
+ * @brief Writes one value by putValue() and returns the words seen by the DAC.
+ */
+std::vector<uint32_t> writeValue (Dac_MCP49x1 & dac, uint16_t percent)
+{
+    frames.clear();
+    framesOutsideCs = 0;
+    SPI1->DR = EMPTY;
+    SPI1->SR = 0;
+    running = true;
+    HostHal_setGpioHandler(onGpioWrite);
+    std::thread thread(spiDevice);
+    dac.putValue(percent);
+    running = false;
+    thread.join();
+    HostHal_setGpioHandler(NULL);
+    CHECK_EQUAL(0, framesOutsideCs);
+    return frames;
+}
+
+void startSpi (Spi & spi, uint32_t dataSize, uint32_t prescaler)
+{
+    CHECK_EQUAL(HAL_OK, spi.start(SPI_DIRECTION_2LINES, prescaler, dataSize, SPI_PHASE_1EDGE, SPI_POLARITY_LOW));
+}
+
+/**
+ * @brief Sets the APB2 clock: the timer clock is doubled if the bus is divided.
+ */
+void setApb2 (uint32_t clock, bool divided)
+{
+    pclk2 = clock;
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_PPRE2) | (divided? RCC_CFGR_PPRE2_DIV2 : RCC_CFGR_PPRE2_DIV1);
+}
+
+void testCommands ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::A, GPIO_PIN_6, IOPort::A, GPIO_PIN_7);
+    // bit 13 is the inverted gain, bit 12 the inverted shutdown
+    Dac_MCP49x1 dac12(spi, pinCs, Dac_MCP49x1::Resolution::BIT_12);
+    CHECK_EQUAL(4095, dac12.getMaxCode());
+    CHECK_EQUAL(0x3ABC, dac12.getCommand(0xABC));
+    CHECK_EQUAL(0x3FFF, dac12.getCommand(0xFFFF));
+    CHECK_EQUAL(0x2000, dac12.getShutdownCommand());
+    dac12.setOutputGain(true);
+    CHECK_EQUAL(0x1ABC, dac12.getCommand(0xABC));
+    CHECK_EQUAL(0x0000, dac12.getShutdownCommand());
+
+    // the codes of the lower resolutions are aligned to the most significant bits
+    Dac_MCP49x1 dac10(spi, pinCs, Dac_MCP49x1::Resolution::BIT_10);
+    CHECK_EQUAL(1023, dac10.getMaxCode());
+    CHECK_EQUAL(0x3FFC, dac10.getCommand(1023));
+    CHECK_EQUAL(0x3004, dac10.getCommand(1));
+    Dac_MCP49x1 dac8(spi, pinCs, Dac_MCP49x1::Resolution::BIT_8);
+    CHECK_EQUAL(255, dac8.getMaxCode());
+    CHECK_EQUAL(0x3AB0, dac8.getCommand(0xAB));
+    CHECK_EQUAL(0x3FF0, dac8.getCommand(0x1FF));
+}
+
+void testBuilders ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::A, GPIO_PIN_6, IOPort::A, GPIO_PIN_7);
+    Timer timer(Timer::TIM_1);
+    Dac_MCP49x1 dac(spi, pinCs, Dac_MCP49x1::Resolution::BIT_12);
+    uint16_t buffer[CAPACITY];
+    WaveformGenerator gen(dac, timer, TIM_CHANNEL_1, GPIO_AF1_TIM1, TIM_CHANNEL_2, DMA2_Stream2, DMA_CHANNEL_6,
+                          buffer, CAPACITY);
+    const uint16_t * b = gen.getBuffer();
+
+    // a ramp includes both ends and is rounded to the nearest code, in both directions
+    CHECK_EQUAL(3, gen.addHold(100, 3));
+    CHECK_EQUAL(4, gen.addRamp(0, 4095, 4));
+    CHECK_EQUAL(4, gen.addRamp(10, 0, 4));
+    CHECK_EQUAL(2, gen.addShutdown(2));
+    const uint16_t codes[] = { 100, 100, 100, 0, 1365, 2730, 4095, 10, 7, 3, 0 };
+    for (size_t i = 0; i < 11; ++i)
+    {
+        CHECK_EQUAL(dac.getCommand(codes[i]), b[i]);
+    }
+    CHECK_EQUAL(dac.getShutdownCommand(), b[11]);
+    CHECK_EQUAL(dac.getShutdownCommand(), b[12]);
+    CHECK_EQUAL(13, gen.getSamples());
+
+    // a ramp of one sample is the last code
+    CHECK_EQUAL(1, gen.addRamp(5, 9, 1));
+    CHECK_EQUAL(dac.getCommand(9), b[13]);
+    CHECK_EQUAL(0, gen.addRamp(5, 9, 0));
+
+    // a long ramp is monotonic and ends exactly at the last code
+    gen.clear();
+    CHECK_EQUAL(CAPACITY, gen.addRamp(4095, 1000, CAPACITY));
+    for (size_t i = 1; i < CAPACITY; ++i)
+    {
+        CHECK(b[i] <= b[i - 1]);
+    }
+    CHECK_EQUAL(dac.getCommand(1000), b[CAPACITY - 1]);
+
+    // sample i of a resampled table takes the entry i * tableSize / n
+    std::mt19937 random(50);
+    std::uniform_int_distribution<size_t> size(1, CAPACITY);
+    uint16_t table[CAPACITY];
+    for (size_t i = 0; i < CAPACITY; ++i)
+    {
+        table[i] = (uint16_t)(i * 61);
+    }
+    for (int run = 0; run < 200; ++run)
+    {
+        size_t tableSize = size(random), n = size(random);
+        gen.clear();
+        CHECK_EQUAL(n, gen.addTable(table, tableSize, n));
+        for (size_t i = 0; i < n; ++i)
+        {
+            CHECK_EQUAL(dac.getCommand(table[i * tableSize / n]), b[i]);
+        }
+    }
+    CHECK_EQUAL(0, gen.addTable(table, 0, 4));
+
+    // a full buffer takes the samples that fit
+    gen.clear();
+    CHECK_EQUAL(CAPACITY - 4, gen.addHold(1, CAPACITY - 4));
+    CHECK_EQUAL(4, gen.addTable(table, 8, 16));
+    CHECK_EQUAL(0, gen.addShutdown(1));
+    CHECK_EQUAL(0, gen.addRamp(0, 10, 5));
+    CHECK_EQUAL(CAPACITY, gen.getSamples());
+    CHECK_EQUAL(dac.getCommand(table[1]), b[CAPACITY - 2]);
+}
+
+/**
+ * @brief The rate limit holds the CS setup, the 16 bit frame with the DMA latency and the CS
+ *        high time in timer ticks. start() programs the timer and the DMA stream.
+ */
+void testSampleRate ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::A, GPIO_PIN_6, IOPort::A, GPIO_PIN_7);
+    Timer timer(Timer::TIM_1);
+    Dac_MCP49x1 dac(spi, pinCs, Dac_MCP49x1::Resolution::BIT_12);
+    uint16_t buffer[CAPACITY];
+    WaveformGenerator gen(dac, timer, TIM_CHANNEL_1, GPIO_AF1_TIM1, TIM_CHANNEL_2, DMA2_Stream2, DMA_CHANNEL_6,
+                          buffer, CAPACITY);
+    CHECK_EQUAL(16, gen.addRamp(0, 4095, 16));
+
+    // APB2 at 84 MHz divided, i.e. TIM1 at 168 MHz, SPI at 84 / 8 = 10.5 MHz:
+    // trigger 8 + frame 291 + CS high 2 ticks
+    setApb2(84000000, true);
+    startSpi(spi, SPI_DATASIZE_16BIT, SPI_BAUDRATEPRESCALER_8);
+    CHECK_EQUAL(168000000 / 301, gen.getMaxSampleRate());
+
+    // APB2 at 42 MHz undivided, SPI at 42 / 4 = 10.5 MHz: trigger 3 + frame 74 + CS high 2 ticks
+    setApb2(42000000, false);
+    startSpi(spi, SPI_DATASIZE_16BIT, SPI_BAUDRATEPRESCALER_4);
+    CHECK_EQUAL(42000000 / 79, gen.getMaxSampleRate());
+
+    // a slower SPI lowers the limit
+    startSpi(spi, SPI_DATASIZE_16BIT, SPI_BAUDRATEPRESCALER_16);
+    const uint32_t slow = gen.getMaxSampleRate();
+    CHECK(slow < 42000000 / 79 / 3);
+    CHECK(!gen.start(slow + 1, true));
+    CHECK(!gen.isActive());
+
+    // a looped output at the limit: the period holds the ticks of one sample
+    CHECK(gen.start(slow, true));
+    CHECK(gen.isActive());
+    TIM_HandleTypeDef * htim = timer.getTimerParameters();
+    CHECK_EQUAL(0, htim->Init.Prescaler);
+    CHECK_EQUAL(42000000 / slow - 1, htim->Init.Period);
+    CHECK_EQUAL((uint32_t)(size_t)buffer, DMA2_Stream2->M0AR);
+    CHECK_EQUAL((uint32_t)(size_t)&SPI1->DR, DMA2_Stream2->PAR);
+    CHECK_EQUAL(16, DMA2_Stream2->NDTR);
+    CHECK_EQUAL(DMA_CHANNEL_6 | DMA_MEMORY_TO_PERIPH | DMA_CIRCULAR,
+                DMA2_Stream2->CR & (DMA_SxCR_CHSEL | DMA_SxCR_DIR | DMA_SxCR_CIRC));
+    CHECK((SPI1->CR2 & SPI_CR2_TXDMAEN) != 0);
+    CHECK(!gen.isFinished());
+    CHECK(!gen.start(slow, true));
+    gen.stop();
+    CHECK(!gen.isActive());
+    CHECK((SPI1->CR2 & SPI_CR2_TXDMAEN) == 0);
+    CHECK((GPIOA->ODR & GPIO_PIN_8) != 0);
+
+    // a low single-shot rate needs the prescaler to keep the period within 16 bit
+    CHECK(gen.start(200, false));
+    CHECK_EQUAL(0, DMA2_Stream2->CR & DMA_SxCR_CIRC);
+    CHECK(!gen.isFinished());
+    // the stream has sent all samples
+    DMA2_Stream2->NDTR = 0;
+    CHECK(gen.isFinished());
+    // 210000 ticks per sample
+    CHECK_EQUAL(4, htim->Init.Prescaler + 1);
+    CHECK_EQUAL(42000000 / 200 / 4 - 1, htim->Init.Period);
+    gen.stop();
+
+    // the 8 bit mode of the SPI is refused
+    startSpi(spi, SPI_DATASIZE_8BIT, SPI_BAUDRATEPRESCALER_4);
+    CHECK(!gen.start(1000, true));
+    spi.stop();
+    setApb2(84000000, false);
+}
+
+/**
+ * @brief putValue() sends the command word as two bytes in the 8 bit mode and as one word in the
+ *        16 bit mode of the waveform generator, both within the chip select.
+ */
+void testPutValue ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::A, GPIO_PIN_6, IOPort::A, GPIO_PIN_7);
+    Dac_MCP49x1 dac(spi, pinCs, Dac_MCP49x1::Resolution::BIT_12, 0, 4095);
+
+    startSpi(spi, SPI_DATASIZE_8BIT, SPI_BAUDRATEPRESCALER_8);
+    std::vector<uint32_t> words = writeValue(dac, 50);
+    CHECK_EQUAL(2, words.size());
+    CHECK_EQUAL(0x37, words[0]);
+    CHECK_EQUAL(0xFF, words[1]);
+
+    startSpi(spi, SPI_DATASIZE_16BIT, SPI_BAUDRATEPRESCALER_8);
+    words = writeValue(dac, 50);
+    CHECK_EQUAL(1, words.size());
+    CHECK_EQUAL(dac.getCommand(2047), words[0]);
+    CHECK_EQUAL(0x37FF, words[0]);
+
+    // 0 % shuts the output down
+    words = writeValue(dac, 0);
+    CHECK_EQUAL(1, words.size());
+    CHECK_EQUAL(0, words[0] & 0x1000);
+    spi.stop();
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Fake HAL: replaces the weak stubs
+ ************************************************************************/
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Init (SPI_HandleTypeDef * hspi)
+{
+    hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.Direction | hspi->Init.DataSize | hspi->Init.CLKPolarity
+                          | hspi->Init.CLKPhase | (hspi->Init.NSS & SPI_CR1_SSM) | hspi->Init.BaudRatePrescaler
+                          | hspi->Init.FirstBit;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_DMA_Init (DMA_HandleTypeDef * hdma)
+{
+    hdma->Instance->CR = hdma->Init.Channel | hdma->Init.Direction | hdma->Init.PeriphInc | hdma->Init.MemInc
+                         | hdma->Init.PeriphDataAlignment | hdma->Init.MemDataAlignment | hdma->Init.Mode
+                         | hdma->Init.Priority;
+    return HAL_OK;
+}
+
+extern "C" uint32_t HAL_RCC_GetPCLK2Freq (void)
+{
+    return pclk2;
+}
+
+int main ()
+{
+    RUN_TEST(testCommands);
+    RUN_TEST(testBuilders);
+    RUN_TEST(testSampleRate);
+    RUN_TEST(testPutValue);
+    return 0;
+}
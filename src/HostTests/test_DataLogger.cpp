@@ -0,0 +1,199 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * DataLogger: record integrity when the producers run concurrently with stalled SD card writes.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "StmPlusPlus/DataLogger.h"
+#include "FakeSdCard.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const char * LOG_FILE = "log.bin";
+const DWORD LOG_SIZE = 16 * 1024 * 1024;
+const size_t PRODUCERS = 4;
+const uint32_t RECORDS_PER_PRODUCER = 20000;
+
+SdCardFixture sd;
+DataLogger::Pages loggerPages;
+DataLogger logger(sd.storage, loggerPages);
+
+typedef struct
+{
+    uint32_t seq;
+    uint8_t fill[DataLogger::MAX_PAYLOAD - sizeof(uint32_t)];
+} __attribute__((__packed__)) Payload;
+
+std::atomic<size_t> runningProducers(0);
+
+/**
+ * @brief A producer that plays a nested interrupt: the records of the producers interleave.
+ */
+void produce (uint8_t type, std::vector<uint32_t> & accepted, uint32_t & rejected)
+{
+    Payload payload;
+    for (uint32_t seq = 0; seq < RECORDS_PER_PRODUCER; ++seq)
+    {
+        payload.seq = seq;
+        uint16_t length = sizeof(uint32_t) + (seq * 7 + type) % sizeof(payload.fill);
+        for (uint16_t i = 0; i < length - sizeof(uint32_t); ++i)
+        {
+            payload.fill[i] = (uint8_t)(seq + i);
+        }
+        if (logger.putRecord(type, &payload, length))
+        {
+            accepted.push_back(seq);
+        }
+        else
+        {
+            ++rejected;
+        }
+        if (seq % 16 == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    --runningProducers;
+}
+
+/**
+ * @brief Reads the log file and checks every record: the records of each producer shall be
+ *        exactly the accepted ones, in the original order.
+ */
+void checkLogFile (const std::vector<uint32_t> (&accepted)[PRODUCERS])
+{
+    CHECK(sd.storage.acquire());
+    FIL file;
+    CHECK_EQUAL(FR_OK, f_open(&file, LOG_FILE, FA_READ));
+    std::vector<uint8_t> data(f_size(&file));
+    UINT br = 0;
+    CHECK_EQUAL(FR_OK, f_read(&file, data.data(), data.size(), &br));
+    CHECK_EQUAL(data.size(), br);
+    f_close(&file);
+    sd.storage.release();
+
+    size_t next[PRODUCERS] = { 0 };
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        if (data[pos] != DataLogger::RECORD_SYNC)
+        {
+            // padding up to the page end
+            CHECK_EQUAL(0, data[pos]);
+            pos = (pos / DataLogger::PAGE_SIZE + 1) * DataLogger::PAGE_SIZE;
+            continue;
+        }
+        DataLogger::RecordHeader header;
+        ::memcpy(&header, &data[pos], sizeof(header));
+        CHECK(header.type < PRODUCERS);
+        CHECK(pos % DataLogger::PAGE_SIZE + header.length + DataLogger::RECORD_OVERHEAD <= DataLogger::PAGE_SIZE);
+        uint16_t checksum;
+        ::memcpy(&checksum, &data[pos + sizeof(header) + header.length], sizeof(checksum));
+        CHECK_EQUAL(DataLogger::calculateChecksum(&data[pos], sizeof(header) + header.length), checksum);
+
+        Payload payload;
+        ::memcpy(&payload, &data[pos + sizeof(header)], header.length);
+        CHECK(next[header.type] < accepted[header.type].size());
+        CHECK_EQUAL(accepted[header.type][next[header.type]], payload.seq);
+        for (uint16_t i = 0; i < header.length - sizeof(uint32_t); ++i)
+        {
+            CHECK_EQUAL((uint8_t)(payload.seq + i), payload.fill[i]);
+        }
+        ++next[header.type];
+        pos += sizeof(header) + header.length + sizeof(uint16_t);
+    }
+    for (size_t t = 0; t < PRODUCERS; ++t)
+    {
+        CHECK_EQUAL(accepted[t].size(), next[t]);
+    }
+}
+
+void testRecordsUnderWriteStalls ()
+{
+    CHECK(logger.start(LOG_FILE, LOG_SIZE));
+    FakeSdCard::setWriteDelay(200);
+
+    std::vector<uint32_t> accepted[PRODUCERS];
+    uint32_t rejected[PRODUCERS] = { 0 };
+    std::vector<std::thread> producers;
+    runningProducers = PRODUCERS;
+    for (size_t t = 0; t < PRODUCERS; ++t)
+    {
+        producers.push_back(std::thread(produce, (uint8_t)t, std::ref(accepted[t]), std::ref(rejected[t])));
+    }
+    while (runningProducers > 0)
+    {
+        logger.periodic();
+        CHECK(logger.isActive());
+    }
+    for (auto & p : producers)
+    {
+        p.join();
+    }
+    FakeSdCard::setWriteDelay(0);
+    logger.stop();
+
+    uint32_t acceptedNumber = 0, rejectedNumber = 0;
+    for (size_t t = 0; t < PRODUCERS; ++t)
+    {
+        acceptedNumber += accepted[t].size();
+        rejectedNumber += rejected[t];
+    }
+    CHECK_EQUAL(acceptedNumber, logger.getRecordsWritten());
+    CHECK_EQUAL(rejectedNumber, logger.getDroppedRecords());
+    CHECK_EQUAL(rejectedNumber, logger.getOverruns());
+    // the stalled writer can not keep up with the producers
+    CHECK(logger.getOverruns() > 0);
+    CHECK(acceptedNumber > 0);
+    checkLogFile(accepted);
+}
+
+void testCardRemovedWhileLogging ()
+{
+    CHECK(logger.start(LOG_FILE, LOG_SIZE));
+    uint32_t value = 0;
+    CHECK(logger.putRecord(0, &value, sizeof(value)));
+    FakeSdCard::remove();
+    sd.storage.periodic();
+    CHECK(!logger.isActive());
+    CHECK(!logger.putRecord(0, &value, sizeof(value)));
+    sd.insert(false);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CHECK(sd.start());
+    RUN_TEST(testRecordsUnderWriteStalls);
+    RUN_TEST(testCardRemovedWhileLogging);
+    return 0;
+}
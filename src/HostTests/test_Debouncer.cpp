@@ -0,0 +1,259 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Debouncer: the vertical counters against a per-input model on random bounce traces, and the
+ * button events generated from the debounced edges of bouncing presses.
+ */
+
+#include <random>
+#include <vector>
+
+#include "StmPlusPlus/Devices/Debouncer.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const uint32_t SAMPLING_FREQ = 1000;
+const size_t KEY = 5; // input of the button in the sampled word
+const uint32_t KEY_BIT = 1UL << KEY;
+
+RealTimeClock rtc;
+
+class PressCounter : public Button::EventHandler
+{
+public:
+
+    std::vector<uint32_t> presses; // numOccured of each event
+
+    virtual void onButtonPressed (const Button *, uint32_t numOccured)
+    {
+        presses.push_back(numOccured);
+    }
+};
+
+/**
+ * @brief The straightforward debouncer: one counter of differing samples per input.
+ */
+class ScalarDebouncer
+{
+public:
+
+    ScalarDebouncer (uint32_t _counterBits): counterBits{_counterBits}, state{0}
+    {
+        for (size_t i = 0; i < Debouncer::MAX_INPUTS; ++i)
+        {
+            counters[i] = 0;
+        }
+    }
+
+    void sample (uint32_t levels)
+    {
+        for (size_t i = 0; i < Debouncer::MAX_INPUTS; ++i)
+        {
+            uint32_t bit = 1UL << i;
+            if ((levels & bit) == (state & bit))
+            {
+                counters[i] = 0;
+            }
+            else if (++counters[i] == (1UL << counterBits))
+            {
+                counters[i] = 0;
+                state ^= bit;
+            }
+        }
+    }
+
+    uint32_t counterBits;
+    uint32_t state;
+    uint32_t counters[Debouncer::MAX_INPUTS];
+};
+
+/**
+ * @brief A bounce trace of one input that leaves the opposite of the final level: the level
+ *        toggles the given number of times after 1..maxGap samples each and then is stable on
+ *        the final level for the given number of samples.
+ */
+void addBounce (std::vector<bool> & trace, std::mt19937 & random, size_t toggles, uint32_t maxGap,
+                bool finalLevel, size_t stable)
+{
+    bool level = !finalLevel;
+    for (size_t t = 0; t < toggles; ++t)
+    {
+        level = !level;
+        trace.insert(trace.end(), 1 + random() % maxGap, level);
+    }
+    trace.insert(trace.end(), stable, finalLevel);
+}
+
+/**
+ * @brief Plays the trace of the button input: the sampling timer runs every millisecond, the main
+ *        loop every loopPeriod milliseconds. Returns the numbers of debounced presses and releases.
+ */
+void play (Debouncer & debouncer, const std::vector<bool> & trace, uint32_t loopPeriod,
+           size_t & pressed, size_t & released)
+{
+    pressed = released = 0;
+    for (size_t t = 0; t < trace.size(); ++t)
+    {
+        rtc.onMilliSecondInterrupt();
+        debouncer.sample(trace[t] ? KEY_BIT : 0);
+        if (t % loopPeriod == 0 || t + 1 == trace.size())
+        {
+            debouncer.periodic();
+            pressed += (debouncer.getPressed() & KEY_BIT) ? 1 : 0;
+            released += (debouncer.getReleased() & KEY_BIT) ? 1 : 0;
+        }
+    }
+}
+
+void testVerticalCounters ()
+{
+    std::mt19937 random(1);
+    for (uint32_t bits = Debouncer::MIN_COUNTER_BITS; bits <= Debouncer::MAX_COUNTER_BITS; ++bits)
+    {
+        Debouncer debouncer(rtc, SAMPLING_FREQ, bits);
+        ScalarDebouncer model(bits);
+        // each input bounces with its own probability: from a noisy line to an almost stable one
+        uint32_t levels = 0;
+        for (size_t t = 0; t < 100000; ++t)
+        {
+            for (size_t i = 0; i < Debouncer::MAX_INPUTS; ++i)
+            {
+                if (random() % (2 + 4 * i) == 0)
+                {
+                    levels ^= 1UL << i;
+                }
+            }
+            debouncer.sample(levels);
+            model.sample(levels);
+            CHECK_EQUAL(model.state, debouncer.getState());
+        }
+    }
+}
+
+void testGlitchFiltering ()
+{
+    Debouncer debouncer(rtc, SAMPLING_FREQ, 2);
+    // pulses of up to 3 samples on all inputs never reach the 4 samples of the counters
+    for (uint32_t width = 1; width < 4; ++width)
+    {
+        for (size_t r = 0; r < 10; ++r)
+        {
+            for (uint32_t t = 0; t < width; ++t)
+            {
+                debouncer.sample(0xFFFFFFFF);
+            }
+            debouncer.sample(0);
+        }
+    }
+    debouncer.periodic();
+    CHECK_EQUAL(0, debouncer.getState());
+    CHECK_EQUAL(0, debouncer.getPressed());
+    for (uint32_t t = 0; t < 4; ++t)
+    {
+        debouncer.sample(0xFFFFFFFF);
+    }
+    CHECK_EQUAL(0xFFFFFFFF, debouncer.getState());
+    debouncer.periodic();
+    CHECK_EQUAL(0xFFFFFFFF, debouncer.getPressed());
+    CHECK_EQUAL(0, debouncer.getLostEdges());
+}
+
+void testBouncingClicks ()
+{
+    std::mt19937 random(2);
+    Button button(IOPort::B, GPIO_PIN_2, GPIO_PULLUP, rtc, 50, 300);
+    PressCounter counter;
+    button.setHandler(&counter);
+    Debouncer debouncer(rtc, SAMPLING_FREQ, 2);
+    CHECK(debouncer.addButton(KEY, button));
+
+    // the pulled-up button is active at the low level
+    std::vector<bool> trace(20, true);
+    debouncer.sample(KEY_BIT);
+    const size_t CLICKS = 50;
+    for (size_t c = 0; c < CLICKS; ++c)
+    {
+        // the contacts bounce for up to 8 * 3 ms on press and release
+        addBounce(trace, random, 2 * (1 + random() % 4), 3, false, 100 + random() % 150);
+        addBounce(trace, random, 2 * (1 + random() % 4), 3, true, 100);
+    }
+    size_t pressed = 0, released = 0;
+    play(debouncer, trace, 10, pressed, released);
+    CHECK_EQUAL(CLICKS, pressed);
+    CHECK_EQUAL(CLICKS, released);
+    CHECK_EQUAL(CLICKS, counter.presses.size());
+    for (auto n : counter.presses)
+    {
+        CHECK_EQUAL(0, n);
+    }
+    CHECK_EQUAL(0, debouncer.getLostEdges());
+}
+
+void testShortAndLongPresses ()
+{
+    std::mt19937 random(3);
+    Button button(IOPort::B, GPIO_PIN_2, GPIO_PULLUP, rtc, 50, 300);
+    PressCounter counter;
+    button.setHandler(&counter);
+    Debouncer debouncer(rtc, SAMPLING_FREQ, 2);
+    CHECK(debouncer.addButton(KEY, button));
+    debouncer.sample(KEY_BIT);
+
+    // a 30 ms press is shorter than the press delay, even if the main loop lags 25 ms: the edge
+    // times are restored from the sample numbers
+    std::vector<bool> trace(20, true);
+    addBounce(trace, random, 6, 3, false, 30);
+    addBounce(trace, random, 6, 3, true, 100);
+    size_t pressed = 0, released = 0;
+    play(debouncer, trace, 25, pressed, released);
+    CHECK_EQUAL(1, pressed);
+    CHECK_EQUAL(1, released);
+    CHECK(counter.presses.empty());
+
+    // a bouncing 1 s press: repeated events every 300 ms, the release adds no event
+    trace.assign(20, true);
+    addBounce(trace, random, 6, 3, false, 1000);
+    addBounce(trace, random, 6, 3, true, 100);
+    play(debouncer, trace, 10, pressed, released);
+    CHECK_EQUAL(1, pressed);
+    CHECK_EQUAL(1, released);
+    CHECK_EQUAL(3, counter.presses.size());
+    for (size_t i = 0; i < counter.presses.size(); ++i)
+    {
+        CHECK_EQUAL(i, counter.presses[i]);
+    }
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    RUN_TEST(testVerticalCounters);
+    RUN_TEST(testGlitchFiltering);
+    RUN_TEST(testBouncingClicks);
+    RUN_TEST(testShortAndLongPresses);
+    return 0;
+}
@@ -0,0 +1,364 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Esp11: command responses, the transparent transmission, the reception and the baud rate
+ * negotiation against the emulated module.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AtEmulator.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+RealTimeClock rtc;
+InterruptPriority prio(5, 0);
+Esp11 esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, prio, IOPort::A, GPIO_PIN_1);
+
+/**
+ * @brief Executes a command like EspSender::step() does: the time passes while the response
+ *        is awaited.
+ */
+bool execute (Esp11::AsyncCmd cmd)
+{
+    if (!esp.transmit(cmd))
+    {
+        return false;
+    }
+    while (!esp.isResponceAvailable())
+    {
+        rtc.onMilliSecondInterrupt();
+        esp.periodic();
+    }
+    return esp.getResponce(cmd);
+}
+
+std::string getInputMessage ()
+{
+    esp.periodic();
+    std::string msg(esp.getInputMessageSize(), 0);
+    esp.getInputMessage(&msg[0], msg.size());
+    return msg;
+}
+
+void connect (bool multiConnection, const char * server)
+{
+    esp.setMultiConnection(multiConnection);
+    esp.setProtocol("TCP");
+    esp.setServer(server);
+    esp.setPort("80");
+    AtEmulator::clear();
+    CHECK(execute(Esp11::AsyncCmd::POWER_OFF));
+    CHECK(execute(Esp11::AsyncCmd::POWER_ON));
+    CHECK(execute(multiConnection? Esp11::AsyncCmd::SET_MULTI_CON : Esp11::AsyncCmd::SET_SINDLE_CON));
+    CHECK(esp.selectLink() == Esp11::LinkState::FREE);
+    CHECK(execute(Esp11::AsyncCmd::CONNECT_SERVER));
+    CHECK(esp.isLinkConnected());
+}
+
+void testEnsureMode ()
+{
+    connect(false, "server");
+    esp.setMode(1);
+    CHECK(execute(Esp11::AsyncCmd::SET_MODE));
+    CHECK(execute(Esp11::AsyncCmd::ENSURE_MODE));
+    esp.setMode(2);
+    CHECK(!execute(Esp11::AsyncCmd::ENSURE_MODE));
+}
+
+void testNormalSend ()
+{
+    connect(true, "server");
+    const char * msg = "{\"a\":1}";
+    esp.setMessage(msg);
+    esp.setMessageSize(::strlen(msg));
+    CHECK(execute(Esp11::AsyncCmd::SEND_MSG_SIZE));
+    CHECK(execute(Esp11::AsyncCmd::SEND_MESSAGE));
+    CHECK(AtEmulator::getServerData("server") == msg);
+
+    // the data prompt of AT+CIPSEND=<len> is not a part of the response
+    CHECK(esp.isListening());
+    AtEmulator::sendFromServer(esp.getLinkId(), "reply");
+    CHECK(getInputMessage() == "reply");
+    CHECK_EQUAL(esp.getLinkId(), esp.getInputLinkId());
+}
+
+void testTransparentPrompt ()
+{
+    connect(false, "server");
+    CHECK(execute(Esp11::AsyncCmd::SET_TRANSP_MODE));
+
+    // the command is finished by the prompt, not by the preceding OK
+    AtEmulator::setPromptHeld(true);
+    CHECK(esp.transmit(Esp11::AsyncCmd::START_TRANSP));
+    for (int i = 0; i < 100; ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+        esp.periodic();
+    }
+    CHECK(!esp.isResponceAvailable());
+    AtEmulator::releasePrompt();
+    AtEmulator::setPromptHeld(false);
+    esp.periodic();
+    CHECK(esp.isResponceAvailable());
+    CHECK(esp.getResponce(Esp11::AsyncCmd::START_TRANSP));
+    CHECK(AtEmulator::isTransparent());
+    CHECK(esp.isTransparent());
+
+    // the prompt is consumed by the command: nothing is received yet
+    CHECK(esp.isListening());
+    esp.periodic();
+    CHECK_EQUAL(0, esp.getInputMessageSize());
+
+    const char * msg = "transparent";
+    esp.setMessage(msg);
+    esp.setMessageSize(::strlen(msg));
+    CHECK(execute(Esp11::AsyncCmd::SEND_TRANSP));
+    CHECK(AtEmulator::getServerData("server") == msg);
+    CHECK(esp.isListening());
+    AtEmulator::sendFromServer(0, "ack1");
+    CHECK(getInputMessage() == "ack1");
+    CHECK(esp.isListening());
+
+    // a reply that arrives within the packet gap is kept for the reader
+    CHECK(esp.transmit(Esp11::AsyncCmd::SEND_TRANSP));
+    AtEmulator::sendFromServer(0, "ack2");
+    while (!esp.isResponceAvailable())
+    {
+        rtc.onMilliSecondInterrupt();
+        esp.periodic();
+    }
+    CHECK(esp.getResponce(Esp11::AsyncCmd::SEND_TRANSP));
+    CHECK(getInputMessage() == "ack2");
+
+    // a reply that is not read is discarded by the next packet
+    CHECK(execute(Esp11::AsyncCmd::SEND_TRANSP));
+    AtEmulator::sendFromServer(0, "ack3");
+    esp.periodic();
+    CHECK(execute(Esp11::AsyncCmd::SEND_TRANSP));
+    CHECK(esp.isListening());
+    CHECK_EQUAL(0, esp.getInputMessageSize());
+    AtEmulator::sendFromServer(0, "ack4");
+    CHECK(getInputMessage() == "ack4");
+
+    // the unread chunks are collected up to the message buffer size
+    uint32_t truncated = esp.getTruncatedBytes();
+    AtEmulator::sendFromServer(0, std::string(600, 'p').c_str());
+    esp.periodic();
+    AtEmulator::sendFromServer(0, std::string(600, 'q').c_str());
+    CHECK(getInputMessage() == std::string(600, 'p') + std::string(Esp11::BUFFER_SIZE - 600, 'q'));
+    CHECK_EQUAL(truncated + 1200 - Esp11::BUFFER_SIZE, esp.getTruncatedBytes());
+
+    CHECK(execute(Esp11::AsyncCmd::ESCAPE_TRANSP));
+    CHECK(!AtEmulator::isTransparent());
+    CHECK(!esp.isTransparent());
+    CHECK(execute(Esp11::AsyncCmd::ENSURE_READY));
+}
+
+void testLinkClosed ()
+{
+    connect(true, "server");
+    // the notification of the last link ID is the last pattern of the tokenizer
+    for (int id = Esp11::MAX_LINKS - 1; id >= 0; --id)
+    {
+        std::string closed = "\r\n" + std::to_string(id) + ",CLOSED\r\n";
+        AtEmulator::sendRaw(closed.c_str());
+    }
+    esp.periodic();
+    CHECK(!esp.isLinkConnected());
+    CHECK(esp.selectLink() == Esp11::LinkState::FREE);
+}
+
+void testOverrun ()
+{
+    connect(false, "server");
+    uint32_t overruns = esp.getRxOverruns();
+    std::string junk(Esp11::DMA_BUFFER_SIZE + 100, 'x');
+    AtEmulator::sendRaw(junk.c_str());
+    esp.periodic();
+    CHECK_EQUAL(overruns + 1, esp.getRxOverruns());
+
+    // the tokenizer restarts at the next line
+    CHECK(execute(Esp11::AsyncCmd::ENSURE_READY));
+}
+
+/**
+ * @brief Collects the messages of a link and the positions they are delivered from.
+ */
+class LinkHandler : public Esp11::EventHandler
+{
+public:
+
+    std::vector<std::string> messages;
+    std::vector<const char *> positions;
+
+    virtual void onInputMessage (int32_t linkId, const char * data, size_t len)
+    {
+        CHECK_EQUAL(0, linkId);
+        messages.push_back(std::string(data, len));
+        positions.push_back(data);
+    }
+};
+
+void testLinkHandler ()
+{
+    connect(true, "server");
+    LinkHandler handler;
+    CHECK(esp.selectLink(&handler) == Esp11::LinkState::CONNECTED);
+
+    // the messages pass the end of the circular buffer once
+    const size_t number = 40;
+    const size_t header = ::strlen("\r\n+IPD,0,30:");
+    size_t zeroCopy = 0;
+    for (size_t i = 0; i < number; ++i)
+    {
+        std::string msg = "message " + std::to_string(i);
+        msg.resize(30, '.');
+        AtEmulator::sendFromServer(0, msg.c_str());
+        esp.periodic();
+        CHECK_EQUAL(i + 1, handler.messages.size());
+        CHECK(handler.messages.back() == msg);
+        if (i > 0 && handler.positions[i] == handler.positions[i - 1] + header + msg.size())
+        {
+            ++zeroCopy;
+        }
+    }
+
+    // a contiguous message is passed from the receive buffer, a wrapped one is copied
+    CHECK(zeroCopy > number / 2);
+    CHECK(zeroCopy < number - 1);
+
+    // a message received in several chunks is collected up to the message buffer size
+    uint32_t truncated = esp.getTruncatedBytes();
+    const size_t size = Esp11::BUFFER_SIZE + 76;
+    AtEmulator::sendRaw(("\r\n+IPD,0," + std::to_string(size) + ":").c_str());
+    for (size_t part = 0; part < size; part += 200)
+    {
+        AtEmulator::sendRaw(std::string(std::min<size_t>(200, size - part), 'z').c_str());
+        esp.periodic();
+    }
+    CHECK_EQUAL(number + 1, handler.messages.size());
+    CHECK(handler.messages.back() == std::string(Esp11::BUFFER_SIZE, 'z'));
+    CHECK_EQUAL(truncated + 76, esp.getTruncatedBytes());
+    CHECK(esp.selectLink() == Esp11::LinkState::CONNECTED);
+}
+
+/**
+ * @brief Powers the module on. The command waits for the responses in a loop, so the time passes
+ *        in an other thread like the SysTick interrupt does.
+ */
+bool powerOn ()
+{
+    std::atomic<bool> done(false);
+    std::thread clock([&]()
+    {
+        while (!done)
+        {
+            HostIrq_enter();
+            rtc.onMilliSecondInterrupt();
+            HostIrq_leave();
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+    });
+    CHECK(execute(Esp11::AsyncCmd::POWER_OFF));
+    AtEmulator::clear();
+    bool ready = execute(Esp11::AsyncCmd::POWER_ON);
+    done = true;
+    clock.join();
+    return ready;
+}
+
+void testBaudRate ()
+{
+    // the default baud rate is not negotiated
+    uint32_t powerOns = AtEmulator::getPowerOns();
+    esp.setBaudRate(Esp11::ESP_BAUDRATE, false);
+    CHECK(powerOn());
+    CHECK(AtEmulator::getCommands().empty());
+    CHECK_EQUAL(powerOns + 1, AtEmulator::getPowerOns());
+
+    // the module switches after OK, the new baud rate is verified by AT
+    powerOns = AtEmulator::getPowerOns();
+    esp.setBaudRate(921600, false);
+    CHECK(powerOn());
+    CHECK_EQUAL(2, AtEmulator::getCommands().size());
+    CHECK(AtEmulator::getCommands()[0] == "AT+UART_CUR=921600,8,1,0,0");
+    CHECK(AtEmulator::getCommands().back() == "AT");
+    CHECK_EQUAL(921600, AtEmulator::getBaudRate());
+    CHECK_EQUAL(921600, AtEmulator::getHostBaudRate());
+    CHECK_EQUAL(UART_HWCONTROL_NONE, AtEmulator::getHostFlowControl());
+    CHECK_EQUAL(powerOns + 1, AtEmulator::getPowerOns());
+    CHECK(execute(Esp11::AsyncCmd::ENSURE_READY));
+
+    // only CTS is assigned: the module drives it by its RTS
+    esp.assignFlowControlPins(IOPort::A, GPIO_PIN_0, 0);
+    esp.setBaudRate(460800, true);
+    CHECK(powerOn());
+    CHECK(AtEmulator::getCommands()[0] == "AT+UART_CUR=460800,8,1,0,1");
+    CHECK_EQUAL(1, AtEmulator::getFlowControl());
+    CHECK_EQUAL(UART_HWCONTROL_CTS, AtEmulator::getHostFlowControl());
+    CHECK_EQUAL(460800, AtEmulator::getHostBaudRate());
+    CHECK(execute(Esp11::AsyncCmd::ENSURE_READY));
+    esp.assignFlowControlPins(IOPort::A, 0, 0);
+
+    // a refused switch is awaited up to the timeout, then the module is power-cycled
+    // since it might have switched anyway
+    AtEmulator::setUartSwitchAccepted(false);
+    powerOns = AtEmulator::getPowerOns();
+    esp.setBaudRate(921600, false);
+    time_ms start = rtc.getUpTimeMillisec();
+    CHECK(powerOn());
+    CHECK(rtc.getUpTimeMillisec() - start >= Esp11::BAUDRATE_TIMEOUT);
+    CHECK_EQUAL(1, AtEmulator::getCommands().size());
+    CHECK(AtEmulator::getCommands()[0] == "AT+UART_CUR=921600,8,1,0,0");
+    CHECK_EQUAL(powerOns + 2, AtEmulator::getPowerOns());
+    CHECK_EQUAL(Esp11::ESP_BAUDRATE, AtEmulator::getBaudRate());
+    CHECK_EQUAL(Esp11::ESP_BAUDRATE, AtEmulator::getHostBaudRate());
+    CHECK(execute(Esp11::AsyncCmd::ENSURE_READY));
+
+    AtEmulator::setUartSwitchAccepted(true);
+    esp.setBaudRate(Esp11::ESP_BAUDRATE, false);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    AtEmulator::attach(esp, GPIOA, GPIO_PIN_1);
+    RUN_TEST(testEnsureMode);
+    RUN_TEST(testNormalSend);
+    RUN_TEST(testTransparentPrompt);
+    RUN_TEST(testLinkHandler);
+    RUN_TEST(testLinkClosed);
+    RUN_TEST(testOverrun);
+    RUN_TEST(testBaudRate);
+    AtEmulator::detach();
+    return 0;
+}
@@ -0,0 +1,339 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * EspSender: output queue, batching, links per destination and delivery latency against the
+ * emulated ESP module.
+ */
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "EspSender.h"
+#include "AtEmulator.h"
+#include "FakeSdCard.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const char * CONFIG_FILE = "conf.txt";
+const char * CONFIG = "WLAN_NAME=wlan\nWLAN_PASS=secret\nTHIS_IP=192.168.1.10\nGATE_IP=192.168.1.1\n"
+                      "IP_MASK=255.255.255.0\nSERVER_PORT=5000\nNTP_SERVER=ntp.server\n"
+                      "REPEAT_DELAY=1\nTURN_OFF_DELAY=2\n";
+
+SdCardFixture sd;
+Config config(sd.storage, CONFIG_FILE);
+
+RealTimeClock rtc;
+InterruptPriority prio(5, 0);
+Esp11 esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, prio, IOPort::A, GPIO_PIN_1);
+IOPin errorLed(IOPort::B, GPIO_PIN_0, GPIO_MODE_OUTPUT_PP);
+
+class NtpHandler : public Esp11::EventHandler
+{
+public:
+
+    std::string received;
+
+    virtual void onInputMessage (int32_t, const char * data, size_t len)
+    {
+        received.assign(data, len);
+    }
+};
+
+NtpHandler ntpHandler;
+
+void writeConfig (const char * serverIp, bool transparent)
+{
+    std::string text = std::string(CONFIG) + "SERVER_IP=" + serverIp + "\nESP_TRANSPARENT=" + (transparent? "1" : "0") + "\n";
+    CHECK(sd.storage.acquire());
+    FIL file;
+    UINT bw = 0;
+    CHECK_EQUAL(FR_OK, f_open(&file, CONFIG_FILE, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_EQUAL(FR_OK, f_write(&file, text.data(), text.size(), &bw));
+    CHECK_EQUAL(FR_OK, f_close(&file));
+    sd.storage.release();
+    config.readConfiguration();
+}
+
+void run (time_ms ms, EspSender & sender)
+{
+    for (time_ms i = 0; i < ms; ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+        sender.periodic();
+    }
+}
+
+void runUntilSent (EspSender & sender)
+{
+    for (int i = 0; i < 60000 && !sender.isOutputMessageSent(); ++i)
+    {
+        run(1, sender);
+    }
+    CHECK(sender.isOutputMessageSent());
+}
+
+size_t countCommands (const char * prefix)
+{
+    size_t n = 0;
+    for (auto & c : AtEmulator::getCommands())
+    {
+        n += (c.compare(0, ::strlen(prefix), prefix) == 0)? 1 : 0;
+    }
+    return n;
+}
+
+bool sendReport (EspSender & sender, const std::string & msg, uint32_t coalesceKey = EspSender::NO_COALESCE)
+{
+    return sender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), msg.c_str(), 0,
+                              EspSender::Priority::NORMAL, coalesceKey);
+}
+
+bool sendNtp (EspSender & sender)
+{
+    return sender.sendMessage("UDP", config.getNtpServer(), "123", "ntp", 0, EspSender::Priority::HIGH,
+                              EspSender::NO_COALESCE, &ntpHandler);
+}
+
+void testBatchIsNewlineDelimited ()
+{
+    writeConfig("report.server", false);
+    AtEmulator::clear();
+    EspSender sender(rtc, esp, config, errorLed);
+    CHECK(sendReport(sender, "{\"seq\":1}"));
+    CHECK(sendReport(sender, "{\"seq\":2}\n"));
+    CHECK(sendReport(sender, "{\"seq\":3}"));
+    runUntilSent(sender);
+
+    // a single transmission, the server splits it into the original messages
+    CHECK_EQUAL(1, countCommands("AT+CIPSEND="));
+    CHECK(AtEmulator::getServerData("report.server") == "{\"seq\":1}\n{\"seq\":2}\n{\"seq\":3}\n");
+    CHECK_EQUAL(3, sender.getMessagesSent());
+    run(5000, sender);
+}
+
+void testQueueUnderBurst ()
+{
+    writeConfig("report.server", false);
+    AtEmulator::clear();
+    EspSender sender(rtc, esp, config, errorLed);
+
+    // the first report is in transmission while the pin state keeps changing
+    CHECK(sendReport(sender, "state0", 1));
+    run(1, sender);
+    CHECK(!sender.isOutputMessageSent());
+    for (int i = 1; i <= 100; ++i)
+    {
+        CHECK(sendReport(sender, "state" + std::to_string(i), 1));
+    }
+    CHECK_EQUAL(99, sender.getMessagesCoalesced());
+
+    // the time request jumps ahead of the queued report
+    CHECK(sendNtp(sender));
+    runUntilSent(sender);
+    CHECK(AtEmulator::getServerData("report.server") == "state0\nstate100\n");
+    CHECK(AtEmulator::getServerData("ntp.server") == "ntp");
+    const auto & commands = AtEmulator::getCommands();
+    size_t udp = 0, tcp = 0;
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        if (commands[i].find("\"UDP\"") != std::string::npos)
+        {
+            udp = i;
+        }
+        if (commands[i].find("\"TCP\"") != std::string::npos)
+        {
+            tcp = i;
+        }
+    }
+    CHECK(udp > tcp);
+    CHECK_EQUAL(3, sender.getMessagesSent());
+    CHECK_EQUAL(0, sender.getMessagesDropped());
+
+    // a full queue drops the messages without a coalescing key
+    for (size_t i = 0; i < EspSender::QUEUE_SIZE; ++i)
+    {
+        CHECK(!sender.isQueueFull());
+        CHECK(sendReport(sender, "bulk"));
+    }
+    CHECK(sender.isQueueFull());
+    CHECK(!sendReport(sender, "bulk"));
+    CHECK_EQUAL(1, sender.getMessagesDropped());
+    runUntilSent(sender);
+
+    // the module is hot: the delivery needs a single AT+CIPSEND round trip only
+    CHECK(sender.getAverageTimeToFirstByte(EspSender::StartType::HOT) < 10);
+
+    // random bursts of distinct reports: each accepted one is delivered once, in order, and
+    // its latency from sendMessage() up to the delivery is recorded
+    std::mt19937 random(34);
+    std::bernoulli_distribution burstStarts(0.05);
+    std::uniform_int_distribution<size_t> burstLength(1, 2 * EspSender::QUEUE_SIZE);
+    std::vector<time_ms> enqueueTime, latency;
+    size_t delivered = 0, dropped = 0, pos = AtEmulator::getServerData("report.server").size();
+    const uint32_t droppedBefore = sender.getMessagesDropped();
+    for (time_ms t = 0; t < 5000 || latency.size() < enqueueTime.size(); ++t)
+    {
+        if (t < 5000 && burstStarts(random))
+        {
+            for (size_t n = burstLength(random); n > 0; --n)
+            {
+                if (sendReport(sender, "r" + std::to_string(enqueueTime.size())))
+                {
+                    enqueueTime.push_back(rtc.getUpTimeMillisec());
+                }
+                else
+                {
+                    ++dropped;
+                }
+            }
+        }
+        run(1, sender);
+        const std::string data = AtEmulator::getServerData("report.server");
+        for (size_t end; (end = data.find('\n', pos)) != std::string::npos; pos = end + 1)
+        {
+            CHECK(data.compare(pos, end - pos, "r" + std::to_string(delivered)) == 0);
+            latency.push_back(rtc.getUpTimeMillisec() - enqueueTime[delivered++]);
+        }
+        CHECK(t < 60000);
+    }
+    CHECK(dropped > 0);
+    CHECK_EQUAL(droppedBefore + dropped, sender.getMessagesDropped());
+    CHECK_EQUAL(enqueueTime.size(), delivered);
+
+    std::sort(latency.begin(), latency.end());
+    const time_ms median = latency[latency.size() / 2], p90 = latency[latency.size() * 9 / 10];
+    ::printf("    %zu reports, %zu dropped, latency min %u, median %u, 90%% %u, max %u ms\n",
+             latency.size(), dropped, (unsigned)latency.front(), (unsigned)median, (unsigned)p90,
+             (unsigned)latency.back());
+    // a burst is batched: even the last report of a full queue waits for a single transmission
+    CHECK(median <= 2);
+    CHECK(latency.back() <= 10);
+    run(5000, sender);
+}
+
+void testLinksPerDestination ()
+{
+    writeConfig("report.server", false);
+    AtEmulator::clear();
+    EspSender sender(rtc, esp, config, errorLed);
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK(sendNtp(sender));
+        runUntilSent(sender);
+        int ntpLink = AtEmulator::findLink("ntp.server");
+        CHECK(ntpLink >= 0);
+        AtEmulator::sendFromServer(ntpLink, "time");
+        run(1, sender);
+        CHECK(ntpHandler.received == "time");
+        ntpHandler.received.clear();
+
+        CHECK(sendReport(sender, "report"));
+        runUntilSent(sender);
+    }
+    // alternating destinations keep their own links
+    CHECK_EQUAL(2, AtEmulator::getConnects());
+    CHECK(AtEmulator::findLink("ntp.server") != AtEmulator::findLink("report.server"));
+
+    // the configuration is re-read into the same buffers: the new server gets a new link
+    writeConfig("new.server", false);
+    CHECK(sendReport(sender, "moved"));
+    runUntilSent(sender);
+    CHECK(AtEmulator::getServerData("new.server") == "moved\n");
+    CHECK_EQUAL(3, AtEmulator::getConnects());
+
+    // a queued message keeps its destination while the configuration changes
+    CHECK(sendReport(sender, "queued"));
+    writeConfig("other.server", false);
+    CHECK(sendReport(sender, "after"));
+    runUntilSent(sender);
+    CHECK(AtEmulator::getServerData("new.server") == "moved\nqueued\n");
+    CHECK(AtEmulator::getServerData("other.server") == "after\n");
+
+    // a destination that does not fit into the queue entry is rejected
+    CHECK(!sender.sendMessage("TCP", std::string(Esp11::MAX_SERVER_LENGTH + 1, 's').c_str(), "5000", "x"));
+    CHECK(sender.sendMessage("TCP", std::string(Esp11::MAX_SERVER_LENGTH, 's').c_str(), "5000", "x"));
+    runUntilSent(sender);
+    run(5000, sender);
+}
+
+#ifdef STMPLUSPLUS_CO_NATIVE
+
+void testFrameExhaustion ()
+{
+    writeConfig("report.server", false);
+    AtEmulator::clear();
+    EspSender sender(rtc, esp, config, errorLed);
+
+    // the top-level coroutine keeps its frame, the frames of the nested ones are taken away
+    std::vector<void *> taken;
+    for (void * f = CoFramePool::allocate(1); f != nullptr; f = CoFramePool::allocate(1))
+    {
+        taken.push_back(f);
+    }
+    CHECK(sendReport(sender, "delayed"));
+    for (size_t freeFrames = 0; freeFrames < 2; ++freeFrames)
+    {
+        if (freeFrames > 0)
+        {
+            CoFramePool::release(taken.back());
+            taken.pop_back();
+        }
+        // a coroutine that can not start yields: periodic() returns and nothing is transmitted
+        uint32_t failures = CoFramePool::getFailures();
+        run(1000, sender);
+        CHECK(!sender.isOutputMessageSent());
+        CHECK(AtEmulator::getCommands().empty());
+        CHECK(CoFramePool::getFailures() > failures);
+    }
+
+    for (void * f : taken)
+    {
+        CoFramePool::release(f);
+    }
+    runUntilSent(sender);
+    CHECK(AtEmulator::getServerData("report.server") == "delayed\n");
+    run(5000, sender);
+}
+
+#endif
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CHECK(sd.start());
+    AtEmulator::attach(esp, GPIOA, GPIO_PIN_1);
+    RUN_TEST(testBatchIsNewlineDelimited);
+    RUN_TEST(testQueueUnderBurst);
+    RUN_TEST(testLinksPerDestination);
+#ifdef STMPLUSPLUS_CO_NATIVE
+    RUN_TEST(testFrameExhaustion);
+#endif
+    AtEmulator::detach();
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Esp11: the module output of recorded ESP8266 sessions (AT firmware 1.x, echo off) passes the
+ * USART RX DMA, processRxChunk() and the tokenizer with the chunk and IDLE boundaries at
+ * different positions, e.g. within the "+IPD," headers and within the payloads.
+ */
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "AtEmulator.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+RealTimeClock rtc;
+InterruptPriority prio(5, 0);
+Esp11 esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, prio, IOPort::A, GPIO_PIN_1);
+
+const char * MESSAGE = "{\"t\":21.5}";
+
+/**
+ * @brief A command with its transmission and the module output that follows it. A step without
+ *        a command is an unsolicited output.
+ */
+class Step
+{
+public:
+
+    Esp11::AsyncCmd cmd;
+    const char * command;
+    const char * output;
+    bool result;
+    const char * input; // the input message after the step
+    bool linkConnected;
+};
+
+class Session
+{
+public:
+
+    const char * name;
+    bool multiConnection;
+    std::vector<Step> steps;
+};
+
+const Session SESSIONS[] = {
+    { "single connection", false, {
+        { Esp11::AsyncCmd::ENSURE_READY, "AT", "\r\nOK\r\n", true, "", false },
+        { Esp11::AsyncCmd::ENSURE_MODE, "AT+CWMODE?", "+CWMODE:1\r\n\r\nOK\r\n", true, "", false },
+        { Esp11::AsyncCmd::SET_SINDLE_CON, "AT+CIPMUX=0", "\r\nOK\r\n", true, "", false },
+        { Esp11::AsyncCmd::CONNECT_SERVER, "AT+CIPSTART=\"TCP\",\"192.168.2.10\",8080",
+          "CONNECT\r\n\r\nOK\r\n", true, "", true },
+        { Esp11::AsyncCmd::SEND_MSG_SIZE, "AT+CIPSEND=10", "\r\nOK\r\n> ", true, "", true },
+        { Esp11::AsyncCmd::SEND_MESSAGE, MESSAGE, "\r\nRecv 10 bytes\r\n\r\nSEND OK\r\n", true, "", true },
+        { Esp11::AsyncCmd::WAITING, NULL, "\r\n+IPD,12:{\"status\":0}", true, "{\"status\":0}", true },
+        { Esp11::AsyncCmd::WAITING, NULL,
+          "\r\n+IPD,42:HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nOK\r\n", true,
+          "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nOK\r\n", true },
+        { Esp11::AsyncCmd::CONNECT_SERVER, "AT+CIPSTART=\"TCP\",\"192.168.2.10\",8080",
+          "ALREADY CONNECTED\r\n\r\nERROR\r\n", false, "", true },
+        { Esp11::AsyncCmd::WAITING, NULL, "WIFI DISCONNECT\r\n", true, "", false },
+        { Esp11::AsyncCmd::CONNECT_SERVER, "AT+CIPSTART=\"TCP\",\"192.168.2.10\",8080",
+          "no ip\r\n\r\nERROR\r\n", false, "", false } } },
+
+    { "multiple connections", true, {
+        { Esp11::AsyncCmd::SET_MULTI_CON, "AT+CIPMUX=1", "\r\nOK\r\n", true, "", false },
+        { Esp11::AsyncCmd::CONNECT_SERVER, "AT+CIPSTART=0,\"TCP\",\"192.168.2.10\",8080",
+          "0,CONNECT\r\n\r\nOK\r\n", true, "", true },
+        { Esp11::AsyncCmd::SEND_MSG_SIZE, "AT+CIPSEND=0,10", "\r\nOK\r\n> ", true, "", true },
+        { Esp11::AsyncCmd::SEND_MESSAGE, MESSAGE,
+          "\r\nRecv 10 bytes\r\n\r\nSEND OK\r\n\r\n+IPD,0,12:{\"status\":0}", true, "{\"status\":0}", true },
+        { Esp11::AsyncCmd::WAITING, NULL, "\r\n+IPD,0,27:1,CLOSED\r\n\r\nOK\r\n> +IPD,1,3:", true,
+          "1,CLOSED\r\n\r\nOK\r\n> +IPD,1,3:", true },
+        { Esp11::AsyncCmd::WAITING, NULL, "0,CLOSED\r\n", true, "", false },
+        { Esp11::AsyncCmd::SEND_MSG_SIZE, "AT+CIPSEND=0,10", "link is not valid\r\n\r\nERROR\r\n", false, "", false },
+        { Esp11::AsyncCmd::CONNECT_SERVER, "AT+CIPSTART=0,\"TCP\",\"192.168.2.10\",8080",
+          "0,CONNECT\r\n\r\nOK\r\n", true, "", true },
+        { Esp11::AsyncCmd::WAITING, NULL, "WIFI DISCONNECT\r\n0,CLOSED\r\n", true, "", false } } }
+};
+
+enum class Split
+{
+    WHOLE     = 0, // one chunk
+    BYTEWISE  = 1, // an IDLE interrupt and a periodic() call after each byte
+    AT_OFFSET = 2, // two chunks split at the given offset
+    RANDOM    = 3  // random pieces, some of them joined since periodic() is not called in between
+};
+
+/**
+ * @brief Plays the module output in pieces. Each piece ends by the IDLE interrupt; the pieces
+ *        received between two periodic() calls are processed as one chunk.
+ */
+void feed (const std::string & output, Split split, size_t offset, std::mt19937 & random)
+{
+    std::uniform_int_distribution<size_t> pieceSize(1, 16);
+    std::bernoulli_distribution process(0.5);
+    for (size_t pos = 0; pos < output.size();)
+    {
+        size_t n = output.size() - pos;
+        bool callPeriodic = true;
+        switch (split)
+        {
+        case Split::WHOLE:
+            break;
+        case Split::BYTEWISE:
+            n = 1;
+            break;
+        case Split::AT_OFFSET:
+            n = (pos < offset && offset < output.size())? offset - pos : n;
+            break;
+        case Split::RANDOM:
+            n = std::min(pieceSize(random), n);
+            callPeriodic = process(random);
+            break;
+        }
+        AtEmulator::sendRaw(output.substr(pos, n).c_str());
+        pos += n;
+        if (callPeriodic)
+        {
+            esp.periodic();
+        }
+    }
+    esp.periodic();
+}
+
+std::string getInputMessage ()
+{
+    std::string msg(esp.getInputMessageSize(), 0);
+    if (!msg.empty())
+    {
+        esp.getInputMessage(&msg[0], msg.size());
+    }
+    return msg;
+}
+
+void run (const Session & session, Split split, size_t offset, std::mt19937 & random)
+{
+    // the module is started by the emulator, the rest of the session is played from the fixture
+    AtEmulator::setScripted(false);
+    esp.setMultiConnection(session.multiConnection);
+    CHECK(esp.transmit(Esp11::AsyncCmd::POWER_OFF) && esp.getResponce(Esp11::AsyncCmd::POWER_OFF));
+    CHECK(esp.transmit(Esp11::AsyncCmd::POWER_ON) && esp.getResponce(Esp11::AsyncCmd::POWER_ON));
+    esp.periodic();
+    AtEmulator::setScripted(true);
+    AtEmulator::clear();
+    esp.selectLink();
+
+    for (const Step & step : session.steps)
+    {
+        if (step.command != NULL)
+        {
+            CHECK(esp.transmit(step.cmd));
+            CHECK(!AtEmulator::getCommands().empty() && AtEmulator::getCommands().back() == step.command);
+        }
+        feed(step.output, split, offset, random);
+        if (step.command != NULL)
+        {
+            CHECK(esp.isResponceAvailable());
+            CHECK_EQUAL(step.result, esp.getResponce(step.cmd));
+        }
+        CHECK(getInputMessage() == step.input);
+        CHECK_EQUAL(step.linkConnected, esp.isLinkConnected());
+    }
+}
+
+void prepare ()
+{
+    esp.setMode(1);
+    esp.setProtocol("TCP");
+    esp.setServer("192.168.2.10");
+    esp.setPort("8080");
+    esp.setMessage(MESSAGE);
+    esp.setMessageSize(::strlen(MESSAGE));
+}
+
+void testWholeOutput ()
+{
+    std::mt19937 random(31);
+    for (const Session & s : SESSIONS)
+    {
+        run(s, Split::WHOLE, 0, random);
+    }
+}
+
+void testBytewise ()
+{
+    std::mt19937 random(31);
+    for (const Session & s : SESSIONS)
+    {
+        run(s, Split::BYTEWISE, 0, random);
+    }
+}
+
+void testEverySplitPoint ()
+{
+    std::mt19937 random(31);
+    for (const Session & s : SESSIONS)
+    {
+        size_t longest = 0;
+        for (const Step & step : s.steps)
+        {
+            longest = std::max(longest, ::strlen(step.output));
+        }
+        for (size_t offset = 1; offset < longest; ++offset)
+        {
+            run(s, Split::AT_OFFSET, offset, random);
+        }
+    }
+}
+
+void testRandomPieces ()
+{
+    std::mt19937 random(31);
+    for (int i = 0; i < 200; ++i)
+    {
+        for (const Session & s : SESSIONS)
+        {
+            run(s, Split::RANDOM, 0, random);
+        }
+    }
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    AtEmulator::attach(esp, GPIOA, GPIO_PIN_1);
+    prepare();
+    RUN_TEST(testWholeOutput);
+    RUN_TEST(testBytewise);
+    RUN_TEST(testEverySplitPoint);
+    RUN_TEST(testRandomPieces);
+    AtEmulator::detach();
+    return 0;
+}
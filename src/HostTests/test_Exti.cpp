@@ -0,0 +1,417 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * EXTI edge detection: the cycle counter, the SPSC queue between an interrupt and the main loop,
+ * the dispatch of the EXTI lines, and the interrupt modes of Button and InputBank.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "StmPlusPlus/BasicIO.h"
+#include "StmPlusPlus/Devices/Button.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+InterruptPriority prio(1, 1);
+RealTimeClock rtc;
+
+class EdgeRecorder : public IOPin::ExtiHandler
+{
+public:
+
+    std::vector<IOPin::ExtiEvent> edges;
+
+    virtual void onExtiEdge (const IOPin::ExtiEvent & event)
+    {
+        edges.push_back(event);
+    }
+};
+
+class PressCounter : public Button::EventHandler
+{
+public:
+
+    std::vector<uint32_t> presses; // numOccured of each event
+
+    virtual void onButtonPressed (const Button *, uint32_t numOccured)
+    {
+        presses.push_back(numOccured);
+    }
+};
+
+/**
+ * @brief Plays the EXTI interrupt: the given pin of the given port changes to the given level.
+ */
+void edge (GPIO_TypeDef * port, uint32_t pin, bool level, uint32_t timestamp)
+{
+    if (level)
+    {
+        port->IDR |= pin;
+    }
+    else
+    {
+        port->IDR &= ~pin;
+    }
+    DWT->CYCCNT = timestamp;
+    EXTI->PR |= pin;
+    IOPin::processExtiInterrupt(pin);
+    // the pending bits are cleared by writing 1, that is plain memory here
+    EXTI->PR = 0;
+}
+
+void testCycleCounter ()
+{
+    CycleCounter::start();
+    CHECK((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) != 0);
+    CHECK((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) != 0);
+    CHECK_EQUAL(SystemCoreClock, CycleCounter::getFrequency());
+
+    DWT->CYCCNT = 12345;
+    CHECK_EQUAL(12345, CycleCounter::getValue());
+    CHECK_EQUAL(1, CycleCounter::toMicros(168));
+    CHECK_EQUAL(25565281, CycleCounter::toMicros(0xFFFFFFFFU));
+    CHECK_EQUAL(5, CycleCounter::toMillis(5 * 168000 + 167999));
+
+    // 1 MB within 168 million cycles (one second), 3 MB within two seconds
+    char buffer[16];
+    CHECK_EQUAL(1024, CycleCounter::getThroughput(1024 * 1024, 168000000));
+    CHECK_EQUAL(0, CycleCounter::getThroughput(1024, 0));
+    CHECK_EQUAL(0, ::strcmp("1.00", CycleCounter::formatThroughput(1024 * 1024, 168000000, buffer)));
+    CHECK_EQUAL(0, ::strcmp("1.50", CycleCounter::formatThroughput(3 * 1024 * 1024, 336000000, buffer)));
+    CHECK_EQUAL(0, ::strcmp("0.00", CycleCounter::formatThroughput(1024, 0, buffer)));
+
+    // the difference of two time stamps is valid over the counter wrap
+    uint32_t before = 0xFFFFFF00U, after = 0x100U;
+    CHECK_EQUAL(0x200, after - before);
+
+    // the busy wait returns once the counter advanced by the given time
+    std::atomic<bool> running(true);
+    DWT->CYCCNT = 0xFFFFF000U;
+    std::thread clock([&running]() {
+        while (running)
+        {
+            DWT->CYCCNT = DWT->CYCCNT + 100;
+        }
+    });
+    uint32_t start = DWT->CYCCNT;
+    CycleCounter::delayMicros(50);
+    uint32_t elapsed = DWT->CYCCNT - start;
+    running = false;
+    clock.join();
+    CHECK(elapsed >= 50 * 168);
+}
+
+void testSpscQueue ()
+{
+    SpscQueue<uint32_t, 8> q;
+    uint32_t v = 0;
+    CHECK(q.isEmpty());
+    CHECK(!q.pop(v));
+
+    // the indices run over many laps of the buffer
+    uint32_t next = 0, expected = 0;
+    for (int lap = 0; lap < 100; ++lap)
+    {
+        for (int i = 0; i < 5; ++i)
+        {
+            CHECK(q.push(next++));
+        }
+        CHECK_EQUAL(5, q.size());
+        for (int i = 0; i < 5; ++i)
+        {
+            CHECK(q.pop(v));
+            CHECK_EQUAL(expected++, v);
+        }
+        CHECK(q.isEmpty());
+    }
+
+    // a full queue drops the new items and counts them
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        CHECK(q.push(i));
+    }
+    CHECK(!q.push(100));
+    CHECK(!q.push(101));
+    CHECK_EQUAL(2, q.getOverflows());
+    CHECK_EQUAL(8, q.size());
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        CHECK(q.pop(v));
+        CHECK_EQUAL(i, v);
+    }
+    CHECK(!q.pop(v));
+}
+
+void testSpscQueueConcurrent ()
+{
+    const uint32_t ITEMS = 2000000;
+    SpscQueue<uint32_t, 32> q;
+    uint32_t dropped = 0;
+    std::atomic<bool> producing(true);
+    std::thread producer([&q, &dropped, &producing]() {
+        for (uint32_t i = 1; i <= ITEMS; ++i)
+        {
+            dropped += q.push(i)? 0 : 1;
+        }
+        producing = false;
+    });
+
+    // the accepted items arrive in order, the dropped ones are seen as gaps
+    uint32_t last = 0, received = 0, gaps = 0, v = 0;
+    bool finished = false;
+    while (!finished)
+    {
+        // the queue is drained once more after the producer finished
+        finished = !producing;
+        while (q.pop(v))
+        {
+            CHECK(v > last);
+            gaps += v - last - 1;
+            last = v;
+            ++received;
+        }
+    }
+    producer.join();
+    gaps += ITEMS - last;
+    CHECK_EQUAL(dropped, q.getOverflows());
+    CHECK_EQUAL(dropped, gaps);
+    CHECK_EQUAL(ITEMS, received + dropped);
+}
+
+void testExtiDispatch ()
+{
+    IOPin a4(IOPort::A, GPIO_PIN_4, GPIO_MODE_INPUT, GPIO_PULLUP);
+    IOPin c4(IOPort::C, GPIO_PIN_4, GPIO_MODE_INPUT, GPIO_PULLUP);
+    IOPin b9(IOPort::B, GPIO_PIN_9, GPIO_MODE_INPUT, GPIO_PULLUP);
+    IOPort port(IOPort::B, GPIO_MODE_INPUT, GPIO_PULLUP, GPIO_SPEED_LOW, GPIO_PIN_10 | GPIO_PIN_11);
+    EdgeRecorder r1, r2;
+
+    CHECK(a4.enableExti(IOPin::Edge::BOTH, prio, &r1));
+    CHECK(a4.isExtiEnabled());
+    // the line 4 is used by port A
+    CHECK(!c4.enableExti(IOPin::Edge::RISING, prio, &r2));
+    CHECK(!c4.isExtiEnabled());
+    CHECK(b9.enableExti(IOPin::Edge::FALLING, prio, &r2));
+    CHECK(GPIOA == IOPin::getExtiPort(4));
+    CHECK(GPIOB == IOPin::getExtiPort(9));
+    CHECK(NULL == IOPin::getExtiPort(5));
+    CHECK(NULL == IOPin::getExtiPort(16));
+
+    // the level is read from the port that owns the line
+    GPIOC->IDR |= GPIO_PIN_4;
+    edge(GPIOA, GPIO_PIN_4, false, 1000);
+    edge(GPIOA, GPIO_PIN_4, true, 2000);
+    CHECK_EQUAL(2, r1.edges.size());
+    CHECK_EQUAL(4, r1.edges[0].line);
+    CHECK(!r1.edges[0].level);
+    CHECK_EQUAL(1000, r1.edges[0].timestamp);
+    CHECK(r1.edges[1].level);
+    CHECK_EQUAL(2000, r1.edges[1].timestamp);
+
+    // several pending lines: each handler gets its own line with the same time stamp,
+    // the lines without a handler are ignored
+    r1.edges.clear();
+    GPIOB->IDR &= ~GPIO_PIN_9;
+    DWT->CYCCNT = 3000;
+    EXTI->PR = GPIO_PIN_4 | GPIO_PIN_9 | GPIO_PIN_0;
+    IOPin::processExtiInterrupt(GPIO_PIN_4 | GPIO_PIN_9 | GPIO_PIN_0);
+    EXTI->PR = 0;
+    CHECK_EQUAL(1, r1.edges.size());
+    CHECK_EQUAL(1, r2.edges.size());
+    CHECK_EQUAL(9, r2.edges[0].line);
+    CHECK(!r2.edges[0].level);
+    CHECK_EQUAL(3000, r2.edges[0].timestamp);
+    CHECK_EQUAL(3000, r1.edges[0].timestamp);
+
+    // only the lines of the calling vector are served
+    EXTI->PR = GPIO_PIN_4 | GPIO_PIN_9;
+    IOPin::processExtiInterrupt(GPIO_PIN_9);
+    EXTI->PR = 0;
+    CHECK_EQUAL(1, r1.edges.size());
+    CHECK_EQUAL(2, r2.edges.size());
+
+    // a disabled line is free for an other port
+    a4.disableExti();
+    CHECK(!a4.isExtiEnabled());
+    edge(GPIOA, GPIO_PIN_4, false, 4000);
+    CHECK_EQUAL(1, r1.edges.size());
+    CHECK(c4.enableExti(IOPin::Edge::RISING, prio, &r2));
+    edge(GPIOC, GPIO_PIN_4, true, 5000);
+    CHECK_EQUAL(3, r2.edges.size());
+    CHECK_EQUAL(4, r2.edges[2].line);
+
+    // only a single pin can be connected
+    CHECK(!((IOPin &)port).enableExti(IOPin::Edge::BOTH, prio, &r1));
+    c4.disableExti();
+    b9.disableExti();
+}
+
+void testButtonInterruptMode ()
+{
+    const uint32_t MS = 168000; // counts per millisecond
+    Button button(IOPort::B, GPIO_PIN_2, GPIO_PULLUP, rtc, 50, 300);
+    PressCounter counter;
+    button.setHandler(&counter);
+    GPIOB->IDR |= GPIO_PIN_2;
+    button.periodic();
+    CHECK(button.startInterrupt(prio));
+    CHECK(button.isInterruptMode());
+
+    // a 60 ms press between two main loop passes: the polling would not see it at all
+    uint32_t t = 1000 * MS;
+    edge(GPIOB, GPIO_PIN_2, false, t);
+    edge(GPIOB, GPIO_PIN_2, true, t + 60 * MS);
+    DWT->CYCCNT = t + 100 * MS;
+    for (int i = 0; i < 100; ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+    }
+    button.periodic();
+    CHECK_EQUAL(1, counter.presses.size());
+    CHECK_EQUAL(0, counter.presses[0]);
+
+    // a 20 ms bounce is shorter than the press delay
+    t += 200 * MS;
+    edge(GPIOB, GPIO_PIN_2, false, t);
+    edge(GPIOB, GPIO_PIN_2, true, t + 20 * MS);
+    DWT->CYCCNT = t + 30 * MS;
+    button.periodic();
+    CHECK_EQUAL(1, counter.presses.size());
+
+    // the edges lost by the queue overflow are recovered from the current level
+    for (int i = 0; i < 20; ++i)
+    {
+        edge(GPIOB, GPIO_PIN_2, i % 2 != 0, t + (40 + i) * MS);
+    }
+    GPIOB->IDR &= ~GPIO_PIN_2;
+    DWT->CYCCNT = t + 70 * MS;
+    button.periodic();
+    for (int i = 0; i < 100; ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+    }
+    GPIOB->IDR |= GPIO_PIN_2;
+    button.periodic();
+    CHECK_EQUAL(2, counter.presses.size());
+    button.stopInterrupt();
+    CHECK(!button.isInterruptMode());
+}
+
+void testInputBank ()
+{
+    // PA4..PA7 form one run, PC4 can not use the line 4 of PA4 and stays polled
+    IOPort portA(IOPort::A, GPIO_MODE_INPUT, GPIO_PULLUP, GPIO_SPEED_LOW, GPIO_PIN_4 | GPIO_PIN_5 | GPIO_PIN_6 | GPIO_PIN_7);
+    std::vector<IOPin> pins = {
+        IOPin(IOPort::A, GPIO_PIN_4, GPIO_MODE_INPUT, GPIO_PULLUP),
+        IOPin(IOPort::A, GPIO_PIN_5, GPIO_MODE_INPUT, GPIO_PULLUP),
+        IOPin(IOPort::A, GPIO_PIN_6, GPIO_MODE_INPUT, GPIO_PULLUP),
+        IOPin(IOPort::A, GPIO_PIN_7, GPIO_MODE_INPUT, GPIO_PULLUP),
+        IOPin(IOPort::C, GPIO_PIN_4, GPIO_MODE_INPUT, GPIO_PULLUP)
+    };
+    InputBank bank;
+    CHECK(bank.addPins(portA));
+    CHECK(bank.addPin(GPIOC, GPIO_PIN_4));
+    CHECK(!bank.addPin(GPIOC, GPIO_PIN_4 | GPIO_PIN_5));
+    CHECK_EQUAL(5, bank.getPinCount());
+    CHECK_EQUAL(0x1F, bank.getMask());
+    size_t extiPins = 0;
+    for (auto & p : pins)
+    {
+        extiPins += bank.addInterrupt(p, prio);
+    }
+    CHECK_EQUAL(4, extiPins);
+    CHECK_EQUAL(0x0F, bank.getExtiMask());
+
+    GPIOA->IDR = GPIO_PIN_4 | GPIO_PIN_5 | GPIO_PIN_6 | GPIO_PIN_7;
+    GPIOC->IDR = GPIO_PIN_4;
+    bank.setState(bank.getMask());
+    CHECK_EQUAL(0, bank.scan());
+
+    // a pulse shorter than the scan period is reported, the state is the current level
+    edge(GPIOA, GPIO_PIN_6, false, 100);
+    edge(GPIOA, GPIO_PIN_6, true, 200);
+    CHECK_EQUAL(0x04, bank.scan());
+    CHECK_EQUAL(0x04, bank.getEdges());
+    CHECK_EQUAL(200, bank.getLastEdgeTime());
+    CHECK_EQUAL(0x1F, bank.getState());
+    CHECK_EQUAL(0, bank.scan());
+
+    // the polled pin is compared with the stored state
+    GPIOC->IDR = 0;
+    CHECK_EQUAL(0x10, bank.scan());
+    CHECK_EQUAL(0, bank.getEdges());
+    CHECK_EQUAL(0x0F, bank.getState());
+
+    // the queue overflow loses edges, but the next scan reads the current levels
+    for (int i = 0; i < 2 * (int)InputBank::QUEUE_SIZE; ++i)
+    {
+        edge(GPIOA, GPIO_PIN_7, i % 2 != 0, 300 + i);
+    }
+    GPIOA->IDR &= ~GPIO_PIN_7;
+    CHECK(bank.getLostEdges() > 0);
+    CHECK_EQUAL(0x08, bank.scan());
+    CHECK_EQUAL(0x07, bank.getState());
+    for (auto & p : pins)
+    {
+        p.disableExti();
+    }
+}
+
+void testInputBankAllExti ()
+{
+    IOPin pin(IOPort::B, GPIO_PIN_12, GPIO_MODE_INPUT, GPIO_PULLUP);
+    InputBank bank;
+    CHECK(bank.addPin(GPIOB, GPIO_PIN_12));
+    CHECK(bank.addInterrupt(pin, prio));
+    GPIOB->IDR |= GPIO_PIN_12;
+    bank.setState(bank.getMask());
+    CHECK_EQUAL(0, bank.scan());
+
+    // all pins use EXTI: the ports are read only after an edge
+    GPIOB->IDR &= ~GPIO_PIN_12;
+    CHECK_EQUAL(0, bank.scan());
+    CHECK_EQUAL(1, bank.getState());
+    edge(GPIOB, GPIO_PIN_12, false, 500);
+    CHECK_EQUAL(1, bank.scan());
+    CHECK_EQUAL(0, bank.getState());
+    pin.disableExti();
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    RUN_TEST(testCycleCounter);
+    RUN_TEST(testSpscQueue);
+    RUN_TEST(testSpscQueueConcurrent);
+    RUN_TEST(testExtiDispatch);
+    RUN_TEST(testButtonInterruptMode);
+    RUN_TEST(testInputBank);
+    RUN_TEST(testInputBankAllExti);
+    return 0;
+}
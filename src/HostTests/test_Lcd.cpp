@@ -0,0 +1,529 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Lcd_DOGM162_SPI: the frame buffer against a model of the ST7036 display data RAM, the flush of
+ * the dirty runs in the blocking and in the DMA mode, and the byte gap timed by the busy-wait or
+ * by the one-pulse timer. A thread plays the hardware: the cycle counter runs, the gap timer
+ * fires and, if enabled, the DMA transfers are completed.
+ */
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StmPlusPlus/Devices/Lcd_DOGM162.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const uint32_t PCLK1 = 42000000;
+const uint32_t PCLK2 = 84000000;
+const uint32_t CYCLES_PER_US = 168; // SystemCoreClock of HostHal
+
+/**
+ * @brief The ST7036 display data RAM: 0x00..0x27 is the first line, 0x40..0x67 the second one.
+ */
+class St7036
+{
+public:
+
+    char ddram[0x80];
+    uint8_t address = 0;
+    std::vector<uint8_t> instructions;
+
+    St7036 ()
+    {
+        ::memset(ddram, '?', sizeof(ddram));
+    }
+
+    void write (bool isData, uint8_t b)
+    {
+        if (isData)
+        {
+            ddram[address] = (char)b;
+            address = (address == 0x27)? 0x40 : (address == 0x67)? 0x00 : address + 1;
+            return;
+        }
+        instructions.push_back(b);
+        if (b == 0x01)
+        {
+            ::memset(ddram, ' ', sizeof(ddram));
+            address = 0;
+        }
+        else if ((b & 0x80) != 0)
+        {
+            address = b & 0x7F;
+        }
+    }
+
+    std::string getLine (uint8_t y) const
+    {
+        return std::string(ddram + y * 0x40, Lcd_DOGM162_SPI::COLUMNS);
+    }
+
+    size_t countCursorCommands () const
+    {
+        size_t n = 0;
+        for (uint8_t i : instructions)
+        {
+            n += (i & 0x80)? 1 : 0;
+        }
+        return n;
+    }
+};
+
+/**
+ * @brief A transfer seen on the bus: the RS level, the bytes and the cycle counter at its start.
+ */
+class BusTransfer
+{
+public:
+
+    bool isData;
+    bool dma;
+    uint32_t prescaler;
+    uint32_t cycles;
+    std::vector<uint8_t> tx;
+};
+
+St7036 display;
+std::vector<BusTransfer> bus;
+HAL_StatusTypeDef nextStatus = HAL_OK;
+
+IOPin pinCs(IOPort::C, GPIO_PIN_6, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, true, true);
+IOPin pinRs(IOPort::C, GPIO_PIN_7, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, true, false);
+InterruptPriority prio(1, 0);
+Timer gapTimer(Timer::TIM_7, TIM7_IRQn);
+
+// the hardware thread
+Spi * activeSpi = NULL;
+std::atomic<bool> running(false), autoComplete(false), autoTimer(false);
+bool dmaPending = false;
+uint32_t timerStart = 0;
+bool timerArmed = false;
+
+HAL_StatusTypeDef transfer (SPI_HandleTypeDef * hspi, uint8_t * txData, uint16_t size, bool dma)
+{
+    HAL_StatusTypeDef status = nextStatus;
+    nextStatus = HAL_OK;
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    BusTransfer t;
+    t.isData = (GPIOC->ODR & GPIO_PIN_7) != 0;
+    t.dma = dma;
+    t.prescaler = hspi->Instance->CR1 & SPI_CR1_BR;
+    t.cycles = DWT->CYCCNT;
+    CHECK((GPIOC->ODR & GPIO_PIN_6) == 0);
+    for (uint16_t i = 0; i < size; ++i)
+    {
+        t.tx.push_back(txData[i]);
+        display.write(t.isData, txData[i]);
+    }
+    bus.push_back(t);
+    dmaPending = dma;
+    return HAL_OK;
+}
+
+/**
+ * @brief Plays the update interrupt of the one-pulse gap timer: the counter is stopped.
+ */
+void fireTimer ()
+{
+    TIM_HandleTypeDef * htim = gapTimer.getTimerParameters();
+    CHECK((htim->Instance->CR1 & TIM_CR1_CEN) != 0);
+    htim->Instance->SR |= TIM_SR_UIF;
+    if ((htim->Instance->CR1 & TIM_CR1_OPM) != 0)
+    {
+        htim->Instance->CR1 &= ~TIM_CR1_CEN;
+    }
+    timerArmed = false;
+    gapTimer.processInterrupt();
+}
+
+bool isTimerRunning ()
+{
+    return (gapTimer.getTimerParameters()->Instance->CR1 & TIM_CR1_CEN) != 0;
+}
+
+/**
+ * @brief Plays the DMA completion interrupt routed to Spi::processCallback().
+ */
+void complete (HAL_StatusTypeDef status = HAL_OK)
+{
+    HostIrq_enter();
+    CHECK(dmaPending);
+    dmaPending = false;
+    activeSpi->processCallback(status);
+    HostIrq_leave();
+}
+
+void hardware ()
+{
+    while (running)
+    {
+        DWT->CYCCNT = DWT->CYCCNT + CYCLES_PER_US / 8;
+        HostIrq_enter();
+        if (autoTimer && isTimerRunning())
+        {
+            // the timer counts microseconds: the period is the gap
+            if (!timerArmed)
+            {
+                timerArmed = true;
+                timerStart = DWT->CYCCNT;
+            }
+            else if (DWT->CYCCNT - timerStart >= (gapTimer.getTimerParameters()->Init.Period + 1) * CYCLES_PER_US)
+            {
+                fireTimer();
+            }
+        }
+        if (autoComplete && dmaPending)
+        {
+            dmaPending = false;
+            activeSpi->processCallback(HAL_OK);
+        }
+        HostIrq_leave();
+        std::this_thread::yield();
+    }
+}
+
+class Hardware
+{
+public:
+
+    std::thread thread;
+
+    Hardware (Spi & spi)
+    {
+        bus.clear();
+        display = St7036();
+        activeSpi = &spi;
+        dmaPending = timerArmed = false;
+        autoComplete = autoTimer = true;
+        running = true;
+        thread = std::thread(hardware);
+    }
+
+    ~Hardware ()
+    {
+        running = false;
+        thread.join();
+        activeSpi = NULL;
+    }
+};
+
+void waitFlushed (Lcd_DOGM162_SPI & lcd)
+{
+    while (lcd.isFlushing())
+    {
+        std::this_thread::yield();
+    }
+}
+
+void checkFrame (const Lcd_DOGM162_SPI & lcd)
+{
+    for (uint8_t y = 0; y < lcd.getLinesNumber(); ++y)
+    {
+        std::string frame;
+        for (uint8_t x = 0; x < Lcd_DOGM162_SPI::COLUMNS; ++x)
+        {
+            frame += lcd.getChar(x, y);
+        }
+        if (frame != display.getLine(y))
+        {
+            ::printf("line %u: \"%s\", expected \"%s\"\n", y, display.getLine(y).c_str(), frame.c_str());
+        }
+        CHECK(frame == display.getLine(y));
+    }
+}
+
+void testInitAndRuns ()
+{
+    // SPI2 at 42 MHz: the slowest clock still needs 48 us per byte, no gap is needed
+    Spi spi(Spi::DeviceName::SPI_2, IOPort::B, GPIO_PIN_13, IOPort::B, GPIO_PIN_14, IOPort::B, GPIO_PIN_15);
+    Hardware hw(spi);
+    Lcd_DOGM162_SPI lcd(spi, pinCs, pinRs, true, 0x28);
+    CHECK_EQUAL(HAL_OK, lcd.start(2));
+    const uint8_t init[] = { 0x29, 0x1C, 0x5E, 0x78, 0x6A, 0x0C, 0x01, 0x06 };
+    CHECK(display.instructions == std::vector<uint8_t>(init, init + sizeof(init)));
+    CHECK_EQUAL(sizeof(init), bus.size());
+    CHECK_EQUAL(SPI_BAUDRATEPRESCALER_256, bus[0].prescaler);
+    // the clear instruction is awaited by a delay
+    CHECK(bus[7].cycles - bus[6].cycles >= Lcd_DOGM162_SPI::CLEAR_TIME * CYCLES_PER_US);
+    checkFrame(lcd);
+    CHECK(!lcd.isDirty());
+
+    // without DMA, the flush is finished when it returns; an unchanged character is not dirty
+    lcd.setChar(3, 0, ' ');
+    CHECK(!lcd.isDirty());
+    CHECK(lcd.flush());
+    CHECK_EQUAL(sizeof(init), bus.size());
+    CHECK_EQUAL(0, lcd.getFlushTime());
+
+    // a single clean character joins two runs, two clean ones split them
+    bus.clear();
+    display.instructions.clear();
+    lcd.setString(0, 0, "Hello", 5);
+    lcd.setChar(6, 0, '!');
+    lcd.setChar(9, 0, '#');
+    lcd.setString(12, 1, "ABCDEFGH", 8);
+    CHECK(lcd.isDirty());
+    CHECK(lcd.flush());
+    CHECK(!lcd.isFlushing());
+    CHECK(!lcd.isDirty());
+    checkFrame(lcd);
+    CHECK(display.getLine(0) == "Hello !  #      ");
+    CHECK(display.getLine(1) == "            ABCD");
+    CHECK_EQUAL(3, display.countCursorCommands());
+    const uint8_t cursors[] = { 0x80, 0x89, 0xCC };
+    CHECK(display.instructions == std::vector<uint8_t>(cursors, cursors + 3));
+    CHECK_EQUAL(6, bus.size());
+    CHECK_EQUAL(7, bus[1].tx.size());
+
+    // the whole frame: one run per line
+    bus.clear();
+    display.instructions.clear();
+    lcd.fillFrame('*');
+    CHECK(lcd.flush());
+    checkFrame(lcd);
+    CHECK_EQUAL(2, display.countCursorCommands());
+    CHECK_EQUAL(16, bus[1].tx.size());
+    CHECK_EQUAL(0, lcd.getErrors());
+    spi.stop();
+}
+
+void testBackgroundFlush ()
+{
+    Spi spi(Spi::DeviceName::SPI_2, IOPort::B, GPIO_PIN_13, IOPort::B, GPIO_PIN_14, IOPort::B, GPIO_PIN_15);
+    Hardware hw(spi);
+    Lcd_DOGM162_SPI lcd(spi, pinCs, pinRs, false, 0x20);
+    CHECK_EQUAL(HAL_OK, spi.start(SPI_DIRECTION_1LINE, SPI_BAUDRATEPRESCALER_256, SPI_DATASIZE_8BIT, SPI_PHASE_2EDGE));
+    CHECK_EQUAL(HAL_OK, spi.startDma(prio));
+    lcd.init(2);
+    CHECK(bus.back().dma);
+    autoComplete = false;
+
+    // the flush proceeds from the completion interrupts
+    bus.clear();
+    lcd.setString(2, 0, "abc", 3);
+    lcd.setString(0, 1, "xyz", 3);
+    CHECK(lcd.flush());
+    CHECK(lcd.isFlushing());
+    CHECK(!lcd.flush());
+    CHECK_EQUAL(1, bus.size());
+    complete();
+    CHECK_EQUAL(2, bus.size());
+    CHECK(bus[1].isData);
+
+    // the characters changed during the flush are sent by it, even in a run already sent
+    lcd.setChar(15, 1, 'Z');
+    lcd.setChar(2, 0, 'A');
+    for (int i = 0; i < 10 && lcd.isFlushing(); ++i)
+    {
+        complete();
+    }
+    CHECK(!lcd.isFlushing());
+    CHECK_EQUAL(8, bus.size());
+    CHECK_EQUAL(0x82, bus[2].tx[0]);
+    CHECK(!lcd.isDirty());
+    checkFrame(lcd);
+
+    // a failed transfer marks its run dirty again
+    lcd.setString(4, 0, "0123", 4);
+    CHECK(lcd.flush());
+    complete();
+    complete(HAL_ERROR);
+    CHECK(!lcd.isFlushing());
+    CHECK_EQUAL(1, lcd.getErrors());
+    CHECK(lcd.isDirty());
+    CHECK(lcd.flush());
+    complete();
+    complete();
+    checkFrame(lcd);
+    CHECK(!lcd.isDirty());
+
+    // a transfer refused at the start fails the run as well
+    lcd.setChar(0, 0, '+');
+    nextStatus = HAL_BUSY;
+    CHECK(lcd.flush());
+    CHECK(!lcd.isFlushing());
+    CHECK_EQUAL(2, lcd.getErrors());
+    CHECK(lcd.isDirty());
+    CHECK(lcd.flush());
+    complete();
+    complete();
+    checkFrame(lcd);
+    spi.stopDma();
+    spi.stop();
+}
+
+/**
+ * @brief SPI1 at 84 MHz divided by 256 takes 24 us per byte: the bytes are sent one by one with
+ *        a gap of 3 us. The fake bus takes no time, so the consecutive transfers are separated
+ *        by the gap only.
+ */
+void checkByteGaps ()
+{
+    const uint32_t gap = Lcd_DOGM162_SPI::EXECUTION_TIME - 8 * 256 / (PCLK2 / 1000000);
+    CHECK_EQUAL(3, gap);
+    for (size_t i = 1; i < bus.size(); ++i)
+    {
+        CHECK_EQUAL(1, bus[i].tx.size());
+        CHECK(bus[i].cycles - bus[i - 1].cycles >= gap * CYCLES_PER_US);
+    }
+}
+
+void testBusyWaitGap ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    Hardware hw(spi);
+    Lcd_DOGM162_SPI lcd(spi, pinCs, pinRs, true, 0x28);
+    CHECK_EQUAL(HAL_OK, lcd.start(2));
+    CHECK_EQUAL(SPI_BAUDRATEPRESCALER_256, bus[0].prescaler);
+    bus.clear();
+    lcd.setString(0, 0, "gap", 3);
+    CHECK(lcd.flush());
+    CHECK(!lcd.isFlushing());
+    CHECK_EQUAL(4, bus.size());
+    // the busy-wait in the SPI interrupt delays the next byte
+    checkByteGaps();
+    checkFrame(lcd);
+    spi.stop();
+}
+
+void testGapTimer ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    Hardware hw(spi);
+    Lcd_DOGM162_SPI lcd(spi, pinCs, pinRs, true, 0x28);
+    lcd.setGapTimer(&gapTimer, prio);
+    CHECK_EQUAL(HAL_OK, lcd.start(2));
+    TIM_HandleTypeDef * htim = gapTimer.getTimerParameters();
+    CHECK_EQUAL(3, htim->Init.Period);
+    CHECK_EQUAL(PCLK1 / 1000000 - 1, htim->Init.Prescaler);
+    CHECK((htim->Instance->CR1 & TIM_CR1_OPM) != 0);
+    CHECK_EQUAL(8, bus.size());
+    checkFrame(lcd);
+
+    // the next byte is sent from the timer interrupt, not from the SPI one
+    CHECK_EQUAL(HAL_OK, spi.startDma(prio));
+    autoComplete = autoTimer = false;
+    bus.clear();
+    lcd.setString(5, 1, "ok", 2);
+    CHECK(lcd.flush());
+    CHECK_EQUAL(1, bus.size());
+    CHECK(!isTimerRunning());
+    complete();
+    CHECK_EQUAL(1, bus.size());
+    CHECK(isTimerRunning());
+    CHECK_EQUAL(0, htim->Instance->CNT);
+    HostIrq_enter();
+    fireTimer();
+    HostIrq_leave();
+    CHECK_EQUAL(2, bus.size());
+    CHECK(bus[1].isData && bus[1].tx[0] == 'o');
+    CHECK(!isTimerRunning());
+    complete();
+    HostIrq_enter();
+    fireTimer();
+    HostIrq_leave();
+    complete();
+    CHECK(isTimerRunning());
+    CHECK(lcd.isFlushing());
+    HostIrq_enter();
+    fireTimer();
+    HostIrq_leave();
+    CHECK(!lcd.isFlushing());
+    CHECK_EQUAL(3, bus.size());
+    checkFrame(lcd);
+
+    // the timed gaps in background
+    autoComplete = autoTimer = true;
+    bus.clear();
+    lcd.fillFrame('-');
+    CHECK(lcd.flush());
+    waitFlushed(lcd);
+    CHECK_EQUAL(2 + 2 * Lcd_DOGM162_SPI::COLUMNS, bus.size());
+    checkByteGaps();
+    CHECK(lcd.getFlushTime() >= (bus.size() - 1) * 3);
+    checkFrame(lcd);
+    CHECK_EQUAL(0, lcd.getErrors());
+    autoComplete = autoTimer = false;
+    gapTimer.stop();
+    spi.stopDma();
+    spi.stop();
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Fake SPI, RCC and timer HAL: replaces the weak stubs
+ ************************************************************************/
+
+extern "C" uint32_t HAL_RCC_GetPCLK1Freq (void)
+{
+    return PCLK1;
+}
+
+extern "C" uint32_t HAL_RCC_GetPCLK2Freq (void)
+{
+    return PCLK2;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_Base_Start_IT (TIM_HandleTypeDef * htim)
+{
+    htim->Instance->DIER |= TIM_IT_UPDATE;
+    htim->Instance->CR1 |= TIM_CR1_CEN;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Init (SPI_HandleTypeDef * hspi)
+{
+    hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.Direction | hspi->Init.DataSize | hspi->Init.CLKPolarity
+                          | hspi->Init.CLKPhase | (hspi->Init.NSS & SPI_CR1_SSM) | hspi->Init.BaudRatePrescaler
+                          | hspi->Init.FirstBit;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Transmit (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size, uint32_t)
+{
+    return transfer(hspi, pData, Size, false);
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Transmit_DMA (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size)
+{
+    return transfer(hspi, pData, Size, true);
+}
+
+int main ()
+{
+    RUN_TEST(testInitAndRuns);
+    RUN_TEST(testBackgroundFlush);
+    RUN_TEST(testBusyWaitGap);
+    RUN_TEST(testGapTimer);
+    return 0;
+}
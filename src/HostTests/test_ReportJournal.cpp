@@ -0,0 +1,270 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * ReportJournal: delivery of the journal over link outages and the numbering of a recreated
+ * journal file, against the emulated ESP module and a server that confirms the records.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ReportJournal.h"
+#include "AtEmulator.h"
+#include "FakeSdCard.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const char * CONFIG_FILE = "conf.txt";
+const char * CONFIG = "WLAN_NAME=wlan\nWLAN_PASS=secret\nTHIS_IP=192.168.1.10\nGATE_IP=192.168.1.1\n"
+                      "IP_MASK=255.255.255.0\nSERVER_IP=report.server\nSERVER_PORT=5000\n"
+                      "NTP_SERVER=ntp.server\nREPEAT_DELAY=1\nTURN_OFF_DELAY=2\nESP_TRANSPARENT=0\n";
+const char * JOURNAL_FILE = "journal.bin";
+const DWORD JOURNAL_SIZE = 64 * 1024;
+
+SdCardFixture sd;
+Config config(sd.storage, CONFIG_FILE);
+
+RealTimeClock rtc;
+InterruptPriority prio(5, 0);
+Esp11 esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, prio, IOPort::A, GPIO_PIN_1);
+IOPin errorLed(IOPort::B, GPIO_PIN_0, GPIO_MODE_OUTPUT_PP);
+EspSender sender(rtc, esp, config, errorLed);
+ReportJournal journal(sd.storage, rtc, sender);
+
+/**
+ * @brief The report server: skips the already known sequence numbers and confirms the
+ *        contiguously received records.
+ */
+class Server
+{
+public:
+
+    std::map<uint32_t, std::string> reports; // by sequence number
+    uint32_t frames = 0, duplicates = 0, contiguousSeq = 0;
+    bool ackEnabled = true;
+
+    void serve ()
+    {
+        std::string data = AtEmulator::getServerData(config.getServerIp());
+        if (data.size() < received)
+        {
+            // the emulator was cleared
+            received = 0;
+        }
+        bool newFrames = false;
+        size_t end;
+        while ((end = data.find('\n', received)) != std::string::npos)
+        {
+            parseFrame(data.substr(received, end - received));
+            received = end + 1;
+            newFrames = true;
+        }
+        int link = AtEmulator::findLink(config.getServerIp());
+        if (newFrames && ackEnabled && link >= 0 && contiguousSeq > 0)
+        {
+            AtEmulator::sendFromServer(link, ("ACK " + std::to_string(contiguousSeq)).c_str());
+        }
+    }
+
+private:
+
+    size_t received = 0;
+
+    void parseFrame (const std::string & frame)
+    {
+        // {"seq":<n>,"time":<t>,"report":<report>}
+        size_t seqPos = frame.find("\"seq\":");
+        size_t reportPos = frame.find("\"report\":");
+        CHECK(seqPos != std::string::npos && reportPos != std::string::npos && frame.back() == '}');
+        uint32_t seq = (uint32_t)::strtoul(frame.c_str() + seqPos + 6, NULL, 10);
+        reportPos += 9;
+        std::string report = frame.substr(reportPos, frame.size() - 1 - reportPos);
+        ++frames;
+        auto known = reports.find(seq);
+        if (known != reports.end())
+        {
+            // a retransmission shall repeat the same record
+            CHECK(known->second == report);
+            ++duplicates;
+            return;
+        }
+        reports[seq] = report;
+        while (reports.count(contiguousSeq + 1) > 0)
+        {
+            ++contiguousSeq;
+        }
+    }
+};
+
+Server server;
+std::vector<std::string> appended; // appended[i] is the record with the sequence number i + 1
+
+void writeConfig ()
+{
+    CHECK(sd.storage.acquire());
+    FIL file;
+    UINT bw = 0;
+    CHECK_EQUAL(FR_OK, f_open(&file, CONFIG_FILE, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_EQUAL(FR_OK, f_write(&file, CONFIG, ::strlen(CONFIG), &bw));
+    CHECK_EQUAL(FR_OK, f_close(&file));
+    sd.storage.release();
+    config.readConfiguration();
+}
+
+void run (time_ms ms)
+{
+    for (time_ms i = 0; i < ms; ++i)
+    {
+        rtc.onMilliSecondInterrupt();
+        sender.periodic();
+        journal.periodic();
+        server.serve();
+    }
+}
+
+void runUntilConfirmed ()
+{
+    for (int i = 0; i < 300000 && journal.getPendingRecords() > 0; ++i)
+    {
+        run(1);
+    }
+    CHECK_EQUAL(0, journal.getPendingRecords());
+}
+
+void append (size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        std::string report = "{\"n\":" + std::to_string(appended.size() + 1) + "}";
+        CHECK(journal.append(report.data(), report.size(), Encoder::Format::JSON));
+        appended.push_back(report);
+    }
+}
+
+/**
+ * @brief Every appended record is known to the server exactly once, under its own sequence number.
+ */
+void checkServer ()
+{
+    CHECK_EQUAL(appended.size(), server.reports.size());
+    CHECK_EQUAL(appended.size(), server.contiguousSeq);
+    for (size_t i = 0; i < appended.size(); ++i)
+    {
+        CHECK(server.reports[i + 1] == appended[i]);
+    }
+    CHECK_EQUAL(appended.size(), journal.getAckedSeq());
+    CHECK_EQUAL(0, journal.getDroppedRecords());
+}
+
+void testLinkOutages ()
+{
+    CHECK(journal.start(JOURNAL_FILE, JOURNAL_SIZE, config.getServerIp(), config.getServerPort()));
+    append(6);
+    runUntilConfirmed();
+    CHECK_EQUAL(0, server.duplicates);
+
+    // the server is not reachable: the records wait in the journal
+    AtEmulator::setServersReachable(false);
+    append(9);
+    run(45000);
+    CHECK_EQUAL(6, server.reports.size());
+    CHECK_EQUAL(9, journal.getPendingRecords());
+    append(3);
+    AtEmulator::setServersReachable(true);
+    runUntilConfirmed();
+    checkServer();
+
+    // the records arrive but the link breaks before the acknowledge: they are sent again
+    server.ackEnabled = false;
+    append(5);
+    for (int i = 0; i < 60000 && server.reports.size() < appended.size(); ++i)
+    {
+        run(1);
+    }
+    CHECK_EQUAL(appended.size(), server.reports.size());
+    AtEmulator::setServersReachable(false);
+    run(1000);
+    AtEmulator::setServersReachable(true);
+    server.ackEnabled = true;
+    runUntilConfirmed();
+    CHECK(server.duplicates >= 5);
+    checkServer();
+    journal.stop();
+}
+
+void testNumberingOfRecreatedJournal ()
+{
+    // the journal file is deleted
+    CHECK(sd.storage.acquire());
+    CHECK_EQUAL(FR_OK, f_unlink(JOURNAL_FILE));
+    sd.storage.release();
+    CHECK(journal.start(JOURNAL_FILE, JOURNAL_SIZE, config.getServerIp(), config.getServerPort()));
+    CHECK_EQUAL(appended.size(), journal.getAckedSeq());
+    CHECK_EQUAL(0, journal.getPendingRecords());
+    append(4);
+    runUntilConfirmed();
+    checkServer();
+    journal.stop();
+
+    // another card: a new file system
+    FakeSdCard::remove();
+    sd.storage.periodic();
+    CHECK(sd.insert());
+    writeConfig();
+    CHECK(journal.start(JOURNAL_FILE, JOURNAL_SIZE, config.getServerIp(), config.getServerPort()));
+    CHECK_EQUAL(appended.size(), journal.getAckedSeq());
+    append(4);
+    runUntilConfirmed();
+    checkServer();
+    journal.stop();
+
+    // without the backup register, e.g. no VBAT, the journal file keeps the numbering
+    rtc.setBackupRegister(ReportJournal::SEQ_REGISTER, 0);
+    CHECK(journal.start(JOURNAL_FILE, JOURNAL_SIZE, config.getServerIp(), config.getServerPort()));
+    CHECK_EQUAL(appended.size(), journal.getAckedSeq());
+    CHECK_EQUAL(appended.size() + 1, rtc.getBackupRegister(ReportJournal::SEQ_REGISTER));
+    append(2);
+    runUntilConfirmed();
+    checkServer();
+    journal.stop();
+    CHECK_EQUAL(server.frames, server.reports.size() + server.duplicates);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CHECK(sd.start());
+    writeConfig();
+    AtEmulator::attach(esp, GPIOA, GPIO_PIN_1);
+    AtEmulator::clear();
+    rtc.setBackupRegister(ReportJournal::SEQ_REGISTER, 0);
+    RUN_TEST(testLinkOutages);
+    RUN_TEST(testNumberingOfRecreatedJournal);
+    AtEmulator::detach();
+    return 0;
+}
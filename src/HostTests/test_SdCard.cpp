@@ -0,0 +1,167 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * SdCard: retries of the transfer checks, the reported statistics, the bus tuning and the raw
+ * sector access to contiguous files.
+ */
+
+#include "FakeSdCard.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+SdCardFixture sd;
+
+uint32_t block[SdCard::SDHC_BLOCK_SIZE / sizeof(uint32_t)];
+
+const SdCardStatistics::Entry & readEntry ()
+{
+    return sd.sdCard.getStatistics().getEntry(SdCardStatistics::Operation::READ, 0);
+}
+
+void testRetriesBeforeSuccess ()
+{
+    sd.sdCard.getStatistics().reset();
+    FakeSdCard::setTimeouts(3);
+    uint32_t checks = FakeSdCard::getChecks();
+    CHECK_EQUAL(SD_OK, sd.sdCard.readBlocks(block, 0, SdCard::SDHC_BLOCK_SIZE, 1));
+    CHECK_EQUAL(4, FakeSdCard::getChecks() - checks);
+    CHECK_EQUAL(3, readEntry().retries);
+    CHECK_EQUAL(0, readEntry().errors);
+}
+
+void testRetriesExhausted ()
+{
+    sd.sdCard.getStatistics().reset();
+    FakeSdCard::setTimeouts(1000);
+    uint32_t checks = FakeSdCard::getChecks();
+    CHECK_EQUAL(SD_DATA_TIMEOUT, sd.sdCard.readBlocks(block, 0, SdCard::SDHC_BLOCK_SIZE, 1));
+    // every attempt is a check: the first one and the retries
+    CHECK_EQUAL(SdCard::CHECK_ATTEMPTS, FakeSdCard::getChecks() - checks);
+    CHECK_EQUAL(SdCard::CHECK_ATTEMPTS - 1, readEntry().retries);
+    CHECK_EQUAL(SdCard::CHECK_ATTEMPTS - 1, readEntry().maxRetries);
+    CHECK_EQUAL(1, readEntry().errors);
+    FakeSdCard::setTimeouts(0);
+}
+
+void testLastAttemptSucceeds ()
+{
+    sd.sdCard.getStatistics().reset();
+    FakeSdCard::setTimeouts(SdCard::CHECK_ATTEMPTS - 1);
+    CHECK_EQUAL(SD_OK, sd.sdCard.writeBlocks(block, 0, SdCard::SDHC_BLOCK_SIZE, 1));
+    CHECK_EQUAL(SdCard::CHECK_ATTEMPTS - 1,
+                sd.sdCard.getStatistics().getEntry(SdCardStatistics::Operation::WRITE, 0).retries);
+}
+
+uint32_t countOperations ()
+{
+    uint32_t count = 0;
+    for (size_t op = 0; op < SdCardStatistics::OPERATIONS; ++op)
+    {
+        for (size_t c = 0; c < SdCardStatistics::BLOCK_CLASSES; ++c)
+        {
+            const SdCardStatistics::Entry & e = sd.sdCard.getStatistics().getEntry((SdCardStatistics::Operation)op, c);
+            count += e.count + e.errors + e.retries;
+        }
+    }
+    return count;
+}
+
+void testTuningBypassesStatistics ()
+{
+    sd.sdCard.getStatistics().reset();
+    // the bypass and the dividers 0..2 fail, the reference read needs retries
+    FakeSdCard::setMinClockDiv(3);
+    FakeSdCard::setTimeouts(2);
+    CHECK(sd.sdCard.tuneBus());
+    CHECK_EQUAL(0, countOperations());
+    // the reads at the tuned clock are registered again
+    CHECK_EQUAL(SD_OK, sd.sdCard.readBlocks(block, 0, SdCard::SDHC_BLOCK_SIZE, 1));
+    CHECK_EQUAL(1, readEntry().count);
+    CHECK_EQUAL(0, readEntry().errors);
+    FakeSdCard::setMinClockDiv(0);
+}
+
+void testContiguousFile ()
+{
+    const uint32_t SECTORS = 40;
+    static uint32_t data[SECTORS * SdCard::SDHC_BLOCK_SIZE / sizeof(uint32_t)];
+    for (size_t i = 0; i < sizeof(data) / sizeof(uint32_t); ++i)
+    {
+        data[i] = (uint32_t)(i * 2654435761U);
+    }
+
+    SdCard::ContiguousFile cf;
+    CHECK_EQUAL(FR_OK, sd.sdCard.openContiguous(cf, "raw.bin", FA_CREATE_ALWAYS | FA_READ | FA_WRITE,
+                                                SECTORS * SdCard::SDHC_BLOCK_SIZE));
+    CHECK(cf.sectorCount >= SECTORS);
+
+    // beyond the end of the file, also when the end sector does not fit into 32 bit; the last
+    // sector is written again below
+    uint32_t writtenBlocks = FakeSdCard::getWrittenBlocks();
+    CHECK_EQUAL(SD_OK, sd.sdCard.writeSectors(cf, cf.sectorCount - 1, data, 1));
+    CHECK_EQUAL(SD_OK, sd.sdCard.writeSectors(cf, cf.sectorCount, data, 0));
+    CHECK_EQUAL(SD_INVALID_PARAMETER, sd.sdCard.writeSectors(cf, cf.sectorCount - 1, data, 2));
+    CHECK_EQUAL(SD_INVALID_PARAMETER, sd.sdCard.writeSectors(cf, cf.sectorCount + 1, data, 0));
+    CHECK_EQUAL(SD_INVALID_PARAMETER, sd.sdCard.writeSectors(cf, 1, data, 0xFFFFFFFF));
+    CHECK_EQUAL(SD_INVALID_PARAMETER, sd.sdCard.writeSectors(cf, 0xFFFFFFF0, data, 0x20));
+    static uint32_t readBack[sizeof(data) / sizeof(uint32_t)];
+    CHECK_EQUAL(SD_INVALID_PARAMETER, sd.sdCard.readSectors(cf, 2, readBack, 0xFFFFFFFF));
+    CHECK_EQUAL(SD_INVALID_PARAMETER, sd.sdCard.readSectors(cf, 0xFFFFFFFF, readBack, 1));
+    CHECK_EQUAL(writtenBlocks + 1, FakeSdCard::getWrittenBlocks());
+
+    // the sectors are written at the file position on the card
+    CHECK_EQUAL(SD_OK, sd.sdCard.writeSectors(cf, 0, data, SECTORS));
+    CHECK_EQUAL(0, ::memcmp(FakeSdCard::getSector(cf.startSector), data, sizeof(data)));
+    CHECK_EQUAL(SD_OK, sd.sdCard.readSectors(cf, 1, readBack, SECTORS - 1));
+    CHECK_EQUAL(0, ::memcmp(readBack, data + SdCard::SDHC_BLOCK_SIZE / sizeof(uint32_t),
+                            (SECTORS - 1) * SdCard::SDHC_BLOCK_SIZE));
+
+    // the file content seen by FAT FS
+    CHECK_EQUAL(FR_OK, sd.sdCard.closeContiguous(cf, sizeof(data)));
+    FIL file;
+    UINT br = 0;
+    CHECK_EQUAL(FR_OK, f_open(&file, "raw.bin", FA_READ));
+    CHECK_EQUAL(sizeof(data), f_size(&file));
+    CHECK_EQUAL(FR_OK, f_read(&file, readBack, sizeof(readBack), &br));
+    CHECK_EQUAL(sizeof(data), br);
+    CHECK_EQUAL(0, ::memcmp(readBack, data, sizeof(data)));
+    f_close(&file);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CHECK(sd.start());
+    CHECK(sd.storage.acquire());
+    RUN_TEST(testRetriesBeforeSuccess);
+    RUN_TEST(testRetriesExhausted);
+    RUN_TEST(testLastAttemptSucceeds);
+    RUN_TEST(testTuningBypassesStatistics);
+    RUN_TEST(testContiguousFile);
+    sd.storage.release();
+    return 0;
+}
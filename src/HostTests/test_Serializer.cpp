@@ -0,0 +1,407 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Serializer: the CBOR encoding against the examples of RFC 7049 Appendix A, the JSON separators,
+ * nesting and escaping, and the overflow of BufferWriter.
+ */
+
+#include <cstring>
+#include <string>
+
+#include "StmPlusPlus/Serializer.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+
+namespace
+{
+
+uint8_t buffer[256];
+
+std::string toHex (const uint8_t * data, size_t len)
+{
+    static const char * HEX_DIGITS = "0123456789abcdef";
+    std::string s;
+    for (size_t i = 0; i < len; ++i)
+    {
+        s += HEX_DIGITS[data[i] >> 4];
+        s += HEX_DIGITS[data[i] & 0x0F];
+    }
+    return s;
+}
+
+/**
+ * @brief Encodes an item by the given function and compares it with the expected hex string.
+ */
+template<typename F> void checkCbor (const char * expected, F encode)
+{
+    CborEncoder e(buffer, sizeof(buffer));
+    encode(e);
+    CHECK(!e.isOverflow());
+    std::string hex = toHex(e.getData(), e.getSize());
+    if (hex != expected)
+    {
+        ::printf("CBOR: %s, expected %s\n", hex.c_str(), expected);
+    }
+    CHECK(hex == expected);
+}
+
+template<typename F> void checkJson (const char * expected, F encode)
+{
+    JsonEncoder e(buffer, sizeof(buffer));
+    encode(e);
+    CHECK(!e.isOverflow());
+    const char * text = e.getString();
+    if (::strcmp(text, expected) != 0)
+    {
+        ::printf("JSON: %s, expected %s\n", text, expected);
+    }
+    CHECK(::strcmp(text, expected) == 0);
+    CHECK_EQUAL(::strlen(expected), e.getSize());
+}
+
+void testCborIntegers ()
+{
+    const struct
+    {
+        uint32_t value;
+        const char * hex;
+    } uints[] = {
+        { 0, "00" }, { 1, "01" }, { 10, "0a" }, { 23, "17" }, { 24, "1818" }, { 25, "1819" },
+        { 100, "1864" }, { 255, "18ff" }, { 256, "190100" }, { 1000, "1903e8" }, { 65535, "19ffff" },
+        { 65536, "1a00010000" }, { 1000000, "1a000f4240" }, { 4294967295UL, "1affffffff" } };
+    for (auto & u : uints)
+    {
+        checkCbor(u.hex, [&](Encoder & e) { e.putUInt(u.value); });
+    }
+
+    const struct
+    {
+        int32_t value;
+        const char * hex;
+    } ints[] = {
+        { 0, "00" }, { 23, "17" }, { 24, "1818" }, { -1, "20" }, { -10, "29" }, { -24, "37" },
+        { -25, "3818" }, { -100, "3863" }, { -256, "38ff" }, { -257, "390100" }, { -1000, "3903e7" },
+        { -65536, "39ffff" }, { -65537, "3a00010000" }, { INT32_MAX, "1a7fffffff" },
+        { INT32_MIN, "3a7fffffff" } };
+    for (auto & i : ints)
+    {
+        checkCbor(i.hex, [&](Encoder & e) { e.putInt(i.value); });
+    }
+}
+
+void testCborSimpleAndTagged ()
+{
+    checkCbor("f4", [](Encoder & e) { e.putBool(false); });
+    checkCbor("f5", [](Encoder & e) { e.putBool(true); });
+    checkCbor("c11a514b67b0", [](Encoder & e) { e.putTimestamp(1363896240); });
+    checkCbor("60", [](Encoder & e) { e.putString(""); });
+    checkCbor("6161", [](Encoder & e) { e.putString("a"); });
+    checkCbor("6449455446", [](Encoder & e) { e.putString("IETF"); });
+    checkCbor("62225c", [](Encoder & e) { e.putString("\"\\"); });
+    checkCbor("62c3bc", [](Encoder & e) { e.putString("\xc3\xbc"); });
+    checkCbor("64f0908591", [](Encoder & e) { e.putString("\xf0\x90\x85\x91"); });
+}
+
+void testCborContainers ()
+{
+    checkCbor("80", [](Encoder & e) { e.beginArray(0); e.endArray(); });
+    checkCbor("83010203", [](Encoder & e)
+    {
+        e.beginArray(3);
+        e.putUInt(1);
+        e.putUInt(2);
+        e.putUInt(3);
+        e.endArray();
+    });
+    checkCbor("8301820203820405", [](Encoder & e)
+    {
+        e.beginArray(3);
+        e.putUInt(1);
+        e.beginArray(2); e.putUInt(2); e.putUInt(3); e.endArray();
+        e.beginArray(2); e.putUInt(4); e.putUInt(5); e.endArray();
+        e.endArray();
+    });
+    checkCbor("98190102030405060708090a0b0c0d0e0f101112131415161718181819", [](Encoder & e)
+    {
+        e.beginArray(25);
+        for (uint32_t i = 1; i <= 25; ++i)
+        {
+            e.putUInt(i);
+        }
+        e.endArray();
+    });
+    checkCbor("a0", [](Encoder & e) { e.beginMap(0); e.endMap(); });
+    checkCbor("a201020304", [](Encoder & e)
+    {
+        e.beginMap(2);
+        e.putKey(1, "one");
+        e.putUInt(2);
+        e.putKey(3, "three");
+        e.putUInt(4);
+        e.endMap();
+    });
+    checkCbor("a26161016162820203", [](Encoder & e)
+    {
+        e.beginMap(2);
+        e.putString("a");
+        e.putUInt(1);
+        e.putString("b");
+        e.beginArray(2); e.putUInt(2); e.putUInt(3); e.endArray();
+        e.endMap();
+    });
+    checkCbor("826161a161626163", [](Encoder & e)
+    {
+        e.beginArray(2);
+        e.putString("a");
+        e.beginMap(1); e.putString("b"); e.putString("c"); e.endMap();
+        e.endArray();
+    });
+}
+
+void testCborIndefinite ()
+{
+    checkCbor("9fff", [](Encoder & e) { e.beginArray(Encoder::UNKNOWN_COUNT); e.endArray(); });
+    checkCbor("9f018202039f0405ffff", [](Encoder & e)
+    {
+        e.beginArray(Encoder::UNKNOWN_COUNT);
+        e.putUInt(1);
+        e.beginArray(2); e.putUInt(2); e.putUInt(3); e.endArray();
+        e.beginArray(Encoder::UNKNOWN_COUNT); e.putUInt(4); e.putUInt(5); e.endArray();
+        e.endArray();
+    });
+    checkCbor("9f01820203820405ff", [](Encoder & e)
+    {
+        e.beginArray(Encoder::UNKNOWN_COUNT);
+        e.putUInt(1);
+        e.beginArray(2); e.putUInt(2); e.putUInt(3); e.endArray();
+        e.beginArray(2); e.putUInt(4); e.putUInt(5); e.endArray();
+        e.endArray();
+    });
+    checkCbor("83018202039f0405ff", [](Encoder & e)
+    {
+        e.beginArray(3);
+        e.putUInt(1);
+        e.beginArray(2); e.putUInt(2); e.putUInt(3); e.endArray();
+        e.beginArray(Encoder::UNKNOWN_COUNT); e.putUInt(4); e.putUInt(5); e.endArray();
+        e.endArray();
+    });
+    checkCbor("bf61610161629f0203ffff", [](Encoder & e)
+    {
+        e.beginMap(Encoder::UNKNOWN_COUNT);
+        e.putString("a");
+        e.putUInt(1);
+        e.putString("b");
+        e.beginArray(Encoder::UNKNOWN_COUNT); e.putUInt(2); e.putUInt(3); e.endArray();
+        e.endMap();
+    });
+    checkCbor("826161bf61626163ff", [](Encoder & e)
+    {
+        e.beginArray(2);
+        e.putString("a");
+        e.beginMap(Encoder::UNKNOWN_COUNT); e.putString("b"); e.putString("c"); e.endMap();
+        e.endArray();
+    });
+    checkCbor("bf6346756ef563416d7421ff", [](Encoder & e)
+    {
+        e.beginMap(Encoder::UNKNOWN_COUNT);
+        e.putString("Fun");
+        e.putBool(true);
+        e.putString("Amt");
+        e.putInt(-2);
+        e.endMap();
+    });
+
+    // the definite and indefinite levels are tracked separately, deeper than a single bit
+    checkCbor("9f819f81a0ffff", [](Encoder & e)
+    {
+        e.beginArray(Encoder::UNKNOWN_COUNT);
+        e.beginArray(1);
+        e.beginArray(Encoder::UNKNOWN_COUNT);
+        e.beginArray(1);
+        e.beginMap(0);
+        e.endMap();
+        e.endArray();
+        e.endArray();
+        e.endArray();
+        e.endArray();
+    });
+
+    // an embedded item is copied as it is
+    checkCbor("a1036449455446", [](Encoder & e)
+    {
+        const uint8_t item[] = { 0x64, 'I', 'E', 'T', 'F' };
+        e.beginMap(1);
+        e.putKey(3, "ietf");
+        e.putRaw(item, sizeof(item));
+        e.endMap();
+    });
+}
+
+void testJsonStructure ()
+{
+    checkJson("{}", [](Encoder & e) { e.beginMap(0); e.endMap(); });
+    checkJson("[]", [](Encoder & e) { e.beginArray(Encoder::UNKNOWN_COUNT); e.endArray(); });
+    checkJson("[1,-2,true,false]", [](Encoder & e)
+    {
+        e.beginArray(4);
+        e.putUInt(1);
+        e.putInt(-2);
+        e.putBool(true);
+        e.putBool(false);
+        e.endArray();
+    });
+    checkJson("{\"a\":1,\"b\":[2,3,{\"c\":true}],\"d\":{},\"e\":[[],[4],[[5]]],\"f\":\"x\"}", [](Encoder & e)
+    {
+        e.beginMap(5);
+        e.putKey(0, "a");
+        e.putUInt(1);
+        e.putKey(1, "b");
+        e.beginArray(3);
+        e.putUInt(2);
+        e.putUInt(3);
+        e.beginMap(1); e.putKey(0, "c"); e.putBool(true); e.endMap();
+        e.endArray();
+        e.putKey(2, "d");
+        e.beginMap(0);
+        e.endMap();
+        e.putKey(3, "e");
+        e.beginArray(3);
+        e.beginArray(0); e.endArray();
+        e.beginArray(1); e.putUInt(4); e.endArray();
+        e.beginArray(1); e.beginArray(1); e.putUInt(5); e.endArray(); e.endArray();
+        e.endArray();
+        e.putKey(4, "f");
+        e.putString("x");
+        e.endMap();
+    });
+    checkJson("[0,4294967295,-2147483648,2147483647,1363896240,{\"raw\":[1,2]},{\"n\":null}]", [](Encoder & e)
+    {
+        e.beginArray(7);
+        e.putUInt(0);
+        e.putUInt(4294967295UL);
+        e.putInt(INT32_MIN);
+        e.putInt(INT32_MAX);
+        e.putTimestamp(1363896240);
+        e.beginMap(1); e.putKey(0, "raw"); e.putRaw("[1,2]", 5); e.endMap();
+        e.putRaw("{\"n\":null}", 10);
+        e.endArray();
+    });
+}
+
+void testJsonEscaping ()
+{
+    checkJson("\"\"", [](Encoder & e) { e.putString(""); });
+    checkJson("\"say \\\"hi\\\"\"", [](Encoder & e) { e.putString("say \"hi\""); });
+    checkJson("\"C:\\\\dir\\\\\"", [](Encoder & e) { e.putString("C:\\dir\\"); });
+    checkJson("\"\\u0000\\u0001\\u0009\\u000a\\u000d\\u001f \x7f\"", [](Encoder & e)
+    {
+        e.putString("\x00\x01\t\n\r\x1f \x7f", 8);
+    });
+    checkJson("\"\x7f\"", [](Encoder & e) { e.putString("\x7f"); });
+    checkJson("\"\xc3\xbc\xf0\x90\x85\x91\"", [](Encoder & e) { e.putString("\xc3\xbc\xf0\x90\x85\x91"); });
+    checkJson("{\"a\\\"b\":\"\\\\\\\"\"}", [](Encoder & e)
+    {
+        e.beginMap(1);
+        e.putKey(0, "a\"b");
+        e.putString("\\\"");
+        e.endMap();
+    });
+}
+
+void testWriterOverflow ()
+{
+    uint8_t data[8];
+    ::memset(data, 0xAA, sizeof(data));
+    BufferWriter w(data, 4);
+    w.write("abc", 3);
+    CHECK(!w.isOverflow());
+    w.put('d');
+    CHECK(!w.isOverflow());
+    CHECK_EQUAL(4, w.getSize());
+
+    // the bytes beyond the capacity are discarded, the buffer behind is not touched
+    w.put('e');
+    w.write("fg", 2);
+    w.writeDecimal(12345);
+    CHECK(w.isOverflow());
+    CHECK_EQUAL(4, w.getSize());
+    CHECK(::memcmp(data, "abcd", 4) == 0);
+    CHECK_EQUAL(0xAA, data[4]);
+
+    // a partial write fills the rest
+    w.reset();
+    CHECK(!w.isOverflow());
+    w.write("xy", 2);
+    w.write("123", 3);
+    CHECK(w.isOverflow());
+    CHECK_EQUAL(4, w.getSize());
+    CHECK(::memcmp(data, "xy12", 4) == 0);
+
+    // the terminating zero needs a byte of its own
+    w.reset();
+    w.write("xyz", 3);
+    w.terminate();
+    CHECK(!w.isOverflow());
+    CHECK(::strcmp((const char *)data, "xyz") == 0);
+    w.put('w');
+    w.terminate();
+    CHECK(w.isOverflow());
+    CHECK(::strcmp((const char *)data, "xyz") == 0);
+    CHECK_EQUAL(0xAA, data[4]);
+
+    // the encoders report the overflow at the end and keep the buffer bounds
+    ::memset(buffer, 0xAA, sizeof(buffer));
+    CborEncoder c(buffer, 5);
+    c.beginMap(1);
+    c.putKey(1, "text");
+    c.putString("IETF");
+    c.endMap();
+    CHECK(c.isOverflow());
+    CHECK_EQUAL(5, c.getSize());
+    CHECK(toHex(buffer, 6) == "a101644945aa");
+    c.reset();
+    c.putUInt(65536);
+    CHECK(c.isOverflow() == false && c.getSize() == 5);
+
+    JsonEncoder j(buffer, 8);
+    j.beginMap(1);
+    j.putKey(0, "key");
+    j.putString("value");
+    j.endMap();
+    CHECK(j.isOverflow());
+    CHECK(::strcmp(j.getString(), "{\"key\":") == 0);
+    CHECK_EQUAL(0xAA, buffer[8]);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    RUN_TEST(testCborIntegers);
+    RUN_TEST(testCborSimpleAndTagged);
+    RUN_TEST(testCborContainers);
+    RUN_TEST(testCborIndefinite);
+    RUN_TEST(testJsonStructure);
+    RUN_TEST(testJsonEscaping);
+    RUN_TEST(testWriterOverflow);
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * SoeRecorder: the order of the events of the EXTI and the polled inputs, the consumer cursors
+ * over an overwritten journal, and a reader that runs concurrently with the interrupts.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "StmPlusPlus/SoeRecorder.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+
+namespace
+{
+
+const uint32_t US = 168; // counts per microsecond
+
+InterruptPriority prio(1, 1);
+SoeRecorder::Journal journal;
+
+/**
+ * @brief Plays the EXTI interrupt: the given pin of the port A changes to the given level.
+ */
+void edge (uint32_t pin, bool level, uint32_t timestamp)
+{
+    if (level)
+    {
+        GPIOA->IDR |= pin;
+    }
+    else
+    {
+        GPIOA->IDR &= ~pin;
+    }
+    DWT->CYCCNT = timestamp;
+    EXTI->PR |= pin;
+    IOPin::processExtiInterrupt(pin);
+    EXTI->PR = 0;
+}
+
+/**
+ * @brief Reads all events starting from the given sequence number and checks the order: the
+ *        sequence numbers are contiguous and the time stamps do not decrease.
+ */
+std::vector<SoeRecorder::Event> readAll (const SoeRecorder & recorder, uint32_t & seq)
+{
+    std::vector<SoeRecorder::Event> all;
+    SoeRecorder::Event events[10];
+    size_t n;
+    while ((n = recorder.read(seq, events, 10)) > 0)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!all.empty())
+            {
+                CHECK_EQUAL(all.back().seq + 1, events[i].seq);
+                CHECK(all.back().time <= events[i].time);
+            }
+            all.push_back(events[i]);
+        }
+    }
+    return all;
+}
+
+void testOrderOfExtiAndPolledEdges ()
+{
+    // PA4 and PA5 use EXTI, PC4 is polled
+    std::vector<IOPin> pins = {
+        IOPin(IOPort::A, GPIO_PIN_4, GPIO_MODE_INPUT, GPIO_PULLUP),
+        IOPin(IOPort::A, GPIO_PIN_5, GPIO_MODE_INPUT, GPIO_PULLUP),
+        IOPin(IOPort::C, GPIO_PIN_4, GPIO_MODE_INPUT, GPIO_PULLUP)
+    };
+    InputBank bank;
+    for (auto & p : pins)
+    {
+        CHECK(bank.addPin(p.getPort(), p.getPins()));
+        bank.addInterrupt(p, prio);
+    }
+    CHECK_EQUAL(0x03, bank.getExtiMask());
+    GPIOA->IDR = GPIO_PIN_4 | GPIO_PIN_5;
+    GPIOC->IDR = GPIO_PIN_4;
+
+    SoeRecorder recorder(bank, journal);
+    DWT->CYCCNT = 1000;
+    recorder.start(bank.getMask(), bank.read());
+    CHECK_EQUAL(0, recorder.getLastSeq());
+
+    // the EXTI edges are recorded in the interrupt with their own time stamps
+    edge(GPIO_PIN_4, false, 1000 + 10 * US);
+    edge(GPIO_PIN_5, false, 1000 + 20 * US);
+    // the polled pin changed before the second EXTI edge, but is seen by the next sample: its time
+    // stamp is the sampling time
+    GPIOC->IDR = 0;
+    recorder.sample(bank.read(), 1000 + 1000 * US);
+    // the EXTI time stamp was taken before the sample, but the EXTI handler runs after it: the
+    // journal stays monotonic
+    edge(GPIO_PIN_4, true, 1000 + 990 * US);
+    // an unchanged sample records nothing
+    recorder.sample(bank.read(), 1000 + 2000 * US);
+    CHECK_EQUAL(4, recorder.getLastSeq());
+
+    uint32_t seq = 1;
+    auto events = readAll(recorder, seq);
+    CHECK_EQUAL(4, events.size());
+    CHECK_EQUAL(5, seq);
+    const size_t inputs[] = { 0, 1, 2, 0 };
+    const bool levels[] = { false, false, false, true };
+    const uint64_t times[] = { 10, 20, 1000, 1000 };
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        CHECK_EQUAL(i + 1, events[i].seq);
+        CHECK_EQUAL(inputs[i], events[i].input);
+        CHECK_EQUAL(levels[i], events[i].level);
+        CHECK_EQUAL(times[i], events[i].time);
+    }
+
+    // the time base is extended over the wrap of the 32-bit cycle counter
+    uint32_t t = 1000 + 2000 * US;
+    for (int i = 0; i < 40; ++i)
+    {
+        t += 0x10000000U;
+        recorder.sample(bank.read(), t);
+    }
+    edge(GPIO_PIN_5, true, t + US);
+    events = readAll(recorder, seq);
+    CHECK_EQUAL(1, events.size());
+    CHECK_EQUAL(5, events[0].seq);
+    CHECK_EQUAL(SoeRecorder::toMicros(40ULL * 0x10000000U + 2001 * US), events[0].time);
+
+    recorder.stop();
+    edge(GPIO_PIN_4, false, t + 2 * US);
+    CHECK_EQUAL(5, recorder.getLastSeq());
+    for (auto & p : pins)
+    {
+        p.disableExti();
+    }
+}
+
+void testConsumersOfOverwrittenJournal ()
+{
+    IOPin pin(IOPort::C, GPIO_PIN_4, GPIO_MODE_INPUT, GPIO_PULLUP);
+    InputBank bank;
+    CHECK(bank.addPin(GPIOC, GPIO_PIN_4));
+    SoeRecorder recorder(bank, journal);
+    recorder.start(bank.getMask(), 0);
+
+    // the report consumer keeps up, the spill consumer lags behind
+    uint32_t reportSeq = 1, spillSeq = 1;
+    uint32_t t = DWT->CYCCNT;
+    for (size_t i = 1; i <= SoeRecorder::JOURNAL_SIZE / 2; ++i)
+    {
+        recorder.sample(i % 2, t += US);
+    }
+    auto reported = readAll(recorder, reportSeq);
+    CHECK_EQUAL(SoeRecorder::JOURNAL_SIZE / 2, reported.size());
+    for (size_t i = 1; i <= SoeRecorder::JOURNAL_SIZE; ++i)
+    {
+        recorder.sample((SoeRecorder::JOURNAL_SIZE / 2 + i) % 2, t += US);
+    }
+    reported = readAll(recorder, reportSeq);
+    CHECK_EQUAL(SoeRecorder::JOURNAL_SIZE, reported.size());
+    CHECK_EQUAL(SoeRecorder::JOURNAL_SIZE / 2 + 1, reported.front().seq);
+
+    // the overwritten events are seen as a gap: the copy starts with the oldest available one
+    auto spilled = readAll(recorder, spillSeq);
+    CHECK_EQUAL(SoeRecorder::JOURNAL_SIZE, spilled.size());
+    CHECK_EQUAL(SoeRecorder::JOURNAL_SIZE / 2 + 1, spilled.front().seq);
+    CHECK_EQUAL(reportSeq, spillSeq);
+    for (size_t i = 0; i < spilled.size(); ++i)
+    {
+        CHECK_EQUAL(reported[i].seq, spilled[i].seq);
+        CHECK_EQUAL(spilled[i].seq % 2, spilled[i].level);
+    }
+    recorder.stop();
+}
+
+void testConcurrentReader ()
+{
+    const uint32_t EVENTS = 200000;
+    IOPort port(IOPort::C, GPIO_MODE_INPUT, GPIO_PULLUP, GPIO_SPEED_LOW, 0xFF);
+    InputBank bank;
+    CHECK(bank.addPins(port));
+    SoeRecorder recorder(bank, journal);
+    DWT->CYCCNT = 0;
+    recorder.start(bank.getMask(), 0);
+
+    // the timer interrupt toggles one input per sample: the input and the level of an event
+    // follow from its sequence number, so a torn copy would be detected
+    std::atomic<bool> producing(true);
+    std::thread timer([&]()
+    {
+        InputBank::Bits levels = 0;
+        uint32_t t = 0;
+        for (uint32_t seq = 1; seq <= EVENTS; ++seq)
+        {
+            levels ^= (InputBank::Bits)1 << (seq % 8);
+            HostIrq_enter();
+            recorder.sample(levels, t += US);
+            HostIrq_leave();
+        }
+        producing = false;
+    });
+
+    uint32_t seq = 1, lastSeq = 0, read = 0;
+    uint64_t lastTime = 0;
+    SoeRecorder::Event events[16];
+    bool done = false;
+    while (!done)
+    {
+        done = !producing;
+        size_t n;
+        while ((n = recorder.read(seq, events, 16)) > 0)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                const SoeRecorder::Event & e = events[i];
+                CHECK(e.seq > lastSeq);
+                CHECK(e.time >= lastTime);
+                CHECK_EQUAL(e.seq % 8, e.input);
+                // the event is the toggle number (seq + 7) / 8 of its input: odd toggles set it
+                CHECK_EQUAL(((e.seq + 7) / 8) % 2 == 1, e.level);
+                CHECK_EQUAL(e.seq, e.time);
+                lastSeq = e.seq;
+                lastTime = e.time;
+                ++read;
+            }
+        }
+    }
+    timer.join();
+    CHECK_EQUAL(EVENTS, lastSeq);
+    CHECK(read > 0 && read <= EVENTS);
+    recorder.stop();
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    CycleCounter::start();
+    RUN_TEST(testOrderOfExtiAndPolledEdges);
+    RUN_TEST(testConsumersOfOverwrittenJournal);
+    RUN_TEST(testConcurrentReader);
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Spi: the transaction queue against a fake SPI HAL, in the blocking mode and in the DMA mode
+ * where the test plays the completion interrupt.
+ */
+
+#include <vector>
+
+#include "StmPlusPlus/StmPlusPlus.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+
+namespace
+{
+
+const uint32_t CR1_MODE = SPI_CR1_CPOL | SPI_CR1_CPHA | SPI_CR1_BR;
+
+/**
+ * @brief A transfer seen on the bus: the clock mode, the chip select pins driven low and the
+ *        transmitted bytes. The device answers with the inverted bytes.
+ */
+class BusTransfer
+{
+public:
+
+    uint32_t mode;
+    uint32_t csLow;
+    bool dma;
+    std::vector<uint8_t> tx;
+};
+
+std::vector<BusTransfer> bus;
+HAL_StatusTypeDef nextStatus = HAL_OK;
+
+HAL_StatusTypeDef transfer (SPI_HandleTypeDef * hspi, uint8_t * txData, uint8_t * rxData, uint16_t size, bool dma)
+{
+    HAL_StatusTypeDef status = nextStatus;
+    nextStatus = HAL_OK;
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    BusTransfer t;
+    t.mode = hspi->Instance->CR1 & CR1_MODE;
+    t.csLow = ~GPIOB->ODR & (GPIO_PIN_8 | GPIO_PIN_9);
+    t.dma = dma;
+    for (uint16_t i = 0; i < size; ++i)
+    {
+        t.tx.push_back((txData != NULL)? txData[i] : 0xFF);
+        if (rxData != NULL)
+        {
+            rxData[i] = (uint8_t)~t.tx.back();
+        }
+    }
+    bus.push_back(t);
+    return HAL_OK;
+}
+
+class Recorder : public Spi::Transaction::EventHandler
+{
+public:
+
+    std::vector<Spi::Transaction *> finished;
+    std::vector<uint32_t> csLow; // chip select pins driven low when the handler is called
+    Spi::Transaction * followUp = NULL;
+    Spi * spi = NULL;
+
+    virtual void onSpiTransaction (Spi::Transaction & t)
+    {
+        finished.push_back(&t);
+        csLow.push_back(~GPIOB->ODR & (GPIO_PIN_8 | GPIO_PIN_9));
+        if (followUp != NULL)
+        {
+            Spi::Transaction * f = followUp;
+            followUp = NULL;
+            spi->enqueue(*f);
+        }
+    }
+};
+
+IOPin cs1(IOPort::B, GPIO_PIN_8, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, true, true);
+IOPin cs2(IOPort::B, GPIO_PIN_9, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, true, true);
+InterruptPriority prio(1, 0);
+
+void prepare (Spi::Transaction & t, IOPin * cs, uint32_t polarity, uint32_t phase, uint32_t prescaler,
+              const uint8_t * txData, uint8_t * rxData, uint16_t size, Recorder & recorder)
+{
+    t.cs = cs;
+    t.polarity = polarity;
+    t.phase = phase;
+    t.prescaler = prescaler;
+    t.txData = txData;
+    t.rxData = rxData;
+    t.size = size;
+    t.handler = &recorder;
+}
+
+/**
+ * @brief Plays the DMA completion interrupt routed to Spi::processCallback().
+ */
+void complete (Spi & spi, HAL_StatusTypeDef status)
+{
+    HostIrq_enter();
+    spi.processCallback(status);
+    HostIrq_leave();
+}
+
+void testBlockingQueue ()
+{
+    bus.clear();
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    CHECK_EQUAL(HAL_OK, spi.start(SPI_DIRECTION_2LINES, SPI_BAUDRATEPRESCALER_4, SPI_DATASIZE_8BIT,
+                                  SPI_PHASE_1EDGE, SPI_POLARITY_LOW));
+    Recorder recorder;
+    const uint8_t cmd[] = { 0x9F, 0x00, 0x00 };
+    uint8_t answer[3] = { 0 };
+    Spi::Transaction t1, t2;
+    prepare(t1, &cs1, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_4, cmd, answer, 3, recorder);
+    prepare(t2, &cs2, SPI_POLARITY_HIGH, SPI_PHASE_2EDGE, SPI_BAUDRATEPRESCALER_16, cmd, NULL, 1, recorder);
+
+    // without DMA, each transaction is finished before enqueue() returns
+    spi.enqueue(t1);
+    CHECK(t1.isFinished());
+    CHECK_EQUAL(HAL_OK, t1.status);
+    CHECK_EQUAL(0x60, answer[0]);
+    CHECK_EQUAL(0xFF, answer[2]);
+    spi.enqueue(t2);
+    CHECK(t2.isFinished());
+    CHECK(spi.isQueueEmpty());
+
+    CHECK_EQUAL(2, bus.size());
+    CHECK_EQUAL(GPIO_PIN_8, bus[0].csLow);
+    CHECK_EQUAL(SPI_POLARITY_LOW | SPI_PHASE_1EDGE | SPI_BAUDRATEPRESCALER_4, bus[0].mode);
+    CHECK_EQUAL(GPIO_PIN_9, bus[1].csLow);
+    CHECK_EQUAL(SPI_POLARITY_HIGH | SPI_PHASE_2EDGE | SPI_BAUDRATEPRESCALER_16, bus[1].mode);
+    CHECK(!bus[0].dma && !bus[1].dma);
+    CHECK_EQUAL(2, recorder.finished.size());
+    CHECK_EQUAL(0, recorder.csLow[0]);
+    CHECK_EQUAL(0, recorder.csLow[1]);
+    spi.stop();
+}
+
+void testDmaQueue ()
+{
+    bus.clear();
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    CHECK_EQUAL(HAL_OK, spi.start(SPI_DIRECTION_2LINES, SPI_BAUDRATEPRESCALER_4, SPI_DATASIZE_8BIT,
+                                  SPI_PHASE_1EDGE, SPI_POLARITY_LOW));
+    CHECK_EQUAL(HAL_OK, spi.startDma(prio));
+    Recorder recorder;
+    recorder.spi = &spi;
+    const uint8_t data[] = { 1, 2, 3, 4 };
+    uint8_t rx[4] = { 0 };
+    Spi::Transaction a, b, c, d;
+    prepare(a, &cs1, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_4, data, rx, 4, recorder);
+    prepare(b, &cs2, SPI_POLARITY_HIGH, SPI_PHASE_2EDGE, SPI_BAUDRATEPRESCALER_8, data, NULL, 2, recorder);
+    prepare(c, &cs1, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_4, NULL, rx, 4, recorder);
+    prepare(d, &cs2, SPI_POLARITY_HIGH, SPI_PHASE_2EDGE, SPI_BAUDRATEPRESCALER_8, data + 2, NULL, 2, recorder);
+
+    // the first transaction starts at once, the others wait for the completion interrupts
+    spi.enqueue(a);
+    spi.enqueue(b);
+    spi.enqueue(c);
+    CHECK_EQUAL(1, bus.size());
+    CHECK(bus[0].dma);
+    CHECK_EQUAL(GPIO_PIN_8, bus[0].csLow);
+    CHECK(!a.isFinished() && !b.isFinished() && !c.isFinished());
+    CHECK(!spi.isQueueEmpty());
+
+    // the handler of b enqueues d: it is appended after c
+    recorder.followUp = &d;
+    complete(spi, HAL_OK);
+    CHECK(a.isFinished());
+    CHECK_EQUAL(0xFE, rx[0]);
+    CHECK_EQUAL(2, bus.size());
+    CHECK_EQUAL(GPIO_PIN_9, bus[1].csLow);
+    CHECK_EQUAL(SPI_POLARITY_HIGH | SPI_PHASE_2EDGE | SPI_BAUDRATEPRESCALER_8, bus[1].mode);
+    complete(spi, HAL_OK);
+    complete(spi, HAL_OK);
+    complete(spi, HAL_OK);
+    CHECK(spi.isQueueEmpty());
+    CHECK_EQUAL(4, bus.size());
+    CHECK_EQUAL(SPI_POLARITY_LOW | SPI_PHASE_1EDGE | SPI_BAUDRATEPRESCALER_4, bus[2].mode);
+    CHECK_EQUAL(GPIO_PIN_8, bus[2].csLow);
+    CHECK_EQUAL(GPIO_PIN_9, bus[3].csLow);
+    CHECK_EQUAL(3, bus[3].tx[0]);
+
+    const Spi::Transaction * order[] = { &a, &b, &c, &d };
+    CHECK_EQUAL(4, recorder.finished.size());
+    for (size_t i = 0; i < 4; ++i)
+    {
+        CHECK(recorder.finished[i] == order[i]);
+        CHECK_EQUAL(HAL_OK, recorder.finished[i]->status);
+        // the chip select is released before the handler is called
+        CHECK_EQUAL(0, recorder.csLow[i]);
+    }
+    // a spurious callback of an idle bus is ignored
+    complete(spi, HAL_OK);
+    CHECK_EQUAL(4, recorder.finished.size());
+    spi.stopDma();
+    spi.stop();
+}
+
+void testErrors ()
+{
+    bus.clear();
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    CHECK_EQUAL(HAL_OK, spi.start(SPI_DIRECTION_2LINES, SPI_BAUDRATEPRESCALER_4, SPI_DATASIZE_8BIT,
+                                  SPI_PHASE_1EDGE, SPI_POLARITY_LOW));
+    CHECK_EQUAL(HAL_OK, spi.startDma(prio));
+    Recorder recorder;
+    const uint8_t data[] = { 1, 2 };
+    Spi::Transaction a, b, c;
+    prepare(a, &cs1, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_4, data, NULL, 2, recorder);
+    prepare(b, &cs2, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_4, data, NULL, 2, recorder);
+    prepare(c, &cs1, SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BAUDRATEPRESCALER_4, data, NULL, 2, recorder);
+
+    // a transfer that can not be started fails at once and the next one is started
+    nextStatus = HAL_BUSY;
+    spi.enqueue(a);
+    spi.enqueue(b);
+    CHECK(a.isFinished());
+    CHECK_EQUAL(HAL_ERROR, a.status);
+    CHECK_EQUAL(0, recorder.csLow[0]);
+    CHECK_EQUAL(1, bus.size());
+    CHECK_EQUAL(GPIO_PIN_9, bus[0].csLow);
+
+    // an error reported by the interrupt fails the running transfer only
+    spi.enqueue(c);
+    complete(spi, HAL_ERROR);
+    CHECK_EQUAL(HAL_ERROR, b.status);
+    CHECK_EQUAL(2, bus.size());
+    complete(spi, HAL_OK);
+    CHECK_EQUAL(HAL_OK, c.status);
+    CHECK(spi.isQueueEmpty());
+    CHECK_EQUAL(3, recorder.finished.size());
+    spi.stopDma();
+    spi.stop();
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Fake SPI HAL: replaces the weak stubs
+ ************************************************************************/
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Init (SPI_HandleTypeDef * hspi)
+{
+    hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.Direction | hspi->Init.DataSize | hspi->Init.CLKPolarity
+                          | hspi->Init.CLKPhase | (hspi->Init.NSS & SPI_CR1_SSM) | hspi->Init.BaudRatePrescaler
+                          | hspi->Init.FirstBit;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_TransmitReceive (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData,
+                                                      uint16_t Size, uint32_t)
+{
+    return transfer(hspi, pTxData, pRxData, Size, false);
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Transmit (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size, uint32_t)
+{
+    return transfer(hspi, pData, NULL, Size, false);
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Receive (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size, uint32_t)
+{
+    return transfer(hspi, NULL, pData, Size, false);
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA (SPI_HandleTypeDef * hspi, uint8_t * pTxData,
+                                                          uint8_t * pRxData, uint16_t Size)
+{
+    return transfer(hspi, pTxData, pRxData, Size, true);
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Transmit_DMA (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size)
+{
+    return transfer(hspi, pData, NULL, Size, true);
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Receive_DMA (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size)
+{
+    return transfer(hspi, NULL, pData, Size, true);
+}
+
+int main ()
+{
+    RUN_TEST(testBlockingQueue);
+    RUN_TEST(testDmaQueue);
+    RUN_TEST(testErrors);
+    return 0;
+}
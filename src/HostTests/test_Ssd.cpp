@@ -0,0 +1,423 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Ssd and SsdDisplay: the digits latched by a chain of 74HC595 shift registers, tick by tick, for
+ * the PWM brightness, the blinking digits and the forced resend of an unchanged frame.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "StmPlusPlus/Devices/Ssd.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+namespace
+{
+
+const size_t DIGITS = 4;
+
+/**
+ * @brief A chain of 74HC595: a shifted byte enters the register nearest to MOSI (the first digit)
+ *        and pushes the others towards the last digit. The outputs follow the shift registers
+ *        when the chip select rises, i.e. after a blocking transfer or at the DMA completion.
+ */
+class Hc595Chain
+{
+public:
+
+    uint8_t shift[DIGITS];
+    uint8_t latch[DIGITS];
+    size_t transfers = 0;
+
+    Hc595Chain ()
+    {
+        ::memset(shift, 0, sizeof(shift));
+        ::memset(latch, 0, sizeof(latch));
+    }
+
+    void shiftIn (const uint8_t * data, uint16_t size)
+    {
+        for (uint16_t i = 0; i < size; ++i)
+        {
+            ::memmove(shift + 1, shift, DIGITS - 1);
+            shift[0] = data[i];
+        }
+        ++transfers;
+    }
+
+    void latchOut ()
+    {
+        ::memcpy(latch, shift, DIGITS);
+    }
+};
+
+Hc595Chain chain;
+HAL_StatusTypeDef nextStatus = HAL_OK;
+bool dmaPending = false;
+
+IOPin pinCs(IOPort::B, GPIO_PIN_12, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, true, true);
+InterruptPriority prio(1, 0);
+
+HAL_StatusTypeDef transfer (uint8_t * txData, uint16_t size, bool dma)
+{
+    HAL_StatusTypeDef status = nextStatus;
+    nextStatus = HAL_OK;
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    CHECK((GPIOB->ODR & GPIO_PIN_12) == 0);
+    chain.shiftIn(txData, size);
+    if (!dma)
+    {
+        chain.latchOut();
+    }
+    dmaPending = dma;
+    return HAL_OK;
+}
+
+/**
+ * @brief Plays the DMA completion interrupt routed to Spi::processCallback().
+ */
+void complete (Spi & spi, HAL_StatusTypeDef status = HAL_OK)
+{
+    HostIrq_enter();
+    CHECK(dmaPending);
+    dmaPending = false;
+    chain.latchOut();
+    spi.processCallback(status);
+    HostIrq_leave();
+}
+
+/**
+ * @brief Plays the refresh timer interrupt.
+ */
+void tick (SsdDisplay & ssd)
+{
+    HostIrq_enter();
+    ssd.onTimerUpdate(NULL);
+    HostIrq_leave();
+}
+
+/**
+ * @brief The FONT code shown by a digit of the canonical wiring.
+ */
+uint8_t shown (size_t digit, bool inverse)
+{
+    return chain.latch[digit] ^ (inverse? 0xFF : 0x00);
+}
+
+void startSpi (Spi & spi)
+{
+    chain = Hc595Chain();
+    dmaPending = false;
+    CHECK_EQUAL(HAL_OK, spi.start(SPI_DIRECTION_2LINES, SPI_BAUDRATEPRESCALER_8, SPI_DATASIZE_8BIT,
+                                  SPI_PHASE_1EDGE, SPI_POLARITY_LOW));
+}
+
+void testFont ()
+{
+    Ssd ssd;
+    // the digits and the symbols of the former switch
+    const uint8_t digits[] = { 0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F };
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK_EQUAL(digits[i], (uint8_t)ssd.getBits(i, false));
+        CHECK_EQUAL(digits[i], (uint8_t)ssd.getBits('0' + i, false));
+        CHECK_EQUAL(digits[i] | Ssd::DOT, (uint8_t)ssd.getBits('0' + i, true));
+    }
+    CHECK_EQUAL(0x40, (uint8_t)ssd.getBits('-', false));
+    CHECK_EQUAL(0x80, (uint8_t)ssd.getBits('.', false));
+    CHECK_EQUAL(0x00, (uint8_t)ssd.getBits(' ', false));
+
+    // a reversed wiring: each FONT bit moves to the mirrored output
+    Ssd::SegmentsMask sm;
+    sm.top = 7;
+    sm.rightTop = 6;
+    sm.rightBottom = 5;
+    sm.bottom = 4;
+    sm.leftBottom = 3;
+    sm.leftTop = 2;
+    sm.center = 1;
+    sm.dot = 0;
+    ssd.setSegmentsMask(sm);
+    for (int c = 0; c < 128; ++c)
+    {
+        uint8_t font = Ssd::FONT[c], mirrored = 0;
+        for (int b = 0; b < 8; ++b)
+        {
+            mirrored |= ((font >> b) & 1) << (7 - b);
+        }
+        CHECK_EQUAL(mirrored, (uint8_t)ssd.getBits(c, false));
+    }
+    CHECK_EQUAL(0x01, (uint8_t)ssd.getBits('.', false));
+}
+
+/**
+ * @brief The refreshed chain shows the same bytes as the former Ssd_74HC595_SPI, for an inverse
+ *        display with a custom wiring.
+ */
+void testSameAsDirectDriver ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    startSpi(spi);
+    Ssd::SegmentsMask sm;
+    sm.top = 3;
+    sm.rightTop = 0;
+    sm.rightBottom = 6;
+    sm.bottom = 1;
+    sm.leftBottom = 7;
+    sm.leftTop = 2;
+    sm.center = 5;
+    sm.dot = 4;
+    const bool dots[DIGITS] = { false, true, false, true };
+
+    Ssd_74HC595_SPI direct(spi, pinCs, true);
+    direct.setSegmentsMask(sm);
+    direct.putString("12-A", dots, DIGITS);
+    CHECK_EQUAL(1, chain.transfers);
+    uint8_t expected[DIGITS];
+    ::memcpy(expected, chain.latch, DIGITS);
+
+    chain = Hc595Chain();
+    SsdDisplay ssd(spi, pinCs, DIGITS, true);
+    ssd.setSegmentsMask(sm);
+    ssd.setString("12-A", dots, DIGITS);
+    ssd.start(SPI_BAUDRATEPRESCALER_8, 0);
+    tick(ssd);
+    CHECK_EQUAL(1, chain.transfers);
+    CHECK(::memcmp(expected, chain.latch, DIGITS) == 0);
+
+    // digit 0 is the first character: its register is the nearest to MOSI
+    CHECK_EQUAL((uint8_t)~ssd.getBits('1', false), chain.latch[0]);
+    CHECK_EQUAL((uint8_t)~ssd.getBits('A', true), chain.latch[3]);
+    spi.stop();
+}
+
+/**
+ * @brief Every tick, a digit is lit if the PWM phase is below its brightness and it is not in the
+ *        blank half of the blink period. A transfer only happens when the latched bytes change.
+ */
+void testPwmAndBlink ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    startSpi(spi);
+    const uint32_t BLINK_TICKS = 16;
+    const uint8_t levels[DIGITS] = { SsdDisplay::BRIGHTNESS_LEVELS, 5, 1, 0 };
+    const bool blink[DIGITS] = { false, false, true, false };
+
+    SsdDisplay ssd(spi, pinCs, DIGITS, false);
+    CHECK_EQUAL(DIGITS, ssd.getDigits());
+    ssd.setString("8888", NULL, DIGITS);
+    ssd.setDot(0, true);
+    ssd.setDot(1, true);
+    for (size_t d = 0; d < DIGITS; ++d)
+    {
+        ssd.setBrightness(d, levels[d]);
+        ssd.setBlink(d, blink[d]);
+    }
+    ssd.start(SPI_BAUDRATEPRESCALER_8, BLINK_TICKS);
+    // the first frame is shifted at the first tick, before any resend
+    ssd.setResendTicks(0);
+
+    const uint8_t lit[DIGITS] = { 0x7F | Ssd::DOT, 0x7F | Ssd::DOT, 0x7F, 0x7F };
+    const uint32_t TICKS = 8 * BLINK_TICKS;
+    uint32_t litTicks[DIGITS] = { 0 }, changes = 0;
+    uint8_t previous[DIGITS];
+    ::memset(previous, 0xAA, sizeof(previous));
+    for (uint32_t t = 1; t <= TICKS; ++t)
+    {
+        tick(ssd);
+        uint32_t phase = t % SsdDisplay::BRIGHTNESS_LEVELS;
+        bool blankHalf = (t / BLINK_TICKS) % 2 == 1;
+        for (size_t d = 0; d < DIGITS; ++d)
+        {
+            bool on = phase < levels[d] && !(blink[d] && blankHalf);
+            CHECK_EQUAL(on? lit[d] : 0, shown(d, false));
+            litTicks[d] += on? 1 : 0;
+        }
+        changes += (::memcmp(previous, chain.latch, DIGITS) != 0)? 1 : 0;
+        ::memcpy(previous, chain.latch, DIGITS);
+    }
+    CHECK_EQUAL(changes, chain.transfers);
+    CHECK_EQUAL(changes, ssd.getTransfers());
+    CHECK_EQUAL(TICKS, litTicks[0]);
+    CHECK_EQUAL(TICKS * 5 / SsdDisplay::BRIGHTNESS_LEVELS, litTicks[1]);
+    CHECK_EQUAL(TICKS / SsdDisplay::BRIGHTNESS_LEVELS / 2, litTicks[2]);
+    CHECK_EQUAL(0, litTicks[3]);
+
+    // full brightness without blinking: only the first tick shifts a frame
+    ssd.setBrightness(SsdDisplay::BRIGHTNESS_LEVELS);
+    ssd.setBlink(2, false);
+    ssd.update();
+    const size_t before = chain.transfers;
+    for (uint32_t t = 0; t < TICKS; ++t)
+    {
+        tick(ssd);
+        CHECK_EQUAL(0x7F, shown(2, false));
+    }
+    CHECK_EQUAL(before + 1, chain.transfers);
+    CHECK_EQUAL(0, ssd.getOverruns());
+    spi.stop();
+}
+
+/**
+ * @brief A latch corrupted by a glitch is repaired within RESEND_TICKS, and at once after a
+ *        failed transfer. Without resend, it stays wrong.
+ */
+void testResend ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    startSpi(spi);
+    SsdDisplay ssd(spi, pinCs, DIGITS, true);
+    ssd.setString("1234", NULL, DIGITS);
+    ssd.start(SPI_BAUDRATEPRESCALER_8, 0);
+    uint8_t good[DIGITS];
+    tick(ssd);
+    ::memcpy(good, chain.latch, DIGITS);
+    CHECK_EQUAL(Ssd::FONT['1'], shown(0, true));
+
+    // the unchanged frame is shifted again every RESEND_TICKS ticks
+    const uint32_t TICKS = 3 * SsdDisplay::RESEND_TICKS;
+    uint32_t wrongTicks = 0, longestWrong = 0;
+    for (uint32_t t = 2; t <= TICKS; ++t)
+    {
+        if (t == SsdDisplay::RESEND_TICKS + SsdDisplay::RESEND_TICKS / 2)
+        {
+            chain.latch[2] ^= 0x41;
+        }
+        tick(ssd);
+        wrongTicks = (::memcmp(good, chain.latch, DIGITS) != 0)? wrongTicks + 1 : 0;
+        longestWrong = std::max(longestWrong, wrongTicks);
+    }
+    CHECK_EQUAL(3, chain.transfers);
+    CHECK_EQUAL(0, wrongTicks);
+    CHECK(longestWrong > 0 && longestWrong < SsdDisplay::RESEND_TICKS);
+
+    // a failed transfer is repeated at the next tick; the counter already exceeds the new period
+    ssd.setResendTicks(10);
+    tick(ssd);
+    CHECK_EQUAL(4, chain.transfers);
+    const size_t before = chain.transfers;
+    for (int t = 0; t < 9; ++t)
+    {
+        tick(ssd);
+    }
+    CHECK_EQUAL(before, chain.transfers);
+    nextStatus = HAL_ERROR;
+    tick(ssd);
+    CHECK_EQUAL(before, chain.transfers);
+    CHECK_EQUAL(5, ssd.getTransfers());
+    tick(ssd);
+    CHECK_EQUAL(before + 1, chain.transfers);
+
+    // without resend, the corrupted latch is never repaired
+    ssd.setResendTicks(0);
+    chain.latch[0] ^= 0x01;
+    for (uint32_t t = 0; t < TICKS; ++t)
+    {
+        tick(ssd);
+    }
+    CHECK_EQUAL(before + 1, chain.transfers);
+    CHECK(::memcmp(good, chain.latch, DIGITS) != 0);
+    spi.stop();
+}
+
+/**
+ * @brief In the DMA mode, a tick that finds the previous frame still in flight counts an overrun
+ *        and the frame follows at the next tick after the completion.
+ */
+void testDmaOverrun ()
+{
+    Spi spi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5);
+    startSpi(spi);
+    CHECK_EQUAL(HAL_OK, spi.startDma(prio));
+    SsdDisplay ssd(spi, pinCs, DIGITS, false);
+    ssd.setString("0000", NULL, DIGITS);
+    ssd.setBrightness(SsdDisplay::BRIGHTNESS_LEVELS / 2);
+    ssd.start(SPI_BAUDRATEPRESCALER_8, 0);
+
+    // ticks 1..3 are lit: the frame of tick 1 is latched at the completion
+    tick(ssd);
+    CHECK(dmaPending);
+    CHECK_EQUAL(0, shown(0, false));
+    complete(spi);
+    CHECK_EQUAL(Ssd::FONT['0'], shown(0, false));
+    tick(ssd);
+    tick(ssd);
+    CHECK(!dmaPending);
+
+    // tick 4 blanks the digits, tick 8 lights them while the blank frame is still in flight
+    for (int t = 4; t <= 7; ++t)
+    {
+        tick(ssd);
+    }
+    CHECK(dmaPending);
+    tick(ssd);
+    CHECK_EQUAL(1, ssd.getOverruns());
+    complete(spi);
+    CHECK_EQUAL(0, shown(0, false));
+    tick(ssd);
+    CHECK(dmaPending);
+    complete(spi);
+    CHECK_EQUAL(Ssd::FONT['0'], shown(0, false));
+    CHECK_EQUAL(3, ssd.getTransfers());
+    CHECK_EQUAL(3, chain.transfers);
+    spi.stopDma();
+    spi.stop();
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Fake SPI HAL: replaces the weak stubs
+ ************************************************************************/
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Init (SPI_HandleTypeDef * hspi)
+{
+    hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.Direction | hspi->Init.DataSize | hspi->Init.CLKPolarity
+                          | hspi->Init.CLKPhase | (hspi->Init.NSS & SPI_CR1_SSM) | hspi->Init.BaudRatePrescaler
+                          | hspi->Init.FirstBit;
+    return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Transmit (SPI_HandleTypeDef *, uint8_t * pData, uint16_t Size, uint32_t)
+{
+    return transfer(pData, Size, false);
+}
+
+extern "C" HAL_StatusTypeDef HAL_SPI_Transmit_DMA (SPI_HandleTypeDef *, uint8_t * pData, uint16_t Size)
+{
+    return transfer(pData, Size, true);
+}
+
+int main ()
+{
+    RUN_TEST(testFont);
+    RUN_TEST(testSameAsDirectDriver);
+    RUN_TEST(testPwmAndBlink);
+    RUN_TEST(testResend);
+    RUN_TEST(testDmaOverrun);
+    return 0;
+}
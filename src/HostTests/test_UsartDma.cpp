@@ -0,0 +1,141 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/**
+ * Usart: number of bytes received by the circular DMA, including a completely filled buffer
+ * and a buffer wrap whose interrupt is still pending.
+ */
+
+#include "StmPlusPlus/BasicIO.h"
+#include "TestUtils.h"
+
+using namespace StmPlusPlus;
+
+namespace
+{
+
+const size_t BUFFER_SIZE = 1024;
+
+char buffer[BUFFER_SIZE];
+Usart usart(Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3);
+InterruptPriority prio(5, 0);
+size_t dmaPos = 0;
+
+/**
+ * @brief Plays the DMA stream: writes the given number of bytes and raises the half and
+ *        complete transfer flags.
+ */
+void receive (size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        buffer[dmaPos++] = (char)i;
+        if (dmaPos == BUFFER_SIZE / 2)
+        {
+            DMA1->HISR |= DMA_FLAG_HTIF1_5;
+        }
+        if (dmaPos == BUFFER_SIZE)
+        {
+            dmaPos = 0;
+            DMA1->HISR |= DMA_FLAG_TCIF1_5;
+        }
+    }
+    DMA1_Stream5->NDTR = BUFFER_SIZE - dmaPos;
+}
+
+/**
+ * @brief Serves the pending DMA interrupt.
+ */
+void serveInterrupt ()
+{
+    usart.processDmaRxInterrupt();
+    // the flags are cleared by writing HIFCR, that is plain memory here
+    DMA1->HISR = 0;
+}
+
+void start ()
+{
+    dmaPos = 0;
+    DMA1->HISR = 0;
+    DMA1_Stream5->NDTR = BUFFER_SIZE;
+    usart.stopReceiveCircular();
+    CHECK_EQUAL(HAL_OK, usart.startReceiveCircular(buffer, BUFFER_SIZE, prio));
+    CHECK_EQUAL(0, usart.getReceivedBytes());
+}
+
+void testFullBuffer ()
+{
+    start();
+    receive(BUFFER_SIZE);
+    serveInterrupt();
+    // the write position is back at the start: the buffer is full, not empty
+    CHECK_EQUAL(0, usart.getReceivePosition());
+    CHECK_EQUAL(BUFFER_SIZE, usart.getReceivedBytes());
+}
+
+void testPendingInterrupt ()
+{
+    start();
+    receive(BUFFER_SIZE / 2 + 10);
+    CHECK_EQUAL(BUFFER_SIZE / 2 + 10, usart.getReceivedBytes());
+    serveInterrupt();
+    CHECK_EQUAL(BUFFER_SIZE / 2 + 10, usart.getReceivedBytes());
+
+    // the wrap is seen before its interrupt is served
+    receive(BUFFER_SIZE / 2);
+    CHECK_EQUAL(BUFFER_SIZE + 10, usart.getReceivedBytes());
+    serveInterrupt();
+    CHECK_EQUAL(BUFFER_SIZE + 10, usart.getReceivedBytes());
+}
+
+void testManyWraps ()
+{
+    start();
+    uint32_t expected = 0;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        size_t n = (i * 37) % (BUFFER_SIZE / 2);
+        receive(n);
+        expected += n;
+        CHECK_EQUAL(expected, usart.getReceivedBytes());
+        serveInterrupt();
+        CHECK_EQUAL(expected, usart.getReceivedBytes());
+    }
+}
+
+void testStopped ()
+{
+    start();
+    receive(10);
+    CHECK_EQUAL(10, usart.getReceivedBytes());
+    usart.stopReceiveCircular();
+    CHECK_EQUAL(0, usart.getReceivedBytes());
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    RUN_TEST(testFullBuffer);
+    RUN_TEST(testPendingInterrupt);
+    RUN_TEST(testManyWraps);
+    RUN_TEST(testStopped);
+    return 0;
+}
@@ -23,10 +23,19 @@ using namespace StmPlusPlus;
 
 #define USART_DEBUG_MODULE "Main: "
 
+// Define BENCHMARK_TOGGLE_RATE (e.g. -DBENCHMARK_TOGGLE_RATE) in order to compare the toggle
+// rate of IOPin and FastPin at start-up. The benchmark is not part of the normal firmware.
+
 class MyApplication : public Timer::EventHandler, RealTimeClock::EventHandler
 {
 private:
 
+#ifdef BENCHMARK_TOGGLE_RATE
+    // the same pin as led1, accessed without HAL
+    typedef FastPin<IOPort::B, 0> FastLed1;
+    static const uint32_t TOGGLE_COUNT = 1000;
+#endif
+
     UsartLogger log;
 
     RealTimeClock rtc;
@@ -79,6 +88,9 @@ public:
 
         USART_DEBUG("Oscillator frequency: " << System::getExternalOscillatorFreq()
                     << ", MCU frequency: " << System::getMcuFreq());
+#ifdef BENCHMARK_TOGGLE_RATE
+        measureToggleRate();
+#endif
 
         HAL_StatusTypeDef status = HAL_TIMEOUT;
 
@@ -95,6 +107,35 @@ public:
         }
     }
 
+#ifdef BENCHMARK_TOGGLE_RATE
+    /**
+     * @brief Compares the toggle rate of IOPin and FastPin using the CycleCounter.
+     */
+    void measureToggleRate ()
+    {
+        CycleCounter::start();
+
+        uint32_t start = CycleCounter::getValue();
+        for (uint32_t i = 0; i < TOGGLE_COUNT; ++i)
+        {
+            led1.toggle();
+        }
+        uint32_t pinCycles = CycleCounter::getValue() - start;
+
+        start = CycleCounter::getValue();
+        for (uint32_t i = 0; i < TOGGLE_COUNT; ++i)
+        {
+            FastLed1::toggle();
+        }
+        uint32_t fastCycles = CycleCounter::getValue() - start;
+
+        USART_DEBUG("Cycles per " << (int)TOGGLE_COUNT << " toggles: IOPin = " << pinCycles
+                    << ", FastPin = " << fastCycles);
+        USART_DEBUG("Toggle rate, kHz: IOPin = " << CycleCounter::getFrequency() / 1000 * TOGGLE_COUNT / pinCycles
+                    << ", FastPin = " << CycleCounter::getFrequency() / 1000 * TOGGLE_COUNT / fastCycles);
+    }
+#endif
+
     virtual void onTimerUpdate (const Timer *)
     {
         uint32_t sysTicks = HAL_GetTick() % 500;
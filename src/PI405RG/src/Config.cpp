@@ -31,7 +31,11 @@ using namespace StmPlusPlus;
 
 const char * CfgParameter::strings[] = { "BOARD_ID", "THIS_IP", "IP_MASK", "GATE_IP", "WLAN_NAME", "WLAN_PASS",
                                          "SERVER_IP", "SERVER_PORT", "REPEAT_DELAY", "TURN_OFF_DELAY", "NTP_SERVER",
-                                         "WAV_FILE", "INVALID_PARAMETER" };
+                                         "WAV_FILE", "LOG_FILE", "LOG_SIZE", "ESP_TRANSPARENT",
+                                         "ESP_BAUDRATE", "ESP_FLOW_CONTROL", "JOURNAL_FILE", "JOURNAL_SIZE",
+                                         "REPORT_FORMAT", "ESP_STANDBY", "REPORT_EDGES",
+                                         "SHIFT_INPUTS", "SHIFT_OUTPUTS", "SHIFT_FREQ",
+                                         "INVALID_PARAMETER" };
 
 ConvertClass<CfgParameter::Type, CfgParameter::size, CfgParameter::strings> CfgParameter::Convert;
 
@@ -41,12 +45,22 @@ AsStringClass<CfgParameter::Type, CfgParameter::size, CfgParameter::strings> Cfg
  * Class Config
  ************************************************************************/
 
-Config::Config (IOPin & _pinSdPower, Devices::SdCard & _sdCard, const char * _fileName) :
+Config::Config (StorageManager & _storage, const char * _fileName) :
         fileName{_fileName},
-        pinSdPower{_pinSdPower},
-        sdCard{_sdCard},
+        storage{_storage},
         repeatDelay{0},
-        turnOffDelay{0}
+        turnOffDelay{0},
+        logSize{0},
+        espTransparent{false},
+        espBaudRate{0},
+        espFlowControl{false},
+        journalSize{0},
+        reportFormat{StmPlusPlus::Encoder::Format::CBOR},
+        espStandby{0},
+        reportEdges{false},
+        shiftInputs{0},
+        shiftOutputs{0},
+        shiftFreq{0}
 {
     for (size_t i = 0; i < CfgParameter::size; ++i)
     {
@@ -58,11 +72,7 @@ bool Config::readConfiguration ()
 {
     USART_DEBUG("Reading configuration from file: " << fileName);
     
-    sdCard.clearPort();
-    pinSdPower.setLow();
-    HAL_Delay(250);
-    
-    if (sdCard.start(6) && sdCard.mountFatFs())
+    if (storage.acquire())
     {
         FRESULT res = readFile(fileName);
         if (res != FR_OK)
@@ -74,10 +84,8 @@ bool Config::readConfiguration ()
             USART_DEBUG("Configuration file successfully parsed:");
             dump();
         }
+        storage.release();
     }
-    
-    sdCard.stop();
-    pinSdPower.setHigh();
     return true;
 }
 
@@ -139,6 +147,40 @@ FRESULT Config::readFile (const char * fileName)
         case CfgParameter::TURN_OFF_DELAY:
             turnOffDelay = ::atoi(value);
             break;
+        case CfgParameter::LOG_SIZE:
+            logSize = ::atoi(value);
+            break;
+        case CfgParameter::ESP_TRANSPARENT:
+            espTransparent = (::atoi(value) != 0);
+            break;
+        case CfgParameter::ESP_BAUDRATE:
+            espBaudRate = ::atoi(value);
+            break;
+        case CfgParameter::ESP_FLOW_CONTROL:
+            espFlowControl = (::atoi(value) != 0);
+            break;
+        case CfgParameter::JOURNAL_SIZE:
+            journalSize = ::atoi(value);
+            break;
+        case CfgParameter::REPORT_FORMAT:
+            reportFormat = (::strcmp(value, "JSON") == 0)?
+                    StmPlusPlus::Encoder::Format::JSON : StmPlusPlus::Encoder::Format::CBOR;
+            break;
+        case CfgParameter::ESP_STANDBY:
+            espStandby = ::atoi(value);
+            break;
+        case CfgParameter::REPORT_EDGES:
+            reportEdges = (::atoi(value) != 0);
+            break;
+        case CfgParameter::SHIFT_INPUTS:
+            shiftInputs = ::atoi(value);
+            break;
+        case CfgParameter::SHIFT_OUTPUTS:
+            shiftOutputs = ::atoi(value);
+            break;
+        case CfgParameter::SHIFT_FREQ:
+            shiftFreq = ::atoi(value);
+            break;
         default:
             // nothing to do
             break;
@@ -23,7 +23,8 @@
 #include <cstring>
 #include <cstdlib>
 
-#include "StmPlusPlus/Devices/SdCard.h"
+#include "StmPlusPlus/StorageManager.h"
+#include "StmPlusPlus/Serializer.h"
 
 /**
  * @brief Template class providing operator () for converting a string argument
@@ -101,7 +102,20 @@ public:
         REPEAT_DELAY   = 8,
         TURN_OFF_DELAY = 9,
         NTP_SERVER     = 10,
-        WAV_FILE       = 11
+        WAV_FILE       = 11,
+        LOG_FILE       = 12,
+        LOG_SIZE       = 13,
+        ESP_TRANSPARENT = 14,
+        ESP_BAUDRATE   = 15,
+        ESP_FLOW_CONTROL = 16,
+        JOURNAL_FILE   = 17,
+        JOURNAL_SIZE   = 18,
+        REPORT_FORMAT  = 19,
+        ESP_STANDBY    = 20,
+        REPORT_EDGES   = 21,
+        SHIFT_INPUTS   = 22,
+        SHIFT_OUTPUTS  = 23,
+        SHIFT_FREQ     = 24
     };
 
     /**
@@ -109,7 +123,7 @@ public:
      */
     enum
     {
-        size = 12
+        size = 25
     };
 
     /**
@@ -138,8 +152,7 @@ public:
     static const char SEPARATOR = '=';
     static const size_t MAX_LINE_LENGTH = 32;
 
-    Config (StmPlusPlus::IOPin & _pinSdPower, StmPlusPlus::Devices::SdCard & _sdCard,
-            const char * _fileName);
+    Config (StmPlusPlus::StorageManager & _storage, const char * _fileName);
     bool readConfiguration ();
 
     inline const char * getBoardId () const
@@ -201,17 +214,91 @@ public:
     {
         return parameters[CfgParameter::WAV_FILE];
     }
+
+    inline const char * getLogFile () const
+    {
+        return parameters[CfgParameter::LOG_FILE];
+    }
+
+    inline int getLogSize () const
+    {
+        return logSize;
+    }
+
+    inline bool isEspTransparent () const
+    {
+        return espTransparent;
+    }
+
+    inline int getEspBaudRate () const
+    {
+        return espBaudRate;
+    }
+
+    inline bool isEspFlowControl () const
+    {
+        return espFlowControl;
+    }
+
+    inline const char * getJournalFile () const
+    {
+        return parameters[CfgParameter::JOURNAL_FILE];
+    }
+
+    inline int getJournalSize () const
+    {
+        return journalSize;
+    }
+
+    inline int getEspStandby () const
+    {
+        return espStandby;
+    }
+
+    inline StmPlusPlus::Encoder::Format getReportFormat () const
+    {
+        return reportFormat;
+    }
+
+    inline bool isReportEdges () const
+    {
+        return reportEdges;
+    }
+
+    inline int getShiftInputs () const
+    {
+        return shiftInputs;
+    }
+
+    inline int getShiftOutputs () const
+    {
+        return shiftOutputs;
+    }
+
+    inline int getShiftFreq () const
+    {
+        return shiftFreq;
+    }
     
 private:
     
     // File handling
     const char * fileName;
     FIL cfgFile;
-    StmPlusPlus::IOPin & pinSdPower;
-    StmPlusPlus::Devices::SdCard & sdCard;
+    StmPlusPlus::StorageManager & storage;
 
     char parameters[CfgParameter::size][MAX_LINE_LENGTH + 1];
     int repeatDelay, turnOffDelay; // delays in seconds
+    int logSize; // maximal log file size in KB
+    bool espTransparent;
+    int espBaudRate; // ESP baud rate negotiated after power-on, zero for default
+    bool espFlowControl;
+    int journalSize; // maximal journal file size in KB
+    StmPlusPlus::Encoder::Format reportFormat;
+    int espStandby; // time in seconds the ESP is kept in the modem sleep before power off
+    bool reportEdges; // the input edge list is reported instead of the pin state
+    int shiftInputs, shiftOutputs; // number of 74HC165 inputs and 74HC595 outputs, up to 64
+    int shiftFreq; // shift register refresh frequency in Hz, zero for default
 
     FRESULT readFile (const char * fileName);
     void dump () const;
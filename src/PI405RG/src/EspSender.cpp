@@ -25,46 +25,214 @@ using namespace Devices;
 
 #define USART_DEBUG_MODULE "ESPS: "
 
+// a step that could not be started (no coroutine frame) fails as an unanswered command: it is
+// awaited again if it shall be retried
+#define CO_AWAIT_STEP(ctx, cmd, retry) \
+    do { CO_AWAIT_CHECKED(ctx, step(cmd, retry), stepResult); } while ((retry) && !stepResult)
+
+// a child coroutine that could not be started (no coroutine frame) is awaited again
+#define CO_AWAIT_STARTED(ctx, task) \
+    do { taskStarted = true; CO_AWAIT_CHECKED(ctx, task, taskStarted); } while (!taskStarted)
+
 /************************************************************************
  * Class EspSender
  ************************************************************************/
 
-EspSender::EspSender (const RealTimeClock & _rtc, Devices::Esp11 & _esp, IOPin & _errorLed) :
+EspSender::EspSender (const RealTimeClock & _rtc, Devices::Esp11 & _esp, const Config & _config, IOPin & _errorLed) :
         rtc(_rtc),
         esp(_esp),
+        config(_config),
         errorLed(_errorLed),
-        espState(Esp11::AsyncCmd::OFF),
         outputMessage(NULL),
         repeatDelay(0),
         turnOffDelay(0),
+        standbyTime(0),
         nextOperationTime(0),
         turnOffTime(INFINITY_TIME),
-        asyncStates { {
-            AsyncState(Esp11::AsyncCmd::POWER_ON,       Esp11::AsyncCmd::ECHO_OFF,       "power on"),
-            AsyncState(Esp11::AsyncCmd::ECHO_OFF,       Esp11::AsyncCmd::ENSURE_READY,   "echo off"),
-            AsyncState(Esp11::AsyncCmd::ENSURE_READY,   Esp11::AsyncCmd::SET_MODE,       "ensure ready"),
-            AsyncState(Esp11::AsyncCmd::SET_MODE,       Esp11::AsyncCmd::ENSURE_MODE,    "set ESP mode"),
-            AsyncState(Esp11::AsyncCmd::ENSURE_MODE,    Esp11::AsyncCmd::SET_ADDR,       "ensure set ESP"),
-            AsyncState(Esp11::AsyncCmd::SET_ADDR,       Esp11::AsyncCmd::CONNECT_WLAN,   "set IP"),
-            AsyncState(Esp11::AsyncCmd::CONNECT_WLAN,   Esp11::AsyncCmd::SET_CON_MODE,   "connect SSID"),
-            AsyncState(Esp11::AsyncCmd::SET_CON_MODE,   Esp11::AsyncCmd::SET_SINDLE_CON, "set normal connection mode"),
-            AsyncState(Esp11::AsyncCmd::SET_SINDLE_CON, Esp11::AsyncCmd::PING_SERVER,    "set single connection"),
-            AsyncState(Esp11::AsyncCmd::PING_SERVER,    Esp11::AsyncCmd::CONNECT_SERVER, "ping"),
-            AsyncState(Esp11::AsyncCmd::CONNECT_SERVER, Esp11::AsyncCmd::SEND_MSG_SIZE,  "connect server"),
-            AsyncState(Esp11::AsyncCmd::SEND_MSG_SIZE,  Esp11::AsyncCmd::SEND_MESSAGE,   Esp11::AsyncCmd::RECONNECT, "send message size"),
-            AsyncState(Esp11::AsyncCmd::SEND_MESSAGE,   Esp11::AsyncCmd::WAITING,        Esp11::AsyncCmd::RECONNECT, "send message"),
-            AsyncState(Esp11::AsyncCmd::RECONNECT,      Esp11::AsyncCmd::SET_CON_MODE,   Esp11::AsyncCmd::SET_CON_MODE, "reconnect server"),
-            AsyncState(Esp11::AsyncCmd::WAITING,        Esp11::AsyncCmd::WAITING,        "waiting message"),
-            AsyncState(Esp11::AsyncCmd::DISCONNECT,     Esp11::AsyncCmd::POWER_OFF,      Esp11::AsyncCmd::POWER_OFF, "disconnect"),
-            AsyncState(Esp11::AsyncCmd::POWER_OFF,      Esp11::AsyncCmd::OFF,            "power off"),
-            AsyncState(Esp11::AsyncCmd::OFF,            Esp11::AsyncCmd::OFF,            "turned off")
-        } }
-{
-    // empty
-}
-
-void EspSender::sendMessage (const Config & config, const char* protocol, const char * server, const char * port, const char * msg, size_t messageSize)
+        idleState(Esp11::AsyncCmd::OFF),
+        stepResult(false),
+        taskStarted(false),
+        serverChanged(false),
+        linkOccupied(false),
+        reconnect(false),
+        configure(false),
+        transparentMode(false),
+        nextOrder(0),
+        batchSize(0),
+        batchMessages(0),
+        messageTime(0),
+        messagesSent(0),
+        messagesCoalesced(0),
+        messagesDropped(0),
+        startType(StartType::COLD),
+        startTime(0),
+        firstByteSent(true),
+        stepsSkipped(0)
+{
+    destination.protocol[0] = destination.server[0] = destination.port[0] = 0;
+    for (auto & q : queue)
+    {
+        q.used = false;
+    }
+    for (size_t i = 0; i < START_TYPES; ++i)
+    {
+        ttfbCount[i] = 0;
+        ttfbSum[i] = 0;
+    }
+    runner.start(this, &EspSender::run);
+}
+
+bool EspSender::sendMessage (const char* protocol, const char * server, const char * port,
+                             const char * msg, size_t messageSize, Priority priority, uint32_t coalesceKey,
+                             Devices::Esp11::EventHandler * handler)
+{
+    if (messageSize == 0)
+    {
+        messageSize = ::strlen(msg);
+    }
+    if (messageSize > MESSAGE_SIZE)
+    {
+        USART_DEBUG("Message is too long: " << messageSize);
+        return false;
+    }
+    Destination d;
+    if (!setDestination(d, protocol, server, port))
+    {
+        USART_DEBUG("Message destination is too long: " << server << "/" << port);
+        return false;
+    }
+
+    OutputMessage * m = NULL;
+    if (coalesceKey != NO_COALESCE)
+    {
+        // the latest message replaces a queued one with the same key and destination
+        for (auto & q : queue)
+        {
+            if (q.used && q.coalesceKey == coalesceKey && isSameDestination(q.destination, d))
+            {
+                m = &q;
+                ++messagesCoalesced;
+                break;
+            }
+        }
+    }
+    if (m == NULL)
+    {
+        for (auto & q : queue)
+        {
+            if (!q.used)
+            {
+                m = &q;
+                m->order = nextOrder++;
+                m->enqueueTime = rtc.getUpTimeMillisec();
+                break;
+            }
+        }
+    }
+    if (m == NULL)
+    {
+        ++messagesDropped;
+        USART_DEBUG("Output queue is full, message dropped");
+        return false;
+    }
+
+    m->used = true;
+    m->destination = d;
+    m->priority = priority;
+    m->coalesceKey = coalesceKey;
+    m->handler = handler;
+    m->size = messageSize;
+    ::memcpy(m->payload, msg, messageSize);
+    return true;
+}
+
+bool EspSender::isOutputMessageSent () const
+{
+    if (outputMessage != NULL)
+    {
+        return false;
+    }
+    for (auto & q : queue)
+    {
+        if (q.used)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EspSender::isQueueFull () const
+{
+    for (auto & q : queue)
+    {
+        if (!q.used)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+EspSender::OutputMessage * EspSender::findNextMessage (const OutputMessage * head)
+{
+    OutputMessage * next = NULL;
+    for (auto & q : queue)
+    {
+        if (!q.used)
+        {
+            continue;
+        }
+        if (head != NULL && (!isSameDestination(q.destination, head->destination)
+                             || batchSize + getFramedSize(q) > Devices::Esp11::BUFFER_SIZE))
+        {
+            continue;
+        }
+        if (next == NULL || q.priority < next->priority
+            || (q.priority == next->priority && q.order < next->order))
+        {
+            next = &q;
+        }
+    }
+    return next;
+}
+
+void EspSender::startNextMessage ()
 {
+    OutputMessage * head = findNextMessage(NULL);
+    if (head == NULL)
+    {
+        return;
+    }
+
+    // Several TCP messages to the same server are sent within a single transmission, each one
+    // terminated by the delimiter, while UDP messages are sent separately since each one is
+    // a datagram
+    // the previous destination is still set to Esp11: the new one is compared before it is copied
+    serverChanged = (destination.protocol[0] != 0 && !isSameDestination(destination, head->destination));
+    destination = head->destination;
+    Esp11::EventHandler * handler = head->handler;
+    bool batching = (::strcmp(destination.protocol, "TCP") == 0);
+    size_t batchCount = 0;
+    batchSize = 0;
+    messageTime = head->enqueueTime;
+    for (OutputMessage * m = head; m != NULL; m = batching? findNextMessage(head) : NULL)
+    {
+        ::memcpy(batchBuffer + batchSize, m->payload, m->size);
+        batchSize += m->size;
+        if (getFramedSize(*m) > m->size)
+        {
+            batchBuffer[batchSize++] = MESSAGE_DELIMITER;
+        }
+        if (m->enqueueTime < messageTime)
+        {
+            messageTime = m->enqueueTime;
+        }
+        ++batchCount;
+        m->used = false;
+    }
+    batchMessages = batchCount;
+
     esp.setMode(1);
     esp.setIp(config.getThisIp());
     esp.setGatway(config.getGateIp());
@@ -73,132 +241,313 @@ void EspSender::sendMessage (const Config & config, const char* protocol, const
     esp.setPasswd(config.getWlanPass());
     repeatDelay = config.getRepeatDelay() * MILLIS_IN_SEC;
     turnOffDelay = config.getTurnOffDelay() * MILLIS_IN_SEC;
+    standbyTime = config.getEspStandby() * MILLIS_IN_SEC;
+    transparentMode = config.isEspTransparent() && batching;
 
-    outputMessage = msg;
+    outputMessage = batchBuffer;
     esp.setMessage(outputMessage);
-    if (messageSize == 0)
+    esp.setMessageSize(batchSize);
+    USART_DEBUG("Sending " << batchCount << " message(s) to " << destination.server << "/" << destination.port
+                << "[" << batchSize << "]");
+    if (serverChanged)
     {
-        messageSize = ::strlen(outputMessage);
+        USART_DEBUG("Connection parameters changed, reconnect");
     }
-    esp.setMessageSize(messageSize);
-    USART_DEBUG("Sending message to " << server << "/" << port << "[" << messageSize << "]: " << msg);
+    esp.setProtocol(destination.protocol);
+    esp.setServer(destination.server);
+    esp.setPort(destination.port);
 
-    bool serverChanged = false;
-    if (esp.getProtocol() != NULL && esp.getServer() != NULL && esp.getPort() != NULL)
+    nextOperationTime = 0;
+    if (idleState == Esp11::AsyncCmd::OFF)
     {
-        if (::strcmp(protocol, esp.getProtocol()) != 0 ||
-            ::strcmp(server, esp.getServer()) != 0 ||
-            ::strcmp(port, esp.getPort()) != 0)
-        {
-            USART_DEBUG("Connection parameters changed, reconnect");
-            serverChanged = true;
-        }
+        // the transparent transmission requires the single connection mode
+        esp.setMultiConnection(!config.isEspTransparent());
+        esp.setBaudRate((config.getEspBaudRate() > 0)? config.getEspBaudRate() : (uint32_t)Esp11::ESP_BAUDRATE,
+                        config.isEspFlowControl());
     }
-    esp.setProtocol(protocol);
-    esp.setServer(server);
-    esp.setPort(port);
+    linkOccupied = (esp.selectLink(handler) == Esp11::LinkState::OCCUPIED);
+    startType = (idleState == Esp11::AsyncCmd::OFF)? StartType::COLD :
+                (idleState == Esp11::AsyncCmd::STANDBY)? StartType::WARM : StartType::HOT;
+    startTime = rtc.getUpTimeMillisec();
+    firstByteSent = false;
+    stepsSkipped = 0;
+}
 
-    nextOperationTime = 0;
-    if (espState == Esp11::AsyncCmd::OFF)
+void EspSender::periodic ()
+{
+    runner.periodic();
+}
+
+bool EspSender::isWorkPending ()
+{
+    if (outputMessage == NULL)
+    {
+        startNextMessage();
+    }
+    if (outputMessage != NULL)
+    {
+        return true;
+    }
+    if (idleState == Esp11::AsyncCmd::OFF)
     {
-        espState = Esp11::AsyncCmd::POWER_ON;
+        return false;
     }
-    else if (espState == Esp11::AsyncCmd::WAITING)
+    if (rtc.getUpTimeMillisec() > turnOffTime)
     {
-        espState = serverChanged? Esp11::AsyncCmd::RECONNECT : Esp11::AsyncCmd::SEND_MSG_SIZE;
+        return true;
     }
+    // the links with a handler receive the messages independently of the listening state
+    esp.periodic();
+    if (esp.isListening() && esp.getInputMessageSize() > 0)
+    {
+        delayTurnOff();
+    }
+    return false;
 }
 
-void EspSender::periodic ()
+bool EspSender::isResponceReceived ()
 {
-    if (espState == Esp11::AsyncCmd::OFF)
+    if (esp.isResponceAvailable())
     {
-        return;
+        return true;
     }
+    esp.periodic();
+    return false;
+}
 
-    time_ms currentTime = rtc.getUpTimeMillisec();
-    if (currentTime < nextOperationTime)
+CO_TASK EspSender::run ()
+{
+    CO_BEGIN(runCo);
+    while (true)
     {
-        return;
-    }
+        // OFF, WAITING or STANDBY: wait for the next message or the turn-off time
+        CO_AWAIT_UNTIL(runCo, isWorkPending());
 
-    if (espState == Esp11::AsyncCmd::WAITING)
-    {
-        if (outputMessage == NULL && currentTime > turnOffTime)
+        if (outputMessage != NULL)
+        {
+            if (startType != StartType::HOT)
+            {
+                CO_AWAIT_STARTED(runCo, bringUp());
+            }
+            CO_AWAIT_STARTED(runCo, transmitMessage());
+            idleState = Esp11::AsyncCmd::WAITING;
+            continue;
+        }
+
+        if (esp.isTransparent())
         {
-            espState = Esp11::AsyncCmd::DISCONNECT;
+            CO_AWAIT_STEP(runCo, Esp11::AsyncCmd::ESCAPE_TRANSP, false);
         }
-        else if (esp.isListening())
+        if (idleState == Esp11::AsyncCmd::WAITING && standbyTime > 0)
         {
-            esp.periodic();
-            if (esp.getInputMessageSize() > 0)
+            // the module stays associated with the WLAN in the modem sleep
+            CO_AWAIT_STEP(runCo, Esp11::AsyncCmd::SET_SLEEP, false);
+            if (stepResult)
             {
-                delayTurnOff();
+                idleState = Esp11::AsyncCmd::STANDBY;
+                delayStandby();
+                USART_DEBUG("ESP standby for " << (int)(standbyTime / MILLIS_IN_SEC) << " sec");
+                continue;
             }
         }
-        return;
+        CO_AWAIT_STEP(runCo, Esp11::AsyncCmd::DISCONNECT, false);
+        CO_AWAIT_STEP(runCo, Esp11::AsyncCmd::POWER_OFF, false);
+        delayNextOperation();
+        idleState = Esp11::AsyncCmd::OFF;
     }
-    
-    if (!esp.isTransmissionStarted())
+    CO_END(runCo);
+}
+
+CO_TASK EspSender::bringUp ()
+{
+    CO_BEGIN(bringUpCo);
+    if (startType == StartType::WARM)
     {
-        errorLed.putBit(false);
-        const AsyncState * s = findState(espState);
-        if (s == NULL)
+        CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::WAKE_UP, false);
+        if (!stepResult)
+        {
+            // the module did not wake up: the message is sent after a cold start
+            CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::POWER_OFF, false);
+            delayNextOperation();
+            idleState = Esp11::AsyncCmd::OFF;
+        }
+    }
+    if (idleState == Esp11::AsyncCmd::OFF)
+    {
+        CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::POWER_ON, true);
+    }
+
+    // the steps already done since power on are skipped
+    CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::ECHO_OFF, true);
+    CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::ENSURE_READY, true);
+    CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::SET_MODE, true);
+    CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::ENSURE_MODE, true);
+    CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::SET_ADDR, true);
+    CO_AWAIT_STEP(bringUpCo, Esp11::AsyncCmd::CONNECT_WLAN, true);
+    configure = true;
+    CO_END(bringUpCo);
+}
+
+CO_TASK EspSender::transmitMessage ()
+{
+    CO_BEGIN(transmitCo);
+    reconnect = false;
+    if (startType == StartType::HOT)
+    {
+        configure = false;
+        if (esp.isTransparent() && (serverChanged || !transparentMode))
+        {
+            // leave the transparent mode before any reconfiguration: the reconnection
+            // falls back to the normal mode
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::ESCAPE_TRANSP, false);
+            reconnect = true;
+        }
+        else if (!esp.isMultiConnection() && serverChanged)
+        {
+            reconnect = true;
+        }
+    }
+
+    while (true)
+    {
+        if (reconnect)
+        {
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::RECONNECT, false);
+            reconnect = false;
+            configure = true;
+        }
+        if (configure)
         {
-            USART_DEBUG("ESP state: state corrupted");
-            return;
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::SET_CON_MODE, true);
+            CO_AWAIT_STEP(transmitCo, esp.isMultiConnection()?
+                     Esp11::AsyncCmd::SET_MULTI_CON : Esp11::AsyncCmd::SET_SINDLE_CON, true);
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::PING_SERVER, true);
+            configure = false;
         }
 
-        if (s->cmd == Esp11::AsyncCmd::POWER_ON)
+        // each destination keeps an own link: a connected link is reused without reconnection
+        if (linkOccupied)
         {
-            turnOffTime = INFINITY_TIME;
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::CLOSE_LINK, false);
         }
-        if (s->cmd == Esp11::AsyncCmd::SEND_MSG_SIZE)
+        CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::CONNECT_SERVER, true);
+
+        if (transparentMode)
         {
-            if (outputMessage == NULL)
+            if (!esp.isTransparent())
             {
-                return;
+                CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::SET_TRANSP_MODE, false);
+                reconnect = !stepResult;
+                if (reconnect)
+                {
+                    continue;
+                }
+                CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::START_TRANSP, false);
+                reconnect = !stepResult;
+                if (reconnect)
+                {
+                    continue;
+                }
+            }
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::SEND_TRANSP, false);
+            if (!stepResult)
+            {
+                CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::ESCAPE_TRANSP, false);
+                reconnect = true;
+                continue;
             }
         }
-
-        if (!esp.transmit(s->cmd))
+        else
         {
-            USART_DEBUG("ESP state: " << s->description << " -> failed to start transmission");
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::SEND_MSG_SIZE, false);
+            reconnect = !stepResult;
+            if (reconnect)
+            {
+                continue;
+            }
+            CO_AWAIT_STEP(transmitCo, Esp11::AsyncCmd::SEND_MESSAGE, false);
+            reconnect = !stepResult;
+            if (reconnect)
+            {
+                continue;
+            }
         }
+        break;
+    }
+
+    outputMessage = NULL;
+    delayTurnOff();
+    messagesSent += batchMessages;
+    USART_DEBUG("Messages sent: " << messagesSent << ", latency: "
+             << (int)(rtc.getUpTimeMillisec() - messageTime) << " ms ("
+             << (esp.isTransparent()? "transparent" : "normal") << " mode, link "
+             << esp.getLinkId() << ")");
+    CO_END(transmitCo);
+}
+
+CO_TASK EspSender::step (Esp11::AsyncCmd cmd, bool retry)
+{
+    CO_BEGIN(stepCo);
+    stepResult = true;
+    if (cmd == Esp11::AsyncCmd::POWER_ON || cmd == Esp11::AsyncCmd::WAKE_UP)
+    {
+        turnOffTime = INFINITY_TIME;
+    }
+    if (esp.isCheckpointed(cmd)
+        || (cmd == Esp11::AsyncCmd::CONNECT_SERVER && !linkOccupied && esp.isLinkConnected()))
+    {
+        // nothing changed since this step was done
+        ++stepsSkipped;
+        CO_RETURN(stepCo);
     }
-    else if (esp.isResponceAvailable())
+    do
     {
-        const AsyncState * s = findState(espState);
-        if (s == NULL)
+        CO_AWAIT_UNTIL(stepCo, rtc.getUpTimeMillisec() >= nextOperationTime);
+        errorLed.putBit(false);
+        if (cmd == Esp11::AsyncCmd::SEND_MESSAGE || cmd == Esp11::AsyncCmd::SEND_TRANSP)
         {
-            USART_DEBUG("ESP state: state corrupted");
-            return;
+            reportTimeToFirstByte();
         }
-        if (esp.getResponce(s->cmd))
+        if (esp.transmit(cmd))
         {
-            espState = s->okNextCmd;
-            if (s->cmd == Esp11::AsyncCmd::SEND_MESSAGE)
+            CO_AWAIT_UNTIL(stepCo, isResponceReceived());
+            if (cmd == Esp11::AsyncCmd::CLOSE_LINK || cmd == Esp11::AsyncCmd::RECONNECT
+                || cmd == Esp11::AsyncCmd::DISCONNECT)
             {
-                outputMessage = NULL;
-                delayTurnOff();
+                linkOccupied = false;
             }
-            stateReport(true, s->description);
+            stepResult = esp.getResponce(cmd);
         }
         else
         {
-            espState = s->errorNextCmd;
-            delayNextOperation();
-            stateReport(false, s->description);
+            USART_DEBUG("ESP state: " << getDescription(cmd) << " -> failed to start transmission");
+            stepResult = false;
         }
-        if (espState == Esp11::AsyncCmd::POWER_OFF)
+        stateReport(stepResult, getDescription(cmd));
+        if (!stepResult)
         {
             delayNextOperation();
         }
     }
-    else
+    while (retry && !stepResult);
+    CO_END(stepCo);
+}
+
+void EspSender::reportTimeToFirstByte ()
+{
+    if (firstByteSent)
     {
-        esp.periodic();
+        return;
     }
+    firstByteSent = true;
+    size_t i = (size_t)startType;
+    time_ms ttfb = rtc.getUpTimeMillisec() - startTime;
+    ++ttfbCount[i];
+    ttfbSum[i] += ttfb;
+    USART_DEBUG("Time to first byte ("
+             << ((startType == StartType::COLD)? "cold" : (startType == StartType::WARM)? "warm" : "hot")
+             << " start): " << (int)ttfb << " ms, average: " << (int)(ttfbSum[i] / ttfbCount[i])
+             << " ms, skipped steps: " << (int)stepsSkipped);
 }
 
 void EspSender::stateReport (bool result, const char * description)
@@ -214,14 +563,60 @@ void EspSender::stateReport (bool result, const char * description)
     }
 }
 
-const EspSender::AsyncState * EspSender::findState (Devices::Esp11::AsyncCmd st)
+bool EspSender::setDestination (Destination & d, const char* protocol, const char * server, const char * port)
 {
-    for (auto & ss : asyncStates)
+    if (::strlen(protocol) >= sizeof(d.protocol) || ::strlen(server) >= sizeof(d.server)
+        || ::strlen(port) >= sizeof(d.port))
     {
-        if (ss.cmd == st)
-        {
-            return &ss;
-        }
+        return false;
+    }
+    ::strcpy(d.protocol, protocol);
+    ::strcpy(d.server, server);
+    ::strcpy(d.port, port);
+    return true;
+}
+
+bool EspSender::isSameDestination (const Destination & d1, const Destination & d2)
+{
+    return ::strcmp(d1.protocol, d2.protocol) == 0 && ::strcmp(d1.server, d2.server) == 0
+           && ::strcmp(d1.port, d2.port) == 0;
+}
+
+size_t EspSender::getFramedSize (const OutputMessage & m)
+{
+    // a TCP message that already ends with the delimiter is sent as is
+    bool framed = ::strcmp(m.destination.protocol, "TCP") != 0 || (m.size > 0 && m.payload[m.size - 1] == MESSAGE_DELIMITER);
+    return framed? m.size : m.size + 1;
+}
+
+const char * EspSender::getDescription (Esp11::AsyncCmd cmd)
+{
+    switch (cmd)
+    {
+    case Esp11::AsyncCmd::POWER_ON:        return "power on";
+    case Esp11::AsyncCmd::ECHO_OFF:        return "echo off";
+    case Esp11::AsyncCmd::ENSURE_READY:    return "ensure ready";
+    case Esp11::AsyncCmd::SET_MODE:        return "set ESP mode";
+    case Esp11::AsyncCmd::ENSURE_MODE:     return "ensure set ESP";
+    case Esp11::AsyncCmd::SET_ADDR:        return "set IP";
+    case Esp11::AsyncCmd::CONNECT_WLAN:    return "connect SSID";
+    case Esp11::AsyncCmd::SET_CON_MODE:    return "set normal connection mode";
+    case Esp11::AsyncCmd::SET_SINDLE_CON:  return "set single connection";
+    case Esp11::AsyncCmd::SET_MULTI_CON:   return "set multiple connections";
+    case Esp11::AsyncCmd::PING_SERVER:     return "ping";
+    case Esp11::AsyncCmd::CONNECT_SERVER:  return "connect server";
+    case Esp11::AsyncCmd::CLOSE_LINK:      return "close link";
+    case Esp11::AsyncCmd::SEND_MSG_SIZE:   return "send message size";
+    case Esp11::AsyncCmd::SEND_MESSAGE:    return "send message";
+    case Esp11::AsyncCmd::RECONNECT:       return "reconnect server";
+    case Esp11::AsyncCmd::DISCONNECT:      return "disconnect";
+    case Esp11::AsyncCmd::POWER_OFF:       return "power off";
+    case Esp11::AsyncCmd::SET_TRANSP_MODE: return "set transparent mode";
+    case Esp11::AsyncCmd::START_TRANSP:    return "start transparent transmission";
+    case Esp11::AsyncCmd::SEND_TRANSP:     return "send transparent message";
+    case Esp11::AsyncCmd::ESCAPE_TRANSP:   return "escape transparent mode";
+    case Esp11::AsyncCmd::SET_SLEEP:       return "enter modem sleep";
+    case Esp11::AsyncCmd::WAKE_UP:         return "leave modem sleep";
+    default:                               return "unknown";
     }
-    return NULL;
 }
@@ -20,62 +20,177 @@
 #ifndef ESPSENDER_H_
 #define ESPSENDER_H_
 
+#include <array>
+
 #include "Config.h"
+#include "StmPlusPlus/Coroutine.h"
 #include "StmPlusPlus/Devices/Esp11.h"
 
 using namespace StmPlusPlus;
 
+/**
+ * @brief Class that sends messages to a server using ESP module.
+ *
+ * Outgoing messages are copied into a bounded queue. The queue is served in the order of message
+ * priority and, within a priority, in the order of arrival. A message with a coalescing key
+ * replaces a queued message with the same key and destination (the latest wins). Several queued
+ * TCP messages to the same server are batched into a single transmission. Since TCP is a stream,
+ * every TCP message is terminated by MESSAGE_DELIMITER (e.g. newline-delimited JSON), so the
+ * server can split a batch into the original messages.
+ *
+ * Unless the transparent mode is configured, the ESP works in the multiple connection mode: each
+ * destination (e.g. the NTP server and the state report server) keeps an own link, so alternating
+ * destinations does not require a reconnection.
+ *
+ * If the standby is configured, the idle ESP is put into the modem sleep instead of power off: it
+ * stays associated with the WLAN and keeps its links. The bring-up sequence is checkpointed by
+ * the ESP driver: after a wake-up, only the steps whose settings changed since power on are
+ * executed again. The time to the first payload byte is measured separately for the cold (power
+ * on), warm (wake-up from standby) and hot (already connected) start.
+ *
+ * The command sequence is implemented as a set of coroutines (see Coroutine.h): run() serves the
+ * idle states and the turn-off, bringUp() powers on or wakes up the module, transmitMessage()
+ * connects and sends the message, and step() executes a single AT command.
+ */
 class EspSender
 {
 public:
+
+    enum class Priority
+    {
+        HIGH   = 0, // time-critical requests, e.g. NTP
+        NORMAL = 1, // state reports
+        BULK   = 2  // bulk data
+    };
+
+    enum class StartType
+    {
+        COLD = 0, // the module is powered on
+        WARM = 1, // the module wakes up from the standby
+        HOT  = 2  // the module is already active
+    };
+
+    static const size_t START_TYPES = 3;
+    static const size_t QUEUE_SIZE = 8;
+    static const size_t MESSAGE_SIZE = 256;
+    static const uint32_t NO_COALESCE = 0;
+    static const char MESSAGE_DELIMITER = '\n'; // terminates each TCP message
     
-    EspSender (const RealTimeClock & _rtc, Devices::Esp11 & _esp, IOPin & _errorLed);
+    EspSender (const RealTimeClock & _rtc, Devices::Esp11 & _esp, const Config & _config, IOPin & _errorLed);
+
+    /**
+     * @brief Returns true if the queue is empty and no message is in transmission.
+     */
+    bool isOutputMessageSent () const;
+
+    /**
+     * @brief Returns true if the queue has no free slot: a message without a coalescing key
+     *        would be dropped.
+     */
+    bool isQueueFull () const;
+
+    /**
+     * @brief Puts the message into the output queue. The destination is copied together with
+     *        the payload: a message to a server name longer than MAX_SERVER_LENGTH is rejected.
+     */
+    bool sendMessage (const char* protocol, const char* server, const char* port, const char * msg, size_t messageSize = 0,
+                      Priority priority = Priority::NORMAL, uint32_t coalesceKey = NO_COALESCE,
+                      Devices::Esp11::EventHandler * handler = NULL);
+    void periodic ();
 
-    inline bool isOutputMessageSent () const
+    inline uint32_t getMessagesSent () const
     {
-        return outputMessage == NULL;
+        return messagesSent;
     }
 
-    void sendMessage (const Config & config, const char* protocol, const char* server, const char* port, const char * msg, size_t messageSize = 0);
-    void periodic ();
+    inline uint32_t getMessagesCoalesced () const
+    {
+        return messagesCoalesced;
+    }
+
+    inline uint32_t getMessagesDropped () const
+    {
+        return messagesDropped;
+    }
+
+    /**
+     * @brief Returns the average time from the message start up to the first payload byte.
+     */
+    inline time_ms getAverageTimeToFirstByte (StartType t) const
+    {
+        size_t i = (size_t)t;
+        return (ttfbCount[i] == 0)? 0 : ttfbSum[i] / ttfbCount[i];
+    }
 
 private:
 
-    static const size_t STATE_NUMBER = 18;
+    /**
+     * @brief Destination of a message. The strings are copied: the configuration buffers passed
+     *        to sendMessage() are re-read in place while the message waits in the queue.
+     */
+    class Destination
+    {
+    public:
+
+        char protocol[4];
+        char server[Devices::Esp11::MAX_SERVER_LENGTH + 1];
+        char port[6];
+    };
 
-    class AsyncState
+    class OutputMessage
     {
     public:
 
-        Devices::Esp11::AsyncCmd cmd;
-        Devices::Esp11::AsyncCmd okNextCmd, errorNextCmd;
-        const char * description;
-
-        AsyncState(Devices::Esp11::AsyncCmd _cmd, Devices::Esp11::AsyncCmd _okState, const char * _description)
-        {
-            cmd = _cmd;
-            okNextCmd = _okState;
-            errorNextCmd = _cmd;
-            description = _description;
-        }
-
-        AsyncState(Devices::Esp11::AsyncCmd _cmd, Devices::Esp11::AsyncCmd _okState, Devices::Esp11::AsyncCmd _errorState, const char * _description)
-        {
-            cmd = _cmd;
-            okNextCmd = _okState;
-            errorNextCmd = _errorState;
-            description = _description;
-        }
+        bool used;
+        Destination destination;
+        Priority priority;
+        uint32_t coalesceKey;
+        Devices::Esp11::EventHandler * handler; // receives the responses of the destination
+        uint32_t order;
+        time_ms enqueueTime;
+        size_t size;
+        char payload[MESSAGE_SIZE];
     };
     
     const RealTimeClock & rtc;
     Devices::Esp11 & esp;
+    const Config & config;
     IOPin & errorLed;
-    Devices::Esp11::AsyncCmd espState;
     const char * outputMessage;
-    time_ms repeatDelay, turnOffDelay; // configured delays in millis
+    time_ms repeatDelay, turnOffDelay, standbyTime; // configured delays in millis
     time_ms nextOperationTime, turnOffTime;
-    std::array<AsyncState, STATE_NUMBER> asyncStates;
+
+    // Coroutines
+    CoRunner<EspSender> runner;
+    CoContext runCo, bringUpCo, transmitCo, stepCo;
+    Devices::Esp11::AsyncCmd idleState; // OFF, WAITING or STANDBY
+    bool stepResult;
+    bool taskStarted; // false if the awaited child coroutine could not be started
+
+    // Connection: the destination of the current transmission, set to Esp11
+    Destination destination;
+    bool serverChanged;
+    bool linkOccupied; // the selected link is connected to an other destination
+    bool reconnect, configure;
+    bool transparentMode;
+
+    // Output queue
+    std::array<OutputMessage, QUEUE_SIZE> queue;
+    uint32_t nextOrder;
+    char batchBuffer[Devices::Esp11::BUFFER_SIZE];
+    size_t batchSize, batchMessages;
+
+    // Statistics
+    time_ms messageTime;
+    uint32_t messagesSent, messagesCoalesced, messagesDropped;
+
+    // Time to first byte
+    StartType startType;
+    time_ms startTime;
+    bool firstByteSent;
+    uint32_t stepsSkipped;
+    uint32_t ttfbCount[START_TYPES];
+    time_ms ttfbSum[START_TYPES];
 
     inline void delayNextOperation ()
     {
@@ -87,8 +202,25 @@ private:
         turnOffTime = rtc.getUpTimeMillisec() + turnOffDelay;
     }
 
+    inline void delayStandby ()
+    {
+        turnOffTime = rtc.getUpTimeMillisec() + standbyTime;
+    }
+
+    OutputMessage * findNextMessage (const OutputMessage * head);
+    void startNextMessage ();
+    static bool setDestination (Destination & d, const char* protocol, const char * server, const char * port);
+    static bool isSameDestination (const Destination & d1, const Destination & d2);
+    static size_t getFramedSize (const OutputMessage & m);
+    bool isWorkPending ();
+    bool isResponceReceived ();
+    CO_TASK run ();
+    CO_TASK bringUp ();
+    CO_TASK transmitMessage ();
+    CO_TASK step (Devices::Esp11::AsyncCmd cmd, bool retry);
+    void reportTimeToFirstByte ();
     void stateReport (bool result, const char * description);
-    const AsyncState * findState (Devices::Esp11::AsyncCmd st);
+    static const char * getDescription (Devices::Esp11::AsyncCmd cmd);
 };
 
 #endif
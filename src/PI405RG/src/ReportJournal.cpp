@@ -0,0 +1,560 @@
+/*******************************************************************************
+ * Test unit for the development board: STM32F405RGT6
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "ReportJournal.h"
+
+using namespace StmPlusPlus;
+
+#define USART_DEBUG_MODULE "JRNL: "
+
+/************************************************************************
+ * Class ReportJournal
+ ************************************************************************/
+
+ReportJournal::ReportJournal (StorageManager & _storage, RealTimeClock & _rtc, EspSender & _sender) :
+        storage(_storage),
+        rtc(_rtc),
+        sender(_sender),
+        fileName(NULL),
+        active(false),
+        maxFileSize(0),
+        dataOffset(HEADER_SIZE),
+        sendOffset(HEADER_SIZE),
+        endOffset(HEADER_SIZE),
+        ackedSeq(0),
+        sentSeq(0),
+        nextSeq(1),
+        server(NULL),
+        port(NULL),
+        batchInFlight(false),
+        ackDeadline(INFINITY_TIME),
+        droppedRecords(0),
+        compactions(0),
+        retransmissions(0),
+        cborFrame(frameBuffer, sizeof(frameBuffer)),
+        jsonFrame(frameBuffer, sizeof(frameBuffer))
+{
+    // empty
+}
+
+bool ReportJournal::start (const char * _fileName, DWORD _maxFileSize, const char * _server, const char * _port)
+{
+    if (active || _maxFileSize < HEADER_SIZE + 2 * getRecordSize(MAX_PAYLOAD))
+    {
+        return false;
+    }
+
+    if (!storage.acquire())
+    {
+        return false;
+    }
+
+    fileName = _fileName;
+    maxFileSize = _maxFileSize;
+    server = _server;
+    port = _port;
+
+    // a compaction was interrupted after the old journal was removed
+    FILINFO info;
+    if (f_stat(fileName, &info) == FR_NO_FILE && f_stat(TMP_FILE_NAME, &info) == FR_OK)
+    {
+        USART_DEBUG("Restoring journal from " << TMP_FILE_NAME);
+        f_rename(TMP_FILE_NAME, fileName);
+    }
+
+    FRESULT code = f_open(&file, fileName, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if (code != FR_OK)
+    {
+        USART_DEBUG("Can not open journal file " << fileName << ": " << code);
+        storage.release();
+        return false;
+    }
+
+    active = true;
+    droppedRecords = compactions = retransmissions = 0;
+    if (!recover())
+    {
+        USART_DEBUG("Can not recover journal file " << fileName);
+        stop();
+        return false;
+    }
+
+    USART_DEBUG("Journal started: " << fileName << ", next record: " << nextSeq
+             << ", pending records: " << getPendingRecords());
+    return true;
+}
+
+bool ReportJournal::append (const void * data, size_t len, Encoder::Format format)
+{
+    if (!active || len == 0 || len > MAX_PAYLOAD)
+    {
+        return false;
+    }
+
+    DWORD size = getRecordSize(len);
+    if (endOffset + size > maxFileSize && !makeRoom(size))
+    {
+        ++droppedRecords;
+        return false;
+    }
+
+    RecordHeader r;
+    r.sync = RECORD_SYNC;
+    r.format = (uint8_t)format;
+    r.length = len;
+    r.seq = nextSeq;
+    r.timestamp = rtc.getTimeSec();
+    ::memcpy(recordBuffer, &r, sizeof(RecordHeader));
+    ::memcpy(recordBuffer + sizeof(RecordHeader), data, len);
+    uint16_t checksum = DataLogger::calculateChecksum(recordBuffer, sizeof(RecordHeader) + len);
+    ::memcpy(recordBuffer + sizeof(RecordHeader) + len, &checksum, sizeof(uint16_t));
+
+    UINT bw = 0;
+    FRESULT code = f_lseek(&file, endOffset);
+    if (code == FR_OK)
+    {
+        code = f_write(&file, recordBuffer, size, &bw);
+    }
+    if (code == FR_OK)
+    {
+        code = f_sync(&file);
+    }
+    if (code != FR_OK || bw != size)
+    {
+        USART_DEBUG("Can not append record " << nextSeq << ": " << code);
+        return false;
+    }
+
+    endOffset += size;
+    ++nextSeq;
+    rtc.setBackupRegister(SEQ_REGISTER, nextSeq);
+    return true;
+}
+
+void ReportJournal::acknowledge (uint32_t seq)
+{
+    if (!active || seq <= ackedSeq)
+    {
+        return;
+    }
+    if (seq > sentSeq)
+    {
+        USART_DEBUG("Acknowledge of not sent record " << seq << " ignored");
+        return;
+    }
+
+    RecordHeader r;
+    while (ackedSeq < seq && readRecord(dataOffset, ackedSeq + 1, r))
+    {
+        dataOffset += getRecordSize(r.length);
+        ackedSeq = r.seq;
+    }
+    writeHeader();
+
+    ackDeadline = (sentSeq > ackedSeq)? rtc.getUpTimeMillisec() + ACK_TIMEOUT : INFINITY_TIME;
+    if (dataOffset == endOffset)
+    {
+        // everything is confirmed: the file is truncated in place
+        compact();
+    }
+}
+
+void ReportJournal::periodic ()
+{
+    if (!active)
+    {
+        return;
+    }
+
+    if (batchInFlight)
+    {
+        if (!sender.isOutputMessageSent())
+        {
+            return;
+        }
+        // the acknowledge is expected after the batch is transmitted
+        batchInFlight = false;
+        ackDeadline = rtc.getUpTimeMillisec() + ACK_TIMEOUT;
+    }
+
+    if (sentSeq > ackedSeq && rtc.getUpTimeMillisec() > ackDeadline)
+    {
+        USART_DEBUG("No acknowledge for records " << ackedSeq + 1 << "-" << sentSeq << ", sending again");
+        ++retransmissions;
+        sendOffset = dataOffset;
+        sentSeq = ackedSeq;
+        ackDeadline = INFINITY_TIME;
+    }
+
+    if (sendOffset < endOffset && sender.isOutputMessageSent())
+    {
+        sendBatch();
+    }
+}
+
+void ReportJournal::stop ()
+{
+    if (!active)
+    {
+        return;
+    }
+    f_close(&file);
+    storage.release();
+    active = false;
+    USART_DEBUG("Journal stopped: pending records: " << getPendingRecords() << ", dropped: " << droppedRecords
+             << ", compactions: " << compactions << ", retransmissions: " << retransmissions);
+}
+
+void ReportJournal::onInputMessage (int32_t, const char * data, size_t len)
+{
+    // "ACK <seq>": the greatest acknowledged number is taken
+    size_t ackLen = ::strlen(RESP_ACK);
+    uint32_t seq = 0;
+    for (size_t i = 0; i + ackLen <= len; ++i)
+    {
+        if (::strncmp(data + i, RESP_ACK, ackLen) != 0)
+        {
+            continue;
+        }
+        size_t j = i + ackLen;
+        while (j < len && (data[j] == ' ' || data[j] == ':'))
+        {
+            ++j;
+        }
+        uint32_t n = 0;
+        for (; j < len && data[j] >= '0' && data[j] <= '9'; ++j)
+        {
+            n = n * 10 + (data[j] - '0');
+        }
+        seq = (n > seq)? n : seq;
+        i = j - 1;
+    }
+    if (seq > 0)
+    {
+        acknowledge(seq);
+    }
+}
+
+bool ReportJournal::recover ()
+{
+    FileHeader h;
+    UINT br = 0;
+    DWORD fileSize = f_size(&file);
+    bool valid = fileSize >= HEADER_SIZE
+            && f_lseek(&file, 0) == FR_OK
+            && f_read(&file, &h, sizeof(FileHeader), &br) == FR_OK
+            && br == sizeof(FileHeader)
+            && h.magic == FILE_MAGIC
+            && h.dataOffset >= HEADER_SIZE && h.dataOffset <= fileSize;
+
+    ackedSeq = valid? h.ackedSeq : 0;
+    dataOffset = valid? h.dataOffset : (DWORD)HEADER_SIZE;
+    if (!valid)
+    {
+        USART_DEBUG("Journal file is not valid, creating a new one");
+    }
+
+    // the header update might be interrupted by a power loss: the records are authoritative
+    DWORD offset = dataOffset;
+    RecordHeader r;
+    while (valid && readRecord(offset, ANY_SEQ, r) && r.seq <= ackedSeq)
+    {
+        offset += getRecordSize(r.length);
+    }
+    if (valid && readRecord(offset, ANY_SEQ, r) && r.seq > ackedSeq + 1)
+    {
+        ackedSeq = r.seq - 1;
+    }
+    dataOffset = offset;
+    nextSeq = ackedSeq + 1;
+
+    // the journal ends at the first record that is not valid, e.g. interrupted by a power loss
+    while (readRecord(offset, nextSeq, r))
+    {
+        offset += getRecordSize(r.length);
+        ++nextSeq;
+    }
+    endOffset = offset;
+    bool restored = restoreSeq();
+    sendOffset = dataOffset;
+    sentSeq = ackedSeq;
+    batchInFlight = false;
+    ackDeadline = INFINITY_TIME;
+
+    if ((!valid || restored) && !writeHeader())
+    {
+        return false;
+    }
+    if (endOffset < fileSize)
+    {
+        USART_DEBUG("Journal truncated: " << (int)(fileSize - endOffset) << " bytes");
+        if (f_lseek(&file, endOffset) != FR_OK || f_truncate(&file) != FR_OK || f_sync(&file) != FR_OK)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ReportJournal::restoreSeq ()
+{
+    // the records in the file are numbered contiguously: only an empty journal can jump
+    uint32_t storedSeq = rtc.getBackupRegister(SEQ_REGISTER);
+    bool restored = dataOffset == endOffset && storedSeq > nextSeq;
+    if (restored)
+    {
+        USART_DEBUG("Sequence number restored from RTC backup register: " << storedSeq);
+        ackedSeq = storedSeq - 1;
+        nextSeq = storedSeq;
+    }
+    rtc.setBackupRegister(SEQ_REGISTER, nextSeq);
+    return restored;
+}
+
+bool ReportJournal::writeHeader ()
+{
+    FileHeader h;
+    h.magic = FILE_MAGIC;
+    h.ackedSeq = ackedSeq;
+    h.dataOffset = dataOffset;
+    h.reserved = 0;
+
+    UINT bw = 0;
+    FRESULT code = f_lseek(&file, 0);
+    if (code == FR_OK)
+    {
+        code = f_write(&file, &h, sizeof(FileHeader), &bw);
+    }
+    if (code == FR_OK)
+    {
+        code = f_sync(&file);
+    }
+    if (code != FR_OK || bw != sizeof(FileHeader))
+    {
+        USART_DEBUG("Can not write journal header: " << code);
+        return false;
+    }
+    return true;
+}
+
+bool ReportJournal::readRecord (DWORD offset, uint32_t expectedSeq, RecordHeader & r)
+{
+    if (offset + RECORD_OVERHEAD > f_size(&file) || f_lseek(&file, offset) != FR_OK)
+    {
+        return false;
+    }
+
+    UINT br = 0;
+    if (f_read(&file, recordBuffer, sizeof(RecordHeader), &br) != FR_OK || br != sizeof(RecordHeader))
+    {
+        return false;
+    }
+    ::memcpy(&r, recordBuffer, sizeof(RecordHeader));
+    if (r.sync != RECORD_SYNC || r.length == 0 || r.length > MAX_PAYLOAD
+        || (expectedSeq != ANY_SEQ && r.seq != expectedSeq))
+    {
+        return false;
+    }
+
+    UINT rest = r.length + sizeof(uint16_t);
+    if (f_read(&file, recordBuffer + sizeof(RecordHeader), rest, &br) != FR_OK || br != rest)
+    {
+        return false;
+    }
+    uint16_t checksum;
+    ::memcpy(&checksum, recordBuffer + sizeof(RecordHeader) + r.length, sizeof(uint16_t));
+    return checksum == DataLogger::calculateChecksum(recordBuffer, sizeof(RecordHeader) + r.length);
+}
+
+bool ReportJournal::makeRoom (DWORD size)
+{
+    // the confirmed records are removed first
+    if (dataOffset > HEADER_SIZE && !compact())
+    {
+        return false;
+    }
+    if (endOffset + size <= maxFileSize)
+    {
+        return true;
+    }
+
+    // the journal is full of unconfirmed records: a quarter of the file is released at once
+    // in order to avoid a compaction for each new record
+    dropRecords(endOffset + size - maxFileSize + maxFileSize / 4);
+    return compact() && endOffset + size <= maxFileSize;
+}
+
+void ReportJournal::dropRecords (DWORD size)
+{
+    DWORD released = 0;
+    uint32_t dropped = 0;
+    RecordHeader r;
+    while (released < size && dataOffset < endOffset && readRecord(dataOffset, ackedSeq + 1, r))
+    {
+        DWORD recordSize = getRecordSize(r.length);
+        dataOffset += recordSize;
+        released += recordSize;
+        ackedSeq = r.seq;
+        ++dropped;
+    }
+    if (sendOffset < dataOffset)
+    {
+        sendOffset = dataOffset;
+        sentSeq = ackedSeq;
+    }
+    droppedRecords += dropped;
+    USART_DEBUG("Journal is full: " << dropped << " oldest records dropped");
+    writeHeader();
+}
+
+bool ReportJournal::compact ()
+{
+    if (dataOffset == HEADER_SIZE)
+    {
+        return true;
+    }
+
+    DWORD shift = dataOffset - HEADER_SIZE;
+    if (dataOffset == endOffset)
+    {
+        // nothing to keep: the header is updated before the records are truncated
+        dataOffset = endOffset = sendOffset = HEADER_SIZE;
+        if (!writeHeader() || f_lseek(&file, HEADER_SIZE) != FR_OK
+            || f_truncate(&file) != FR_OK || f_sync(&file) != FR_OK)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        // the unconfirmed records are copied into a new file that replaces the journal
+        if (!copyRecords())
+        {
+            USART_DEBUG("Journal compaction failed");
+            return false;
+        }
+        dataOffset -= shift;
+        sendOffset -= shift;
+        endOffset -= shift;
+    }
+    ++compactions;
+    return true;
+}
+
+bool ReportJournal::copyRecords ()
+{
+    FRESULT code = f_open(&tmpFile, TMP_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE);
+    if (code != FR_OK)
+    {
+        return false;
+    }
+
+    FileHeader h;
+    h.magic = FILE_MAGIC;
+    h.ackedSeq = ackedSeq;
+    h.dataOffset = HEADER_SIZE;
+    h.reserved = 0;
+    UINT bw = 0, br = 0;
+    code = f_write(&tmpFile, &h, sizeof(FileHeader), &bw);
+
+    DWORD offset = dataOffset;
+    if (code == FR_OK)
+    {
+        code = f_lseek(&file, offset);
+    }
+    while (code == FR_OK && offset < endOffset)
+    {
+        UINT n = (endOffset - offset < sizeof(recordBuffer))? endOffset - offset : sizeof(recordBuffer);
+        code = f_read(&file, recordBuffer, n, &br);
+        if (code == FR_OK && br == n)
+        {
+            code = f_write(&tmpFile, recordBuffer, n, &bw);
+        }
+        if (code == FR_OK && (br != n || bw != n))
+        {
+            code = FR_INT_ERR;
+        }
+        offset += n;
+    }
+    if (f_close(&tmpFile) != FR_OK || code != FR_OK)
+    {
+        f_unlink(TMP_FILE_NAME);
+        return false;
+    }
+
+    // the new file is complete: the old one is replaced. If this step is interrupted,
+    // start() restores the journal from the temporary file
+    f_close(&file);
+    code = f_unlink(fileName);
+    if (code == FR_OK)
+    {
+        code = f_rename(TMP_FILE_NAME, fileName);
+    }
+    if (f_open(&file, fileName, FA_OPEN_EXISTING | FA_READ | FA_WRITE) != FR_OK)
+    {
+        USART_DEBUG("Can not reopen journal file " << fileName << ": " << code);
+        active = false;
+        storage.release();
+        return false;
+    }
+    return code == FR_OK;
+}
+
+void ReportJournal::sendBatch ()
+{
+    uint32_t seq = sentSeq;
+    RecordHeader r;
+    for (size_t i = 0; i < BATCH_RECORDS && sendOffset < endOffset; ++i)
+    {
+        if (!readRecord(sendOffset, seq + 1, r))
+        {
+            USART_DEBUG("Can not read record " << seq + 1);
+            break;
+        }
+        size_t len = fillFrame(r);
+        if (!sender.sendMessage("TCP", server, port, frameBuffer, len,
+                                EspSender::Priority::NORMAL, EspSender::NO_COALESCE, this))
+        {
+            break;
+        }
+        sendOffset += getRecordSize(r.length);
+        seq = r.seq;
+    }
+    if (seq != sentSeq)
+    {
+        sentSeq = seq;
+        batchInFlight = true;
+    }
+}
+
+size_t ReportJournal::fillFrame (const RecordHeader & r)
+{
+    // the report is embedded as is: the frame shall have the same format
+    Encoder & e = (r.format == (uint8_t)Encoder::Format::JSON)? (Encoder &)jsonFrame : (Encoder &)cborFrame;
+    e.reset();
+    e.beginMap(3);
+    e.putKey(FRAME_SEQ, "seq");
+    e.putUInt(r.seq);
+    e.putKey(FRAME_TIME, "time");
+    e.putTimestamp(r.timestamp);
+    e.putKey(FRAME_REPORT, "report");
+    e.putRaw(recordBuffer + sizeof(RecordHeader), r.length);
+    e.endMap();
+    return e.getSize();
+}
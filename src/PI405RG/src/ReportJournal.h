@@ -0,0 +1,174 @@
+/*******************************************************************************
+ * Test unit for the development board: STM32F405RGT6
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef REPORTJOURNAL_H_
+#define REPORTJOURNAL_H_
+
+#include "EspSender.h"
+#include "StmPlusPlus/DataLogger.h"
+#include "StmPlusPlus/Serializer.h"
+
+/**
+ * @brief Class that implements a persistent store-and-forward journal of the outgoing reports.
+ *
+ * Every report is appended to a journal file on the SD card with a sequence number and a time
+ * stamp. The journal is forwarded to the server using EspSender in batches of several records.
+ * Each record is sent as a frame map {seq, time, report} encoded in the same format as
+ * the report. The server confirms the received records by a message "ACK <seq>" that acknowledges all
+ * records up to the given sequence number. The confirmed records are removed from the file
+ * start by the compaction. If no acknowledge arrives within ACK_TIMEOUT after the transmission,
+ * all unconfirmed records are sent again: the server shall skip the already known sequence
+ * numbers.
+ *
+ * File layout (little-endian): FileHeader followed by the records. A record consists of
+ * RecordHeader, payload and a Fletcher-16 checksum over the header and the payload. After a
+ * reset, the journal is recovered from the file header and the valid records: a record
+ * interrupted by a power loss is discarded.
+ *
+ * The next sequence number is also kept in the RTC backup register SEQ_REGISTER. If the journal
+ * file is recreated (deleted, corrupted or another card) or empty, the numbering continues from this
+ * register: the server never sees a number again that it might already know.
+ *
+ * The file size is bounded: if the file is full, the confirmed records are compacted first
+ * and, if this is not enough, the oldest unconfirmed records are dropped.
+ */
+class ReportJournal final : public Devices::Esp11::EventHandler
+{
+public:
+
+    static const uint32_t FILE_MAGIC = 0x4C4E524A; // "JRNL"
+    static const uint8_t RECORD_SYNC = 0x5A;
+    static const size_t FRAME_OVERHEAD = 64; // frame map, sequence number and time stamp
+    static const size_t MAX_PAYLOAD = EspSender::MESSAGE_SIZE - FRAME_OVERHEAD;
+    static const size_t BATCH_RECORDS = 4; // records sent within a single transmission
+    static const time_ms ACK_TIMEOUT = 30000L;
+    static const uint32_t ANY_SEQ = 0; // accepts a record with any sequence number
+    static const uint32_t SEQ_REGISTER = RTC_BKP_DR0; // RTC backup register of the next sequence number
+
+    typedef struct
+    {
+        uint32_t magic;      /* Always FILE_MAGIC */
+        uint32_t ackedSeq;   /* All records up to this sequence number are confirmed */
+        uint32_t dataOffset; /* File offset of the first unconfirmed record */
+        uint32_t reserved;
+    } __attribute__((__packed__)) FileHeader;
+
+    typedef struct
+    {
+        uint8_t sync;        /* Always RECORD_SYNC */
+        uint8_t format;      /* Encoder::Format of the payload */
+        uint16_t length;     /* Payload length in bytes */
+        uint32_t seq;        /* Sequence number, the first record has number 1 */
+        uint32_t timestamp;  /* RTC time in seconds */
+    } __attribute__((__packed__)) RecordHeader;
+
+    static const size_t HEADER_SIZE = sizeof(FileHeader);
+    static const size_t RECORD_OVERHEAD = sizeof(RecordHeader) + sizeof(uint16_t);
+
+    ReportJournal (StorageManager & _storage, RealTimeClock & _rtc, EspSender & _sender);
+
+    inline bool isActive () const
+    {
+        return active;
+    }
+
+    /**
+     * @brief Returns the number of records not yet confirmed by the server.
+     */
+    inline uint32_t getPendingRecords () const
+    {
+        return nextSeq - 1 - ackedSeq;
+    }
+
+    inline uint32_t getAckedSeq () const
+    {
+        return ackedSeq;
+    }
+
+    inline uint32_t getDroppedRecords () const
+    {
+        return droppedRecords;
+    }
+
+    bool start (const char * _fileName, DWORD _maxFileSize, const char * _server, const char * _port);
+
+    bool append (const void * data, size_t len, StmPlusPlus::Encoder::Format format);
+
+    void acknowledge (uint32_t seq);
+
+    void periodic ();
+
+    void stop ();
+
+    virtual void onInputMessage (int32_t linkId, const char * data, size_t len);
+
+private:
+
+    const char * TMP_FILE_NAME = "JOURNAL.TMP";
+    const char * RESP_ACK = "ACK";
+
+    // Frame keys
+    static const uint32_t FRAME_SEQ = 0;
+    static const uint32_t FRAME_TIME = 1;
+    static const uint32_t FRAME_REPORT = 2;
+
+    StorageManager & storage;
+    RealTimeClock & rtc;
+    EspSender & sender;
+
+    // Journal file
+    const char * fileName;
+    FIL file, tmpFile;
+    bool active;
+    DWORD maxFileSize;
+    DWORD dataOffset, sendOffset, endOffset;
+    uint32_t ackedSeq, sentSeq, nextSeq;
+
+    // Forwarding
+    const char * server;
+    const char * port;
+    bool batchInFlight;
+    time_ms ackDeadline;
+
+    // Statistics
+    uint32_t droppedRecords, compactions, retransmissions;
+
+    uint8_t recordBuffer[RECORD_OVERHEAD + MAX_PAYLOAD];
+    char frameBuffer[EspSender::MESSAGE_SIZE];
+    StmPlusPlus::CborEncoder cborFrame;
+    StmPlusPlus::JsonEncoder jsonFrame;
+
+    static inline DWORD getRecordSize (size_t length)
+    {
+        return RECORD_OVERHEAD + length;
+    }
+
+    bool recover ();
+    bool restoreSeq ();
+    bool writeHeader ();
+    bool readRecord (DWORD offset, uint32_t expectedSeq, RecordHeader & r);
+    bool makeRoom (DWORD size);
+    void dropRecords (DWORD size);
+    bool compact ();
+    bool copyRecords ();
+    void sendBatch ();
+    size_t fillFrame (const RecordHeader & r);
+};
+
+#endif
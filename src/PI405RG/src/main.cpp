@@ -19,7 +19,12 @@
 
 #include "StmPlusPlus/StmPlusPlus.h"
 #include "StmPlusPlus/WavStreamer.h"
+#include "StmPlusPlus/DataLogger.h"
+#include "StmPlusPlus/Serializer.h"
+#include "StmPlusPlus/SoeRecorder.h"
+#include "ReportJournal.h"
 #include "StmPlusPlus/Devices/Button.h"
+#include "StmPlusPlus/Devices/ShiftRegisterScanner.h"
 #include "EspSender.h"
 
 #include <array>
@@ -29,11 +34,49 @@ using namespace StmPlusPlus::Devices;
 
 #define USART_DEBUG_MODULE "Main: "
 
-class MyApplication : public RealTimeClock::EventHandler, WavStreamer::EventHandler, Devices::Button::EventHandler
+// Journal of the input edges and pages of the data logger: static objects, since the application
+// object is on the stack
+SoeRecorder::Journal soeJournal;
+DataLogger::Pages loggerPages;
+
+class MyApplication : public RealTimeClock::EventHandler, WavStreamer::EventHandler, Devices::Button::EventHandler, Timer::EventHandler,
+                      Esp11::EventHandler
 {
 public:
 
     static const size_t INPUT_PINS = 8;  // Number of monitored input pins
+    static const uint32_t INPUT_MASK = (1UL << INPUT_PINS) - 1; // Input bank bits of the monitored pins
+    static const size_t SHIFT_SCK_INPUT = 1; // PA5: input pin 1, or SCK of the shift registers if enabled
+    static const uint8_t RECORD_INPUT_PINS = 1; // Data logger record type: state of input pins
+    static const uint8_t RECORD_INPUT_EDGE = 2; // Data logger record type: EdgeRecord
+    static const uint32_t SAMPLING_FREQ = 1000; // Input pins sampling frequency for data logger and SOE recorder, Hz
+    static const uint32_t SHIFT_FREQ = 1000; // Default refresh frequency of the shift registers, Hz
+    static const uint32_t MAX_SHIFT_FREQ = 50000; // a frame of 8 bytes takes 12.2 us at 5.25 MHz
+    static const uint32_t MSG_KEY_STATE = 1; // Coalescing key of pin state reports
+    static const uint32_t MSG_KEY_NTP = 2; // Coalescing key of NTP requests
+    static const size_t EDGES_PER_REPORT = 3; // a JSON edge report fits into the journal record
+    static const size_t EDGES_PER_SPILL = 8; // edges moved to the data logger per main loop cycle
+
+    // Report schema: numeric keys are used by the binary format, names by the text one
+    static const uint32_t KEY_NAME = 0;
+    static const uint32_t KEY_BOARD = 1;
+    static const uint32_t KEY_TIME = 2;
+    static const uint32_t KEY_PINS = 3; // bit i is the state of the input pin i
+    static const uint32_t KEY_COUNTERS = 4;
+    static const uint32_t KEY_EDGES = 5; // [seq, pin, level, seconds, microseconds] per edge
+    static const uint32_t KEY_EXT_PINS = 6; // shift register inputs as 32-bit words, the lowest first
+    static const uint32_t KEY_SENT = 0;
+    static const uint32_t KEY_COALESCED = 1;
+    static const uint32_t KEY_DROPPED = 2;
+    static const uint32_t KEY_LOST = 3;
+
+    typedef struct
+    {
+        uint64_t time;  /* Microseconds since the recorder start */
+        uint32_t seq;   /* Sequence number of the edge */
+        uint8_t input;  /* Input pin number */
+        uint8_t level;  /* Pin level after the edge */
+    } __attribute__((__packed__)) EdgeRecord;
 
 private:
     
@@ -49,11 +92,15 @@ private:
     InterruptPriority irqPrioEsp;
     InterruptPriority irqPrioSd;
     InterruptPriority irqPrioRtc;
+    InterruptPriority irqPrioSampling;
+    InterruptPriority irqPrioInputs;
+    InterruptPriority irqPrioShift;
 
     // SD card
     IOPin pinSdPower, pinSdDetect;
     IOPort portSd1, portSd2;
     SdCard sdCard;
+    StorageManager storage;
     bool sdCardInserted;
 
     // Configuration
@@ -62,13 +109,31 @@ private:
     // ESP
     Esp11 esp;
     EspSender espSender;
+    ReportJournal journal;
 
     // Input pins
     std::array<IOPin, INPUT_PINS> pins;
-    std::array<bool, INPUT_PINS> pinsState;
+    InputBank inputBank;
+    uint32_t inputMask; // bits of INPUT_MASK not taken by the shift registers
+
+    // Sequence of events: next edges to be reported and to be written by the data logger
+    SoeRecorder recorder;
+    uint32_t reportSeq, spillSeq;
+
+    // Shift register expansion: 74HC165 inputs and 74HC595 outputs on SPI1
+    Spi shiftSpi;
+    IOPin pinShiftLatch;
+    Devices::ShiftRegisterScanner shiftRegisters;
+    Timer shiftTimer;
+
+    // Data logger
+    DataLogger logger;
+    Timer samplingTimer;
 
     // Message
     char messageBuffer[2048];
+    CborEncoder cborReport;
+    JsonEncoder jsonReport;
 
     // I2S2 Audio
     I2S i2s;
@@ -78,6 +143,7 @@ private:
 
     // NTP data
     struct RealTimeClock::NtpPacket ntpPacket;
+    bool ntpReceived;
 
 public:
     
@@ -98,6 +164,9 @@ public:
             irqPrioEsp(5, 0),
             irqPrioSd(3, 0), // SD DMA interrupt priority: 4 will be also used
             irqPrioRtc(2, 0),
+            irqPrioSampling(1, 0),
+            irqPrioInputs(1, 1), // all EXTI lines use the same priority: the edge queues have a single producer
+            irqPrioShift(1, 2),
             
             // SD card
             pinSdPower(IOPort::A, GPIO_PIN_15, GPIO_MODE_OUTPUT_PP, GPIO_PULLDOWN, GPIO_SPEED_HIGH, true, false),
@@ -115,14 +184,17 @@ public:
                     /* pin      = */GPIO_PIN_2,
                     /* callInit = */false),
             sdCard(pinSdDetect, portSd1, portSd2),
+            storage(sdCard, pinSdPower),
             sdCardInserted(false),
             
             // Configuration
-            config(pinSdPower, sdCard, "conf.txt"),
+            config(storage, "conf.txt"),
 
-            //ESP
+            // ESP: PA2 --> USART2 TX, PA3 --> USART2 RX, PA1 --> power, PA0 --> USART2 CTS
+            // PA1 is also USART2 RTS: only CTS is available for the flow control
             esp(rtc, Usart::USART_2, IOPort::A, GPIO_PIN_2, GPIO_PIN_3, irqPrioEsp, IOPort::A, GPIO_PIN_1),
-            espSender(rtc, esp, ledRed),
+            espSender(rtc, esp, config, ledRed),
+            journal(storage, rtc, espSender),
 
             // Input pins
             pins { { IOPin(IOPort::A, GPIO_PIN_4,  GPIO_MODE_INPUT, GPIO_PULLUP),
@@ -134,6 +206,26 @@ public:
                      IOPin(IOPort::B, GPIO_PIN_0,  GPIO_MODE_INPUT, GPIO_PULLUP),
                      IOPin(IOPort::B, GPIO_PIN_1,  GPIO_MODE_INPUT, GPIO_PULLUP)
             } },
+            inputMask(INPUT_MASK),
+            recorder(inputBank, soeJournal),
+            reportSeq(1),
+            spillSeq(1),
+
+            // Shift registers: PA5 --> SCK, PB4 --> MISO, PB5 --> MOSI, PB8 --> latch
+            // the pins are configured by startShiftRegisters() only if the shift registers are enabled
+            shiftSpi(Spi::DeviceName::SPI_1, IOPort::A, GPIO_PIN_5, IOPort::B, GPIO_PIN_4, IOPort::B, GPIO_PIN_5,
+                     GPIO_NOPULL, false),
+            pinShiftLatch(IOPort::B, GPIO_PIN_8, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, false, true),
+            shiftRegisters(shiftSpi, pinShiftLatch, DMA2_Stream0, DMA2_Stream5, DMA_CHANNEL_3),
+            shiftTimer(Timer::TIM_7, TIM7_IRQn),
+
+            // Data logger
+            logger(storage, loggerPages),
+            samplingTimer(Timer::TIM_5, TIM5_IRQn),
+
+            // Message
+            cborReport(messageBuffer, sizeof(messageBuffer)),
+            jsonReport(messageBuffer, sizeof(messageBuffer)),
 
             // I2S2 Audio Configuration
             // PB10 --> I2S2_CK
@@ -144,10 +236,11 @@ public:
                      /* power    = */ IOPort::B, GPIO_PIN_11,
                      /* mute     = */ IOPort::B, GPIO_PIN_13,
                      /* smplFreq = */ IOPort::B, GPIO_PIN_14),
-            streamer(sdCard, audioDac),
+            streamer(storage, audioDac),
             playButton(IOPort::B, GPIO_PIN_2, GPIO_PULLUP, rtc)
     {
         mco.activateClockOutput(RCC_MCO1SOURCE_PLLCLK, RCC_MCODIV_5);
+        esp.assignFlowControlPins(IOPort::A, GPIO_PIN_0, 0);
     }
     
     virtual ~MyApplication ()
@@ -170,10 +263,21 @@ public:
         return esp;
     }
 
+    inline const Timer & getSamplingTimer () const
+    {
+        return samplingTimer;
+    }
+
+    inline const Timer & getShiftTimer () const
+    {
+        return shiftTimer;
+    }
+
     void run ()
     {
         log.initInstance();
         HAL_Delay(100);
+        CycleCounter::start();
 
         USART_DEBUG("--------------------------------------------------------");
         USART_DEBUG("Oscillator frequency: " 
@@ -194,79 +298,282 @@ public:
             updateSdCardState();
         }
         
-        USART_DEBUG("Input pins: " << pins.size());
-        pinsState.fill(true);
-        USART_DEBUG("Pin state: " << fillMessage());
+        for (auto & p : pins)
+        {
+            inputBank.addPins(p);
+        }
+        if (isShiftRegistersEnabled())
+        {
+            // the input pin is SPI SCK: it keeps its bank bit, but is not monitored
+            inputMask &= ~(1UL << SHIFT_SCK_INPUT);
+        }
+        // a pin sharing the EXTI line with a pin of an other port stays polled
+        size_t extiPins = 0;
+        for (size_t i = 0; i < INPUT_PINS; ++i)
+        {
+            if ((inputMask >> i) & 1)
+            {
+                extiPins += inputBank.addInterrupt(pins[i], irqPrioInputs);
+            }
+        }
+        USART_DEBUG("Input pins: " << __builtin_popcount(inputMask) << ", with EXTI: " << extiPins);
+        // idle state of the pulled-up inputs: a low pin is reported by the first scan
+        inputBank.setState(inputBank.getMask());
+        recorder.start(inputMask, inputBank.read());
+        encodeReport(jsonReport);
+        USART_DEBUG("Pin state: " << jsonReport.getString());
         esp.assignSendLed(&ledGreen);
 
         streamer.stop();
         streamer.setHandler(this);
         streamer.setVolume(1.0);
         playButton.setHandler(this);
+        playButton.startInterrupt(irqPrioInputs);
+        startDataLogger();
+        startSampling();
+        startShiftRegisters();
 
-        bool reportState = false, ntpReceived = false;
+        ntpReceived = false;
         while (true)
         {
             updateSdCardState();
             playButton.periodic();
             streamer.periodic();
+            logger.periodic();
 
             if (isInputPinsChanged())
             {
-                USART_DEBUG("Input pins change detected");
+                if (inputBank.getEdges() != 0)
+                {
+                    USART_DEBUG("Input pins change detected, "
+                                << CycleCounter::toMicros(CycleCounter::getValue() - inputBank.getLastEdgeTime())
+                                << " us after the edge");
+                }
+                else
+                {
+                    USART_DEBUG("Input pins change detected");
+                }
                 ledBlue.putBit(true);
-                reportState = true;
+                if (!config.isReportEdges())
+                {
+                    reportState();
+                }
+            }
+            if (config.isReportEdges() && recorder.getLastSeq() >= reportSeq)
+            {
+                reportEdges();
             }
+            spillEdges();
 
             espSender.periodic();
+            journal.periodic();
             if (espSender.isOutputMessageSent())
             {
-                if (reportState)
-                {
-                    espSender.sendMessage(config, "TCP", config.getServerIp(), config.getServerPort(), fillMessage());
-                    reportState = false;
-                }
-                if (!reportState)
-                {
-                    ledBlue.putBit(false);
-                }
+                ledBlue.putBit(false);
             }
 
             if (esp.getInputMessageSize() > 0)
             {
+                // a message from the state report server: not used yet
+                USART_DEBUG("Server message received from link " << esp.getInputLinkId() << ": " << esp.getInputMessageSize() << " bytes");
                 esp.getInputMessage(messageBuffer, esp.getInputMessageSize());
-                ::memcpy(&ntpPacket, messageBuffer, RealTimeClock::NTP_PACKET_SIZE);
-                rtc.decodeNtpMessage(ntpPacket);
-                ntpReceived = true;
-                reportState = true;
             }
 
             if (heartbeatEvent.isOccured())
             {
-                if (!ntpReceived && espSender.isOutputMessageSent())
+                if (!ntpReceived)
                 {
                     rtc.fillNtpRrequst(ntpPacket);
-                    espSender.sendMessage(config, "UDP", config.getNtpServer(), "123", (const char *)(&ntpPacket), RealTimeClock::NTP_PACKET_SIZE);
+                    espSender.sendMessage("UDP", config.getNtpServer(), "123", (const char *)(&ntpPacket),
+                                          RealTimeClock::NTP_PACKET_SIZE, EspSender::Priority::HIGH, MSG_KEY_NTP, this);
                 }
                 ledGreen.putBit(heartbeatEvent.occurance() == 1);
             }
         }
     }
     
-    bool isInputPinsChanged ()
+    virtual void onInputMessage (int32_t /*linkId*/, const char * data, size_t len)
     {
-        bool isChanged = false;
-        for (size_t i = 0; i < INPUT_PINS; ++i)
+        // NTP server response
+        if (len < RealTimeClock::NTP_PACKET_SIZE)
         {
-            if (pins[i].getBit() != pinsState[i])
+            return;
+        }
+        ::memcpy(&ntpPacket, data, RealTimeClock::NTP_PACKET_SIZE);
+        rtc.decodeNtpMessage(ntpPacket);
+        ntpReceived = true;
+        reportState();
+    }
+
+    inline Encoder & getReportEncoder ()
+    {
+        return (config.getReportFormat() == Encoder::Format::JSON)?
+                (Encoder &)jsonReport : (Encoder &)cborReport;
+    }
+
+    bool sendReport (const Encoder & e, uint32_t coalesceKey)
+    {
+        // the journal keeps every report until it is confirmed by the server
+        if (e.isOverflow())
+        {
+            USART_DEBUG("Report does not fit into the buffer");
+            return false;
+        }
+        if (journal.isActive() && journal.append(e.getData(), e.getSize(), e.getFormat()))
+        {
+            return true;
+        }
+        return espSender.sendMessage("TCP", config.getServerIp(), config.getServerPort(), (const char *)e.getData(),
+                                     e.getSize(), EspSender::Priority::NORMAL, coalesceKey);
+    }
+
+    void reportState ()
+    {
+        // without journal, only the latest state report is kept in the queue
+        Encoder & e = getReportEncoder();
+        encodeReport(e);
+        sendReport(e, MSG_KEY_STATE);
+    }
+
+    void reportEdges ()
+    {
+        // the edges are consumed only if the report is accepted: edge reports are never coalesced
+        if (!journal.isActive() && espSender.isQueueFull())
+        {
+            // the edges wait in the recorder: neither encoded nor dropped on every loop pass
+            return;
+        }
+        SoeRecorder::Event events[EDGES_PER_REPORT];
+        uint32_t seq = reportSeq;
+        size_t n = recorder.read(seq, events, EDGES_PER_REPORT);
+        if (n == 0)
+        {
+            return;
+        }
+        if (events[0].seq != reportSeq)
+        {
+            USART_DEBUG("Input edges overwritten before report: " << (int)(events[0].seq - reportSeq));
+        }
+        Encoder & e = getReportEncoder();
+        encodeEdgeReport(e, events, n);
+        if (sendReport(e, EspSender::NO_COALESCE))
+        {
+            reportSeq = seq;
+        }
+    }
+
+    void spillEdges ()
+    {
+        if (!logger.isActive())
+        {
+            spillSeq = recorder.getLastSeq() + 1;
+            return;
+        }
+        SoeRecorder::Event events[EDGES_PER_SPILL];
+        uint32_t seq = spillSeq;
+        size_t n = recorder.read(seq, events, EDGES_PER_SPILL);
+        for (size_t i = 0; i < n; ++i)
+        {
+            EdgeRecord r;
+            r.time = events[i].time;
+            r.seq = events[i].seq;
+            r.input = events[i].input;
+            r.level = events[i].level;
+            if (!logger.putRecord(RECORD_INPUT_EDGE, &r, sizeof(r)))
             {
-                isChanged = true;
-                pinsState[i] = pins[i].getBit();
+                // the logger pages are full: retried in the next cycle
+                seq = events[i].seq;
+                break;
             }
         }
-        return isChanged;
+        spillSeq = seq;
+    }
+
+    bool isInputPinsChanged ()
+    {
+        bool changed = (inputBank.scan() & inputMask) != 0;
+        if (shiftRegisters.isActive() && shiftRegisters.scan() != 0)
+        {
+            // the outputs show the state of the shift register inputs
+            shiftRegisters.setOutputs(shiftRegisters.getState());
+            changed = true;
+        }
+        return changed;
     }
     
+    void startJournal ()
+    {
+        if (config.getJournalFile()[0] == 0 || config.getJournalSize() <= 0)
+        {
+            return;
+        }
+        journal.start(config.getJournalFile(), (DWORD)config.getJournalSize() * 1024,
+                      config.getServerIp(), config.getServerPort());
+    }
+
+    void startDataLogger ()
+    {
+        if (config.getLogFile()[0] == 0 || config.getLogSize() <= 0)
+        {
+            return;
+        }
+        logger.start(config.getLogFile(), (DWORD)config.getLogSize() * 1024);
+    }
+
+    void startSampling ()
+    {
+        // TIM5 is clocked by 2 * APB1 = MCU frequency / 4
+        HAL_StatusTypeDef status = samplingTimer.start(TIM_COUNTERMODE_UP,
+                System::getMcuFreq() / 4 / 1000000 - 1, 1000000 / SAMPLING_FREQ - 1);
+        USART_DEBUG("Sampling timer start status: " << status);
+        samplingTimer.startInterrupt(irqPrioSampling, this);
+    }
+
+    inline bool isShiftRegistersEnabled () const
+    {
+        return config.getShiftInputs() > 0 || config.getShiftOutputs() > 0;
+    }
+
+    void startShiftRegisters ()
+    {
+        if (!isShiftRegistersEnabled())
+        {
+            return;
+        }
+        // the latch idles high: the output data register is set by the constructor
+        pinShiftLatch.setMode(GPIO_MODE_OUTPUT_PP);
+        // SPI1 is clocked by APB2 = MCU frequency / 8 = 21 MHz: up to 21 MHz / 2 = 10.5 MHz. The shift
+        // registers use 21 MHz / 4 = 5.25 MHz, mode 0
+        HAL_StatusTypeDef status = shiftSpi.start(SPI_DIRECTION_2LINES, SPI_BAUDRATEPRESCALER_4, SPI_DATASIZE_8BIT,
+                                                  SPI_PHASE_1EDGE, SPI_POLARITY_LOW);
+        if (status != HAL_OK || !shiftRegisters.start(config.getShiftInputs(), config.getShiftOutputs()))
+        {
+            return;
+        }
+        uint32_t freq = (config.getShiftFreq() > 0)? config.getShiftFreq() : SHIFT_FREQ;
+        if (freq > MAX_SHIFT_FREQ)
+        {
+            USART_DEBUG("Shift register frequency " << freq << " is limited to " << MAX_SHIFT_FREQ);
+            freq = MAX_SHIFT_FREQ;
+        }
+        // TIM7 is clocked by 2 * APB1 = MCU frequency / 4
+        status = shiftTimer.start(TIM_COUNTERMODE_UP, System::getMcuFreq() / 4 / 1000000 - 1, 1000000 / freq - 1);
+        USART_DEBUG("Shift register timer start status: " << status << ", frequency: " << freq);
+        shiftTimer.startInterrupt(irqPrioShift, &shiftRegisters);
+    }
+
+    virtual void onTimerUpdate (const Timer *)
+    {
+        uint32_t timestamp = CycleCounter::getValue();
+        uint32_t levels = (uint32_t)inputBank.read();
+        recorder.sample(levels, timestamp);
+        if (logger.isActive())
+        {
+            uint8_t state = (uint8_t)(levels & inputMask);
+            logger.putRecord(RECORD_INPUT_PINS, &state, sizeof(state));
+        }
+    }
+
     virtual void onRtcWakeUp ()
     {
         if (espSender.isOutputMessageSent() && rtc.getTimeSec() % 2 == 0)
@@ -277,33 +584,82 @@ public:
     
     void updateSdCardState ()
     {
+        storage.periodic();
         if (!sdCardInserted && sdCard.isCardInserted())
         {
             config.readConfiguration();
+            // also at boot: the journal is stopped when the card is removed
+            startJournal();
+        }
+        if (sdCardInserted && !sdCard.isCardInserted())
+        {
+            journal.stop();
         }
         sdCardInserted = sdCard.isCardInserted();
     }
 
-    const char * fillMessage ()
+    void encodeReport (Encoder & e)
+    {
+        // the state of the last scan: the report matches the detected change
+        uint32_t pinBits = (uint32_t)inputBank.getState() & inputMask;
+        size_t extWords = (shiftRegisters.getInputs() + 31) / 32;
+        e.reset();
+        e.beginMap(extWords > 0? 6 : 5);
+        e.putKey(KEY_NAME, "name");
+        e.putString("BOARD_STATE");
+        e.putKey(KEY_BOARD, "board");
+        e.putString(config.getBoardId());
+        e.putKey(KEY_TIME, "time");
+        e.putTimestamp(rtc.getTimeSec());
+        e.putKey(KEY_PINS, "pins");
+        e.putUInt(pinBits);
+        if (extWords > 0)
+        {
+            e.putKey(KEY_EXT_PINS, "extPins");
+            e.beginArray(extWords);
+            for (size_t i = 0; i < extWords; ++i)
+            {
+                e.putUInt((uint32_t)(shiftRegisters.getState() >> (32 * i)));
+            }
+            e.endArray();
+        }
+        e.putKey(KEY_COUNTERS, "counters");
+        e.beginMap(4);
+        e.putKey(KEY_SENT, "sent");
+        e.putUInt(espSender.getMessagesSent());
+        e.putKey(KEY_COALESCED, "coalesced");
+        e.putUInt(espSender.getMessagesCoalesced());
+        e.putKey(KEY_DROPPED, "dropped");
+        e.putUInt(espSender.getMessagesDropped());
+        e.putKey(KEY_LOST, "lost");
+        e.putUInt(journal.getDroppedRecords());
+        e.endMap();
+        e.endMap();
+    }
+
+    void encodeEdgeReport (Encoder & e, const SoeRecorder::Event * events, size_t n)
     {
-        char digits[9];
-        ::__utoa(rtc.getTimeSec(), digits, 10);
-        ::strcpy(messageBuffer, "<message>");
-        ::strcat(messageBuffer, "<name>BOARD_STATE</name>");
-        // the first parameter: board ID
-        ::strcat(messageBuffer, "<p>");
-        ::strcat(messageBuffer, config.getBoardId());
-        ::strcat(messageBuffer, "</p>");
-        // the second parameter: state
-        ::strcat(messageBuffer, "<p>");
-        for (auto &p : pins)
+        e.reset();
+        e.beginMap(3);
+        e.putKey(KEY_NAME, "name");
+        e.putString("BOARD_EDGES");
+        e.putKey(KEY_BOARD, "board");
+        e.putString(config.getBoardId());
+        e.putKey(KEY_EDGES, "edges");
+        e.beginArray(n);
+        for (size_t i = 0; i < n; ++i)
         {
-            ::__itoa(p.getBit(), digits, 10);
-            ::strcat(messageBuffer, digits);
+            const SoeRecorder::Event & ev = events[i];
+            e.beginArray(5);
+            e.putUInt(ev.seq);
+            e.putUInt(ev.input);
+            e.putUInt(ev.level);
+            e.putUInt((uint32_t)(ev.time / 1000000UL));
+            e.putUInt((uint32_t)(ev.time % 1000000UL));
+            e.endArray();
         }
-        ::strcat(messageBuffer, "</p>");
-        ::strcat(messageBuffer, "</message>");
-        return &messageBuffer[0];
+        e.endArray();
+        e.endMap();
     }
 
     inline void processDmaTxCpltCallback (I2S_HandleTypeDef * /*channel*/)
@@ -320,16 +676,13 @@ public:
                 USART_DEBUG("SD Card is not inserted");
                 return false;
             }
-            sdCard.clearPort();
-            pinSdPower.setLow();
-            HAL_Delay(250);
         }
         return true;
     }
 
     virtual void onFinishSteaming ()
     {
-        pinSdPower.setHigh();
+        // empty
     }
 
     virtual void onButtonPressed (const Devices::Button * b, uint32_t numOccured)
@@ -398,9 +751,49 @@ void SysTick_Handler (void)
     }
 }
 
+void EXTI0_IRQHandler (void)
+{
+    IOPin::processExtiInterrupt(GPIO_PIN_0);
+}
+
+void EXTI1_IRQHandler (void)
+{
+    IOPin::processExtiInterrupt(GPIO_PIN_1);
+}
+
+void EXTI2_IRQHandler (void)
+{
+    IOPin::processExtiInterrupt(GPIO_PIN_2);
+}
+
+void EXTI3_IRQHandler (void)
+{
+    IOPin::processExtiInterrupt(GPIO_PIN_3);
+}
+
+void EXTI4_IRQHandler (void)
+{
+    IOPin::processExtiInterrupt(GPIO_PIN_4);
+}
+
+void EXTI9_5_IRQHandler (void)
+{
+    IOPin::processExtiInterrupt(GPIO_PIN_5 | GPIO_PIN_6 | GPIO_PIN_7 | GPIO_PIN_8 | GPIO_PIN_9);
+}
+
+void EXTI15_10_IRQHandler (void)
+{
+    IOPin::processExtiInterrupt(GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12 | GPIO_PIN_13 | GPIO_PIN_14 | GPIO_PIN_15);
+}
+
 void TIM5_IRQHandler ()
 {
-    // empty
+    appPtr->getSamplingTimer().processInterrupt();
+}
+
+void TIM7_IRQHandler ()
+{
+    appPtr->getShiftTimer().processInterrupt();
 }
 
 void RTC_WKUP_IRQHandler ()
@@ -465,6 +858,16 @@ void DMA1_Stream4_IRQHandler(void)
     appPtr->getI2S().processDmaTxInterrupt();
 }
 
+void DMA1_Stream5_IRQHandler(void)
+{
+    appPtr->getEsp().processDmaRxInterrupt();
+}
+
+void DMA1_Stream6_IRQHandler(void)
+{
+    appPtr->getEsp().processDmaTxInterrupt();
+}
+
 void HAL_I2S_TxCpltCallback(I2S_HandleTypeDef *channel)
 {
     appPtr->processDmaTxCpltCallback(channel);
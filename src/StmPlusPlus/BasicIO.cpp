@@ -27,6 +27,34 @@ using namespace StmPlusPlus;
 
 #define USART_DEBUG_MODULE "COMM: "
 
+/************************************************************************
+ * Class CycleCounter
+ ************************************************************************/
+
+uint32_t CycleCounter::getThroughput (uint64_t bytes, uint64_t counts)
+{
+    if (counts == 0)
+    {
+        return 0;
+    }
+    return (uint32_t)((bytes * getFrequency()) / (counts * 1024L));
+}
+
+
+const char * CycleCounter::formatThroughput (uint64_t bytes, uint64_t counts, char * buffer)
+{
+    // throughput in 1/100 MB/s
+    uint32_t value = (counts == 0)? 0 : (uint32_t)((bytes * getFrequency() * 100) / (counts * 1024L * 1024L));
+    ::__utoa(value / 100, buffer, 10);
+    size_t len = ::strlen(buffer);
+    buffer[len++] = '.';
+    buffer[len++] = (char)('0' + (value / 10) % 10);
+    buffer[len++] = (char)('0' + value % 10);
+    buffer[len] = 0;
+    return buffer;
+}
+
+
 /************************************************************************
  * Class IOPort
  ************************************************************************/
@@ -88,6 +116,253 @@ void IOPin::activateClockOutput(uint32_t source, uint32_t div)
   HAL_RCC_MCOConfig(RCC_MCO1, source, div);
 }
 
+IOPin::ExtiHandler * IOPin::extiHandlers[IOPin::EXTI_LINES] = { NULL };
+GPIO_TypeDef * IOPin::extiPorts[IOPin::EXTI_LINES] = { NULL };
+
+static IRQn_Type getExtiIrq (uint32_t line)
+{
+    #ifdef STM32L0
+    return (line < 2)? EXTI0_1_IRQn : (line < 4)? EXTI2_3_IRQn : EXTI4_15_IRQn;
+    #else
+    switch (line)
+    {
+        case 0:
+            return EXTI0_IRQn;
+        case 1:
+            return EXTI1_IRQn;
+        case 2:
+            #ifdef STM32F3
+            return EXTI2_TSC_IRQn;
+            #else
+            return EXTI2_IRQn;
+            #endif
+        case 3:
+            return EXTI3_IRQn;
+        case 4:
+            return EXTI4_IRQn;
+        default:
+            return (line < 10)? EXTI9_5_IRQn : EXTI15_10_IRQn;
+    }
+    #endif
+}
+
+bool IOPin::enableExti (Edge edge, const InterruptPriority & prio, ExtiHandler * handler)
+{
+    uint32_t pin = gpioParameters.Pin;
+    if (pin == 0 || pin > GPIO_PIN_15 || (pin & (pin - 1)) != 0)
+    {
+        return false;
+    }
+    uint32_t line = __builtin_ctz(pin);
+    if (extiPorts[line] != NULL && extiPorts[line] != port)
+    {
+        return false;
+    }
+
+    CycleCounter::start();
+    __disable_irq();
+    extiHandlers[line] = handler;
+    extiPorts[line] = port;
+    __enable_irq();
+
+    gpioParameters.Mode = (edge == Edge::RISING)? GPIO_MODE_IT_RISING :
+                          (edge == Edge::FALLING)? GPIO_MODE_IT_FALLING : GPIO_MODE_IT_RISING_FALLING;
+    HAL_GPIO_Init(port, &gpioParameters);
+    IRQn_Type irq = getExtiIrq(line);
+    HAL_NVIC_SetPriority(irq, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(irq);
+    return true;
+}
+
+void IOPin::disableExti ()
+{
+    if (!isExtiEnabled())
+    {
+        return;
+    }
+    uint32_t line = __builtin_ctz(gpioParameters.Pin);
+    // the EXTI configuration is reset by DeInit: a shared vector stays enabled for other lines
+    HAL_GPIO_DeInit(port, gpioParameters.Pin);
+    gpioParameters.Mode = GPIO_MODE_INPUT;
+    HAL_GPIO_Init(port, &gpioParameters);
+    __disable_irq();
+    extiHandlers[line] = NULL;
+    extiPorts[line] = NULL;
+    __enable_irq();
+}
+
+void IOPin::dispatchExti (uint32_t pending, uint32_t timestamp)
+{
+    ExtiEvent event;
+    event.timestamp = timestamp;
+    while (pending != 0)
+    {
+        uint32_t line = __builtin_ctz(pending);
+        pending &= pending - 1;
+        if (line >= EXTI_LINES || extiHandlers[line] == NULL)
+        {
+            continue;
+        }
+        event.line = (uint16_t)line;
+        event.level = (extiPorts[line]->IDR & (1UL << line)) != 0;
+        extiHandlers[line]->onExtiEdge(event);
+    }
+}
+
+/************************************************************************
+ * Class InputBank
+ ************************************************************************/
+
+InputBank::InputBank ():
+    portCount(0),
+    runCount(0),
+    pinCount(0),
+    state(0),
+    changes(0),
+    extiMask(0),
+    edges(0),
+    lastEdgeTime(0),
+    resync(true),
+    edgeHandler(NULL)
+{
+    for (size_t i = 0; i < IOPin::EXTI_LINES; ++i)
+    {
+        extiBits[i] = -1;
+    }
+}
+
+bool InputBank::addPin (GPIO_TypeDef * port, uint32_t pin)
+{
+    if (pinCount >= MAX_PINS || pin == 0 || pin > GPIO_PIN_15 || (pin & (pin - 1)) != 0)
+    {
+        return false;
+    }
+
+    size_t portIdx = 0;
+    while (portIdx < portCount && ports[portIdx] != port)
+    {
+        ++portIdx;
+    }
+    if (portIdx == portCount)
+    {
+        if (portCount >= MAX_PORTS)
+        {
+            return false;
+        }
+        ports[portCount++] = port;
+    }
+
+    int8_t shift = (int8_t)((int)pinCount - __builtin_ctz(pin));
+    if (runCount > 0 && runs[runCount - 1].port == portIdx && runs[runCount - 1].shift == shift)
+    {
+        runs[runCount - 1].mask |= (uint16_t)pin;
+    }
+    else
+    {
+        Run & r = runs[runCount++];
+        r.port = (uint8_t)portIdx;
+        r.shift = shift;
+        r.mask = (uint16_t)pin;
+    }
+    ++pinCount;
+    resync = true;
+    return true;
+}
+
+bool InputBank::addPins (const IOPort & pins)
+{
+    for (uint32_t pin = GPIO_PIN_0; pin <= GPIO_PIN_15; pin <<= 1)
+    {
+        if ((pins.getPins() & pin) != 0 && !addPin(pins.getPort(), pin))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool InputBank::addInterrupt (IOPin & pin, const InterruptPriority & prio)
+{
+    uint32_t p = pin.getPins();
+    if (p == 0 || (p & (p - 1)) != 0)
+    {
+        return false;
+    }
+    int bit = findBit(pin.getPort(), __builtin_ctz(p));
+    if (bit < 0 || !pin.enableExti(IOPin::Edge::BOTH, prio, this))
+    {
+        return false;
+    }
+    extiMask |= (Bits)1 << bit;
+    extiBits[__builtin_ctz(p)] = (int8_t)bit;
+    return true;
+}
+
+void InputBank::onExtiEdge (const IOPin::ExtiEvent & event)
+{
+    events.push(event);
+    if (edgeHandler != NULL && extiBits[event.line] >= 0)
+    {
+        edgeHandler->onInputEdge(extiBits[event.line], event.level, event.timestamp);
+    }
+}
+
+int InputBank::findBit (GPIO_TypeDef * port, uint32_t line) const
+{
+    for (size_t i = 0; i < runCount; ++i)
+    {
+        const Run & r = runs[i];
+        if (ports[r.port] == port && (r.mask & (1UL << line)) != 0)
+        {
+            return (int)line + r.shift;
+        }
+    }
+    return -1;
+}
+
+InputBank::Bits InputBank::scan ()
+{
+    edges = 0;
+    IOPin::ExtiEvent e;
+    while (events.pop(e))
+    {
+        int bit = extiBits[e.line];
+        if (bit >= 0)
+        {
+            edges |= (Bits)1 << bit;
+            lastEdgeTime = e.timestamp;
+        }
+    }
+    if (!resync && edges == 0 && extiMask == getMask())
+    {
+        // all pins are served by EXTI: nothing changed since the last scan
+        changes = 0;
+        return changes;
+    }
+    Bits current = read();
+    changes = (current ^ state) | edges;
+    state = current;
+    resync = false;
+    return changes;
+}
+
+InputBank::Bits InputBank::read () const
+{
+    uint32_t idr[MAX_PORTS];
+    for (size_t i = 0; i < portCount; ++i)
+    {
+        idr[i] = ports[i]->IDR;
+    }
+    Bits bits = 0;
+    for (size_t i = 0; i < runCount; ++i)
+    {
+        const Run & r = runs[i];
+        Bits b = idr[r.port] & r.mask;
+        bits |= (r.shift >= 0)? (b << r.shift) : (b >> -r.shift);
+    }
+    return bits;
+}
+
 /************************************************************************
  * Class Usart
  ************************************************************************/
@@ -107,12 +382,38 @@ Usart::Usart (DeviceName _device, PortName name, uint32_t txPin, uint32_t rxPin)
         setAlternate(GPIO_AF7_USART1);
         usartParameters.Instance = USART1;
         irqName = USART1_IRQn;
+        #ifdef STM32F4
+        rxDma.Instance = DMA2_Stream2;
+        rxDma.Init.Channel = DMA_CHANNEL_4;
+        rxDmaIrq = DMA2_Stream2_IRQn;
+        txDma.Instance = DMA2_Stream7;
+        txDma.Init.Channel = DMA_CHANNEL_4;
+        txDmaIrq = DMA2_Stream7_IRQn;
+        #else
+        rxDma.Instance = DMA1_Channel5;
+        rxDmaIrq = DMA1_Channel5_IRQn;
+        txDma.Instance = DMA1_Channel4;
+        txDmaIrq = DMA1_Channel4_IRQn;
+        #endif
         break;
 
     case USART_2:
         setAlternate(GPIO_AF7_USART2);
         usartParameters.Instance = USART2;
         irqName = USART2_IRQn;
+        #ifdef STM32F4
+        rxDma.Instance = DMA1_Stream5;
+        rxDma.Init.Channel = DMA_CHANNEL_4;
+        rxDmaIrq = DMA1_Stream5_IRQn;
+        txDma.Instance = DMA1_Stream6;
+        txDma.Init.Channel = DMA_CHANNEL_4;
+        txDmaIrq = DMA1_Stream6_IRQn;
+        #else
+        rxDma.Instance = DMA1_Channel6;
+        rxDmaIrq = DMA1_Channel6_IRQn;
+        txDma.Instance = DMA1_Channel7;
+        txDmaIrq = DMA1_Channel7_IRQn;
+        #endif
         break;
 
     case USART_6:
@@ -120,6 +421,14 @@ Usart::Usart (DeviceName _device, PortName name, uint32_t txPin, uint32_t rxPin)
         setAlternate(GPIO_AF8_USART6);
         usartParameters.Instance = USART6;
         irqName = USART6_IRQn;
+        #ifdef STM32F4
+        rxDma.Instance = DMA2_Stream1;
+        rxDma.Init.Channel = DMA_CHANNEL_5;
+        rxDmaIrq = DMA2_Stream1_IRQn;
+        txDma.Instance = DMA2_Stream7;
+        txDma.Init.Channel = DMA_CHANNEL_5;
+        txDmaIrq = DMA2_Stream7_IRQn;
+        #endif
         #endif
         break;
     }
@@ -133,6 +442,30 @@ Usart::Usart (DeviceName _device, PortName name, uint32_t txPin, uint32_t rxPin)
     usartParameters.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
     #endif
     irqStatus = RESET;
+
+    rxDma.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    rxDma.Init.PeriphInc = DMA_PINC_DISABLE;
+    rxDma.Init.MemInc = DMA_MINC_ENABLE;
+    rxDma.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    rxDma.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    rxDma.Init.Mode = DMA_CIRCULAR;
+    rxDma.Init.Priority = DMA_PRIORITY_MEDIUM;
+    #ifdef STM32F4
+    rxDma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    rxDma.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    rxDma.Init.MemBurst = DMA_MBURST_SINGLE;
+    rxDma.Init.PeriphBurst = DMA_PBURST_SINGLE;
+    uint32_t txChannel = txDma.Init.Channel;
+    txDma.Init = rxDma.Init;
+    txDma.Init.Channel = txChannel;
+    #else
+    txDma.Init = rxDma.Init;
+    #endif
+    txDma.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    txDma.Init.Mode = DMA_NORMAL;
+    rxDmaSize = 0;
+    rxDmaHalves = 0;
+    txDmaStarted = false;
 }
 
 void Usart::enableClock()
@@ -169,7 +502,8 @@ HAL_StatusTypeDef Usart::start (uint32_t mode,
                    uint32_t baudRate,
                    uint32_t wordLength/* = UART_WORDLENGTH_8B*/,
                    uint32_t stopBits/* = UART_STOPBITS_1*/,
-                   uint32_t parity/* = UART_PARITY_NONE*/)
+                   uint32_t parity/* = UART_PARITY_NONE*/,
+                   uint32_t hwControl/* = UART_HWCONTROL_NONE*/)
 {
     enableClock();
     usartParameters.Init.Mode = mode;
@@ -177,9 +511,42 @@ HAL_StatusTypeDef Usart::start (uint32_t mode,
     usartParameters.Init.WordLength = wordLength;
     usartParameters.Init.StopBits = stopBits;
     usartParameters.Init.Parity = parity;
+    usartParameters.Init.HwFlowCtl = hwControl;
     return HAL_UART_Init(&usartParameters);
 }
 
+bool Usart::initFlowControlPins (PortName name, uint32_t ctsPin, uint32_t rtsPin)
+{
+    bool ctsValid = (ctsPin == 0), rtsValid = (rtsPin == 0);
+    uint32_t alternate = 0;
+    switch (device)
+    {
+    case USART_1:
+        alternate = GPIO_AF7_USART1;
+        ctsValid |= (name == A && ctsPin == GPIO_PIN_11);
+        rtsValid |= (name == A && rtsPin == GPIO_PIN_12);
+        break;
+    case USART_2:
+        alternate = GPIO_AF7_USART2;
+        ctsValid |= (name == A && ctsPin == GPIO_PIN_0) || (name == D && ctsPin == GPIO_PIN_3);
+        rtsValid |= (name == A && rtsPin == GPIO_PIN_1) || (name == D && rtsPin == GPIO_PIN_4);
+        break;
+    default:
+        // USART6 flow control pins are located on the port G
+        return false;
+    }
+    if (!ctsValid || !rtsValid)
+    {
+        return false;
+    }
+    if ((ctsPin | rtsPin) != 0)
+    {
+        IOPort flowControlPins(name, GPIO_MODE_AF_PP, GPIO_PULLUP, GPIO_SPEED_FREQ_HIGH, ctsPin | rtsPin, false);
+        flowControlPins.setAlternate(alternate);
+    }
+    return true;
+}
+
 HAL_StatusTypeDef Usart::stop ()
 {
     HAL_StatusTypeDef retValue = HAL_UART_DeInit(&usartParameters);
@@ -214,6 +581,130 @@ HAL_StatusTypeDef Usart::receiveIt (const char * buffer, size_t n)
     return HAL_UART_Receive_IT(&usartParameters, (unsigned char *)buffer, n);
 }
 
+void Usart::enableDmaClock ()
+{
+    #ifdef STM32F4
+    if (device == USART_2)
+    {
+        __HAL_RCC_DMA1_CLK_ENABLE();
+    }
+    else
+    {
+        __HAL_RCC_DMA2_CLK_ENABLE();
+    }
+    #else
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    #endif
+}
+
+HAL_StatusTypeDef Usart::startReceiveCircular (const char * buffer, size_t n, const InterruptPriority & prio)
+{
+    enableDmaClock();
+    __HAL_LINKDMA(&usartParameters, hdmarx, rxDma);
+    HAL_StatusTypeDef status = HAL_DMA_Init(&rxDma);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+
+    rxDmaSize = n;
+    rxDmaHalves = 0;
+    #ifdef STM32F4
+    uint32_t dataRegister = (uint32_t)&usartParameters.Instance->DR;
+    #else
+    uint32_t dataRegister = (uint32_t)&usartParameters.Instance->RDR;
+    #endif
+    __HAL_DMA_CLEAR_FLAG(&rxDma, __HAL_DMA_GET_HT_FLAG_INDEX(&rxDma) | __HAL_DMA_GET_TC_FLAG_INDEX(&rxDma));
+    __HAL_DMA_ENABLE_IT(&rxDma, DMA_IT_HT | DMA_IT_TC);
+    HAL_NVIC_SetPriority(rxDmaIrq, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(rxDmaIrq);
+    status = HAL_DMA_Start(&rxDma, dataRegister, (uint32_t)buffer, n);
+    if (status != HAL_OK)
+    {
+        HAL_NVIC_DisableIRQ(rxDmaIrq);
+        return status;
+    }
+    __HAL_UART_CLEAR_IDLEFLAG(&usartParameters);
+    __HAL_UART_ENABLE_IT(&usartParameters, UART_IT_IDLE);
+    SET_BIT(usartParameters.Instance->CR3, USART_CR3_DMAR);
+    return HAL_OK;
+}
+
+void Usart::stopReceiveCircular ()
+{
+    if (rxDmaSize == 0)
+    {
+        return;
+    }
+    CLEAR_BIT(usartParameters.Instance->CR3, USART_CR3_DMAR);
+    __HAL_UART_DISABLE_IT(&usartParameters, UART_IT_IDLE);
+    HAL_NVIC_DisableIRQ(rxDmaIrq);
+    HAL_DMA_Abort(&rxDma);
+    HAL_DMA_DeInit(&rxDma);
+    rxDmaSize = 0;
+}
+
+uint32_t Usart::getReceivedBytes () const
+{
+    if (rxDmaSize == 0)
+    {
+        return 0;
+    }
+    // The write position and the halves counter are not read atomically: if the DMA has already
+    // entered the next half but its interrupt is pending, the position is still counted from
+    // the start of the half that is known to be written
+    const uint32_t half = rxDmaSize / 2;
+    const uint32_t halves = rxDmaHalves;
+    const uint32_t offset = (getReceivePosition() + rxDmaSize - (halves % 2) * half) % rxDmaSize;
+    return halves * half + offset;
+}
+
+void Usart::processDmaRxInterrupt ()
+{
+    if (__HAL_DMA_GET_FLAG(&rxDma, __HAL_DMA_GET_HT_FLAG_INDEX(&rxDma)) != RESET)
+    {
+        __HAL_DMA_CLEAR_FLAG(&rxDma, __HAL_DMA_GET_HT_FLAG_INDEX(&rxDma));
+        ++rxDmaHalves;
+    }
+    if (__HAL_DMA_GET_FLAG(&rxDma, __HAL_DMA_GET_TC_FLAG_INDEX(&rxDma)) != RESET)
+    {
+        __HAL_DMA_CLEAR_FLAG(&rxDma, __HAL_DMA_GET_TC_FLAG_INDEX(&rxDma));
+        ++rxDmaHalves;
+    }
+}
+
+HAL_StatusTypeDef Usart::startTransmitDma (const InterruptPriority & prio)
+{
+    enableDmaClock();
+    __HAL_LINKDMA(&usartParameters, hdmatx, txDma);
+    HAL_StatusTypeDef status = HAL_DMA_Init(&txDma);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    HAL_NVIC_SetPriority(txDmaIrq, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(txDmaIrq);
+    txDmaStarted = true;
+    return HAL_OK;
+}
+
+void Usart::stopTransmitDma ()
+{
+    if (!txDmaStarted)
+    {
+        return;
+    }
+    HAL_NVIC_DisableIRQ(txDmaIrq);
+    HAL_DMA_DeInit(&txDma);
+    txDmaStarted = false;
+}
+
+HAL_StatusTypeDef Usart::transmitDma (const char * buffer, size_t n)
+{
+    irqStatus = RESET;
+    return HAL_UART_Transmit_DMA(&usartParameters, (unsigned char *)buffer, n);
+}
+
 /************************************************************************
  * Class UsartLogger
  ************************************************************************/
@@ -370,6 +861,43 @@ HAL_StatusTypeDef TimerBase::stopCounter ()
     return HAL_TIM_Base_DeInit(&timerParameters);
 }
 
+uint32_t TimerBase::getClockFrequency () const
+{
+    // the timers of APB2: the set depends on the MCU
+    const TIM_TypeDef * tim = timerParameters.Instance;
+    bool apb2 = false;
+    #ifdef TIM1
+    apb2 = apb2 || tim == TIM1;
+    #endif
+    #ifdef TIM8
+    apb2 = apb2 || tim == TIM8;
+    #endif
+    #ifdef TIM9
+    apb2 = apb2 || tim == TIM9;
+    #endif
+    #ifdef TIM10
+    apb2 = apb2 || tim == TIM10;
+    #endif
+    #ifdef TIM11
+    apb2 = apb2 || tim == TIM11;
+    #endif
+    #ifdef TIM15
+    apb2 = apb2 || tim == TIM15;
+    #endif
+    #ifdef TIM16
+    apb2 = apb2 || tim == TIM16;
+    #endif
+    #ifdef TIM17
+    apb2 = apb2 || tim == TIM17;
+    #endif
+    // the timer clock is twice the bus clock if the bus is divided
+    if (apb2)
+    {
+        return HAL_RCC_GetPCLK2Freq() * ((RCC->CFGR & RCC_CFGR_PPRE2) == RCC_CFGR_PPRE2_DIV1? 1 : 2);
+    }
+    return HAL_RCC_GetPCLK1Freq() * ((RCC->CFGR & RCC_CFGR_PPRE1) == RCC_CFGR_PPRE1_DIV1? 1 : 2);
+}
+
 /************************************************************************
  * Class TimerBase
  ************************************************************************/
@@ -42,6 +42,7 @@
 #include <cstring>
 #include <cstdlib>
 #include <functional>
+#include <atomic>
 
 namespace StmPlusPlus {
 
@@ -65,6 +66,162 @@ typedef union
 
 typedef std::pair<uint32_t, uint32_t> InterruptPriority;
 
+/**
+ * @brief High-resolution time stamps based on the DWT cycle counter.
+ *
+ * The counter is 32 bit wide and wraps around after 2^32 MCU cycles (about 25 seconds at 168 MHz):
+ * only differences of time stamps closer than this are meaningful. On a core without DWT, the
+ * millisecond tick is used instead.
+ */
+class CycleCounter final
+{
+public:
+
+    static inline void start ()
+    {
+        #ifdef DWT
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        #endif
+    }
+
+    static inline uint32_t getValue ()
+    {
+        #ifdef DWT
+        return DWT->CYCCNT;
+        #else
+        return HAL_GetTick();
+        #endif
+    }
+
+    /**
+     * @brief Returns the number of counts per second.
+     */
+    static inline uint32_t getFrequency ()
+    {
+        #ifdef DWT
+        return SystemCoreClock;
+        #else
+        return 1000;
+        #endif
+    }
+
+    static inline uint32_t toMicros (uint32_t counts)
+    {
+        return (uint32_t)((uint64_t)counts * 1000000UL / getFrequency());
+    }
+
+    static inline uint32_t toMillis (uint32_t counts)
+    {
+        return counts / (getFrequency() / 1000);
+    }
+
+    /**
+     * @brief Busy wait for the given number of microseconds. The counter shall be started.
+     */
+    static inline void delayMicros (uint32_t us)
+    {
+        #ifdef DWT
+        uint32_t start = DWT->CYCCNT, counts = us * (getFrequency() / 1000000);
+        while (DWT->CYCCNT - start < counts);
+        #else
+        HAL_Delay(us / 1000 + 1);
+        #endif
+    }
+
+    /**
+     * @brief Converts the given amount of bytes processed within the given number of counts
+     *        into a throughput in KB/s.
+     */
+    static uint32_t getThroughput (uint64_t bytes, uint64_t counts);
+
+    /**
+     * @brief Formats the throughput of the given amount of bytes processed within the given
+     *        number of counts in MB/s with two decimal places, like "12.34". The buffer shall
+     *        hold at least 14 characters.
+     */
+    static const char * formatThroughput (uint64_t bytes, uint64_t counts, char * buffer);
+};
+
+/**
+ * @brief Lock-free queue with a single producer and a single consumer, for example an interrupt
+ *        handler and the main loop.
+ *
+ * The capacity N shall be a power of two. The producer shall never be preempted by an other
+ * producer of the same queue: if several interrupts feed the queue, they shall have the same
+ * preemption priority.
+ */
+template<typename T, size_t N> class SpscQueue final
+{
+public:
+
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Queue capacity shall be a power of two");
+
+    SpscQueue () :
+        head(0),
+        tail(0),
+        overflows(0)
+    {
+        // empty
+    }
+
+    /**
+     * @brief Appends an item, called by the producer. If the queue is full, the item is dropped
+     *        and the overflow counter is incremented.
+     */
+    bool push (const T & item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= N)
+        {
+            overflows.store(overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        items[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest item, called by the consumer. Returns false if the queue is empty.
+     */
+    bool pop (T & item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool isEmpty () const
+    {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    inline size_t size () const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the number of items dropped since the queue was full.
+     */
+    inline uint32_t getOverflows () const
+    {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    T items[N];
+    std::atomic<size_t> head, tail;
+    std::atomic<uint32_t> overflows;
+};
+
 /**
  * @brief Base IO port class.
  */
@@ -189,6 +346,22 @@ public:
         return port->IDR;
     }
 
+    /**
+     * @brief Returns the pointer to the port registers.
+     */
+    inline GPIO_TypeDef * getPort () const
+    {
+        return port;
+    }
+
+    /**
+     * @brief Returns the mask of the pins handled by this object.
+     */
+    inline uint32_t getPins () const
+    {
+        return gpioParameters.Pin;
+    }
+
 protected:
 
     /**
@@ -210,6 +383,40 @@ class IOPin : public IOPort
 {
 public:
 
+    static const size_t EXTI_LINES = 16;
+
+    /**
+     * @brief Edge selection for the external interrupt.
+     */
+    enum class Edge
+    {
+        RISING = 0,
+        FALLING = 1,
+        BOTH = 2
+    };
+
+    /**
+     * @brief An edge detected by the external interrupt.
+     */
+    class ExtiEvent
+    {
+    public:
+
+        uint32_t timestamp; // CycleCounter value at the interrupt entry
+        uint16_t line;      // EXTI line, equal to the pin number
+        bool level;         // pin level read in the interrupt handler
+    };
+
+    /**
+     * @brief Receives the edges of an EXTI line. The handler is called in the interrupt context.
+     */
+    class ExtiHandler
+    {
+    public:
+
+        virtual void onExtiEdge (const ExtiEvent & event) =0;
+    };
+
     /**
      * @brief Default constructor.
      */
@@ -243,6 +450,461 @@ public:
      * @brief Activate microcontroller clock output (MCO) for this pin.
      */
     void activateClockOutput (uint32_t source, uint32_t div = RCC_MCODIV_1);
+
+    /**
+     * @brief Connect this pin to its EXTI line and enable the interrupt. Returns false if this
+     *        object does not describe a single pin or the line is already used by an other port.
+     *
+     * @note   The lines 5..9 and 10..15 share an interrupt vector each: the priority of a shared
+     *         vector is set by the last call.
+     */
+    bool enableExti (Edge edge, const InterruptPriority & prio, ExtiHandler * handler);
+
+    /**
+     * @brief Disconnect this pin from the EXTI line, the pin stays an input.
+     */
+    void disableExti ();
+
+    inline bool isExtiEnabled () const
+    {
+        return (gpioParameters.Mode & EXTI_MODE_FLAG) != 0;
+    }
+
+    /**
+     * @brief Serves the EXTI interrupt for the given lines (a mask of GPIO_PIN_x), shall be called
+     *        from EXTIx_IRQHandler.
+     */
+    static inline void processExtiInterrupt (uint32_t lines)
+    {
+        uint32_t pending = __HAL_GPIO_EXTI_GET_IT(lines);
+        __HAL_GPIO_EXTI_CLEAR_IT(pending);
+        dispatchExti(pending, CycleCounter::getValue());
+    }
+
+    /**
+     * @brief Calls the handlers of the given pending lines.
+     */
+    static void dispatchExti (uint32_t pending, uint32_t timestamp);
+
+    /**
+     * @brief Returns the port connected to the given EXTI line, or NULL.
+     */
+    static inline GPIO_TypeDef * getExtiPort (uint32_t line)
+    {
+        return (line < EXTI_LINES)? extiPorts[line] : NULL;
+    }
+
+private:
+
+    // HAL GPIO modes with this bit are the external interrupt/event modes
+    static const uint32_t EXTI_MODE_FLAG = 0x10000000U;
+
+    static ExtiHandler * extiHandlers[EXTI_LINES];
+    static GPIO_TypeDef * extiPorts[EXTI_LINES];
+};
+
+
+/**
+ * @brief Compile-time access to the registers of a GPIO port.
+ *
+ * All functions are inlined into a constant register address: no object and no RAM are required.
+ */
+template<IOPort::PortName Port> class GpioRegisters final
+{
+public:
+
+    static inline GPIO_TypeDef * get ()
+    {
+        switch (Port)
+        {
+        case IOPort::A:
+            return GPIOA;
+        case IOPort::B:
+            return GPIOB;
+        case IOPort::C:
+            return GPIOC;
+        #ifdef GPIOD
+        case IOPort::D:
+            return GPIOD;
+        #endif
+        #ifdef GPIOF
+        case IOPort::F:
+            return GPIOF;
+        #endif
+        default:
+            return NULL;
+        }
+    }
+
+    static inline void enableClock ()
+    {
+        switch (Port)
+        {
+        case IOPort::A:
+            __GPIOA_CLK_ENABLE();
+            break;
+        case IOPort::B:
+            __GPIOB_CLK_ENABLE();
+            break;
+        case IOPort::C:
+            __GPIOC_CLK_ENABLE();
+            break;
+        #ifdef GPIOD
+        case IOPort::D:
+            __GPIOD_CLK_ENABLE();
+            break;
+        #endif
+        #ifdef GPIOF
+        case IOPort::F:
+            __GPIOF_CLK_ENABLE();
+            break;
+        #endif
+        default:
+            break;
+        }
+    }
+
+    /**
+     * @brief Configures the given pins using HAL_GPIO_Init. The parameters are not stored.
+     */
+    static void init (uint32_t pins, uint32_t mode, uint32_t pull, uint32_t speed, uint32_t alternate = 0)
+    {
+        enableClock();
+        GPIO_InitTypeDef gpioParameters;
+        gpioParameters.Pin = pins;
+        gpioParameters.Mode = mode;
+        gpioParameters.Pull = pull;
+        gpioParameters.Speed = speed;
+        gpioParameters.Alternate = alternate;
+        HAL_GPIO_Init(get(), &gpioParameters);
+    }
+};
+
+
+/**
+ * @brief Class that describes a single port pin known at compile time.
+ *
+ * In contrast to IOPin, the port and the pin number (0..15) are template parameters: the class has
+ * no data members, and each operation compiles to a single BSRR store or IDR load without a call
+ * to HAL. All methods are static, an object of this class can be used in the same way as IOPin.
+ * The pin is configured by init() or by an IOPin/IOPort object for the same pin.
+ */
+template<IOPort::PortName Port, uint32_t PinNr> class FastPin final
+{
+public:
+
+    static_assert(PinNr < 16, "GPIO pin number shall be in range 0..15");
+
+    static const uint32_t MASK = 1UL << PinNr;
+
+    static inline void init (uint32_t mode, uint32_t pull = GPIO_NOPULL, uint32_t speed = GPIO_SPEED_HIGH,
+                             uint32_t alternate = 0)
+    {
+        GpioRegisters<Port>::init(MASK, mode, pull, speed, alternate);
+    }
+
+    static inline void setHigh ()
+    {
+        GpioRegisters<Port>::get()->BSRR = MASK;
+    }
+
+    static inline void setLow ()
+    {
+        GpioRegisters<Port>::get()->BSRR = MASK << 16;
+    }
+
+    static inline void putBit (bool value)
+    {
+        GpioRegisters<Port>::get()->BSRR = value? MASK : (MASK << 16);
+    }
+
+    static inline bool getBit ()
+    {
+        return (GpioRegisters<Port>::get()->IDR & MASK) != 0;
+    }
+
+    /**
+     * @brief Toggle the pin. The output is changed by a single BSRR write: other pins of the
+     *        port modified from an interrupt are not affected.
+     */
+    static inline void toggle ()
+    {
+        GPIO_TypeDef * port = GpioRegisters<Port>::get();
+        port->BSRR = (port->ODR & MASK)? (MASK << 16) : MASK;
+    }
+};
+
+
+/**
+ * @brief Set of pins of the same port known at compile time.
+ *
+ * The pins are given by their numbers: PinGroup<IOPort::B, 3, 4, 5>. All pins of the group are
+ * set or cleared by a single BSRR write. In putBits() and getBits(), the bit i of the value
+ * corresponds to the i-th pin of the group; the bit mapping is resolved at compile time.
+ */
+template<IOPort::PortName Port, uint32_t... PinNrs> class PinGroup final
+{
+private:
+
+    static constexpr uint32_t makeMask ()
+    {
+        return 0;
+    }
+
+    template<typename... Rest> static constexpr uint32_t makeMask (uint32_t pinNr, Rest... rest)
+    {
+        return (1UL << pinNr) | makeMask(rest...);
+    }
+
+    static constexpr uint32_t spread (uint32_t /*value*/, uint32_t /*bit*/)
+    {
+        return 0;
+    }
+
+    template<typename... Rest> static constexpr uint32_t spread (uint32_t value, uint32_t bit, uint32_t pinNr, Rest... rest)
+    {
+        return (((value >> bit) & 1UL) << pinNr) | spread(value, bit + 1, rest...);
+    }
+
+    static constexpr uint32_t gather (uint32_t /*idr*/, uint32_t /*bit*/)
+    {
+        return 0;
+    }
+
+    template<typename... Rest> static constexpr uint32_t gather (uint32_t idr, uint32_t bit, uint32_t pinNr, Rest... rest)
+    {
+        return (((idr >> pinNr) & 1UL) << bit) | gather(idr, bit + 1, rest...);
+    }
+
+public:
+
+    static const uint32_t MASK = makeMask(PinNrs...);
+
+    static_assert(MASK <= 0xFFFF, "GPIO pin numbers shall be in range 0..15");
+
+    static inline void init (uint32_t mode, uint32_t pull = GPIO_NOPULL, uint32_t speed = GPIO_SPEED_HIGH,
+                             uint32_t alternate = 0)
+    {
+        GpioRegisters<Port>::init(MASK, mode, pull, speed, alternate);
+    }
+
+    static inline void setHigh ()
+    {
+        GpioRegisters<Port>::get()->BSRR = MASK;
+    }
+
+    static inline void setLow ()
+    {
+        GpioRegisters<Port>::get()->BSRR = MASK << 16;
+    }
+
+    /**
+     * @brief Set the pins of the group according to the given port-wide bit mask: the pins
+     *        not in the mask are cleared. Other pins of the port are not affected.
+     */
+    static inline void putMask (uint32_t portBits)
+    {
+        GpioRegisters<Port>::get()->BSRR = (portBits & MASK) | ((~portBits & MASK) << 16);
+    }
+
+    /**
+     * @brief Set the pins of the group from the given value: bit i is written into the i-th pin.
+     */
+    static inline void putBits (uint32_t value)
+    {
+        putMask(spread(value, 0, PinNrs...));
+    }
+
+    /**
+     * @brief Returns the state of the pins, the i-th pin is returned in the bit i.
+     */
+    static inline uint32_t getBits ()
+    {
+        return gather(GpioRegisters<Port>::get()->IDR, 0, PinNrs...);
+    }
+};
+
+
+/**
+ * @brief Class that samples a set of input pins spread over several ports.
+ *
+ * Each involved port is read only once per scan: the pins are gathered from the IDR values into
+ * a packed bit mask where the bit i is the state of the i-th added pin. When the pins are added,
+ * they are combined into runs: pins of the same port that keep the same distance between the
+ * port bit and the packed bit are extracted by a single mask and shift. For example, PA4..PA7
+ * added as pins 0..3 form one run with the mask 0xF0 and the shift -4.
+ *
+ * The pins shall be configured as inputs separately, for example by IOPin objects.
+ *
+ * In the interrupt mode, the pins added by addInterrupt() report their edges through EXTI. The
+ * edges are queued by the interrupt handler and collected by the next scan: a pulse shorter than
+ * the scan period is reported as a change even if the pin returned to its previous level. The
+ * pins whose EXTI line is used by an other port are still polled. If all pins use EXTI, a scan
+ * reads the ports only when an edge was queued. All lines of a bank shall use the same
+ * interrupt priority.
+ */
+class InputBank : public IOPin::ExtiHandler
+{
+public:
+
+    typedef uint64_t Bits;
+
+    static const size_t MAX_PINS = 64;
+    static const size_t MAX_PORTS = 8;
+    static const size_t QUEUE_SIZE = 32;
+
+    /**
+     * @brief Receives every EXTI edge of the bank pins in the interrupt context, with the bank
+     *        bit of the pin, the level read by the handler and the CycleCounter time stamp.
+     */
+    class EdgeHandler
+    {
+    public:
+
+        virtual void onInputEdge (size_t bit, bool level, uint32_t timestamp) =0;
+    };
+
+    /**
+     * @brief Default constructor.
+     */
+    InputBank ();
+
+    /**
+     * @brief Appends the pin with the given mask (GPIO_PIN_x) of the given port. Returns false if
+     *        the bank is full or the mask does not contain exactly one pin.
+     */
+    bool addPin (GPIO_TypeDef * port, uint32_t pin);
+
+    /**
+     * @brief Appends all pins handled by the given object, in the ascending order.
+     */
+    bool addPins (const IOPort & pins);
+
+    /**
+     * @brief Enables the EXTI interrupt on both edges for the given pin that was already added
+     *        to this bank. Returns false if the EXTI line is not available: the pin stays polled.
+     */
+    bool addInterrupt (IOPin & pin, const InterruptPriority & prio);
+
+    virtual void onExtiEdge (const IOPin::ExtiEvent & event);
+
+    inline void setEdgeHandler (EdgeHandler * _edgeHandler)
+    {
+        edgeHandler = _edgeHandler;
+    }
+
+    inline size_t getPinCount () const
+    {
+        return pinCount;
+    }
+
+    /**
+     * @brief Returns the bit mask of all added pins.
+     */
+    inline Bits getMask () const
+    {
+        return (pinCount == MAX_PINS)? ~(Bits)0 : (((Bits)1 << pinCount) - 1);
+    }
+
+    /**
+     * @brief Reads the current state of all pins without changing the stored state: this method
+     *        can be called from an interrupt.
+     */
+    Bits read () const;
+
+    /**
+     * @brief Reads the current state of all pins and stores it. Returns the bit mask of the pins
+     *        changed since the previous scan, including the pins with a queued edge.
+     */
+    Bits scan ();
+
+    /**
+     * @brief Returns the state stored by the last scan.
+     */
+    inline Bits getState () const
+    {
+        return state;
+    }
+
+    /**
+     * @brief Sets the state the next scan is compared with.
+     */
+    inline void setState (Bits _state)
+    {
+        state = _state & getMask();
+        resync = true;
+    }
+
+    /**
+     * @brief Returns the changes detected by the last scan.
+     */
+    inline Bits getChanges () const
+    {
+        return changes;
+    }
+
+    inline bool getBit (size_t i) const
+    {
+        return (state >> i) & 1;
+    }
+
+    /**
+     * @brief Returns the pins served by EXTI.
+     */
+    inline Bits getExtiMask () const
+    {
+        return extiMask;
+    }
+
+    /**
+     * @brief Returns the pins with an edge collected by the last scan.
+     */
+    inline Bits getEdges () const
+    {
+        return edges;
+    }
+
+    /**
+     * @brief Returns the CycleCounter time stamp of the latest edge collected by the last scan.
+     */
+    inline uint32_t getLastEdgeTime () const
+    {
+        return lastEdgeTime;
+    }
+
+    /**
+     * @brief Returns the number of edges lost due to the queue overflow.
+     */
+    inline uint32_t getLostEdges () const
+    {
+        return events.getOverflows();
+    }
+
+private:
+
+    class Run
+    {
+    public:
+
+        uint8_t port;   // index in the ports array
+        int8_t shift;   // packed bit number minus port bit number
+        uint16_t mask;  // port bits of this run
+    };
+
+    GPIO_TypeDef * ports[MAX_PORTS];
+    Run runs[MAX_PINS];
+    size_t portCount, runCount, pinCount;
+    Bits state, changes;
+
+    // Interrupt mode
+    SpscQueue<IOPin::ExtiEvent, QUEUE_SIZE> events;
+    Bits extiMask, edges;
+    uint32_t lastEdgeTime;
+    bool resync;
+    int8_t extiBits[IOPin::EXTI_LINES]; // bank bit of the EXTI line, or -1
+    EdgeHandler * edgeHandler;
+
+    int findBit (GPIO_TypeDef * port, uint32_t line) const;
 };
 
 
@@ -284,7 +946,21 @@ public:
                              uint32_t baudRate,
                              uint32_t wordLength = UART_WORDLENGTH_8B,
                              uint32_t stopBits = UART_STOPBITS_1,
-                             uint32_t parity = UART_PARITY_NONE);
+                             uint32_t parity = UART_PARITY_NONE,
+                             uint32_t hwControl = UART_HWCONTROL_NONE);
+
+    /**
+     * @brief Connect the CTS and/or RTS pins (zero pin means not used) to the USART in order
+     *        to use the hardware flow control. Returns false if a pin does not provide the
+     *        CTS/RTS function of this device: USART1 - CTS PA11, RTS PA12; USART2 - CTS PA0
+     *        or PD3, RTS PA1 or PD4. USART6 flow control is not supported.
+     */
+    bool initFlowControlPins (PortName name, uint32_t ctsPin, uint32_t rtsPin);
+
+    inline uint32_t getBaudRate () const
+    {
+        return usartParameters.Init.BaudRate;
+    }
 
     /**
      * @brief Close the transmission session.
@@ -338,12 +1014,97 @@ public:
         return irqStatus == SET;
     }
 
+    /**
+     * @brief Start continuous reception into the given circular buffer using DMA.
+     *
+     * The received data is not signaled by the DMA: the reader polls the number of received
+     * bytes using getReceivedBytes(). The half and complete transfer interrupts of the DMA
+     * only count the buffer halves, see processDmaRxInterrupt(). The USART IDLE-line interrupt
+     * is enabled in order to signal the end of a burst, see processIdleInterrupt().
+     */
+    HAL_StatusTypeDef startReceiveCircular (const char * buffer, size_t n, const InterruptPriority & prio);
+
+    /**
+     * @brief Stop continuous reception started by startReceiveCircular().
+     */
+    void stopReceiveCircular ();
+
+    /**
+     * @brief Returns the index within the circular buffer where the next byte will be written.
+     */
+    inline size_t getReceivePosition () const
+    {
+        #ifdef STM32F4
+        return rxDmaSize - rxDma.Instance->NDTR;
+        #else
+        return rxDmaSize - rxDma.Instance->CNDTR;
+        #endif
+    }
+
+    /**
+     * @brief Returns the number of bytes received since startReceiveCircular(), modulo 2^32,
+     *        or zero if the reception is stopped.
+     *
+     * Unlike getReceivePosition(), a completely filled or overwritten buffer can be detected
+     * by comparing this number with the number of consumed bytes. The buffer size shall be
+     * a power of two and the DMA interrupt shall be served within a half of the buffer.
+     */
+    uint32_t getReceivedBytes () const;
+
+    /**
+     * @brief Counts the filled halves of the circular buffer. Shall be called from the
+     *        interrupt of the RX DMA stream.
+     */
+    void processDmaRxInterrupt ();
+
+    /**
+     * @brief Prepare the DMA stream used by transmitDma().
+     */
+    HAL_StatusTypeDef startTransmitDma (const InterruptPriority & prio);
+
+    /**
+     * @brief Release the DMA stream prepared by startTransmitDma().
+     */
+    void stopTransmitDma ();
+
+    /**
+     * @brief Send an amount of data in DMA mode. The buffer shall be valid until the
+     *        transmission complete callback.
+     */
+    HAL_StatusTypeDef transmitDma (const char * buffer, size_t n);
+
+    inline void processDmaTxInterrupt ()
+    {
+        HAL_DMA_IRQHandler(&txDma);
+    }
+
+    /**
+     * @brief Checks and clears the IDLE-line flag. Shall be called from the USART interrupt.
+     */
+    inline bool processIdleInterrupt ()
+    {
+        if (__HAL_UART_GET_FLAG(&usartParameters, UART_FLAG_IDLE) != RESET)
+        {
+            __HAL_UART_CLEAR_IDLEFLAG(&usartParameters);
+            return true;
+        }
+        return false;
+    }
+
 private:
 
     DeviceName device;
     UART_HandleTypeDef usartParameters;
     IRQn_Type irqName;
     __IO ITStatus irqStatus;
+
+    DMA_HandleTypeDef rxDma, txDma;
+    IRQn_Type rxDmaIrq, txDmaIrq;
+    size_t rxDmaSize;
+    __IO uint32_t rxDmaHalves;
+    bool txDmaStarted;
+
+    void enableDmaClock ();
 };
 
 
@@ -461,6 +1222,11 @@ public:
 
     HAL_StatusTypeDef stopCounter ();
 
+    /**
+     * @brief Returns the frequency of the timer input clock the prescaler divides.
+     */
+    uint32_t getClockFrequency () const;
+
     inline uint32_t getValue () const
     {
         return __HAL_TIM_GET_COUNTER(&timerParameters);
@@ -0,0 +1,536 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Lightweight stackless coroutines for the cooperative main loop.
+ *
+ * A coroutine is written as linear code using the following macros:
+ *
+ *   CO_TASK                    - return type of a coroutine function
+ *   CO_BEGIN(ctx)              - starts the coroutine body
+ *   CO_AWAIT_UNTIL(ctx, cond)  - suspends until the condition is true
+ *   CO_AWAIT(ctx, task)        - runs a child coroutine up to its end
+ *   CO_AWAIT_CHECKED(ctx, task, ok) - as CO_AWAIT, sets ok to false if the child could not start
+ *   CO_RETURN(ctx)             - finishes the coroutine
+ *   CO_END(ctx)                - ends the coroutine body
+ *
+ * where ctx is a CoContext object that keeps the resume point of the coroutine. The top-level
+ * coroutine is a member function started by CoRunner::start() and resumed by
+ * CoRunner::periodic().
+ *
+ * Two implementations are available:
+ * - If the compiler supports C++20 coroutines (and STMPLUSPLUS_CO_FALLBACK is not defined), the
+ *   macros map onto co_await/co_return. The coroutine frames are placed into a static pool
+ *   (CoFramePool): no heap is used. If no frame is available, the child coroutine is not
+ *   started: the parent is resumed by the next CoRunner::periodic() call, and CO_AWAIT_CHECKED
+ *   reports the failure.
+ * - Otherwise, the coroutine is a function returning true when finished. The resume point is
+ *   a line number stored in CoContext that is dispatched by a switch statement (Duff's device).
+ *   In this mode, local variables are not kept across the suspension points: the coroutine
+ *   state shall be kept in class members, and a switch statement can not enclose a suspension
+ *   point. The same code can be compiled in both modes.
+ */
+
+namespace StmPlusPlus
+{
+
+/************************************************************************
+ * Class CoContext
+ ************************************************************************/
+
+/**
+ * @brief Resume point of a stackless coroutine, used by the fallback implementation.
+ */
+class CoContext final
+{
+public:
+
+    static const uint16_t START = 0;
+
+    CoContext () :
+        line(START)
+    {
+        // empty
+    }
+
+    inline void reset ()
+    {
+        line = START;
+    }
+
+    inline bool isStarted () const
+    {
+        return line != START;
+    }
+
+    uint16_t line;
+};
+
+} // end namespace
+
+#if defined(__cpp_impl_coroutine) && !defined(STMPLUSPLUS_CO_FALLBACK)
+
+#include <coroutine>
+
+#define STMPLUSPLUS_CO_NATIVE 1
+
+#ifndef STMPLUSPLUS_CO_FRAME_SIZE
+#define STMPLUSPLUS_CO_FRAME_SIZE 256
+#endif
+
+#ifndef STMPLUSPLUS_CO_FRAMES
+#define STMPLUSPLUS_CO_FRAMES 8
+#endif
+
+namespace StmPlusPlus
+{
+
+/************************************************************************
+ * Class CoFramePool
+ ************************************************************************/
+
+/**
+ * @brief Static storage for the frames of C++20 coroutines.
+ */
+class CoFramePool final
+{
+public:
+
+    static const size_t FRAME_SIZE = STMPLUSPLUS_CO_FRAME_SIZE;
+    static const size_t FRAMES = STMPLUSPLUS_CO_FRAMES;
+
+    static void * allocate (size_t size) noexcept
+    {
+        if (size <= FRAME_SIZE)
+        {
+            for (size_t i = 0; i < FRAMES; ++i)
+            {
+                if (!used[i])
+                {
+                    used[i] = true;
+                    return frames[i];
+                }
+            }
+        }
+        ++failures;
+        return nullptr;
+    }
+
+    static void release (void * frame) noexcept
+    {
+        for (size_t i = 0; i < FRAMES; ++i)
+        {
+            if (frame == frames[i])
+            {
+                used[i] = false;
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of coroutines that could not be started: the frame pool
+     *        is exhausted or a frame exceeds FRAME_SIZE.
+     */
+    static uint32_t getFailures ()
+    {
+        return failures;
+    }
+
+private:
+
+    alignas(std::max_align_t) static inline uint8_t frames[FRAMES][FRAME_SIZE];
+    static inline bool used[FRAMES];
+    static inline uint32_t failures = 0;
+};
+
+class CoScheduler;
+
+/************************************************************************
+ * Class CoTask
+ ************************************************************************/
+
+/**
+ * @brief C++20 coroutine that is started when awaited by the parent coroutine or by CoRunner.
+ */
+class CoTask final
+{
+public:
+
+    class promise_type
+    {
+    public:
+
+        std::coroutine_handle<> continuation;
+        CoScheduler * scheduler = nullptr;
+
+        static void * operator new (size_t size) noexcept
+        {
+            return CoFramePool::allocate(size);
+        }
+
+        static void operator delete (void * frame) noexcept
+        {
+            CoFramePool::release(frame);
+        }
+
+        // the task without a frame fails when awaited
+        static CoTask get_return_object_on_allocation_failure () noexcept
+        {
+            return CoTask();
+        }
+
+        CoTask get_return_object () noexcept
+        {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend () noexcept
+        {
+            return {};
+        }
+
+        class FinalAwaiter
+        {
+        public:
+
+            bool await_ready () noexcept
+            {
+                return false;
+            }
+
+            // the parent is resumed directly, without returning to the runner
+            std::coroutine_handle<> await_suspend (std::coroutine_handle<promise_type> h) noexcept
+            {
+                std::coroutine_handle<> c = h.promise().continuation;
+                return c? c : std::noop_coroutine();
+            }
+
+            void await_resume () noexcept
+            {
+                // empty
+            }
+        };
+
+        FinalAwaiter final_suspend () noexcept
+        {
+            return {};
+        }
+
+        void return_void () noexcept
+        {
+            // empty
+        }
+
+        void unhandled_exception () noexcept
+        {
+            // empty
+        }
+    };
+
+    CoTask () :
+        handle(nullptr)
+    {
+        // empty
+    }
+
+    CoTask (CoTask && other) noexcept :
+        handle(other.handle)
+    {
+        other.handle = nullptr;
+    }
+
+    CoTask & operator= (CoTask && other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+            {
+                handle.destroy();
+            }
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+
+    CoTask (const CoTask &) = delete;
+    CoTask & operator= (const CoTask &) = delete;
+
+    ~CoTask ()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    inline bool isFinished () const
+    {
+        return !handle || handle.done();
+    }
+
+    // Awaiting a child task
+    bool await_ready () const noexcept
+    {
+        return handle && handle.done();
+    }
+
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<promise_type> parent) noexcept;
+
+    /**
+     * @brief Returns false if the child could not be started since no frame was available.
+     */
+    bool await_resume () const noexcept
+    {
+        return (bool)handle;
+    }
+
+private:
+
+    template<class T> friend class CoRunner;
+
+    explicit CoTask (std::coroutine_handle<promise_type> h) :
+        handle(h)
+    {
+        // empty
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/************************************************************************
+ * Class CoScheduler
+ ************************************************************************/
+
+/**
+ * @brief Keeps the innermost suspended coroutine and the condition it waits for.
+ */
+class CoScheduler
+{
+public:
+
+    typedef bool (*Check) (void * awaiter);
+
+    void wait (std::coroutine_handle<> h, Check c, void * a)
+    {
+        leaf = h;
+        check = c;
+        awaiter = a;
+    }
+
+    /**
+     * @brief Resumes the suspended coroutine if its condition is true.
+     */
+    void resume ()
+    {
+        if (leaf && (check == nullptr || check(awaiter)))
+        {
+            std::coroutine_handle<> h = leaf;
+            leaf = nullptr;
+            h.resume();
+        }
+    }
+
+private:
+
+    std::coroutine_handle<> leaf;
+    Check check = nullptr;
+    void * awaiter = nullptr;
+};
+
+inline std::coroutine_handle<> CoTask::await_suspend (std::coroutine_handle<promise_type> parent) noexcept
+{
+    if (!handle)
+    {
+        // the child could not be started: the parent yields instead of spinning
+        parent.promise().scheduler->wait(parent, nullptr, nullptr);
+        return std::noop_coroutine();
+    }
+    handle.promise().continuation = parent;
+    handle.promise().scheduler = parent.promise().scheduler;
+    return handle;
+}
+
+/************************************************************************
+ * Class CoRunner
+ ************************************************************************/
+
+/**
+ * @brief Owner of a top-level coroutine given by a member function: periodic() resumes
+ *        the innermost suspended coroutine once its awaited condition is true.
+ */
+template<class T> class CoRunner final : public CoScheduler
+{
+public:
+
+    typedef CoTask (T::*Task) ();
+
+    void start (T * object, Task task)
+    {
+        root = (object->*task)();
+        if (root.handle)
+        {
+            root.handle.promise().scheduler = this;
+            wait(root.handle, nullptr, nullptr);
+        }
+    }
+
+    inline void periodic ()
+    {
+        resume();
+    }
+
+    inline bool isFinished () const
+    {
+        return root.isFinished();
+    }
+
+private:
+
+    CoTask root;
+};
+
+/************************************************************************
+ * Class CoUntil
+ ************************************************************************/
+
+/**
+ * @brief Awaitable that suspends the coroutine until the predicate is true.
+ */
+template<typename Predicate> class CoUntil final
+{
+public:
+
+    explicit CoUntil (Predicate p) :
+        predicate(p)
+    {
+        // empty
+    }
+
+    bool await_ready ()
+    {
+        return predicate();
+    }
+
+    void await_suspend (std::coroutine_handle<CoTask::promise_type> h)
+    {
+        h.promise().scheduler->wait(h, &CoUntil::check, this);
+    }
+
+    void await_resume ()
+    {
+        // empty
+    }
+
+private:
+
+    Predicate predicate;
+
+    static bool check (void * self)
+    {
+        return static_cast<CoUntil *>(self)->predicate();
+    }
+};
+
+} // end namespace
+
+#define CO_TASK StmPlusPlus::CoTask
+#define CO_BEGIN(ctx) (void)(ctx);
+#define CO_AWAIT_UNTIL(ctx, cond) co_await StmPlusPlus::CoUntil([&]() { return (cond); })
+#define CO_AWAIT(ctx, task) co_await (task)
+// a started child may set ok itself: it is read after the child is finished
+#define CO_AWAIT_CHECKED(ctx, task, ok) (ok) = (co_await (task)) && (ok)
+#define CO_RETURN(ctx) co_return
+#define CO_END(ctx) co_return;
+
+#else
+
+namespace StmPlusPlus
+{
+
+/************************************************************************
+ * Class CoRunner
+ ************************************************************************/
+
+/**
+ * @brief Owner of a top-level coroutine. In the fallback mode, the coroutine is a member function
+ *        that is called by periodic() until it returns true.
+ */
+template<class T> class CoRunner final
+{
+public:
+
+    typedef bool (T::*Task) ();
+
+    CoRunner () :
+        object(NULL),
+        task(NULL),
+        finished(true)
+    {
+        // empty
+    }
+
+    void start (T * _object, Task _task)
+    {
+        object = _object;
+        task = _task;
+        finished = false;
+    }
+
+    inline void periodic ()
+    {
+        if (!finished)
+        {
+            finished = (object->*task)();
+        }
+    }
+
+    inline bool isFinished () const
+    {
+        return finished;
+    }
+
+private:
+
+    T * object;
+    Task task;
+    bool finished;
+};
+
+} // end namespace
+
+#define CO_TASK bool
+#define CO_BEGIN(ctx) switch ((ctx).line) { case StmPlusPlus::CoContext::START:
+#define CO_AWAIT_UNTIL(ctx, cond) \
+    do { (ctx).line = __LINE__; /* FALLTHRU */ case __LINE__: if (!(cond)) return false; } while (0)
+#define CO_AWAIT(ctx, task) CO_AWAIT_UNTIL(ctx, task)
+#define CO_AWAIT_CHECKED(ctx, task, ok) CO_AWAIT(ctx, task)
+#define CO_RETURN(ctx) do { (ctx).reset(); return true; } while (0)
+#define CO_END(ctx) default: break; } (ctx).reset(); return true;
+
+#endif
+
+#endif
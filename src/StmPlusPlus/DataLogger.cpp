@@ -0,0 +1,358 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "DataLogger.h"
+
+#ifdef STM32F405xx
+#ifdef HAL_SD_MODULE_ENABLED
+
+using namespace StmPlusPlus;
+
+#define USART_DEBUG_MODULE "LOG: "
+
+/************************************************************************
+ * Class DataLogger
+ ************************************************************************/
+
+DataLogger::DataLogger (StorageManager & _storage, Pages & _pages) :
+        storage(_storage),
+        sdCard(_storage.getSdCard()),
+        logFile(),
+        active(false),
+        rawMode(false),
+        currSector(0),
+        maxFileSize(0),
+        pages(_pages),
+        currPage(0),
+        writePage(0),
+        recording(false),
+        cyclesPerUs(1),
+        lastCycles(0),
+        cyclesRest(0),
+        timeUs(0),
+        bytesWritten(0),
+        writeCycles(0),
+        recordsWritten(0),
+        overruns(0),
+        droppedRecords(0),
+        maxWriteCycles(0)
+{
+    for (size_t i = 0; i < PAGES_NUMBER; ++i)
+    {
+        Page & p = pages[i];
+        p.fill = 0;
+        p.writers = 0;
+        p.full = false;
+    }
+    storage.addHandler(this);
+}
+
+bool DataLogger::start (const char * fileName, DWORD fileSize)
+{
+    if (active)
+    {
+        return false;
+    }
+
+    if (!storage.acquire())
+    {
+        return false;
+    }
+
+    FRESULT code = sdCard.openContiguous(logFile, fileName, FA_CREATE_ALWAYS | FA_READ | FA_WRITE, fileSize);
+    rawMode = (code == FR_OK);
+    if (code == FR_DENIED)
+    {
+        USART_DEBUG("Can not allocate contiguous file " << fileName << ", writing it using FAT FS");
+        code = f_open(&logFile.file, fileName, FA_CREATE_ALWAYS | FA_WRITE);
+    }
+    if (code != FR_OK)
+    {
+        USART_DEBUG("Can not create log file " << fileName << ": " << code);
+        storage.release();
+        return false;
+    }
+
+    active = true;
+    currSector = 0;
+    maxFileSize = (fileSize == 0)? (DWORD)Devices::SdCard::KEEP_FILE_SIZE : fileSize;
+    bytesWritten = writeCycles = 0;
+    recordsWritten = overruns = droppedRecords = maxWriteCycles = 0;
+
+    for (size_t i = 0; i < PAGES_NUMBER; ++i)
+    {
+        Page & p = pages[i];
+        p.fill = 0;
+        p.writers = 0;
+        p.full = false;
+    }
+    currPage = writePage = 0;
+    cyclesPerUs = CycleCounter::getFrequency() / 1000000;
+    lastCycles = CycleCounter::getValue();
+    cyclesRest = timeUs = 0;
+    recording = true;
+
+    USART_DEBUG("Data logging into file started: " << fileName);
+    return true;
+}
+
+bool DataLogger::writeSectors (uint32_t * pData, uint32_t numOfSectors)
+{
+    if (!active)
+    {
+        return false;
+    }
+
+    uint32_t startCycles = CycleCounter::getValue();
+    bool retValue = false;
+    if (rawMode)
+    {
+        HAL_SD_ErrorTypedef status = sdCard.writeSectors(logFile, currSector, pData, numOfSectors);
+        retValue = (status == SD_OK);
+        if (retValue)
+        {
+            currSector += numOfSectors;
+        }
+        else
+        {
+            USART_DEBUG("Can not write sectors: " << status);
+        }
+    }
+    else
+    {
+        UINT bytesToWrite = numOfSectors * SECTOR_SIZE, bw = 0;
+        FRESULT code = f_write(&logFile.file, pData, bytesToWrite, &bw);
+        retValue = (code == FR_OK && bw == bytesToWrite);
+        if (!retValue)
+        {
+            USART_DEBUG("Can not write file: " << code);
+        }
+    }
+    uint32_t cycles = CycleCounter::getValue() - startCycles;
+    writeCycles += cycles;
+    if (cycles > maxWriteCycles)
+    {
+        maxWriteCycles = cycles;
+    }
+
+    if (retValue)
+    {
+        bytesWritten += numOfSectors * SECTOR_SIZE;
+    }
+    return retValue;
+}
+
+bool DataLogger::putRecord (uint8_t type, const void * pData, uint16_t length)
+{
+    // Only the space for the record is reserved within the critical section: the record
+    // is copied and its checksum is calculated with enabled interrupts
+    const uint32_t recordSize = length + RECORD_OVERHEAD;
+    uint32_t primask = System::enterCritical();
+    if (!recording || length > MAX_PAYLOAD)
+    {
+        ++droppedRecords;
+        System::leaveCritical(primask);
+        return false;
+    }
+
+    Page * p = &pages[currPage];
+    if (p->full || p->fill + recordSize > PAGE_SIZE)
+    {
+        p->full = true;
+        size_t nextPage = (currPage + 1) % PAGES_NUMBER;
+        if (pages[nextPage].full)
+        {
+            // the SD card writer is too slow: both pages are waiting to be written
+            ++overruns;
+            ++droppedRecords;
+            System::leaveCritical(primask);
+            return false;
+        }
+        currPage = nextPage;
+        p = &pages[currPage];
+    }
+
+    uint8_t * record = (uint8_t *)p->data + p->fill;
+    p->fill += recordSize;
+    if (p->fill + RECORD_OVERHEAD > PAGE_SIZE)
+    {
+        p->full = true;
+    }
+    ++p->writers;
+    RecordHeader header;
+    header.sync = RECORD_SYNC;
+    header.type = type;
+    header.length = length;
+    header.timestamp = updateTime();
+    System::leaveCritical(primask);
+
+    ::memcpy(record, &header, sizeof(RecordHeader));
+    ::memcpy(record + sizeof(RecordHeader), pData, length);
+    uint16_t checksum = calculateChecksum(record, sizeof(RecordHeader) + length);
+    ::memcpy(record + sizeof(RecordHeader) + length, &checksum, sizeof(uint16_t));
+
+    primask = System::enterCritical();
+    --p->writers;
+    ++recordsWritten;
+    System::leaveCritical(primask);
+    return true;
+}
+
+void DataLogger::periodic ()
+{
+    if (!active)
+    {
+        return;
+    }
+
+    // keep the time stamp base up to date even if no records are put
+    uint32_t primask = System::enterCritical();
+    updateTime();
+    System::leaveCritical(primask);
+
+    if (!flushPages(false))
+    {
+        stop();
+    }
+}
+
+void DataLogger::stop ()
+{
+    if (!active)
+    {
+        return;
+    }
+
+    recording = false;
+    flushPages(true);
+
+    if (rawMode)
+    {
+        sdCard.closeContiguous(logFile, bytesWritten);
+    }
+    else
+    {
+        f_close(&logFile.file);
+    }
+    storage.release();
+    active = false;
+    char throughput[16];
+    USART_DEBUG("Data logging stopped: " << (int)bytesWritten << " bytes written, throughput ("
+             << (rawMode? "raw sectors" : "FAT FS") << "): "
+             << CycleCounter::formatThroughput(bytesWritten, writeCycles, throughput) << " MB/s");
+    if (recordsWritten > 0 || droppedRecords > 0)
+    {
+        USART_DEBUG("    records: " << recordsWritten << ", dropped: " << droppedRecords
+                 << ", overruns: " << overruns
+                 << ", max write time: " << maxWriteCycles / cyclesPerUs << " us");
+    }
+    sdCard.getStatistics().dump();
+}
+
+void DataLogger::onStorageLost ()
+{
+    if (!active)
+    {
+        return;
+    }
+
+    // the file handle is invalid: the card shall not be accessed anymore
+    recording = false;
+    active = false;
+    storage.release();
+    USART_DEBUG("Data logging aborted, SD card lost: " << (int)bytesWritten << " bytes written, "
+             << droppedRecords << " records dropped");
+}
+
+uint16_t DataLogger::calculateChecksum (const uint8_t * pData, size_t length)
+{
+    uint16_t sum1 = 0, sum2 = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        sum1 = (sum1 + pData[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+uint32_t DataLogger::updateTime ()
+{
+    // Extend the 32-bit cycle counter: shall be called at least once per counter period
+    uint32_t currCycles = CycleCounter::getValue();
+    cyclesRest += currCycles - lastCycles;
+    lastCycles = currCycles;
+    uint32_t us = cyclesRest / cyclesPerUs;
+    cyclesRest -= us * cyclesPerUs;
+    timeUs += us;
+    return timeUs;
+}
+
+bool DataLogger::flushPages (bool partialPage)
+{
+    while (true)
+    {
+        Page & p = pages[writePage];
+
+        // the writers counter and the full flag are changed together by a producer: they are
+        // read within a critical section, otherwise the last record of the page could be
+        // reserved between both reads and be written before it is copied
+        uint32_t primask = System::enterCritical();
+        bool ready = p.writers == 0 && (p.full || (partialPage && p.fill > 0));
+        System::leaveCritical(primask);
+        if (!ready)
+        {
+            // a record is still copied into the page, or the page is not complete
+            return true;
+        }
+
+        // the padding is added here, out of the critical section of the producers;
+        // the last (partial) page is written only up to the sectors that contain records
+        uint32_t numOfSectors = p.full? PAGE_SECTORS : (p.fill + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        ::memset((uint8_t *)p.data + p.fill, 0, numOfSectors * SECTOR_SIZE - p.fill);
+
+        if (bytesWritten + numOfSectors * SECTOR_SIZE > maxFileSize)
+        {
+            USART_DEBUG("Log file is full");
+            recording = false;
+            return false;
+        }
+        if (!writeSectors(p.data, numOfSectors))
+        {
+            recording = false;
+            return false;
+        }
+
+        primask = System::enterCritical();
+        p.fill = 0;
+        p.full = false;
+        size_t nextPage = (writePage + 1) % PAGES_NUMBER;
+        if (currPage == writePage)
+        {
+            // the page was completed by its last record without a rotation: the producers
+            // shall continue in the next page, otherwise it would be written out of order
+            currPage = nextPage;
+        }
+        writePage = nextPage;
+        System::leaveCritical(primask);
+    }
+}
+
+#endif
+#endif
@@ -0,0 +1,166 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DATALOGGER_H_
+#define DATALOGGER_H_
+
+#include "StmPlusPlus.h"
+#include "StorageManager.h"
+
+#ifdef STM32F405xx
+#ifdef HAL_SD_MODULE_ENABLED
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Class that writes a data stream into a pre-allocated contiguous file on the SD card.
+ *
+ * The data is written in whole sectors using raw multi-block transfers. If the file can not be
+ * allocated contiguously, the logger falls back to FAT FS writes.
+ *
+ * Binary records can be put from interrupt service routines using putRecord(). The records are
+ * collected in two sector-aligned pages: while one page is filled by the producers, the other
+ * one is written to the SD card from the main loop by periodic(). A record never crosses a page
+ * boundary, the unused tail of a page is filled by zeros. If both pages are full, the record is
+ * dropped and the overrun counter is incremented. The interrupts are disabled only while the
+ * space for a record is reserved: the record itself is copied with enabled interrupts, and
+ * a page is written only after all records reserved in it are complete.
+ *
+ * Record layout (little-endian): RecordHeader, payload of RecordHeader::length bytes and
+ * a Fletcher-16 checksum (2 bytes) calculated over the header and the payload.
+ *
+ * If the card is removed or re-initialized by the StorageManager, the logging is aborted:
+ * the log file is dropped and the pending pages are discarded.
+ *
+ * The page storage is given by the owner: it is large and usually a static object, not a part
+ * of an application object on the stack.
+ */
+class DataLogger final : public StorageManager::EventHandler
+{
+public:
+
+    static const uint32_t SECTOR_SIZE = Devices::SdCard::SDHC_BLOCK_SIZE;
+    static const uint32_t PAGE_SECTORS = 8;
+    static const uint32_t PAGE_SIZE = PAGE_SECTORS * SECTOR_SIZE;
+    static const size_t PAGES_NUMBER = 2;
+    static const uint8_t RECORD_SYNC = 0xA5;
+    static const uint16_t MAX_PAYLOAD = 255;
+
+    typedef struct
+    {
+        uint8_t sync;       /* Always RECORD_SYNC, a zero value marks the padding at the page end */
+        uint8_t type;       /* Application-defined record type */
+        uint16_t length;    /* Payload length in bytes */
+        uint32_t timestamp; /* Microseconds since the logging start (wraps after 71 minutes) */
+    } __attribute__((__packed__)) RecordHeader;
+
+    static const size_t RECORD_OVERHEAD = sizeof(RecordHeader) + sizeof(uint16_t);
+
+    class Page
+    {
+    public:
+
+        uint32_t data[PAGE_SIZE / sizeof(uint32_t)];
+        volatile uint32_t fill;
+        volatile uint32_t writers; // records that are reserved but not copied yet
+        volatile bool full;
+    };
+
+    typedef Page Pages[PAGES_NUMBER];
+
+    DataLogger (StorageManager & _storage, Pages & _pages);
+
+    inline bool isActive () const
+    {
+        return active;
+    }
+
+    inline uint64_t getBytesWritten () const
+    {
+        return bytesWritten;
+    }
+
+    inline uint32_t getRecordsWritten () const
+    {
+        return recordsWritten;
+    }
+
+    inline uint32_t getOverruns () const
+    {
+        return overruns;
+    }
+
+    inline uint32_t getDroppedRecords () const
+    {
+        return droppedRecords;
+    }
+
+    inline uint32_t getMaxWriteCycles () const
+    {
+        return maxWriteCycles;
+    }
+
+    bool start (const char * fileName, DWORD fileSize);
+
+    bool writeSectors (uint32_t * pData, uint32_t numOfSectors);
+
+    bool putRecord (uint8_t type, const void * pData, uint16_t length);
+
+    void periodic ();
+
+    void stop ();
+
+    virtual void onStorageLost ();
+
+    static uint16_t calculateChecksum (const uint8_t * pData, size_t length);
+
+private:
+
+    StorageManager & storage;
+    Devices::SdCard & sdCard;
+    Devices::SdCard::ContiguousFile logFile;
+    bool active, rawMode;
+    uint32_t currSector;
+    DWORD maxFileSize;
+
+    // Record pages: filled from the interrupts, written in the main loop
+    Page * pages;
+    volatile size_t currPage;
+    size_t writePage;
+    volatile bool recording;
+
+    // Record time stamp
+    uint32_t cyclesPerUs, lastCycles, cyclesRest, timeUs;
+
+    // Statistics
+    uint64_t bytesWritten, writeCycles;
+    volatile uint32_t recordsWritten, overruns, droppedRecords;
+    uint32_t maxWriteCycles;
+
+    uint32_t updateTime ();
+    bool flushPages (bool partialPage);
+};
+
+} // end namespace
+
+#endif
+#endif
+#endif
@@ -31,42 +31,67 @@ Button::Button (PortName name, uint32_t pin, uint32_t pull, const RealTimeClock
     pressTime{INFINITY_TIME},
     currentState{false},
     numOccured{0},
-    handler{NULL}
+    handler{NULL},
+    interruptMode{false},
+    bankMode{false}
 {
     // empty
 }
 
 
+void Button::onExtiEdge (const ExtiEvent & event)
+{
+    events.push(event);
+}
+
+
 void Button::periodic ()
 {
-    if (handler == NULL)
+    if (handler == NULL || bankMode)
     {
         return;
     }
 
-    bool newState = (gpioParameters.Pull == GPIO_PULLUP)? !getBit() : getBit();
+    time_ms now = rtc.getUpTimeMillisec();
+    if (interruptMode)
+    {
+        // the edge time is restored from the age of its time stamp
+        uint32_t counter = CycleCounter::getValue();
+        ExtiEvent e;
+        while (events.pop(e))
+        {
+            processState(isPressed(e.level), now - CycleCounter::toMillis(counter - e.timestamp));
+        }
+    }
+    // the current level also covers the edges lost due to the queue overflow
+    processState(isPressed(getBit()), now);
+}
+
+
+void Button::processState (bool newState, time_ms time)
+{
     if (currentState == newState)
     {
         // state is not changed: check for periodical press event
         if (currentState && pressTime != INFINITY_TIME)
         {
-            duration_ms d = rtc.getUpTimeMillisec() - pressTime;
+            duration_ms d = time - pressTime;
             if (d >= pressDuration)
             {
                 handler->onButtonPressed(this, numOccured);
-                pressTime = rtc.getUpTimeMillisec();
+                pressTime = time;
                 ++numOccured;
             }
         }
     }
     else if (!currentState && newState)
     {
-        pressTime = rtc.getUpTimeMillisec();
+        pressTime = time;
         numOccured = 0;
     }
     else
     {
-        duration_ms d = rtc.getUpTimeMillisec() - pressTime;
+        duration_ms d = time - pressTime;
         if (d < pressDelay)
         {
             // nothing to do
@@ -26,10 +26,19 @@
 namespace StmPlusPlus {
 namespace Devices {
 
+class Debouncer;
+
 /** 
  * @brief Class describing a button connected to a pin
+ *
+ * By default, the pin is polled by periodic(). In the interrupt mode, the pin edges are detected by
+ * EXTI and queued with their time stamps: periodic() replays them in the same order, so the press
+ * time does not depend on the main loop period and a press shorter than this period is not lost.
+ *
+ * A button can also be attached to a Debouncer that samples many inputs at once: the button is
+ * then driven by Debouncer::periodic() instead of its own periodic().
  */
-class Button : IOPin
+class Button : IOPin, IOPin::ExtiHandler
 {
 public:
 
@@ -47,16 +56,56 @@ public:
         handler = _handler;
     }
 
+    using IOPin::getPort;
+    using IOPin::getPins;
+
+    /**
+     * @brief Switches the button into the interrupt mode. Returns false if the EXTI line of
+     *        the pin is not available: the button stays in the polling mode.
+     */
+    inline bool startInterrupt (const InterruptPriority & prio)
+    {
+        interruptMode = enableExti(Edge::BOTH, prio, this);
+        return interruptMode;
+    }
+
+    inline void stopInterrupt ()
+    {
+        disableExti();
+        interruptMode = false;
+    }
+
+    inline bool isInterruptMode () const
+    {
+        return interruptMode;
+    }
+
+    virtual void onExtiEdge (const ExtiEvent & event);
+
     void periodic ();
 
 private:
 
+    friend class Debouncer;
+
+    static const size_t QUEUE_SIZE = 8;
+
     const RealTimeClock & rtc;
     duration_ms pressDelay, pressDuration;
     time_ms pressTime;
     bool currentState;
     uint32_t numOccured;
     EventHandler * handler;
+    bool interruptMode;
+    bool bankMode;
+    SpscQueue<ExtiEvent, QUEUE_SIZE> events;
+
+    inline bool isPressed (bool level) const
+    {
+        return (gpioParameters.Pull == GPIO_PULLUP)? !level : level;
+    }
+
+    void processState (bool newState, time_ms time);
 };
 
 } // end of namespace Devices
@@ -23,6 +23,8 @@
 using namespace StmPlusPlus;
 using namespace StmPlusPlus::Devices;
 
+#define USART_DEBUG_MODULE "DAC: "
+
 Dac_MCP49x1::Dac_MCP49x1 (Spi & _spi, IOPin & _pinCs, Resolution _resolution, uint16_t _lowerLimit, uint16_t _upperLimit):
     spi(_spi),
     pinCs(_pinCs),
@@ -61,8 +63,280 @@ void Dac_MCP49x1::putValue (uint16_t percent)
 
     pinCs.setLow();
     HAL_Delay(1);
-    spi.putChar(message.bytes.high);
-    spi.putChar(message.bytes.low);
+    #ifdef SPI_CR1_DFF
+    bool wordMode = (spi.getInstance()->CR1 & SPI_CR1_DFF) != 0;
+    #else
+    bool wordMode = (spi.getInstance()->CR2 & SPI_CR2_DS) > SPI_DATASIZE_8BIT;
+    #endif
+    if (wordMode)
+    {
+        // 16 bit mode, e.g. shared with the waveform generator
+        spi.putInt(message.rawData);
+    }
+    else
+    {
+        spi.putChar(message.bytes.high);
+        spi.putChar(message.bytes.low);
+    }
     HAL_Delay(1);
     pinCs.setHigh();
 }
+
+
+uint16_t Dac_MCP49x1::getCommand (uint16_t code) const
+{
+    Message m = message;
+    m.fields.outputShutdownControl = 1;
+    m.fields.valueInVolts = (code > getMaxCode()? getMaxCode() : code) << (4 - 2 * (int)resolution);
+    return m.rawData;
+}
+
+
+uint16_t Dac_MCP49x1::getShutdownCommand () const
+{
+    Message m = message;
+    m.fields.outputShutdownControl = 0;
+    m.fields.valueInVolts = 0;
+    return m.rawData;
+}
+
+
+#ifdef STM32F4
+
+/************************************************************************
+ * Class WaveformGenerator
+ ************************************************************************/
+WaveformGenerator::WaveformGenerator (Dac_MCP49x1 & _dac, TimerBase & _timer, uint32_t _csChannel, uint32_t _csAlternate,
+                                      uint32_t _triggerChannel, DMA_Stream_TypeDef * stream, uint32_t dmaChannel,
+                                      uint16_t * _buffer, size_t _capacity):
+    dac(_dac),
+    timer(_timer),
+    csChannel(_csChannel),
+    csAlternate(_csAlternate),
+    triggerChannel(_triggerChannel),
+    dma{},
+    buffer(_buffer),
+    capacity(_capacity),
+    samples(0),
+    active(false),
+    loop(false)
+{
+    dma.Instance = stream;
+    dma.Init.Channel = dmaChannel;
+    dma.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    dma.Init.PeriphInc = DMA_PINC_DISABLE;
+    dma.Init.MemInc = DMA_MINC_ENABLE;
+    dma.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    dma.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    dma.Init.Mode = DMA_NORMAL;
+    dma.Init.Priority = DMA_PRIORITY_HIGH;
+    dma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    dma.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    dma.Init.MemBurst = DMA_MBURST_SINGLE;
+    dma.Init.PeriphBurst = DMA_PBURST_SINGLE;
+}
+
+
+size_t WaveformGenerator::addHold (uint16_t code, size_t n)
+{
+    uint16_t command = dac.getCommand(code);
+    size_t added = 0;
+    for (; added < n && samples < capacity; ++added)
+    {
+        buffer[samples++] = command;
+    }
+    return added;
+}
+
+
+size_t WaveformGenerator::addRamp (uint16_t from, uint16_t to, size_t n)
+{
+    if (n < 2)
+    {
+        return addHold(to, n);
+    }
+    int32_t delta = (int32_t)to - (int32_t)from;
+    size_t added = 0;
+    for (; added < n && samples < capacity; ++added)
+    {
+        // rounded to the nearest code
+        int32_t step = (delta * (int32_t)(2 * added) + (int32_t)(n - 1) * (delta < 0? -1 : 1)) / (int32_t)(2 * (n - 1));
+        buffer[samples++] = dac.getCommand(from + step);
+    }
+    return added;
+}
+
+
+size_t WaveformGenerator::addTable (const uint16_t * table, size_t tableSize, size_t n)
+{
+    if (tableSize == 0)
+    {
+        return 0;
+    }
+    // the table index advances by tableSize / n per sample: the remainder is accumulated
+    // exactly, so that sample i always takes the entry i * tableSize / n
+    size_t index = 0, remainder = 0, added = 0;
+    for (; added < n && samples < capacity; ++added)
+    {
+        buffer[samples++] = dac.getCommand(table[index]);
+        remainder += tableSize;
+        while (remainder >= n)
+        {
+            remainder -= n;
+            ++index;
+        }
+    }
+    return added;
+}
+
+
+size_t WaveformGenerator::addShutdown (size_t n)
+{
+    uint16_t command = dac.getShutdownCommand();
+    size_t added = 0;
+    for (; added < n && samples < capacity; ++added)
+    {
+        buffer[samples++] = command;
+    }
+    return added;
+}
+
+
+uint32_t WaveformGenerator::getTriggerTicks () const
+{
+    uint64_t clock = timer.getClockFrequency();
+    return (uint32_t)((CS_SETUP_NS * clock + 999999999ULL) / 1000000000ULL) + 1;
+}
+
+
+uint32_t WaveformGenerator::getFrameTicks () const
+{
+    Spi & spi = dac.getSpi();
+    uint64_t clock = timer.getClockFrequency();
+    uint64_t divider = 2 << ((spi.getInstance()->CR1 & SPI_CR1_BR) >> 3);
+    uint64_t frameNs = 16 * divider * 1000000000ULL / spi.getClockFrequency() + DMA_LATENCY_NS;
+    return (uint32_t)((frameNs * clock + 999999999ULL) / 1000000000ULL) + 1;
+}
+
+
+uint32_t WaveformGenerator::getMaxSampleRate () const
+{
+    return timer.getClockFrequency() / (getTriggerTicks() + getFrameTicks() + CS_HIGH_TICKS);
+}
+
+
+bool WaveformGenerator::start (uint32_t sampleRate, bool _loop)
+{
+    SPI_TypeDef * spi = dac.getSpi().getInstance();
+    if (active || samples == 0 || sampleRate == 0)
+    {
+        return false;
+    }
+    if ((spi->CR1 & SPI_CR1_DFF) == 0)
+    {
+        USART_DEBUG("SPI shall be started in 16 bit mode");
+        return false;
+    }
+    if (sampleRate > getMaxSampleRate())
+    {
+        USART_DEBUG("Sample rate " << sampleRate << " exceeds the maximum " << getMaxSampleRate());
+        return false;
+    }
+    loop = _loop;
+
+    // the timer period is one sample; the prescaler keeps the period within 16 bit
+    uint32_t ticks = timer.getClockFrequency() / sampleRate;
+    uint32_t prescaler = (ticks - 1) / 0x10000 + 1;
+    uint32_t triggerTicks = (getTriggerTicks() + prescaler - 1) / prescaler;
+    uint32_t csTicks = triggerTicks + (getFrameTicks() + prescaler - 1) / prescaler;
+    TIM_HandleTypeDef * htim = timer.getTimerParameters();
+    htim->Init.Prescaler = prescaler - 1;
+    htim->Init.Period = ticks / prescaler - 1;
+    htim->Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim->Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    htim->Init.RepetitionCounter = 0;
+    HAL_StatusTypeDef status = HAL_TIM_PWM_Init(htim);
+
+    // CS: low while the counter is below csTicks
+    TIM_OC_InitTypeDef oc;
+    oc.OCMode = TIM_OCMODE_PWM1;
+    oc.Pulse = csTicks;
+    oc.OCPolarity = TIM_OCPOLARITY_LOW;
+    oc.OCNPolarity = TIM_OCNPOLARITY_HIGH;
+    oc.OCFastMode = TIM_OCFAST_DISABLE;
+    oc.OCIdleState = TIM_OCIDLESTATE_SET;
+    oc.OCNIdleState = TIM_OCNIDLESTATE_RESET;
+    if (status == HAL_OK)
+    {
+        status = HAL_TIM_PWM_ConfigChannel(htim, &oc, csChannel);
+    }
+
+    // trigger: DMA request at the compare event, CS is already low
+    oc.OCMode = TIM_OCMODE_TIMING;
+    oc.Pulse = triggerTicks;
+    oc.OCPolarity = TIM_OCPOLARITY_HIGH;
+    if (status == HAL_OK)
+    {
+        status = HAL_TIM_OC_ConfigChannel(htim, &oc, triggerChannel);
+    }
+
+    if ((size_t)dma.Instance >= (size_t)DMA2_Stream0)
+    {
+        __HAL_RCC_DMA2_CLK_ENABLE();
+    }
+    else
+    {
+        __HAL_RCC_DMA1_CLK_ENABLE();
+    }
+    dma.Init.Mode = loop? DMA_CIRCULAR : DMA_NORMAL;
+    if (status == HAL_OK)
+    {
+        status = HAL_DMA_Init(&dma);
+    }
+    if (status == HAL_OK)
+    {
+        status = HAL_DMA_Start(&dma, (uint32_t)(size_t)buffer, (uint32_t)(size_t)&spi->DR, samples);
+    }
+    if (status != HAL_OK)
+    {
+        USART_DEBUG("Can not start waveform output: " << status);
+        return false;
+    }
+
+    SET_BIT(spi->CR2, SPI_CR2_TXDMAEN);
+    IOPin & pinCs = dac.getPinCs();
+    pinCs.setAlternate(csAlternate);
+    pinCs.setMode(GPIO_MODE_AF_PP);
+    __HAL_TIM_ENABLE_DMA(htim, TIM_DMA_CC1 << (triggerChannel / 4));
+    __HAL_TIM_SET_COUNTER(htim, 0);
+    HAL_TIM_OC_Start(htim, triggerChannel);
+    HAL_TIM_PWM_Start(htim, csChannel);
+    active = true;
+
+    USART_DEBUG("Started waveform output: " << samples << " samples at " << sampleRate
+             << " Hz, loop = " << loop << ", period = " << ticks / prescaler
+             << ", CS = " << csTicks << ", trigger = " << triggerTicks);
+    return true;
+}
+
+
+void WaveformGenerator::stop ()
+{
+    if (!active)
+    {
+        return;
+    }
+    TIM_HandleTypeDef * htim = timer.getTimerParameters();
+    HAL_TIM_PWM_Stop(htim, csChannel);
+    HAL_TIM_OC_Stop(htim, triggerChannel);
+    __HAL_TIM_DISABLE_DMA(htim, TIM_DMA_CC1 << (triggerChannel / 4));
+    HAL_DMA_Abort(&dma);
+    CLEAR_BIT(dac.getSpi().getInstance()->CR2, SPI_CR2_TXDMAEN);
+    // back to the software chip select used by putValue()
+    IOPin & pinCs = dac.getPinCs();
+    pinCs.setHigh();
+    pinCs.setMode(GPIO_MODE_OUTPUT_PP);
+    active = false;
+}
+
+#endif
@@ -45,6 +45,32 @@ public:
     }
 
     void putValue (uint16_t percent);
+
+    /**
+     * @brief Returns the command word that outputs the given code (0 to getMaxCode()) with the
+     *        current output gain setting.
+     */
+    uint16_t getCommand (uint16_t code) const;
+
+    /**
+     * @brief Returns the command word that shuts the output down.
+     */
+    uint16_t getShutdownCommand () const;
+
+    inline uint16_t getMaxCode () const
+    {
+        return (1 << (8 + 2 * (int)resolution)) - 1;
+    }
+
+    inline Spi & getSpi ()
+    {
+        return spi;
+    }
+
+    inline IOPin & getPinCs ()
+    {
+        return pinCs;
+    }
     
 private:
 
@@ -74,6 +100,121 @@ private:
     Message message;
 };
 
+#ifdef STM32F4
+
+/**
+ * @brief Waveform generator that streams precomputed command words to a Dac_MCP49x1 at a fixed
+ *        sample rate, without CPU load during the output.
+ *
+ * The samples (ramps, holds, resampled lookup tables) are converted into MCP49x1 command words
+ * including the gain and shutdown bits when they are added to the buffer. During the output,
+ * a timer paces everything:
+ * - the chip select channel drives the CS pin of the DAC (alternate function of the timer) in
+ *   PWM mode: low at the beginning of every sample period and high after the word is shifted,
+ *   the rising edge latches the word into the DAC (LDAC tied low);
+ * - the compare event of the trigger channel, a few ticks after CS is low, requests the DMA
+ *   stream that writes the next word into the SPI data register.
+ * In the loop mode, the DMA stream is circular and the buffer is repeated endlessly.
+ *
+ * The SPI shall be started by the application in the 16 bit mode, CPOL low, first edge (mode 0)
+ * with a clock of at most 20 MHz, and shall not be used by other devices while the output runs.
+ * Dac_MCP49x1::putValue() sends one 16 bit frame in this mode, so it works after stop().
+ * The DMA stream and its channel shall serve the compare request of the trigger channel, for
+ * example TIM1_CH2 on DMA2 Stream 2 channel 6 with CS on TIM1_CH1. The buffer shall not be
+ * modified while the output runs.
+ */
+class WaveformGenerator final
+{
+public:
+
+    static const uint32_t CS_SETUP_NS = 40;     // CS low to the first clock edge
+    static const uint32_t DMA_LATENCY_NS = 200; // request to data register write, worst case
+    static const uint32_t CS_HIGH_TICKS = 2;    // CS high between two words
+
+    WaveformGenerator (Dac_MCP49x1 & _dac, TimerBase & _timer, uint32_t _csChannel, uint32_t _csAlternate,
+                       uint32_t _triggerChannel, DMA_Stream_TypeDef * stream, uint32_t dmaChannel,
+                       uint16_t * _buffer, size_t _capacity);
+
+    inline void clear ()
+    {
+        samples = 0;
+    }
+
+    /**
+     * @brief Append a constant code. Every add method returns the number of appended samples,
+     *        less than requested if the buffer is full.
+     */
+    size_t addHold (uint16_t code, size_t n);
+
+    /**
+     * @brief Append a linear ramp from the first to the last code, both included.
+     */
+    size_t addRamp (uint16_t from, uint16_t to, size_t n);
+
+    /**
+     * @brief Append one period of a lookup table of codes, resampled to n samples: the
+     *        frequency of the periodic output is the sample rate divided by n.
+     */
+    size_t addTable (const uint16_t * table, size_t tableSize, size_t n);
+
+    /**
+     * @brief Append samples with the DAC output shut down.
+     */
+    size_t addShutdown (size_t n);
+
+    inline size_t getSamples () const
+    {
+        return samples;
+    }
+
+    inline const uint16_t * getBuffer () const
+    {
+        return buffer;
+    }
+
+    /**
+     * @brief Start the output of the buffer. Fails if the SPI is not in the 16 bit mode or if the
+     *        sample rate exceeds getMaxSampleRate().
+     */
+    bool start (uint32_t sampleRate, bool loop);
+
+    void stop ();
+
+    inline bool isActive () const
+    {
+        return active;
+    }
+
+    /**
+     * @brief Returns true if a single (not looped) output has sent all samples.
+     */
+    inline bool isFinished () const
+    {
+        return !active || (!loop && __HAL_DMA_GET_COUNTER(&dma) == 0);
+    }
+
+    /**
+     * @brief Returns the highest sample rate the SPI and the timer allow: one sample period holds
+     *        the CS setup, the DMA latency, the 16 bit frame and the CS high time.
+     */
+    uint32_t getMaxSampleRate () const;
+
+private:
+
+    Dac_MCP49x1 & dac;
+    TimerBase & timer;
+    uint32_t csChannel, csAlternate, triggerChannel;
+    DMA_HandleTypeDef dma;
+    uint16_t * buffer;
+    size_t capacity, samples;
+    bool active, loop;
+
+    uint32_t getTriggerTicks () const;
+    uint32_t getFrameTicks () const;
+};
+
+#endif
+
 } // end of namespace Devices
 } // end of namespace StmPlusPlus
 
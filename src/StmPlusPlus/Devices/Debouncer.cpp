@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "Debouncer.h"
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+Debouncer::Debouncer (const RealTimeClock & _rtc, uint32_t _samplingFreq, uint32_t _counterBits):
+    rtc{_rtc},
+    samplingFreq{_samplingFreq},
+    counterBits{_counterBits},
+    activeLow{0},
+    state{0},
+    ticks{0},
+    buttonMask{0},
+    pressed{0},
+    released{0}
+{
+    if (counterBits < MIN_COUNTER_BITS)
+    {
+        counterBits = MIN_COUNTER_BITS;
+    }
+    if (counterBits > MAX_COUNTER_BITS)
+    {
+        counterBits = MAX_COUNTER_BITS;
+    }
+    for (size_t k = 0; k < MAX_COUNTER_BITS; ++k)
+    {
+        ct[k] = 0;
+    }
+    for (size_t i = 0; i < MAX_INPUTS; ++i)
+    {
+        buttons[i] = NULL;
+    }
+}
+
+
+bool Debouncer::addButton (size_t input, Button & button)
+{
+    if (input >= MAX_INPUTS)
+    {
+        return false;
+    }
+    uint32_t bit = 1UL << input;
+    if (button.isPressed(false))
+    {
+        activeLow |= bit;
+    }
+    else
+    {
+        activeLow &= ~bit;
+    }
+    button.bankMode = true;
+    buttons[input] = &button;
+    buttonMask |= bit;
+    return true;
+}
+
+
+void Debouncer::periodic ()
+{
+    time_ms now = rtc.getUpTimeMillisec();
+    uint32_t t = ticks;
+    pressed = 0;
+    released = 0;
+
+    Edge e;
+    while (edges.pop(e))
+    {
+        pressed |= e.toggled & e.state;
+        released |= e.toggled & ~e.state;
+        // the edge time is restored from the sample number
+        time_ms edgeTime = now - (time_ms)(t - e.tick) * MILLIS_IN_SEC / samplingFreq;
+        for (uint32_t m = e.toggled & buttonMask; m != 0; m &= m - 1)
+        {
+            Button * b = buttons[__builtin_ctz(m)];
+            if (b->handler != NULL)
+            {
+                b->processState((e.state >> __builtin_ctz(m)) & 1, edgeTime);
+            }
+        }
+    }
+
+    // long-press and repeat events of the held buttons
+    uint32_t s = state;
+    for (uint32_t m = buttonMask; m != 0; m &= m - 1)
+    {
+        Button * b = buttons[__builtin_ctz(m)];
+        if (b->handler != NULL)
+        {
+            b->processState((s >> __builtin_ctz(m)) & 1, now);
+        }
+    }
+}
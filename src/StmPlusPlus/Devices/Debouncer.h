@@ -0,0 +1,170 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DEBOUNCER_H_
+#define DEBOUNCER_H_
+
+#include "Button.h"
+
+namespace StmPlusPlus {
+namespace Devices {
+
+/** 
+ * @brief Class that debounces up to 32 inputs at once using vertical counters
+ *
+ * The inputs are sampled at a fixed rate, usually from a timer interrupt, as a 32-bit word where
+ * the bit i is the level of the input i. Each input has a small counter of consecutive samples
+ * that differ from its debounced state. The counters are stored "vertically": the word ct[k]
+ * holds the bit k of all 32 counters, so all counters are incremented or reset by a few bitwise
+ * operations per sample regardless of the number of inputs. A counter with COUNTER_BITS bits
+ * wraps after 2^COUNTER_BITS samples: the input is then toggled. With 2 bits at 1 kHz, an input
+ * shall be stable for 4 ms.
+ *
+ * The debounced state is stored as "active" bits: the inputs given by the active-low mask are
+ * inverted. The press (active) and release edges are queued to the main loop with the sample
+ * number. periodic() drives the attached Button objects: the press, release, long-press and
+ * repeat events are reported by the unchanged Button::EventHandler interface with the timing
+ * parameters of the button.
+ */
+class Debouncer
+{
+public:
+
+    static const size_t MAX_INPUTS = 32;
+    static const uint32_t MIN_COUNTER_BITS = 1;
+    static const uint32_t MAX_COUNTER_BITS = 4;
+    static const size_t QUEUE_SIZE = 16;
+
+    Debouncer (const RealTimeClock & _rtc, uint32_t _samplingFreq, uint32_t _counterBits = 2);
+
+    /**
+     * @brief Sets the inputs that are active at the low level, for example pulled-up buttons.
+     */
+    inline void setActiveLow (uint32_t mask)
+    {
+        activeLow = mask;
+    }
+
+    /**
+     * @brief Attaches a button to the given input. The button is not polled anymore: its events
+     *        are generated by periodic(). The active level is taken from the button pull.
+     */
+    bool addButton (size_t input, Button & button);
+
+    /**
+     * @brief Processes the sample of all inputs, shall be called with the sampling frequency.
+     *        Can be called from an interrupt.
+     */
+    inline void sample (uint32_t levels)
+    {
+        uint32_t s = state;
+        uint32_t delta = (levels ^ activeLow) ^ s;
+        // increment the counters of the differing inputs, reset all others
+        uint32_t carry = delta;
+        for (uint32_t k = 0; k < counterBits; ++k)
+        {
+            uint32_t c = ct[k];
+            ct[k] = (c ^ carry) & delta;
+            carry &= c;
+        }
+        // a carry out of the most significant bit means that the counter wrapped
+        ++ticks;
+        if (carry != 0)
+        {
+            s ^= carry;
+            state = s;
+            Edge e;
+            e.toggled = carry;
+            e.state = s;
+            e.tick = ticks;
+            edges.push(e);
+        }
+    }
+
+    /**
+     * @brief Dispatches the debounced edges to the attached buttons, shall be called from the
+     *        main loop.
+     */
+    void periodic ();
+
+    /**
+     * @brief Returns the debounced state, bit i is set if the input i is active.
+     */
+    inline uint32_t getState () const
+    {
+        return state;
+    }
+
+    /**
+     * @brief Returns the inputs activated since the previous call of periodic().
+     */
+    inline uint32_t getPressed () const
+    {
+        return pressed;
+    }
+
+    /**
+     * @brief Returns the inputs released since the previous call of periodic().
+     */
+    inline uint32_t getReleased () const
+    {
+        return released;
+    }
+
+    /**
+     * @brief Returns the number of edges lost due to the queue overflow.
+     */
+    inline uint32_t getLostEdges () const
+    {
+        return edges.getOverflows();
+    }
+
+private:
+
+    class Edge
+    {
+    public:
+
+        uint32_t toggled; // inputs toggled by this sample
+        uint32_t state;   // debounced state after this sample
+        uint32_t tick;    // sample number
+    };
+
+    const RealTimeClock & rtc;
+    uint32_t samplingFreq;
+    uint32_t counterBits;
+    uint32_t activeLow;
+
+    // Sampling, updated in the interrupt context
+    uint32_t ct[MAX_COUNTER_BITS];
+    volatile uint32_t state;
+    volatile uint32_t ticks;
+    SpscQueue<Edge, QUEUE_SIZE> edges;
+
+    // Dispatching
+    Button * buttons[MAX_INPUTS];
+    uint32_t buttonMask;
+    uint32_t pressed, released;
+};
+
+} // end of namespace Devices
+} // end of namespace StmPlusPlus
+
+#endif
@@ -26,6 +26,203 @@ using namespace StmPlusPlus::Devices;
 
 #define USART_DEBUG_MODULE "ESP: "
 
+/************************************************************************
+ * Class AtTokenizer
+ ************************************************************************/
+
+AtTokenizer::AtTokenizer () :
+        nodesCount(1),
+        handler(NULL),
+        state(State::TEXT),
+        currNode(0),
+        pendingToken(Token::NONE),
+        number(0),
+        prefixNumber(-1),
+        payloadRest(0)
+{
+    ::memset(nodes, 0, sizeof(nodes));
+}
+
+bool AtTokenizer::addPattern (const char * text, Token token, bool withNumber, int8_t value)
+{
+    uint8_t node = 0;
+    for (const char * c = text; *c != 0; ++c)
+    {
+        uint8_t child = findChild(node, *c);
+        if (child == 0)
+        {
+            if (nodesCount >= MAX_NODES)
+            {
+                return false;
+            }
+            child = nodesCount++;
+            nodes[child].c = *c;
+            nodes[child].sibling = nodes[node].child;
+            nodes[node].child = child;
+        }
+        node = child;
+    }
+    nodes[node].token = token;
+    nodes[node].withNumber = withNumber;
+    nodes[node].value = value;
+    return true;
+}
+
+void AtTokenizer::build ()
+{
+    // breadth-first traversal: the failure link of a node points to the node representing
+    // the longest proper suffix that is also a prefix of a pattern
+    uint8_t queue[MAX_NODES];
+    size_t head = 0, tail = 0;
+    for (uint8_t child = nodes[0].child; child != 0; child = nodes[child].sibling)
+    {
+        nodes[child].fail = 0;
+        queue[tail++] = child;
+    }
+    while (head < tail)
+    {
+        uint8_t node = queue[head++];
+        for (uint8_t child = nodes[node].child; child != 0; child = nodes[child].sibling)
+        {
+            uint8_t f = nodes[node].fail;
+            while (f != 0 && findChild(f, nodes[child].c) == 0)
+            {
+                f = nodes[f].fail;
+            }
+            nodes[child].fail = findChild(f, nodes[child].c);
+            if (nodes[child].token == Token::NONE)
+            {
+                // a pattern that is a suffix of the current one
+                nodes[child].token = nodes[nodes[child].fail].token;
+                nodes[child].withNumber = nodes[nodes[child].fail].withNumber;
+                nodes[child].value = nodes[nodes[child].fail].value;
+            }
+            queue[tail++] = child;
+        }
+    }
+    reset();
+}
+
+void AtTokenizer::reset ()
+{
+    state = State::TEXT;
+    currNode = 0;
+    pendingToken = Token::NONE;
+    payloadRest = 0;
+    step(LINE_START);
+}
+
+void AtTokenizer::feed (const char * data, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        if (state == State::PAYLOAD)
+        {
+            size_t n = (payloadRest < len - i)? payloadRest : len - i;
+            payloadRest -= n;
+            if (handler != NULL)
+            {
+                handler->onPayload(data + i, n, payloadRest == 0);
+            }
+            i += n;
+            if (payloadRest == 0)
+            {
+                reset();
+            }
+            continue;
+        }
+
+        char c = data[i++];
+        if (state == State::NUMBER && processNumber(c))
+        {
+            continue;
+        }
+        step(c);
+    }
+}
+
+uint8_t AtTokenizer::findChild (uint8_t node, char c) const
+{
+    for (uint8_t child = nodes[node].child; child != 0; child = nodes[child].sibling)
+    {
+        if (nodes[child].c == c)
+        {
+            return child;
+        }
+    }
+    return 0;
+}
+
+void AtTokenizer::step (char c)
+{
+    uint8_t next = findChild(currNode, c);
+    while (next == 0 && currNode != 0)
+    {
+        currNode = nodes[currNode].fail;
+        next = findChild(currNode, c);
+    }
+    currNode = next;
+
+    const Node & n = nodes[currNode];
+    if (n.token == Token::NONE)
+    {
+        return;
+    }
+    if (n.withNumber)
+    {
+        state = State::NUMBER;
+        pendingToken = n.token;
+        number = 0;
+        prefixNumber = -1;
+    }
+    else
+    {
+        emitToken(n.token, n.value);
+    }
+}
+
+bool AtTokenizer::processNumber (char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        number = number * 10 + (c - '0');
+        return true;
+    }
+    if (c == ',')
+    {
+        prefixNumber = number;
+        number = 0;
+        return true;
+    }
+
+    state = State::TEXT;
+    emitToken(pendingToken, number);
+    if (c == ':' && pendingToken == Token::IPD)
+    {
+        if (number > 0)
+        {
+            state = State::PAYLOAD;
+            payloadRest = number;
+        }
+        return true;
+    }
+    // not a part of the number: process it as a text
+    return false;
+}
+
+void AtTokenizer::emitToken (Token token, int32_t value)
+{
+    if (handler != NULL)
+    {
+        handler->onToken(token, value);
+    }
+}
+
+/************************************************************************
+ * Class Esp11
+ ************************************************************************/
+
 Esp11::Esp11 (const RealTimeClock & _rtc,
               Usart::DeviceName usartName, IOPort::PortName usartPort, uint32_t txPin,
               uint32_t rxPin, InterruptPriority & prio, IOPort::PortName powerPort, uint32_t powerPin) :
@@ -35,8 +232,34 @@ Esp11::Esp11 (const RealTimeClock & _rtc,
         pinPower(powerPort, powerPin, GPIO_MODE_OUTPUT_PP),
         sendLed(NULL),
         commState(CommState::NONE),
-        rxIndex(0),
+        rxIdle(false),
+        rxReadBytes(0),
+        rxOverruns(0),
+        truncatedBytes(0),
+        msgIndex(0),
+        msgSize(0),
         listening(false),
+        shortOkResponse(true),
+        promptResponse(false),
+        expectResponce(true),
+        transparent(false),
+        responceTime(INFINITY_TIME),
+        respMode(-1),
+        respWlanFound(false),
+        respConnected(false),
+        baudRate(ESP_BAUDRATE),
+        flowControl(false),
+        flowControlPort(IOPort::A),
+        ctsPin(0),
+        rtsPin(0),
+        sendStartCycles(0),
+        payloadBytes(0),
+        payloadCycles(0),
+        multiConnection(false),
+        linkId(0),
+        inputLinkId(-1),
+        inputHandler(NULL),
+        checkpoint(),
         mode(-1),
         ip(NULL),
         gatway(NULL),
@@ -52,57 +275,176 @@ Esp11::Esp11 (const RealTimeClock & _rtc,
         inputMessage(NULL),
         inputMessageSize(0)
 {
-    // empty
+    tokenizer.addPattern(RESP_OK, AtTokenizer::Token::OK);
+    tokenizer.addPattern(RESP_SEND_OK, AtTokenizer::Token::SEND_OK);
+    tokenizer.addPattern(RESP_ERROR, AtTokenizer::Token::ERROR);
+    tokenizer.addPattern(RESP_READY, AtTokenizer::Token::READY);
+    tokenizer.addPattern(CMD_CONNECT_SERVER_RESPONCE, AtTokenizer::Token::CONNECT);
+    tokenizer.addPattern(RESP_GETMODE, AtTokenizer::Token::CWMODE, true);
+    tokenizer.addPattern(RESP_GETNET, AtTokenizer::Token::CWLAP);
+    tokenizer.addPattern(CMD_INPUT_MESSAGE, AtTokenizer::Token::IPD, true);
+    tokenizer.addPattern(RESP_WIFI_DISCONNECT, AtTokenizer::Token::WIFI_DISCONNECT);
+    tokenizer.addPattern(RESP_PROMPT, AtTokenizer::Token::PROMPT);
+
+    // "<id>,CLOSED" notifications: one pattern per link ID
+    char closed[16];
+    for (size_t i = 0; i < MAX_LINKS; ++i)
+    {
+        closed[0] = AtTokenizer::LINE_START;
+        closed[1] = '0' + i;
+        ::strcpy(closed + 2, RESP_CLOSED);
+        tokenizer.addPattern(closed, AtTokenizer::Token::CLOSED, false, i);
+
+        links[i].protocol[0] = links[i].server[0] = links[i].port[0] = 0;
+        links[i].connected = false;
+        links[i].lastUsed = 0;
+        links[i].handler = NULL;
+    }
+    tokenizer.build();
+    tokenizer.setHandler(this);
+    resetCheckpoint();
 }
 
 bool Esp11::init ()
 {
-    HAL_StatusTypeDef status = usart.start(UART_MODE_RX, ESP_BAUDRATE, UART_WORDLENGTH_8B,
-    					   UART_STOPBITS_1, UART_PARITY_NONE);
-    if (status != HAL_OK)
+    if (!startUsart(ESP_BAUDRATE, UART_HWCONTROL_NONE))
     {
-        USART_DEBUG("Cannot start ESP USART/RX: " << status);
         return false;
     }
-    ::memset(rxBuffer, 0, BUFFER_SIZE);
     pinPower.putBit(true);
     bool isReady = waitForResponce(RESP_READY);
+    if (isReady && baudRate != ESP_BAUDRATE)
+    {
+        if (negotiateBaudRate())
+        {
+            USART_DEBUG("ESP baud rate: " << (int)baudRate);
+        }
+        else
+        {
+            // the baud rate set by AT+UART_CUR is not stored: a reset restores the default one
+            USART_DEBUG("Cannot switch ESP baud rate to " << (int)baudRate << ", fall back to " << (int)ESP_BAUDRATE);
+            stopUsart();
+            pinPower.putBit(false);
+            HAL_Delay(POWER_OFF_DELAY);
+            if (!startUsart(ESP_BAUDRATE, UART_HWCONTROL_NONE))
+            {
+                return false;
+            }
+            pinPower.putBit(true);
+            isReady = waitForResponce(RESP_READY);
+        }
+    }
     if (!isReady)
     {
         powerOff();
+        return false;
     }
+    payloadBytes = payloadCycles = 0;
     usart.startInterrupt(usartPrio);
     return isReady;
 }
 
-bool Esp11::waitForResponce (const char * responce)
+bool Esp11::startUsart (uint32_t rate, uint32_t hwControl)
 {
-    bool retValue = false;
-    size_t responceLen = ::strlen(responce);
-    char tmp[10];
-    char * tmpPtr = &tmp[0];
-    size_t idx = 0;
-    while (true)
+    HAL_StatusTypeDef status = usart.start(UART_MODE_TX_RX, rate, UART_WORDLENGTH_8B,
+                                           UART_STOPBITS_1, UART_PARITY_NONE, hwControl);
+    if (status != HAL_OK)
+    {
+        USART_DEBUG("Cannot start ESP USART: " << status);
+        return false;
+    }
+    status = usart.startReceiveCircular(dmaBuffer, DMA_BUFFER_SIZE, usartPrio);
+    if (status != HAL_OK)
+    {
+        USART_DEBUG("Cannot start ESP USART/RX DMA: " << status);
+        usart.stop();
+        return false;
+    }
+    status = usart.startTransmitDma(usartPrio);
+    if (status != HAL_OK)
+    {
+        USART_DEBUG("Cannot start ESP USART/TX DMA: " << status);
+        usart.stopReceiveCircular();
+        usart.stop();
+        return false;
+    }
+    flushReceiver();
+    return true;
+}
+
+void Esp11::stopUsart ()
+{
+    usart.stopTransmitDma();
+    usart.stopReceiveCircular();
+    usart.stop();
+    flushReceiver();
+}
+
+bool Esp11::negotiateBaudRate ()
+{
+    uint32_t hwControl = UART_HWCONTROL_NONE;
+    int espFlowControl = 0;
+    if (flowControl)
     {
-        if (usart.receive(tmpPtr, 1, ESP_TIMEOUT) != HAL_OK)
+        if ((ctsPin | rtsPin) != 0 && usart.initFlowControlPins(flowControlPort, ctsPin, rtsPin))
         {
-            break;
+            // the module RTS drives the MCU CTS and vice versa
+            hwControl = (ctsPin != 0 && rtsPin != 0)? UART_HWCONTROL_RTS_CTS :
+                        (ctsPin != 0)? UART_HWCONTROL_CTS : UART_HWCONTROL_RTS;
+            espFlowControl = ((ctsPin != 0)? 1 : 0) | ((rtsPin != 0)? 2 : 0);
         }
-        
-        if (*tmpPtr != responce[idx])
+        else
         {
-            idx = 0;
-            continue;
+            USART_DEBUG("Flow control pins are not valid for ESP USART, flow control disabled");
         }
-        
-        ++idx;
-        if (idx == responceLen)
+    }
+
+    // AT+UART_CUR=<baudrate>,<databits>,<stopbits>,<parity>,<flow control>
+    ::strcpy(cmdBuffer, CMD_SET_UART);
+    ::__utoa(baudRate, cmdBuffer + ::strlen(cmdBuffer), 10);
+    ::strcat(cmdBuffer, ",8,1,0,");
+    ::__itoa(espFlowControl, cmdBuffer + ::strlen(cmdBuffer), 10);
+    if (!sendCmd(cmdBuffer) || !waitForResponce(RESP_OK, BAUDRATE_TIMEOUT))
+    {
+        return false;
+    }
+
+    // the module responds using the old baud rate and switches after that
+    stopUsart();
+    if (!startUsart(baudRate, hwControl))
+    {
+        return false;
+    }
+    HAL_Delay(BAUDRATE_SWITCH_DELAY);
+    flushReceiver();
+    return sendCmd(CMD_AT) && waitForResponce(RESP_OK, BAUDRATE_TIMEOUT);
+}
+
+bool Esp11::waitForResponce (const char * responce, time_ms timeout)
+{
+    size_t responceLen = ::strlen(responce);
+    size_t idx = 0;
+    timeout += rtc.getUpTimeMillisec();
+    while (rtc.getUpTimeMillisec() < timeout)
+    {
+        uint32_t receivedBytes = usart.getReceivedBytes();
+        if (receivedBytes - rxReadBytes > DMA_BUFFER_SIZE)
         {
-            retValue = true;
-            break;
+            ++rxOverruns;
+            rxReadBytes = receivedBytes;
+        }
+        while (rxReadBytes != receivedBytes)
+        {
+            char c = dmaBuffer[rxReadBytes % DMA_BUFFER_SIZE];
+            ++rxReadBytes;
+            idx = (c == responce[idx])? idx + 1 : (c == responce[0])? 1 : 0;
+            if (idx == responceLen)
+            {
+                return true;
+            }
         }
     }
-    return retValue;
+    return false;
 }
 
 bool Esp11::sendCmd (const char * cmd, size_t cmdLen, bool addCmdEnd)
@@ -119,8 +461,10 @@ bool Esp11::sendCmd (const char * cmd, size_t cmdLen, bool addCmdEnd)
     USART_DEBUG(" -> " << cmd);
     stopListening();
     
-    ::memset(msgBuffer, 0, BUFFER_SIZE);
-    ::memset(rxBuffer, 0, BUFFER_SIZE);
+    flushReceiver();
+    tokenizer.reset();
+    respMode = -1;
+    respWlanFound = respConnected = false;
     ::memcpy(txBuffer, cmd, cmdLen);
     if (addCmdEnd)
     {
@@ -128,20 +472,33 @@ bool Esp11::sendCmd (const char * cmd, size_t cmdLen, bool addCmdEnd)
         cmdLen += 2;
     }
 
-    HAL_StatusTypeDef status = usart.startMode(UART_MODE_TX);
+    HAL_StatusTypeDef status = usart.transmitDma(txBuffer, cmdLen);
     if (status != HAL_OK)
     {
-        USART_DEBUG("Cannot start ESP USART/TX: " << status);
+        USART_DEBUG("Cannot transmit ESP request message: " << status);
         return false;
     }
 
-    status = usart.transmitIt(txBuffer, cmdLen);
-    if (status != HAL_OK)
+    return true;
+}
+
+bool Esp11::sendData (const char * data, size_t len, time_ms guardTime)
+{
+    if (data == NULL || len == 0)
     {
-        USART_DEBUG("Cannot transmit ESP request message: " << status);
         return false;
     }
 
+    // no response expected: the operation is finished when the guard time after
+    // the transmission is elapsed
+    expectResponce = false;
+    responceTime = rtc.getUpTimeMillisec() + guardTime;
+    HAL_StatusTypeDef status = usart.transmitDma(data, len);
+    if (status != HAL_OK)
+    {
+        USART_DEBUG("Cannot transmit ESP data: " << status);
+        return false;
+    }
     return true;
 }
 
@@ -221,6 +578,7 @@ bool Esp11::connectToServer ()
         return false;
     }
     ::strcpy(cmdBuffer, CMD_CONNECT_SERVER);
+    appendLinkId(cmdBuffer, linkId);
     ::strcat(cmdBuffer, "\"");
     ::strcat(cmdBuffer, protocol);
     ::strcat(cmdBuffer, "\",\"");
@@ -229,8 +587,10 @@ bool Esp11::connectToServer ()
     ::strcat(cmdBuffer, port);
     if (::strcmp(protocol, "UDP") == 0)
     {
+        // each UDP link needs an own local port
         ::strcat(cmdBuffer, ",");
-        ::strcat(cmdBuffer, UDP_PORT);
+        ::__itoa(UDP_LOCAL_PORT + (multiConnection? linkId : 0), cmdBuffer + ::strlen(cmdBuffer), 10);
+        ::strcat(cmdBuffer, ",0");
     }
     return sendCmd(cmdBuffer);
 }
@@ -243,7 +603,8 @@ bool Esp11::sendMessageSize ()
     }
     size_t len = messageSize;
     ::strcpy(cmdBuffer, CMD_SEND);
-    ::__itoa(len, cmdBuffer + ::strlen(CMD_SEND), 10);
+    appendLinkId(cmdBuffer, linkId);
+    ::__itoa(len, cmdBuffer + ::strlen(cmdBuffer), 10);
     return sendCmd(cmdBuffer);
 }
 
@@ -257,6 +618,91 @@ bool Esp11::sendMessage ()
     return sendCmd(message, messageSize, false);
 }
 
+bool Esp11::closeLink ()
+{
+    if (!multiConnection)
+    {
+        return closeAllLinks();
+    }
+    ::strcpy(cmdBuffer, CMD_CLOSE_CONNECT);
+    ::strcat(cmdBuffer, "=");
+    ::__itoa(linkId, cmdBuffer + ::strlen(cmdBuffer), 10);
+    return sendCmd(cmdBuffer);
+}
+
+bool Esp11::closeAllLinks ()
+{
+    if (!multiConnection)
+    {
+        return sendCmd(CMD_CLOSE_CONNECT);
+    }
+    // link ID equal to MAX_LINKS + 1 closes all connections
+    ::strcpy(cmdBuffer, CMD_CLOSE_CONNECT);
+    ::strcat(cmdBuffer, "=");
+    ::__itoa(MAX_LINKS + 1, cmdBuffer + ::strlen(cmdBuffer), 10);
+    return sendCmd(cmdBuffer);
+}
+
+void Esp11::appendLinkId (char * cmd, int32_t id)
+{
+    if (multiConnection)
+    {
+        ::__itoa(id, cmd + ::strlen(cmd), 10);
+        ::strcat(cmd, ",");
+    }
+}
+
+Esp11::LinkState Esp11::selectLink (EventHandler * handler)
+{
+    size_t linksNumber = multiConnection? MAX_LINKS : 1;
+    int32_t selected = -1;
+    for (size_t i = 0; i < linksNumber; ++i)
+    {
+        const Link & l = links[i];
+        if (l.protocol[0] != 0 && ::strcmp(l.protocol, protocol) == 0
+            && ::strcmp(l.server, server) == 0 && ::strcmp(l.port, port) == 0)
+        {
+            selected = i;
+            break;
+        }
+    }
+
+    bool sameDestination = (selected >= 0);
+    if (!sameDestination)
+    {
+        // a free link is preferred, otherwise the least recently used link is taken over
+        for (size_t i = 0; i < linksNumber; ++i)
+        {
+            if (!links[i].connected)
+            {
+                selected = i;
+                break;
+            }
+            if (selected < 0 || links[i].lastUsed < links[selected].lastUsed)
+            {
+                selected = i;
+            }
+        }
+    }
+
+    Link & l = links[selected];
+    if (!copyString(l.protocol, protocol, sizeof(l.protocol))
+        || !copyString(l.server, server, sizeof(l.server))
+        || !copyString(l.port, port, sizeof(l.port)))
+    {
+        // a truncated destination shall not match: the link is not reused by the next message
+        l.protocol[0] = 0;
+    }
+    l.handler = handler;
+    l.lastUsed = rtc.getUpTimeMillisec();
+    linkId = selected;
+    if (!l.connected)
+    {
+        return LinkState::FREE;
+    }
+    return sameDestination? LinkState::CONNECTED : LinkState::OCCUPIED;
+}
+
 bool Esp11::transmit (Esp11::AsyncCmd cmd)
 {
     if (isTransmissionStarted())
@@ -272,6 +718,8 @@ bool Esp11::transmit (Esp11::AsyncCmd cmd)
     commState = CommState::TX;
     operationEnd = rtc.getUpTimeMillisec() + ESP_TIMEOUT;
     shortOkResponse = true;
+    promptResponse = false;
+    expectResponce = true;
 
     bool isReady = true;
     switch (cmd)
@@ -307,13 +755,43 @@ bool Esp11::transmit (Esp11::AsyncCmd cmd)
     case AsyncCmd::SET_CON_MODE:
         isReady = sendCmd(CMD_SET_NORMAL_MODE);
         break;
+    case AsyncCmd::SET_TRANSP_MODE:
+        isReady = sendCmd(CMD_SET_TRANSPARENT_MODE);
+        break;
+    case AsyncCmd::START_TRANSP:
+        // "OK" is followed by the data prompt: the data sent before it would be lost
+        shortOkResponse = false;
+        promptResponse = true;
+        isReady = sendCmd(CMD_START_TRANSPARENT);
+        break;
+    case AsyncCmd::SEND_TRANSP:
+        // the reply to this packet is collected from an empty input message
+        startListening();
+        isReady = transparent && sendData(message, messageSize, PACKET_GAP_TIME);
+        break;
+    case AsyncCmd::ESCAPE_TRANSP:
+        isReady = sendData(CMD_ESCAPE_TRANSPARENT, ::strlen(CMD_ESCAPE_TRANSPARENT), ESCAPE_GUARD_TIME);
+        break;
     case AsyncCmd::SET_SINDLE_CON:
         isReady = sendCmd(CMD_SET_SINGLE_CONNECTION);
         break;
+    case AsyncCmd::SET_MULTI_CON:
+        isReady = sendCmd(CMD_MULTCON);
+        break;
+    case AsyncCmd::CLOSE_LINK:
+        isReady = closeLink();
+        break;
+    case AsyncCmd::SET_SLEEP:
+        isReady = sendCmd(CMD_MODEM_SLEEP);
+        break;
+    case AsyncCmd::WAKE_UP:
+        isReady = sendCmd(CMD_NO_SLEEP);
+        break;
     case AsyncCmd::CONNECT_SERVER:
         isReady = connectToServer();
         break;
     case AsyncCmd::SEND_MSG_SIZE:
+        sendStartCycles = CycleCounter::getValue();
         isReady = sendMessageSize();
         break;
     case AsyncCmd::SEND_MESSAGE:
@@ -321,7 +799,7 @@ bool Esp11::transmit (Esp11::AsyncCmd cmd)
         break;
     case AsyncCmd::DISCONNECT:
     case AsyncCmd::RECONNECT:
-        isReady = sendCmd(CMD_CLOSE_CONNECT);
+        isReady = closeAllLinks();
         break;
     case AsyncCmd::POWER_OFF:
         powerOff();
@@ -347,23 +825,61 @@ bool Esp11::getResponce (AsyncCmd cmd)
         return false;
     }
 
+    // an error response of AT+CIPCLOSE means that the link is not connected as well
+    if (cmd == AsyncCmd::CLOSE_LINK)
+    {
+        links[linkId].connected = false;
+    }
+    else if (cmd == AsyncCmd::DISCONNECT || cmd == AsyncCmd::RECONNECT)
+    {
+        for (auto & l : links)
+        {
+            l.connected = false;
+        }
+    }
+
     bool retValue = false;
     if (commState == CommState::SUCC)
     {
-        const char * responce = NULL;
         switch (cmd)
         {
         case AsyncCmd::ENSURE_MODE:
-            responce = ::strstr(rxBuffer, RESP_GETMODE);
-            retValue = responce != 0 && ::atoi(responce + ::strlen(RESP_GETMODE)) == mode;
+            retValue = (respMode == mode);
             break;
 
         case AsyncCmd::ENSURE_WLAN:
-            retValue = (::strstr(rxBuffer, RESP_GETNET) != NULL && ::strstr(rxBuffer, ssid) != NULL);
+            // AT+CWLAP="<ssid>" lists only the access points with the given SSID
+            retValue = respWlanFound;
+            break;
+
+        case AsyncCmd::SEND_MESSAGE:
+            reportThroughput();
+            retValue = true;
             break;
 
         case AsyncCmd::CONNECT_SERVER:
-            retValue = (::strstr(rxBuffer, CMD_CONNECT_SERVER_RESPONCE) != NULL);
+            retValue = respConnected;
+            links[linkId].connected = respConnected;
+            break;
+
+        case AsyncCmd::START_TRANSP:
+            transparent = true;
+            retValue = true;
+            break;
+
+        case AsyncCmd::SEND_TRANSP:
+            // the reception state is restarted for the next packet unless a response to this
+            // packet is already waiting for getInputMessage()
+            if (inputMessageSize == 0)
+            {
+                startListening();
+            }
+            retValue = true;
+            break;
+
+        case AsyncCmd::ESCAPE_TRANSP:
+            transparent = false;
+            retValue = true;
             break;
 
         default:
@@ -372,6 +888,7 @@ bool Esp11::getResponce (AsyncCmd cmd)
         }
     }
 
+    updateCheckpoint(cmd, retValue);
     commState = CommState::NONE;
     operationEnd = INFINITY_TIME;
 
@@ -383,11 +900,142 @@ bool Esp11::getResponce (AsyncCmd cmd)
     return retValue;
 }
 
+bool Esp11::isCheckpointed (AsyncCmd cmd) const
+{
+    switch (cmd)
+    {
+    case AsyncCmd::ECHO_OFF:
+        return checkpoint.echoOff;
+    case AsyncCmd::SET_MODE:
+    case AsyncCmd::ENSURE_MODE:
+        return mode >= 0 && checkpoint.mode == mode;
+    case AsyncCmd::SET_ADDR:
+        return checkpoint.address != 0 && checkpoint.address == hashStrings(ip, gatway, mask);
+    case AsyncCmd::CONNECT_WLAN:
+        return checkpoint.wlan != 0 && checkpoint.wlan == hashStrings(ssid, passwd);
+    case AsyncCmd::PING_SERVER:
+        return checkpoint.pingServer != 0 && checkpoint.pingServer == hashStrings(server);
+    case AsyncCmd::SET_CON_MODE:
+        return checkpoint.conMode == 0;
+    case AsyncCmd::SET_SINDLE_CON:
+        return checkpoint.muxMode == 0;
+    case AsyncCmd::SET_MULTI_CON:
+        return checkpoint.muxMode == 1;
+    default:
+        return false;
+    }
+}
+
+void Esp11::updateCheckpoint (AsyncCmd cmd, bool result)
+{
+    switch (cmd)
+    {
+    case AsyncCmd::ECHO_OFF:
+        checkpoint.echoOff = result;
+        break;
+    case AsyncCmd::SET_MODE:
+        if (!result)
+        {
+            checkpoint.mode = -1;
+        }
+        break;
+    case AsyncCmd::ENSURE_MODE:
+        // the mode is only trusted after the verification
+        checkpoint.mode = result? mode : -1;
+        break;
+    case AsyncCmd::SET_ADDR:
+        checkpoint.address = result? hashStrings(ip, gatway, mask) : 0;
+        break;
+    case AsyncCmd::CONNECT_WLAN:
+        checkpoint.wlan = result? hashStrings(ssid, passwd) : 0;
+        checkpoint.pingServer = 0;
+        break;
+    case AsyncCmd::PING_SERVER:
+        checkpoint.pingServer = result? hashStrings(server) : 0;
+        break;
+    case AsyncCmd::SET_CON_MODE:
+        checkpoint.conMode = result? 0 : -1;
+        break;
+    case AsyncCmd::SET_TRANSP_MODE:
+        checkpoint.conMode = result? 1 : -1;
+        break;
+    case AsyncCmd::SET_SINDLE_CON:
+        checkpoint.muxMode = result? 0 : -1;
+        break;
+    case AsyncCmd::SET_MULTI_CON:
+        checkpoint.muxMode = result? 1 : -1;
+        break;
+    case AsyncCmd::CONNECT_SERVER:
+        if (!result)
+        {
+            // the server may be unreachable due to a silently lost WLAN
+            checkpoint.pingServer = 0;
+        }
+        break;
+    default:
+        // nothing to do
+        break;
+    }
+}
+
+void Esp11::resetCheckpoint ()
+{
+    checkpoint.echoOff = false;
+    checkpoint.mode = -1;
+    checkpoint.address = checkpoint.wlan = checkpoint.pingServer = 0;
+    checkpoint.conMode = checkpoint.muxMode = -1;
+}
+
+uint32_t Esp11::hashStrings (const char * s1, const char * s2, const char * s3)
+{
+    // FNV-1a over all strings including the terminating zeros
+    uint32_t h = 2166136261UL;
+    const char * strings[3] = { s1, s2, s3 };
+    for (const char * str : strings)
+    {
+        if (str == NULL)
+        {
+            continue;
+        }
+        do
+        {
+            h = (h ^ (uint8_t)*str) * 16777619UL;
+        }
+        while (*str++ != 0);
+    }
+    return (h == 0)? 1 : h;
+}
+
+bool Esp11::copyString (char * dst, const char * src, size_t size)
+{
+    size_t len = ::strlen(src);
+    bool fits = (len < size);
+    if (!fits)
+    {
+        len = size - 1;
+    }
+    ::memcpy(dst, src, len);
+    dst[len] = 0;
+    return fits;
+}
+
+void Esp11::reportThroughput ()
+{
+    // the payload is accounted from AT+CIPSEND up to SEND OK
+    payloadBytes += messageSize;
+    payloadCycles += CycleCounter::getValue() - sendStartCycles;
+    USART_DEBUG("Payload throughput at " << (int)usart.getBaudRate() << " baud: "
+                << (int)getPayloadThroughput() << " KB/s ("
+                << (int)payloadBytes << " bytes sent)");
+}
+
 void Esp11::periodic ()
 {
-    if (listening && rxIndex > 0)
+    processReceivedData();
+
+    if (commState == CommState::TX_CMPL && rtc.getUpTimeMillisec() >= responceTime)
     {
-        processInputMessage();
+        commState = CommState::SUCC;
     }
 
     if (isResponceAvailable())
@@ -406,9 +1054,7 @@ void Esp11::startListening ()
 {
     listening = true;
     setInputMessage(NULL, 0);
-    rxIndex = 0;
-    usart.startMode(UART_MODE_RX);
-    usart.receiveIt(msgBuffer, BUFFER_SIZE);
+    msgIndex = msgSize = 0;
 }
 
 void Esp11::stopListening ()
@@ -419,29 +1065,183 @@ void Esp11::stopListening ()
     }
 }
 
-void Esp11::processInputMessage ()
+void Esp11::processReceivedData ()
+{
+    // the number of received bytes is counted across the buffer wraps: a completely filled
+    // buffer is not mistaken for an empty one and an overwritten buffer is detected
+    const uint32_t receivedBytes = usart.getReceivedBytes();
+    uint32_t pending = receivedBytes - rxReadBytes;
+    if (pending == 0 || (!rxIdle && pending < DMA_BUFFER_SIZE / 2))
+    {
+        // wait for the end of the burst
+        return;
+    }
+    rxIdle = false;
+
+    if (pending > DMA_BUFFER_SIZE)
+    {
+        ++rxOverruns;
+        USART_DEBUG("ESP receive buffer overrun: " << pending - DMA_BUFFER_SIZE << " bytes lost");
+        rxReadBytes = receivedBytes;
+        tokenizer.reset();
+        return;
+    }
+
+    // the circular buffer is processed in up to two contiguous chunks
+    size_t readPos = rxReadBytes % DMA_BUFFER_SIZE;
+    if (readPos + pending > DMA_BUFFER_SIZE)
+    {
+        processRxChunk(dmaBuffer + readPos, DMA_BUFFER_SIZE - readPos);
+        pending -= DMA_BUFFER_SIZE - readPos;
+        readPos = 0;
+    }
+    processRxChunk(dmaBuffer + readPos, pending);
+    rxReadBytes = receivedBytes;
+}
+
+void Esp11::processRxChunk (const char * data, size_t len)
 {
-    size_t idx = rxIndex;
-    size_t messagePrefixLen = ::strlen(CMD_INPUT_MESSAGE);
-    if (idx > messagePrefixLen)
+    if (transparent)
     {
-        const char * startIpd = ::strstr(msgBuffer, CMD_INPUT_MESSAGE);
-        if (startIpd != NULL)
+        // passthrough: every received chunk is an input message of the current link
+        inputLinkId = linkId;
+        inputHandler = links[linkId].handler;
+        if (inputHandler != NULL || listening)
         {
-            const char * startLen = startIpd + messagePrefixLen;
-            const char * endLen = ::strchr(startLen, ':');
-            size_t lenSize = endLen - startLen;
-            if (endLen != NULL && lenSize > 0 && lenSize < 256)
+            deliverInputMessage(data, len, true);
+        }
+        return;
+    }
+
+    tokenizer.feed(data, len);
+}
+
+void Esp11::onToken (AtTokenizer::Token token, int32_t value)
+{
+    bool pending = (commState == CommState::TX || commState == CommState::RX);
+    switch (token)
+    {
+    case AtTokenizer::Token::OK:
+        if (pending && shortOkResponse)
+        {
+            commState = CommState::SUCC;
+            startListening();
+        }
+        break;
+    case AtTokenizer::Token::SEND_OK:
+        if (pending)
+        {
+            commState = CommState::SUCC;
+            startListening();
+        }
+        break;
+    case AtTokenizer::Token::ERROR:
+        if (pending)
+        {
+            commState = CommState::ERROR;
+        }
+        break;
+    case AtTokenizer::Token::PROMPT:
+        if (pending && promptResponse)
+        {
+            // the prompt is consumed here: the data received after it is the input message
+            commState = CommState::SUCC;
+            transparent = true;
+            startListening();
+        }
+        break;
+    case AtTokenizer::Token::CONNECT:
+        respConnected = true;
+        break;
+    case AtTokenizer::Token::CWMODE:
+        respMode = value;
+        break;
+    case AtTokenizer::Token::CWLAP:
+        respWlanFound = true;
+        break;
+    case AtTokenizer::Token::IPD:
+        {
+            // "+IPD,<id>,<len>:" in the multiple connection mode, "+IPD,<len>:" otherwise
+            int32_t id = tokenizer.getPrefixNumber();
+            inputLinkId = (id >= 0)? id : linkId;
+            inputHandler = (inputLinkId >= 0 && (size_t)inputLinkId < MAX_LINKS)? links[inputLinkId].handler : NULL;
+            msgIndex = msgSize = 0;
+            if (inputHandler != NULL || listening)
             {
-                ::memcpy(cmdBuffer, startLen, lenSize);
-                cmdBuffer[lenSize] = 0;
-                size_t msgSize = ::atoi(cmdBuffer);
-                if (idx >= messagePrefixLen + lenSize + 1 + msgSize)
+                if (inputHandler == NULL)
                 {
-                    setInputMessage(endLen + 1, msgSize);
+                    setInputMessage(NULL, 0);
                 }
+                msgSize = value;
             }
         }
+        break;
+    case AtTokenizer::Token::CLOSED:
+        if (value >= 0 && (size_t)value < MAX_LINKS)
+        {
+            USART_DEBUG("Link " << value << " closed by the remote side");
+            links[value].connected = false;
+        }
+        break;
+    case AtTokenizer::Token::WIFI_DISCONNECT:
+        USART_DEBUG("WLAN connection lost");
+        checkpoint.wlan = checkpoint.pingServer = 0;
+        for (auto & l : links)
+        {
+            l.connected = false;
+        }
+        break;
+    default:
+        // nothing to do
+        break;
+    }
+}
+
+void Esp11::onPayload (const char * data, size_t len, bool complete)
+{
+    if (msgSize == 0 || (inputHandler == NULL && !listening))
+    {
+        return;
+    }
+    if (complete)
+    {
+        msgSize = 0;
+    }
+    deliverInputMessage(data, len, complete);
+}
+
+void Esp11::deliverInputMessage (const char * data, size_t len, bool complete)
+{
+    if (inputHandler != NULL && complete && msgIndex == 0)
+    {
+        // the whole message is contiguous within the circular receive buffer and the handler
+        // consumes it within the call: it is passed without copying
+        inputHandler->onInputMessage(inputLinkId, data, len);
+        return;
+    }
+
+    // the message wraps the circular buffer or waits for getInputMessage(): it is collected
+    // in the message buffer, since the DMA overwrites the receive buffer by the next data
+    size_t n = (len < BUFFER_SIZE - msgIndex)? len : BUFFER_SIZE - msgIndex;
+    if (n < len)
+    {
+        truncatedBytes += len - n;
+        USART_DEBUG("Input message exceeds the message buffer: " << len - n << " bytes dropped");
+    }
+    ::memcpy(msgBuffer + msgIndex, data, n);
+    msgIndex += n;
+    if (!complete)
+    {
+        return;
+    }
+    if (inputHandler != NULL)
+    {
+        inputHandler->onInputMessage(inputLinkId, msgBuffer, msgIndex);
+        msgIndex = 0;
+    }
+    else
+    {
+        setInputMessage(msgBuffer, msgIndex);
     }
 }
 
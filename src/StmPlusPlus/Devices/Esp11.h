@@ -28,13 +28,149 @@ namespace StmPlusPlus
 namespace Devices
 {
 
+/************************************************************************
+ * Class AtTokenizer
+ ************************************************************************/
+
+/**
+ * @brief Incremental tokenizer of the AT responses.
+ *
+ * The tokenizer is an Aho-Corasick automaton built from a set of patterns: every received byte
+ * is consumed exactly once, independently of how the data stream is split into chunks. A pattern
+ * can be followed by a decimal number (e.g. "+CWMODE:1") or can carry a constant value (e.g. the
+ * link ID of "0,CLOSED"). A number list terminated by a colon (e.g. "+IPD,0,12:") starts a payload
+ * of the given length that is passed to the handler without being copied or matched against
+ * the patterns.
+ */
+class AtTokenizer
+{
+public:
+
+    enum class Token
+    {
+        NONE    = 0,
+        OK      = 1,
+        SEND_OK = 2,
+        ERROR   = 3,
+        READY   = 4,
+        CONNECT = 5,
+        CWMODE  = 6,
+        CWLAP   = 7,
+        IPD     = 8,
+        CLOSED  = 9,
+        WIFI_DISCONNECT = 10,
+        PROMPT  = 11
+    };
+
+    static const size_t MAX_NODES = 128;
+    static const char LINE_START = '\n';
+
+    class EventHandler
+    {
+    public:
+
+        virtual void onToken (Token token, int32_t value) =0;
+        virtual void onPayload (const char * data, size_t len, bool complete) =0;
+    };
+
+    AtTokenizer ();
+
+    /**
+     * @brief Adds a pattern into the automaton. Shall be called before build().
+     */
+    bool addPattern (const char * text, Token token, bool withNumber = false, int8_t value = 0);
+
+    /**
+     * @brief Calculates the failure links. Shall be called once after all patterns are added.
+     */
+    void build ();
+
+    /**
+     * @brief Resets the automaton to the line start.
+     */
+    void reset ();
+
+    void feed (const char * data, size_t len);
+
+    inline void setHandler (EventHandler * _handler)
+    {
+        handler = _handler;
+    }
+
+    /**
+     * @brief Returns the number preceding the last number of a number list (link ID of
+     *        "+IPD,<id>,<len>:"), or -1 if the list contained a single number only.
+     */
+    inline int32_t getPrefixNumber () const
+    {
+        return prefixNumber;
+    }
+
+private:
+
+    class Node
+    {
+    public:
+
+        char c;
+        uint8_t child, sibling, fail; // 0 means no node: the root can not be a child
+        Token token;
+        bool withNumber;
+        int8_t value;
+    };
+
+    enum class State
+    {
+        TEXT    = 0,
+        NUMBER  = 1,
+        PAYLOAD = 2
+    };
+
+    Node nodes[MAX_NODES];
+    size_t nodesCount;
+    EventHandler * handler;
+
+    State state;
+    uint8_t currNode;
+    Token pendingToken;
+    int32_t number, prefixNumber;
+    size_t payloadRest;
+
+    uint8_t findChild (uint8_t node, char c) const;
+    void step (char c);
+    bool processNumber (char c);
+    void emitToken (Token token, int32_t value);
+};
+
+
 /************************************************************************
  * Class Esp11
  ************************************************************************/
 
-class Esp11
+class Esp11 : public AtTokenizer::EventHandler
 {
 public:
+
+    /**
+     * @brief Handler of the messages received from a link. The message is consumed within the
+     *        call: the data may point into the circular receive buffer.
+     */
+    class EventHandler
+    {
+    public:
+
+        virtual void onInputMessage (int32_t linkId, const char * data, size_t len) =0;
+    };
+
+    /**
+     * @brief State of the link selected for the current destination.
+     */
+    enum class LinkState
+    {
+        CONNECTED = 0, // the link is already connected to the destination
+        FREE      = 1, // the link is free and shall be connected
+        OCCUPIED  = 2  // the link is connected to an other destination and shall be closed first
+    };
     
     enum class AsyncCmd
     {
@@ -56,7 +192,16 @@ public:
         DISCONNECT     = 15,
         POWER_OFF      = 16,
         WAITING        = 17,
-        OFF            = 18
+        OFF            = 18,
+        SET_TRANSP_MODE = 19,
+        START_TRANSP   = 20,
+        SEND_TRANSP    = 21,
+        ESCAPE_TRANSP  = 22,
+        SET_MULTI_CON  = 23,
+        CLOSE_LINK     = 24,
+        SET_SLEEP      = 25,
+        STANDBY        = 26,
+        WAKE_UP        = 27
     };
 
     enum class CommState
@@ -69,9 +214,19 @@ public:
         ERROR   = 5
     };
 
-    static const uint32_t ESP_BAUDRATE = 115200;
+    static const uint32_t ESP_BAUDRATE = 115200; // baud rate after power-on
     static const time_ms ESP_TIMEOUT = 10000L;
+    static const time_ms BAUDRATE_TIMEOUT = 1000L; // timeout of the baud rate verification
+    static const uint32_t BAUDRATE_SWITCH_DELAY = 10; // delay in ms before the new baud rate is used
+    static const uint32_t POWER_OFF_DELAY = 100; // delay in ms needed to reset the module
+    static const time_ms ESCAPE_GUARD_TIME = 1000L; // silence after "+++" before the next AT command
+    static const time_ms PACKET_GAP_TIME = 20L; // ESP closes a transparent packet after this silence
     static const uint32_t BUFFER_SIZE = 1024;
+    static const uint32_t DMA_BUFFER_SIZE = 1024;
+    static_assert((DMA_BUFFER_SIZE & (DMA_BUFFER_SIZE - 1)) == 0, "DMA buffer size shall be a power of two");
+    static const size_t MAX_LINKS = 4; // number of link IDs in the multiple connection mode
+    static const size_t MAX_SERVER_LENGTH = 63; // longer server names are never reused by selectLink()
+    static const uint32_t UDP_LOCAL_PORT = 5888; // local UDP port of the first link
 
 public:
     
@@ -86,7 +241,20 @@ public:
 
     inline void processTxCpltCallback ()
     {
-        commState = CommState::TX_CMPL;
+        if (commState == CommState::TX)
+        {
+            commState = expectResponce? CommState::RX : CommState::TX_CMPL;
+        }
+    }
+
+    inline void processDmaTxInterrupt ()
+    {
+        usart.processDmaTxInterrupt();
+    }
+
+    inline void processDmaRxInterrupt ()
+    {
+        usart.processDmaRxInterrupt();
     }
     
     inline void processErrorCallback ()
@@ -94,59 +262,17 @@ public:
         commState = CommState::ERROR;
     }
 
+    /**
+     * @brief USART interrupt handler: the received data is collected by the DMA and parsed
+     *        in the main context, the interrupt only signals the end of a burst.
+     */
     inline void processInterrupt ()
     {
-        usart.processInterrupt();
-        if (commState == CommState::TX_CMPL)
-        {
-            commState = CommState::RX;
-            rxIndex = 0;
-            usart.startMode(UART_MODE_RX);
-            usart.receiveIt(rxBuffer, BUFFER_SIZE);
-        }
-        else if (commState == CommState::RX && rxIndex < BUFFER_SIZE)
-        {
-            if (rxIndex >= 1
-                && rxBuffer[rxIndex-1] == '\r'
-                && rxBuffer[rxIndex] == '\n')
-            {
-                if (shortOkResponse && rxIndex >= 3
-                    && rxBuffer[rxIndex - 3] == 'O'
-                    && rxBuffer[rxIndex - 2] == 'K')
-                {
-                    commState = CommState::SUCC;
-                }
-                else if (rxIndex >= 8
-                        && rxBuffer[rxIndex - 8] == 'S'
-                        && rxBuffer[rxIndex - 7] == 'E'
-                        && rxBuffer[rxIndex - 6] == 'N'
-                        && rxBuffer[rxIndex - 5] == 'D'
-                        && rxBuffer[rxIndex - 4] == ' '
-                        && rxBuffer[rxIndex - 3] == 'O'
-                        && rxBuffer[rxIndex - 2] == 'K')
-                {
-                    commState = CommState::SUCC;
-                }
-                else if (rxIndex >= 6
-                        && rxBuffer[rxIndex - 6] == 'E'
-                        && rxBuffer[rxIndex - 5] == 'R'
-                        && rxBuffer[rxIndex - 4] == 'R'
-                        && rxBuffer[rxIndex - 3] == 'O'
-                        && rxBuffer[rxIndex - 2] == 'R')
-                {
-                    commState = CommState::ERROR;
-                }
-            }
-            ++rxIndex;
-            if (commState == CommState::SUCC)
-            {
-                startListening();
-            }
-        }
-        else if (listening && rxIndex < BUFFER_SIZE)
+        if (usart.processIdleInterrupt())
         {
-            ++rxIndex;
+            rxIdle = true;
         }
+        usart.processInterrupt();
     }
     
     inline void setMode (int mode)
@@ -208,6 +334,28 @@ public:
     {
         sendLed = _sendLed;
     }
+
+    /**
+     * @brief Sets the pins used for the hardware flow control (zero pin means not used).
+     */
+    inline void assignFlowControlPins (IOPort::PortName port, uint32_t ctsPin, uint32_t rtsPin)
+    {
+        flowControlPort = port;
+        this->ctsPin = ctsPin;
+        this->rtsPin = rtsPin;
+    }
+
+    /**
+     * @brief Sets the baud rate negotiated after power-on using AT+UART_CUR. The module always
+     *        starts at ESP_BAUDRATE and stays on it if the negotiation fails. If the flow control
+     *        is requested, it is enabled on the assigned pins together with the new baud rate.
+     *        Shall be set before power on.
+     */
+    inline void setBaudRate (uint32_t baudRate, bool flowControl)
+    {
+        this->baudRate = baudRate;
+        this->flowControl = flowControl;
+    }
     
     inline bool isResponceAvailable ()
     {
@@ -219,6 +367,33 @@ public:
         return commState != CommState::NONE;
     }
 
+    /**
+     * @brief Returns the number of times the circular receive buffer was overwritten before
+     *        it was parsed: the received data was lost.
+     */
+    inline uint32_t getRxOverruns () const
+    {
+        return rxOverruns;
+    }
+
+    /**
+     * @brief Returns the number of received bytes dropped since an input message that was
+     *        collected in the message buffer did not fit into it.
+     */
+    inline uint32_t getTruncatedBytes () const
+    {
+        return truncatedBytes;
+    }
+
+    /**
+     * @brief Returns the payload throughput in KB/s since the last power-on: the payload sent by
+     *        AT+CIPSEND=<len> against the time from the command up to SEND OK.
+     */
+    inline uint32_t getPayloadThroughput () const
+    {
+        return CycleCounter::getThroughput(payloadBytes, payloadCycles);
+    }
+
     inline size_t getInputMessageSize () const
     {
         return inputMessageSize;
@@ -228,7 +403,51 @@ public:
     {
         return listening;
     }
+
+    /**
+     * @brief Returns true if the transparent (passthrough) transmission is active: the data
+     *        is sent without AT+CIPSEND and "+++" is needed to return into the command mode.
+     */
+    inline bool isTransparent () const
+    {
+        return transparent;
+    }
     
+    /**
+     * @brief Enables the multiple connection mode (AT+CIPMUX=1): up to MAX_LINKS connections
+     *        are kept open simultaneously, one per destination. Shall be set before power on.
+     */
+    inline void setMultiConnection (bool multiConnection)
+    {
+        this->multiConnection = multiConnection;
+    }
+
+    inline bool isMultiConnection () const
+    {
+        return multiConnection;
+    }
+
+    inline int32_t getLinkId () const
+    {
+        return linkId;
+    }
+
+    /**
+     * @brief Returns the link ID the last input message was received from.
+     */
+    inline int32_t getInputLinkId () const
+    {
+        return inputLinkId;
+    }
+
+    /**
+     * @brief Returns true if the selected link is connected.
+     */
+    inline bool isLinkConnected () const
+    {
+        return links[linkId].connected;
+    }
+
     inline const char* getProtocol () const
     {
         return protocol;
@@ -244,6 +463,19 @@ public:
         return port;
     }
     
+    /**
+     * @brief Selects the link for the destination set by setProtocol(), setServer() and
+     *        setPort(). The destination strings are copied into the link table, so they only need
+     *        to stay valid until the connection is established.
+     */
+    LinkState selectLink (EventHandler * handler = NULL);
+
+    /**
+     * @brief Returns true if the given bring-up step is already applied with the current settings
+     *        since power on and can be skipped.
+     */
+    bool isCheckpointed (AsyncCmd cmd) const;
+
     bool transmit (AsyncCmd cmd);
     bool getResponce (AsyncCmd cmd);
     void periodic ();
@@ -267,15 +499,58 @@ private:
     const char * CMD_MULTCON = "AT+CIPMUX=1";
     const char * CMD_TCPSERVER = "AT+CIPSERVER=1,";
     const char * CMD_SET_NORMAL_MODE = "AT+CIPMODE=0";
+    const char * CMD_SET_TRANSPARENT_MODE = "AT+CIPMODE=1";
+    const char * CMD_START_TRANSPARENT = "AT+CIPSEND";
+    const char * CMD_ESCAPE_TRANSPARENT = "+++";
     const char * CMD_SET_SINGLE_CONNECTION = "AT+CIPMUX=0";
     const char * CMD_CONNECT_SERVER = "AT+CIPSTART=";
     const char * CMD_CONNECT_SERVER_RESPONCE = "CONNECT";
     const char * CMD_SEND = "AT+CIPSEND=";
     const char * CMD_CLOSE_CONNECT = "AT+CIPCLOSE";
+    const char * CMD_SET_UART = "AT+UART_CUR=";
+    const char * CMD_MODEM_SLEEP = "AT+SLEEP=2";
+    const char * CMD_NO_SLEEP = "AT+SLEEP=0";
     const char * CMD_INPUT_MESSAGE = "+IPD,";
     const char * CMD_END = "\r\n";
     const char * RESP_READY = "ready\r\n";
-    const char * UDP_PORT = "5888,0";
+    const char * RESP_OK = "\nOK\r\n";
+    const char * RESP_SEND_OK = "\nSEND OK\r\n";
+    const char * RESP_ERROR = "\nERROR\r\n";
+    const char * RESP_CLOSED = ",CLOSED";
+    const char * RESP_WIFI_DISCONNECT = "WIFI DISCONNECT";
+    const char * RESP_PROMPT = "\n>";
+
+    /**
+     * @brief Destination of a link. The strings are copied: the buffers of the caller (e.g. the
+     *        configuration) may be changed or reused while the link stays connected.
+     */
+    class Link
+    {
+    public:
+
+        char protocol[4];
+        char server[MAX_SERVER_LENGTH + 1];
+        char port[6];
+        bool connected;
+        time_ms lastUsed;
+        EventHandler * handler;
+    };
+
+    /**
+     * @brief Settings applied since power on. A hash value of zero means "not applied".
+     */
+    class Checkpoint
+    {
+    public:
+
+        bool echoOff;
+        int mode;
+        uint32_t address;     // hash of IP, gateway and mask
+        uint32_t wlan;        // hash of SSID and password, reset if the WLAN is lost
+        uint32_t pingServer;  // hash of the last pinged server
+        int32_t conMode;      // AT+CIPMODE: 0 - normal, 1 - transparent, -1 - unknown
+        int32_t muxMode;      // AT+CIPMUX: 0 - single, 1 - multiple, -1 - unknown
+    };
 
     const RealTimeClock & rtc;
     Usart usart;
@@ -284,9 +559,39 @@ private:
     IOPin * sendLed;
 
     __IO CommState commState;
-    __IO size_t rxIndex;
-    __IO bool listening;
-    __IO bool shortOkResponse;
+    __IO bool rxIdle;
+    uint32_t rxReadBytes; // bytes consumed from the circular buffer, compared with Usart::getReceivedBytes()
+    uint32_t rxOverruns;
+    uint32_t truncatedBytes;
+    size_t msgIndex, msgSize;
+    bool listening;
+    bool shortOkResponse;
+    bool promptResponse; // the command is finished by the data prompt instead of OK
+    __IO bool expectResponce;
+    bool transparent;
+    time_ms responceTime;
+    AtTokenizer tokenizer;
+    int32_t respMode;
+    bool respWlanFound, respConnected;
+
+    // UART settings
+    uint32_t baudRate;
+    bool flowControl;
+    IOPort::PortName flowControlPort;
+    uint32_t ctsPin, rtsPin;
+
+    // Payload throughput
+    uint32_t sendStartCycles;
+    uint64_t payloadBytes, payloadCycles;
+
+    // Connection table
+    bool multiConnection;
+    Link links[MAX_LINKS];
+    int32_t linkId, inputLinkId;
+    EventHandler * inputHandler;
+
+    // Bring-up checkpoint
+    Checkpoint checkpoint;
 
     int mode;
     const char * ip;
@@ -305,11 +610,16 @@ private:
 
     char cmdBuffer[256];
     char txBuffer[BUFFER_SIZE];
-    char rxBuffer[BUFFER_SIZE];
     char msgBuffer[BUFFER_SIZE];
+    char dmaBuffer[DMA_BUFFER_SIZE];
 
-    bool waitForResponce (const char * responce);
+    bool waitForResponce (const char * responce, time_ms timeout = ESP_TIMEOUT);
+    bool startUsart (uint32_t baudRate, uint32_t hwControl);
+    void stopUsart ();
+    bool negotiateBaudRate ();
+    void reportThroughput ();
     bool sendCmd (const char * cmd, size_t cmdLen = 0, bool addCmdEnd = true);
+    bool sendData (const char * data, size_t len, time_ms guardTime);
     bool init ();
     bool applyMode ();
     bool applyIpAddress ();
@@ -319,15 +629,39 @@ private:
     bool connectToServer ();
     bool sendMessageSize ();
     bool sendMessage ();
-    void processInputMessage ();
+    bool closeLink ();
+    bool closeAllLinks ();
+    void appendLinkId (char * cmd, int32_t id);
+    void updateCheckpoint (AsyncCmd cmd, bool result);
+    void resetCheckpoint ();
+    static uint32_t hashStrings (const char * s1, const char * s2 = NULL, const char * s3 = NULL);
+    static bool copyString (char * dst, const char * src, size_t size);
+    void deliverInputMessage (const char * data, size_t len, bool complete);
     void startListening ();
     void stopListening ();
+    void processReceivedData ();
+    void processRxChunk (const char * data, size_t len);
+
+    virtual void onToken (AtTokenizer::Token token, int32_t value);
+    virtual void onPayload (const char * data, size_t len, bool complete);
 
     inline void powerOff ()
     {
         usart.stopInterrupt();
-        usart.stop();
+        stopUsart();
+        transparent = false;
+        resetCheckpoint();
         pinPower.putBit(false);
+        for (auto & l : links)
+        {
+            l.connected = false;
+        }
+    }
+
+    inline void flushReceiver ()
+    {
+        rxReadBytes = usart.getReceivedBytes();
+        rxIdle = false;
     }
 
     inline void setInputMessage (const char * msg, size_t len)
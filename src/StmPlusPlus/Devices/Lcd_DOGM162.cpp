@@ -20,6 +20,9 @@
 
 #include "Lcd_DOGM162.h"
 
+#include <algorithm>
+#include <cstring>
+
 using namespace StmPlusPlus;
 using namespace StmPlusPlus::Devices;
 
@@ -31,85 +34,331 @@ using namespace StmPlusPlus::Devices;
 Lcd_DOGM162_SPI::Lcd_DOGM162_SPI(Spi & _spi, IOPin & _pinCs, IOPin & _pinRs, bool _bias, uint8_t _contrast):
     spi(_spi),
     pinCs(_pinCs),
-    pinRs(_pinRs)
+    pinRs(_pinRs),
+    prescaler(SPI_BAUDRATEPRESCALER_256),
+    chunkSize(COLUMNS),
+    byteGap(0),
+    gapTimer(NULL),
+    gapTimerPrio(NULL),
+    command(0),
+    runLine(0),
+    runColumn(0),
+    runLength(0),
+    runSent(0),
+    flushing(false),
+    flushStart(0),
+    flushCycles(0),
+    errors(0)
 {
     bias = _bias? 0b00011100 : 0b00010100;
     contrast1 = (0b00110000 & _contrast) >> 4;
     contrast2 = (0b00001111 & _contrast);
     linesNumber = 2;
+    ::memset(frame, ' ', sizeof(frame));
+    dirty[0] = dirty[1] = 0;
+    transaction.cs = &pinCs;
+    transaction.polarity = SPI_POLARITY_HIGH;
+    transaction.phase = SPI_PHASE_2EDGE;
+    transaction.handler = this;
 }
 
 
 HAL_StatusTypeDef Lcd_DOGM162_SPI::start (uint8_t n)
 {
-    HAL_StatusTypeDef status = spi.start(SPI_DIRECTION_1LINE, SPI_BAUDRATEPRESCALER_256, SPI_DATASIZE_8BIT, SPI_PHASE_2EDGE);
+    // the slowest clock is used: the fastest one where a byte still takes EXECUTION_TIME
+    uint32_t clock = spi.getClockFrequency();
+    uint32_t divider = 2, code = 0;
+    while (divider < 256 && (uint64_t)8 * divider * 1000000UL < (uint64_t)EXECUTION_TIME * clock)
+    {
+        divider <<= 1;
+        ++code;
+    }
+    prescaler = code << 3; // SPI_BAUDRATEPRESCALER_x
+    uint32_t byteTime = (uint32_t)((uint64_t)8 * divider * 1000000UL / clock);
+    if (byteTime < EXECUTION_TIME)
+    {
+        chunkSize = 1;
+        byteGap = (EXECUTION_TIME - byteTime) * (CycleCounter::getFrequency() / 1000000);
+        if (gapTimer != NULL)
+        {
+            startGapTimer(EXECUTION_TIME - byteTime);
+        }
+    }
+    transaction.prescaler = prescaler;
 
+    HAL_StatusTypeDef status = spi.start(SPI_DIRECTION_1LINE, prescaler, SPI_DATASIZE_8BIT, SPI_PHASE_2EDGE);
     init(n);
-    spi.stop();
 
     USART_DEBUG("Started DOGM162"
              << ": bias = " << bias
              << ", contrast1 = " << contrast1 << "/" << contrast2
-             << ", line number = " << n);
+             << ", line number = " << n
+             << ", byte time = " << byteTime << "us"
+             << ", chunk = " << chunkSize);
 
     return status;
 }
 
 
+void Lcd_DOGM162_SPI::startGapTimer (uint32_t gapMicros)
+{
+    // the timer counts microseconds and stops itself after one period (one-pulse mode); the
+    // period is rounded up to keep it above zero
+    TIM_HandleTypeDef * htim = gapTimer->getTimerParameters();
+    gapTimer->start(TIM_COUNTERMODE_UP, gapTimer->getClockFrequency() / 1000000 - 1, gapMicros);
+    __HAL_TIM_DISABLE(htim);
+    htim->Instance->CR1 |= TIM_CR1_OPM;
+    // the update event generated by the initialization shall not start a byte
+    __HAL_TIM_CLEAR_IT(htim, TIM_IT_UPDATE);
+    gapTimer->startInterrupt(*gapTimerPrio, this);
+}
+
+
 void Lcd_DOGM162_SPI::init (uint8_t n)
 {
+    CycleCounter::start();
     linesNumber = n;
-    pinRs.setLow();
-
-    pinCs.setLow();
-    HAL_Delay(1);
 
     uint8_t lineMask = n == 1? 0b00000100 : 0b00001000;
-    spi.putChar(0b00100001 | lineMask); // Function Set ; 8 Bit; 2Zeilen, Istr.Tab 1
-    HAL_Delay(1);
+    writeData(false, 0b00100001 | lineMask); // Function Set ; 8 Bit; 2Zeilen, Istr.Tab 1
+    writeData(false, bias); // Bias Set: BS=0, FX=0
+    writeData(false, 0b01011100 | contrast1); // Power/ICON/Contrast: Icon=1, Bon=1, C5=1, C4=1
+    writeData(false, 0b01110000 | contrast2); // Contrast Set: C3=1, C2=C1=C0=0
+    writeData(false, 0b01101010); // Follower Ctrl: Fon=1, Rab2=0, Rab1=1, Rab0=0
+    writeData(false, 0x0C); // DISPLAY ON: D=1, C=0, B=0
+    clear();
+}
+
+
+void Lcd_DOGM162_SPI::clear (void)
+{
+    writeData(false, 0x01); // CLEAR DISPLAY
+    CycleCounter::delayMicros(CLEAR_TIME);
+    writeData(false, 0x06); // Entry mode set: I/D=1, S=0
+    ::memset(frame, ' ', sizeof(frame));
+    dirty[0] = dirty[1] = 0;
+}
+
+
+void Lcd_DOGM162_SPI::putString (const char * pData, uint16_t pSize)
+{
+    send(true, (const uint8_t *)pData, pSize);
+}
 
-    spi.putChar(bias); // Bias Set: BS=0, FX=0
-    HAL_Delay(1);
 
-    spi.putChar(0b01011100 | contrast1); // Power/ICON/Contrast: Icon=1, Bon=1, C5=1, C4=1
-    HAL_Delay(1);
+void Lcd_DOGM162_SPI::writeData (bool isData, uint8_t data)
+{
+    send(isData, &data, 1);
+}
 
-    spi.putChar(0b01110000 | contrast2); // Contrast Set: C3=1, C2=C1=C0=0
-    HAL_Delay(1);
 
-    spi.putChar(0b01101010); // Follower Ctrl: Fon=1, Rab2=0, Rab1=1, Rab0=0
-    HAL_Delay(1);
+void Lcd_DOGM162_SPI::send (bool isData, const uint8_t * data, uint16_t size)
+{
+    while (flushing);
+    for (uint16_t sent = 0; sent < size; sent += transaction.size)
+    {
+        prepareTransaction(isData, data + sent, std::min<uint16_t>(chunkSize, size - sent));
+        spi.enqueue(transaction);
+        while (flushing);
+    }
+}
 
-    spi.putChar(0x0C); // DISPLAY ON: D=1, C=0, B=0
-    HAL_Delay(1);
 
-    spi.putChar(0x01); // CLEAR DISPLAY
-    HAL_Delay(1);
+void Lcd_DOGM162_SPI::prepareTransaction (bool isData, const uint8_t * data, uint16_t size)
+{
+    pinRs.putBit(isData);
+    transaction.txData = data;
+    transaction.size = size;
+    flushing = true;
+}
 
-    spi.putChar(0x06); // Entry mode set: I/D=1, S=0
-    HAL_Delay(1);
 
-    pinCs.setHigh();
+void Lcd_DOGM162_SPI::setChar (uint8_t x, uint8_t y, char c)
+{
+    if (x >= COLUMNS || y >= linesNumber)
+    {
+        return;
+    }
+    if (frame[y][x] != c)
+    {
+        frame[y][x] = c;
+        markDirty(y, 1 << x);
+    }
 }
 
 
-void Lcd_DOGM162_SPI::putString (const char * pData, uint16_t pSize)
+void Lcd_DOGM162_SPI::setString (uint8_t x, uint8_t y, const char * pData, uint16_t pSize)
 {
-    pinRs.setHigh();
-    pinCs.setLow();
-    HAL_Delay(1);
-    spi.writeBuffer((uint8_t *)pData, pSize);
-    HAL_Delay(1);
-    pinCs.setHigh();
+    if (y >= linesNumber)
+    {
+        return;
+    }
+    uint16_t mask = 0;
+    for (uint16_t i = 0; i < pSize && x < COLUMNS; ++i, ++x)
+    {
+        if (frame[y][x] != pData[i])
+        {
+            frame[y][x] = pData[i];
+            mask |= 1 << x;
+        }
+    }
+    markDirty(y, mask);
 }
 
 
-void Lcd_DOGM162_SPI::writeData (bool isData, uint8_t data)
+void Lcd_DOGM162_SPI::fillFrame (char c)
 {
-    pinRs.putBit(isData);
-    pinCs.setLow();
-    HAL_Delay(1);
-    spi.putChar(data);
-    HAL_Delay(1);
-    pinCs.setHigh();
+    for (uint8_t y = 0; y < linesNumber; ++y)
+    {
+        uint16_t mask = 0;
+        for (uint8_t x = 0; x < COLUMNS; ++x)
+        {
+            if (frame[y][x] != c)
+            {
+                frame[y][x] = c;
+                mask |= 1 << x;
+            }
+        }
+        markDirty(y, mask);
+    }
+}
+
+
+void Lcd_DOGM162_SPI::markDirty (uint8_t y, uint16_t mask)
+{
+    // the bits are cleared by the flush running in the SPI interrupt
+    uint32_t primask = System::enterCritical();
+    dirty[y] |= mask;
+    System::leaveCritical(primask);
+}
+
+
+bool Lcd_DOGM162_SPI::flush ()
+{
+    if (flushing)
+    {
+        return false;
+    }
+    flushStart = CycleCounter::getValue();
+    if (nextRun())
+    {
+        sendCommand();
+    }
+    else
+    {
+        flushCycles = 0;
+    }
+    return true;
+}
+
+
+bool Lcd_DOGM162_SPI::nextRun ()
+{
+    uint32_t primask = System::enterCritical();
+    for (uint8_t y = 0; y < linesNumber; ++y)
+    {
+        uint16_t bits = dirty[y];
+        if (bits == 0)
+        {
+            continue;
+        }
+        // a run of dirty characters: a single clean character in between is sent as well
+        // since it costs the same bus time as a new cursor command
+        uint8_t first = __builtin_ctz(bits), last = first;
+        while (last + 1 < COLUMNS && ((bits >> (last + 1)) & 0b11) != 0)
+        {
+            last += ((bits >> (last + 1)) & 1)? 1 : 2;
+        }
+        runLine = y;
+        runColumn = first;
+        runLength = last - first + 1;
+        runSent = 0;
+        ::memcpy(run, &frame[y][first], runLength);
+        dirty[y] = bits & ~(((1 << runLength) - 1) << first);
+        System::leaveCritical(primask);
+        return true;
+    }
+    System::leaveCritical(primask);
+    return false;
+}
+
+
+void Lcd_DOGM162_SPI::sendCommand ()
+{
+    command = 0x80 | ((runLine * 0x40) + runColumn);
+    prepareTransaction(false, &command, 1);
+    spi.enqueue(transaction);
+}
+
+
+void Lcd_DOGM162_SPI::sendData ()
+{
+    prepareTransaction(true, run + runSent, std::min<uint16_t>(chunkSize, runLength - runSent));
+    spi.enqueue(transaction);
+}
+
+
+void Lcd_DOGM162_SPI::onSpiTransaction (Spi::Transaction & t)
+{
+    bool isRun = t.txData == &command || (t.txData >= run && t.txData < run + COLUMNS);
+    if (t.status != HAL_OK)
+    {
+        // the run is sent again by the next flush
+        ++errors;
+        if (isRun)
+        {
+            markDirty(runLine, ((1 << runLength) - 1) << runColumn);
+        }
+        flushing = false;
+        return;
+    }
+    if (byteGap != 0)
+    {
+        if (gapTimer != NULL)
+        {
+            // continued by onTimerUpdate()
+            TIM_HandleTypeDef * htim = gapTimer->getTimerParameters();
+            __HAL_TIM_SET_COUNTER(htim, 0);
+            __HAL_TIM_ENABLE(htim);
+            return;
+        }
+        uint32_t start = CycleCounter::getValue();
+        while (CycleCounter::getValue() - start < byteGap);
+    }
+    proceed();
+}
+
+
+void Lcd_DOGM162_SPI::onTimerUpdate (const Timer *)
+{
+    proceed();
+}
+
+
+void Lcd_DOGM162_SPI::proceed ()
+{
+    const Spi::Transaction & t = transaction;
+    bool isRun = t.txData >= run && t.txData < run + COLUMNS;
+    if (t.txData == &command)
+    {
+        sendData();
+        return;
+    }
+    if (isRun)
+    {
+        runSent += t.size;
+        if (runSent < runLength)
+        {
+            sendData();
+            return;
+        }
+        if (nextRun())
+        {
+            sendCommand();
+            return;
+        }
+        flushCycles = CycleCounter::getValue() - flushStart;
+    }
+    // a direct write or the last run is finished
+    flushing = false;
 }
@@ -29,10 +29,27 @@ namespace Devices {
 /** 
  * @brief Driver for the DOGM162 LCD series by Electonic Assembly with ST7036 controller.
  *        This driver uses SPI connection method.
+ *
+ * The displayed text is kept in a frame buffer: setChar(), setString() and fillFrame() only
+ * modify the buffer and mark the changed characters as dirty, and flush() sends the dirty runs
+ * (a cursor command followed by the data bytes) as a chain of SPI transactions. If the DMA of
+ * the bus is started, the flush runs in background from the SPI interrupts; otherwise, it is
+ * finished when flush() returns.
+ *
+ * The controller needs about 27 us to execute an instruction or to store a character. The bus is
+ * clocked so that one byte takes at least this time; if the slowest baud rate is still too fast,
+ * the bytes are sent one by one with a gap. The gap is timed by a one-pulse timer given by
+ * setGapTimer(): the next byte is sent from the timer interrupt. Without a timer, the gap is a
+ * busy-wait in the SPI interrupt.
  */
-class Lcd_DOGM162_SPI
+class Lcd_DOGM162_SPI : public Spi::Transaction::EventHandler, public Timer::EventHandler
 {
 public:
+
+    static const uint8_t COLUMNS = 16;
+    static const uint8_t MAX_LINES = 2;
+    static const uint32_t EXECUTION_TIME = 27;  // us, most instructions and data write
+    static const uint32_t CLEAR_TIME = 1100;    // us, clear display and return home
     
     /** 
      * @brief Default constructor
@@ -40,20 +57,27 @@ public:
     Lcd_DOGM162_SPI (Spi & _spi, IOPin & _pinCs, IOPin & _pinRs, bool _bias, uint8_t _contrast);
     
     /**
-     * @brief Initialize LCD module
+     * @brief Start the SPI bus and initialize LCD module. If the bus is shared with other
+     *        devices, the application starts the bus and calls init() instead.
      */
     HAL_StatusTypeDef start (uint8_t n);
-    void init (uint8_t n);
 
+    /**
+     * @brief Sets the timer of the gap between two bytes, shall be called before start(). The
+     *        timer interrupt shall have the priority of the SPI interrupts and call
+     *        Timer::processInterrupt().
+     */
+    inline void setGapTimer (Timer * _gapTimer, const InterruptPriority & _gapTimerPrio)
+    {
+        gapTimer = _gapTimer;
+        gapTimerPrio = &_gapTimerPrio;
+    }
+    void init (uint8_t n);
 
     /** 
-     * @brief Clear display, go to first char in first line
+     * @brief Clear display and frame buffer, go to first char in first line
      */ 
-    inline void clear (void)
-    {
-        writeData(false, 0x01);
-        writeData(false, 0x06);
-    }
+    void clear (void);
 
     /** 
      * @brief Go to a specific position
@@ -64,7 +88,8 @@ public:
     }
     
     /** 
-     * @brief Write single character at current position
+     * @brief Write single character at current position. The direct write methods bypass
+     *        the frame buffer and wait until a running flush is finished.
      */ 
     inline void putChar (uint8_t c)
     {
@@ -99,6 +124,59 @@ public:
         return linesNumber;
     }
 
+    /**
+     * @brief Put a character into the frame buffer.
+     */
+    void setChar (uint8_t x, uint8_t y, char c);
+
+    /**
+     * @brief Put a string into the frame buffer. The string is clipped at the end of the line.
+     */
+    void setString (uint8_t x, uint8_t y, const char * pData, uint16_t pSize);
+
+    /**
+     * @brief Fill the whole frame buffer with the given character.
+     */
+    void fillFrame (char c = ' ');
+
+    inline char getChar (uint8_t x, uint8_t y) const
+    {
+        return frame[y][x];
+    }
+
+    inline bool isDirty () const
+    {
+        return (dirty[0] | dirty[1]) != 0;
+    }
+
+    /**
+     * @brief Send the dirty characters to the display. Returns false if the previous flush
+     *        is still running.
+     */
+    bool flush ();
+
+    inline bool isFlushing () const
+    {
+        return flushing;
+    }
+
+    /**
+     * @brief Returns the duration of the last finished flush, in microseconds.
+     */
+    inline uint32_t getFlushTime () const
+    {
+        return CycleCounter::toMicros(flushCycles);
+    }
+
+    inline uint32_t getErrors () const
+    {
+        return errors;
+    }
+
+    virtual void onSpiTransaction (Spi::Transaction & t);
+
+    virtual void onTimerUpdate (const Timer *);
+
 private:
 
     Spi & spi;
@@ -106,8 +184,34 @@ private:
     IOPin & pinRs;
     uint8_t bias, contrast1, contrast2, linesNumber;
 
-    void writeData (bool isData, uint8_t data);
+    // bus timing
+    uint32_t prescaler;
+    uint16_t chunkSize;
+    uint32_t byteGap; // cycle counter ticks
+    Timer * gapTimer;
+    const InterruptPriority * gapTimerPrio;
+
+    // frame buffer and its characters not yet sent, one bit per column
+    char frame[MAX_LINES][COLUMNS];
+    volatile uint16_t dirty[MAX_LINES];
+
+    // background flush: the run being sent
+    Spi::Transaction transaction;
+    uint8_t command;
+    uint8_t run[COLUMNS];
+    uint8_t runLine, runColumn, runLength, runSent;
+    volatile bool flushing;
+    uint32_t flushStart, flushCycles, errors;
 
+    void writeData (bool isData, uint8_t data);
+    void send (bool isData, const uint8_t * data, uint16_t size);
+    void prepareTransaction (bool isData, const uint8_t * data, uint16_t size);
+    void markDirty (uint8_t y, uint16_t mask);
+    bool nextRun ();
+    void sendCommand ();
+    void sendData ();
+    void startGapTimer (uint32_t gapMicros);
+    void proceed ();
 };
 
 } // end of namespace Devices
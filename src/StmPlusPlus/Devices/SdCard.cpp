@@ -28,11 +28,75 @@ using namespace StmPlusPlus::Devices;
 
 #define USART_DEBUG_MODULE "SD: "
 
+/************************************************************************
+ * Class SdCardStatistics
+ ************************************************************************/
+
+SdCardStatistics::SdCardStatistics ()
+{
+    reset();
+}
+
+
+void SdCardStatistics::reset ()
+{
+    ::memset(entries, 0, sizeof(entries));
+}
+
+
+void SdCardStatistics::dump () const
+{
+    static const char * operationNames[OPERATIONS] = { "read", "write" };
+    static const char * blockClassNames[BLOCK_CLASSES] = { "1", "2-8", "9-32", ">32" };
+    const uint32_t cyclesPerUs = CycleCounter::getFrequency() / 1000000;
+
+    USART_DEBUG("Transfer statistics (latency in us):");
+    for (size_t op = 0; op < OPERATIONS; ++op)
+    {
+        for (size_t bc = 0; bc < BLOCK_CLASSES; ++bc)
+        {
+            const Entry & e = entries[op][bc];
+            if (e.count == 0)
+            {
+                continue;
+            }
+            USART_DEBUG("  " << operationNames[op] << " " << blockClassNames[bc] << " blocks: "
+                     << e.count << " operations"
+                     << ", avg = " << (uint32_t)(e.totalCycles / e.count / cyclesPerUs)
+                     << ", max = " << e.maxCycles / cyclesPerUs << " at " << e.maxTimestamp << " ms"
+                     << ", retries = " << e.retries << " (max " << e.maxRetries << ")"
+                     << ", errors = " << e.errors);
+            if (e.errors > 0)
+            {
+                USART_DEBUG("    last error: " << e.lastError << " at " << e.lastErrorTimestamp << " ms");
+            }
+            for (size_t b = 0; b < LATENCY_BUCKETS; ++b)
+            {
+                if (e.histogram[b] == 0)
+                {
+                    continue;
+                }
+                if (b < LATENCY_BUCKETS - 1)
+                {
+                    USART_DEBUG("    < " << (BUCKET_CYCLES << b) / cyclesPerUs << ": " << e.histogram[b]);
+                }
+                else
+                {
+                    USART_DEBUG("    >= " << (BUCKET_CYCLES << (b - 1)) / cyclesPerUs << ": " << e.histogram[b]);
+                }
+            }
+        }
+    }
+}
+
+
 /************************************************************************
  * FAT FS driver
  ************************************************************************/
 
 SdCard * SdCard::instance = NULL;
+SdCard::BusSettings SdCard::busSettingsCache[SdCard::BUS_SETTINGS_CACHE_SIZE] = {};
+size_t SdCard::busSettingsCacheIdx = 0;
 
 /**
   * @brief  Initializes a Drive
@@ -65,7 +129,7 @@ DSTATUS SD_status(BYTE lun)
 DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
     HAL_SD_ErrorTypedef status = SdCard::getInstance()->readBlocks(
-            (uint32_t*)buff, (uint64_t) (sector * SdCard::SDHC_BLOCK_SIZE), SdCard::SDHC_BLOCK_SIZE, count);
+            (uint32_t*)buff, (uint64_t)sector * SdCard::SDHC_BLOCK_SIZE, SdCard::SDHC_BLOCK_SIZE, count);
     return (status != SD_OK)? RES_ERROR : RES_OK;
 }
 
@@ -80,7 +144,7 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
     HAL_SD_ErrorTypedef status = SdCard::getInstance()->writeBlocks(
-            (uint32_t*)buff, (uint64_t)(sector * SdCard::SDHC_BLOCK_SIZE), SdCard::SDHC_BLOCK_SIZE, count);
+            (uint32_t*)buff, (uint64_t)sector * SdCard::SDHC_BLOCK_SIZE, SdCard::SDHC_BLOCK_SIZE, count);
     return (status != SD_OK)? RES_ERROR : RES_OK;
 }
 
@@ -144,7 +208,10 @@ SdCard::SdCard (IOPin & _sdDetect, IOPort & _portSd1, IOPort & _portSd2):
     sdDetect(_sdDetect),
     portSd1(_portSd1),
     portSd2(_portSd2),
-    irqPrio(5,0)
+    irqPrio(5,0),
+    errorOccurred(false),
+    tuning(false),
+    fatFsLinked(false)
 {
     // empty
 }
@@ -168,6 +235,7 @@ bool SdCard::start (uint32_t clockDiv)
         return false;
     }
 
+    errorOccurred = false;
     portSd1.setMode(GPIO_MODE_AF_PP);
     portSd1.setAlternate(GPIO_AF12_SDIO);
 
@@ -196,6 +264,7 @@ bool SdCard::start (uint32_t clockDiv)
         USART_DEBUG("Can not initialize SD Wide Bus Operation: " << status);
         return false;
     }
+    sdParams.Init.BusWide = SDIO_BUS_WIDE_4B;
 
     HAL_SD_CardStatusTypedef cardStatus;
     status = HAL_SD_GetCardStatus(&sdParams, &cardStatus);
@@ -277,15 +346,145 @@ bool SdCard::start (uint32_t clockDiv)
 }
 
 
-bool SdCard::mountFatFs ()
+bool SdCard::tuneBus ()
+{
+    /* Failed tuning steps are no errors of the production transfers */
+    tuning = true;
+    bool retValue = findBusSettings();
+    tuning = false;
+    return retValue;
+}
+
+
+bool SdCard::findBusSettings ()
 {
-    uint8_t code1 = FATFS_LinkDriver(&fatFsDriver, fatFs.path);
-    if (code1 != 0)
+    const uint32_t serialNumber = sdCardInfo.SD_cid.ProdSN;
+    const BusSettings safeSettings = { true, serialNumber, sdParams.Init.ClockDiv, false, false };
+    BusSettings bs;
+
+    /* Reference data read with the current (safe) settings */
+    if (readBlocks(testBlocks[0], 0, SDHC_BLOCK_SIZE, TEST_BLOCKS) != SD_OK)
     {
-        USART_DEBUG("Can not link FAT FS driver");
+        USART_DEBUG("Can not read reference blocks");
         return false;
     }
 
+    /* Try the cached settings at first */
+    size_t cacheIdx = busSettingsCacheIdx;
+    for (size_t i = 0; i < BUS_SETTINGS_CACHE_SIZE; ++i)
+    {
+        const BusSettings & cached = busSettingsCache[i];
+        if (!cached.valid || cached.serialNumber != serialNumber)
+        {
+            continue;
+        }
+        cacheIdx = i;
+        if ((!cached.highSpeed || HAL_SD_HighSpeed(&sdParams) == SD_OK) && verifyBusSettings(cached))
+        {
+            errorOccurred = false;
+            USART_DEBUG("Cached bus settings applied: clock = " << getClockFreq()/1000 << " kHz");
+            return true;
+        }
+        applyBusSettings(safeSettings);
+        break;
+    }
+
+    /* CMD6: switch to High-Speed mode if the card supports it */
+    bs = safeSettings;
+    HAL_SD_ErrorTypedef status = HAL_SD_HighSpeed(&sdParams);
+    bs.highSpeed = (status == SD_OK);
+    USART_DEBUG("High-Speed mode: " << (bs.highSpeed? "supported" : "not supported") << " (" << status << ")");
+
+    /* Step from the fastest clock up to the safe divider */
+    bool tuned = false;
+    if (bs.highSpeed)
+    {
+        bs.clockBypass = true;
+        bs.clockDiv = 0;
+        tuned = verifyBusSettings(bs);
+        bs.clockBypass = false;
+    }
+    for (bs.clockDiv = 0; !tuned && bs.clockDiv < safeSettings.clockDiv; ++bs.clockDiv)
+    {
+        if (verifyBusSettings(bs))
+        {
+            tuned = true;
+            break;
+        }
+    }
+    if (!tuned)
+    {
+        bs = safeSettings;
+        applyBusSettings(bs);
+    }
+
+    /* Measure the read throughput */
+    uint32_t startCycles = CycleCounter::getValue();
+    for (size_t i = 0; i < TEST_BLOCKS; ++i)
+    {
+        readBlocks(testBlocks[1], 0, SDHC_BLOCK_SIZE, TEST_BLOCKS);
+    }
+    uint32_t cycles = CycleCounter::getValue() - startCycles;
+    errorOccurred = false;
+
+    busSettingsCache[cacheIdx] = bs;
+    if (cacheIdx == busSettingsCacheIdx)
+    {
+        busSettingsCacheIdx = (busSettingsCacheIdx + 1) % BUS_SETTINGS_CACHE_SIZE;
+    }
+
+    char throughput[16];
+    USART_DEBUG("Bus tuned: serial number = " << serialNumber
+             << ", high speed = " << bs.highSpeed
+             << ", clock = " << getClockFreq()/1000 << " kHz"
+             << ", read throughput = " << CycleCounter::formatThroughput(TEST_BLOCKS * TEST_BLOCKS * SDHC_BLOCK_SIZE, cycles, throughput) << " MB/s");
+    return true;
+}
+
+
+void SdCard::applyBusSettings (const BusSettings & bs)
+{
+    sdParams.Init.ClockBypass = bs.clockBypass? SDIO_CLOCK_BYPASS_ENABLE : SDIO_CLOCK_BYPASS_DISABLE;
+    sdParams.Init.ClockDiv = bs.clockDiv;
+    SDIO_Init(sdParams.Instance, sdParams.Init);
+}
+
+
+bool SdCard::verifyBusSettings (const BusSettings & bs)
+{
+    applyBusSettings(bs);
+    /* The SDIO checks the CRC of each data block: a CRC error fails the transfer */
+    ::memset(testBlocks[1], 0, sizeof(testBlocks[1]));
+    HAL_SD_ErrorTypedef status = readBlocks(testBlocks[1], 0, SDHC_BLOCK_SIZE, TEST_BLOCKS);
+    if (status != SD_OK)
+    {
+        HAL_SD_StopTransfer(&sdParams);
+        return false;
+    }
+    return ::memcmp(testBlocks[0], testBlocks[1], sizeof(testBlocks[1])) == 0;
+}
+
+
+uint32_t SdCard::getClockFreq () const
+{
+    return (sdParams.Init.ClockBypass == SDIO_CLOCK_BYPASS_ENABLE)?
+            SDIO_CLOCK_FREQ : SDIO_CLOCK_FREQ / (sdParams.Init.ClockDiv + 2);
+}
+
+
+bool SdCard::mountFatFs ()
+{
+    if (!fatFsLinked)
+    {
+        uint8_t code1 = FATFS_LinkDriver(&fatFsDriver, fatFs.path);
+        if (code1 != 0)
+        {
+            USART_DEBUG("Can not link FAT FS driver");
+            return false;
+        }
+        fatFsLinked = true;
+    }
+
     FRESULT code2 = f_mount(&fatFs.key, fatFs.path, 1);
     if (code2 != FR_OK)
     {
@@ -370,6 +569,128 @@ FRESULT SdCard::openAppend (uint32_t clockDiv, FIL * fp, const char * path)
 }
 
 
+FRESULT SdCard::openContiguous (ContiguousFile & cf, const char * path, BYTE mode, DWORD preallocate)
+{
+    cf.startSector = cf.sectorCount = 0;
+    FRESULT fr = f_open(&cf.file, path, mode);
+    if (fr != FR_OK)
+    {
+        return fr;
+    }
+
+    /* Pre-allocate the file: in the write mode, f_lseek beyond the end of the file expands it */
+    if (preallocate > f_size(&cf.file))
+    {
+        fr = f_lseek(&cf.file, preallocate);
+        if (fr == FR_OK && f_tell(&cf.file) != preallocate)
+        {
+            fr = FR_DENIED; // disk full
+        }
+        if (fr == FR_OK)
+        {
+            fr = f_sync(&cf.file);
+        }
+        if (fr != FR_OK)
+        {
+            USART_DEBUG("Can not pre-allocate file " << path << ": " << fr);
+            f_close(&cf.file);
+            return fr;
+        }
+    }
+
+    if (cf.file.sclust == 0)
+    {
+        USART_DEBUG("File " << path << " is empty");
+        f_close(&cf.file);
+        return FR_DENIED;
+    }
+
+    /* A contiguous file is described by the cluster link map with exactly one fragment:
+       [map size] [number of clusters] [start cluster] [0] */
+    DWORD linkMap[4];
+    linkMap[0] = sizeof(linkMap) / sizeof(DWORD);
+    cf.file.cltbl = linkMap;
+    fr = f_lseek(&cf.file, CREATE_LINKMAP);
+    cf.file.cltbl = NULL;
+    if (fr != FR_OK)
+    {
+        USART_DEBUG("File " << path << " is not contiguous: " << fr);
+        f_close(&cf.file);
+        return (fr == FR_NOT_ENOUGH_CORE)? FR_DENIED : fr;
+    }
+
+    const FATFS * fs = cf.file.fs;
+    cf.startSector = fs->database + (linkMap[2] - 2) * fs->csize;
+    cf.sectorCount = linkMap[1] * fs->csize;
+    f_lseek(&cf.file, 0);
+
+    USART_DEBUG("Contiguous file " << path << " opened: startSector = " << cf.startSector
+             << ", sectorCount = " << cf.sectorCount << ", size = " << f_size(&cf.file));
+    return FR_OK;
+}
+
+
+FRESULT SdCard::closeContiguous (ContiguousFile & cf, DWORD fileSize)
+{
+    if (fileSize != KEEP_FILE_SIZE && fileSize < f_size(&cf.file))
+    {
+        /* Release unused pre-allocated clusters */
+        FRESULT fr = f_lseek(&cf.file, fileSize);
+        if (fr == FR_OK)
+        {
+            fr = f_truncate(&cf.file);
+        }
+        if (fr != FR_OK)
+        {
+            USART_DEBUG("Can not truncate contiguous file: " << fr);
+        }
+    }
+    cf.startSector = cf.sectorCount = 0;
+    /* The directory entry is only updated here */
+    return f_close(&cf.file);
+}
+
+
+HAL_SD_ErrorTypedef SdCard::readSectors (const ContiguousFile & cf, uint32_t sector, uint32_t *pData, uint32_t numOfSectors)
+{
+    // the sum can overflow: compare against the remaining sectors
+    if (sector > cf.sectorCount || numOfSectors > cf.sectorCount - sector)
+    {
+        return SD_INVALID_PARAMETER;
+    }
+    HAL_SD_ErrorTypedef status = SD_OK;
+    while (numOfSectors > 0 && status == SD_OK)
+    {
+        uint32_t n = (numOfSectors < MAX_BURST_BLOCKS)? numOfSectors : MAX_BURST_BLOCKS;
+        status = readBlocks(pData, (uint64_t)(cf.startSector + sector) * SDHC_BLOCK_SIZE, SDHC_BLOCK_SIZE, n);
+        sector += n;
+        pData += n * SDHC_BLOCK_SIZE / sizeof(uint32_t);
+        numOfSectors -= n;
+    }
+    return status;
+}
+
+
+HAL_SD_ErrorTypedef SdCard::writeSectors (const ContiguousFile & cf, uint32_t sector, uint32_t *pData, uint32_t numOfSectors)
+{
+    // the sum can overflow: compare against the remaining sectors
+    if (sector > cf.sectorCount || numOfSectors > cf.sectorCount - sector)
+    {
+        return SD_INVALID_PARAMETER;
+    }
+    HAL_SD_ErrorTypedef status = SD_OK;
+    while (numOfSectors > 0 && status == SD_OK)
+    {
+        uint32_t n = (numOfSectors < MAX_BURST_BLOCKS)? numOfSectors : MAX_BURST_BLOCKS;
+        status = writeBlocks(pData, (uint64_t)(cf.startSector + sector) * SDHC_BLOCK_SIZE, SDHC_BLOCK_SIZE, n);
+        sector += n;
+        pData += n * SDHC_BLOCK_SIZE / sizeof(uint32_t);
+        numOfSectors -= n;
+    }
+    return status;
+}
+
+
 void SdCard::stop ()
 {
     HAL_NVIC_DisableIRQ(TX_IRQ);
@@ -384,50 +705,74 @@ void SdCard::stop ()
 
 HAL_SD_ErrorTypedef SdCard::readBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks)
 {
+    uint32_t startCycles = CycleCounter::getValue();
+    uint32_t retries = 0;
     HAL_SD_ErrorTypedef status = HAL_SD_ReadBlocks_DMA(&sdParams, pData, addr, blockSize, numOfBlocks);
     if (status == SD_OK)
     {
-        uint8_t repeatNr = 0xFF;
-        do
+        status = HAL_SD_CheckReadOperation(&sdParams, TIMEOUT);
+        while (status == SD_DATA_TIMEOUT && retries + 1 < CHECK_ATTEMPTS)
         {
+            ++retries;
             status = HAL_SD_CheckReadOperation(&sdParams, TIMEOUT);
         }
-        while (status == SD_DATA_TIMEOUT && --repeatNr > 0);
 
         if (status != SD_OK)
         {
-            USART_DEBUG("Error at reading blocks (operation finish): " << status);
+            USART_DEBUG("Error at reading blocks (operation finish): " << status << " after "
+                     << retries + 1 << " attempts");
         }
     }
     else
     {
         USART_DEBUG("Error at reading blocks (operation start): " << status);
     }
+    if (status != SD_OK)
+    {
+        errorOccurred = true;
+    }
+    if (!tuning)
+    {
+        statistics.registerOperation(SdCardStatistics::Operation::READ, numOfBlocks,
+                                     CycleCounter::getValue() - startCycles, retries, status);
+    }
     return status;
 }
 
 
 HAL_SD_ErrorTypedef SdCard::writeBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks)
 {
+    uint32_t startCycles = CycleCounter::getValue();
+    uint32_t retries = 0;
     HAL_SD_ErrorTypedef status = HAL_SD_WriteBlocks_DMA(&sdParams, pData, addr, blockSize, numOfBlocks);
     if (status == SD_OK)
     {
-        uint8_t repeatNr = 0xFF;
-        do
+        status = HAL_SD_CheckWriteOperation(&sdParams, TIMEOUT);
+        while (status == SD_DATA_TIMEOUT && retries + 1 < CHECK_ATTEMPTS)
         {
+            ++retries;
             status = HAL_SD_CheckWriteOperation(&sdParams, TIMEOUT);
         }
-        while (status == SD_DATA_TIMEOUT && --repeatNr > 0);
 
         if (status != SD_OK)
         {
-            USART_DEBUG("Error at writing blocks (operation finish): " << status);
+            USART_DEBUG("Error at writing blocks (operation finish): " << status << " after "
+                     << retries + 1 << " attempts");
         }
     }
     else
     {
         USART_DEBUG("Error at writing blocks (operation start): " << status);
     }
+    if (status != SD_OK)
+    {
+        errorOccurred = true;
+    }
+    if (!tuning)
+    {
+        statistics.registerOperation(SdCardStatistics::Operation::WRITE, numOfBlocks,
+                                     CycleCounter::getValue() - startCycles, retries, status);
+    }
     return status;
 }
 
@@ -32,6 +32,97 @@
 namespace StmPlusPlus {
 namespace Devices {
 
+/**
+ * @brief Class that collects the latency and retry statistics of SD card block transfers.
+ *
+ * Statistics are collected separately for reading and writing and split by the number of
+ * transferred blocks. The latencies are measured with the cycle counter and sorted into
+ * logarithmic histogram buckets: the bucket K (K > 0) contains latencies in the range
+ * [2^(K-1), 2^K) * BUCKET_CYCLES, the bucket 0 contains latencies below BUCKET_CYCLES.
+ */
+class SdCardStatistics
+{
+public:
+
+    enum class Operation
+    {
+        READ  = 0,
+        WRITE = 1
+    };
+
+    static const size_t OPERATIONS = 2;
+    static const size_t BLOCK_CLASSES = 4; // 1, 2..8, 9..32 and more than 32 blocks
+    static const size_t LATENCY_BUCKETS = 12;
+    static const uint32_t BUCKET_SHIFT = 12;
+    static const uint32_t BUCKET_CYCLES = 1 << BUCKET_SHIFT;
+
+    class Entry
+    {
+    public:
+
+        uint32_t count;
+        uint32_t errors;
+        uint32_t retries;
+        uint32_t maxRetries;
+        uint32_t maxCycles;
+        uint32_t maxTimestamp; // system tick (ms) of the slowest operation
+        uint64_t totalCycles;
+        HAL_SD_ErrorTypedef lastError;
+        uint32_t lastErrorTimestamp; // system tick (ms) of the last error
+        uint32_t histogram[LATENCY_BUCKETS];
+    };
+
+    SdCardStatistics ();
+
+    void reset ();
+
+    /**
+     * @brief Registers a finished block transfer.
+     */
+    inline void registerOperation (Operation op, uint32_t numOfBlocks, uint32_t cycles, uint32_t retries,
+                                   HAL_SD_ErrorTypedef status)
+    {
+        Entry & e = entries[(size_t)op][getBlockClass(numOfBlocks)];
+        ++e.count;
+        e.totalCycles += cycles;
+        e.retries += retries;
+        if (retries > e.maxRetries)
+        {
+            e.maxRetries = retries;
+        }
+        if (cycles > e.maxCycles)
+        {
+            e.maxCycles = cycles;
+            e.maxTimestamp = HAL_GetTick();
+        }
+        uint32_t bucket = 32 - __CLZ(cycles >> BUCKET_SHIFT);
+        ++e.histogram[bucket < LATENCY_BUCKETS? bucket : LATENCY_BUCKETS - 1];
+        if (status != SD_OK)
+        {
+            ++e.errors;
+            e.lastError = status;
+            e.lastErrorTimestamp = HAL_GetTick();
+        }
+    }
+
+    inline const Entry & getEntry (Operation op, size_t blockClass) const
+    {
+        return entries[(size_t)op][blockClass];
+    }
+
+    static inline size_t getBlockClass (uint32_t numOfBlocks)
+    {
+        return (numOfBlocks <= 1)? 0 : (numOfBlocks <= 8)? 1 : (numOfBlocks <= 32)? 2 : 3;
+    }
+
+    void dump () const;
+
+private:
+
+    Entry entries[OPERATIONS][BLOCK_CLASSES];
+};
+
+
 /**
  * @brief Class that implements SD card interface.
  */
@@ -41,6 +132,14 @@ public:
 
     static const uint32_t SDHC_BLOCK_SIZE = 512;
     static const size_t FAT_FS_OBJECT_LENGHT = 64;
+    static const uint32_t MAX_BURST_BLOCKS = 64; // maximal number of blocks in a multi-block transfer
+    static const DWORD KEEP_FILE_SIZE = __UINT32_MAX__;
+    static const uint32_t SDIO_CLOCK_FREQ = 48000000; // SDIOCLK, provided by PLL48CLK
+    static const uint32_t SAFE_CLOCK_DIV = 6;
+    static const uint32_t AUTO_CLOCK_DIV = __UINT32_MAX__;
+    static const uint32_t TEST_BLOCKS = 4; // number of blocks used to verify the bus settings
+    static const size_t BUS_SETTINGS_CACHE_SIZE = 4;
+    static const uint32_t CHECK_ATTEMPTS = 255; // checks of a transfer before its data timeout is reported
 
     const uint32_t TIMEOUT = 10000;
     const IRQn_Type RX_IRQ = DMA2_Stream3_IRQn;
@@ -56,6 +155,30 @@ public:
         char currentDirectory[FAT_FS_OBJECT_LENGHT];
     } FatFs;
 
+    /**
+     * @brief A file that occupies a contiguous range of sectors. FAT FS is only used in order to
+     *        find or create the file and to update its directory entry on close. The file data
+     *        is accessed by raw multi-block transfers.
+     */
+    typedef struct
+    {
+        FIL file;             /* FAT FS file object */
+        uint32_t startSector; /* LBA of the first data sector */
+        uint32_t sectorCount; /* Number of allocated sectors */
+    } ContiguousFile;
+
+    /**
+     * @brief Bus settings negotiated for a card with given serial number.
+     */
+    typedef struct
+    {
+        bool valid;
+        uint32_t serialNumber;
+        uint32_t clockDiv;
+        bool clockBypass;
+        bool highSpeed;
+    } BusSettings;
+
     /**
      * @brief Default constructor.
      */
@@ -106,19 +229,50 @@ public:
         irqPrio = prio;
     }
 
+    inline bool isErrorOccurred () const
+    {
+        return errorOccurred;
+    }
+
+    /**
+     * @brief Stops the SDIO clock output when the bus is idle.
+     */
+    inline void setClockPowerSave (bool enable)
+    {
+        if (enable)
+        {
+            SET_BIT(sdParams.Instance->CLKCR, SDIO_CLKCR_PWRSAV);
+        }
+        else
+        {
+            CLEAR_BIT(sdParams.Instance->CLKCR, SDIO_CLKCR_PWRSAV);
+        }
+    }
+
     void clearPort ();
 
     bool start (uint32_t clockDiv = 0);
+    bool tuneBus ();
 
     bool mountFatFs ();
     void listFiles ();
     FRESULT openAppend (uint32_t clockDiv, FIL * fp, const char * path);
 
+    FRESULT openContiguous (ContiguousFile & cf, const char * path, BYTE mode, DWORD preallocate = 0);
+    FRESULT closeContiguous (ContiguousFile & cf, DWORD fileSize = KEEP_FILE_SIZE);
+    HAL_SD_ErrorTypedef readSectors (const ContiguousFile & cf, uint32_t sector, uint32_t *pData, uint32_t numOfSectors);
+    HAL_SD_ErrorTypedef writeSectors (const ContiguousFile & cf, uint32_t sector, uint32_t *pData, uint32_t numOfSectors);
+
     void stop ();
 
     HAL_SD_ErrorTypedef readBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks);
     HAL_SD_ErrorTypedef writeBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks);
 
+    inline SdCardStatistics & getStatistics ()
+    {
+        return statistics;
+    }
+
 private:
 
     static SdCard * instance;
@@ -131,10 +285,24 @@ private:
     DMA_HandleTypeDef sdDmaRx;
     DMA_HandleTypeDef sdDmaTx;
     InterruptPriority irqPrio;
+    bool errorOccurred;
+    SdCardStatistics statistics;
+
+    // Bus tuning
+    static BusSettings busSettingsCache[BUS_SETTINGS_CACHE_SIZE];
+    static size_t busSettingsCacheIdx;
+    uint32_t testBlocks[2][TEST_BLOCKS * SDHC_BLOCK_SIZE / sizeof(uint32_t)];
+    bool tuning; // the test transfers are not registered in the statistics
 
     // FAT FS
     static Diskio_drvTypeDef fatFsDriver;
     FatFs fatFs;
+    bool fatFsLinked;
+
+    bool findBusSettings ();
+    void applyBusSettings (const BusSettings & bs);
+    bool verifyBusSettings (const BusSettings & bs);
+    uint32_t getClockFreq () const;
 };
 
 } // end of namespace Devices
@@ -0,0 +1,226 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "ShiftRegisterScanner.h"
+
+#ifdef STM32F4
+
+#include <cstring>
+
+using namespace StmPlusPlus;
+using namespace StmPlusPlus::Devices;
+
+#define USART_DEBUG_MODULE "SHIFT: "
+
+ShiftRegisterScanner::ShiftRegisterScanner (Spi & _spi, IOPin & _latch,
+                                            DMA_Stream_TypeDef * rxStream, DMA_Stream_TypeDef * txStream,
+                                            uint32_t dmaChannel):
+    spi{_spi},
+    latch{_latch},
+    inputs{0},
+    outputs{0},
+    frameLength{0},
+    inputMask{0},
+    outputMask{0},
+    rxIndex{0},
+    txIndex{0},
+    txReady{false},
+    shifting{false},
+    receivedState{0},
+    receivedChanges{0},
+    state{0},
+    changes{0},
+    outputBits{0},
+    frames{0},
+    overruns{0},
+    isrCycles{0},
+    maxIsrCycles{0}
+{
+    rxDma.Instance = rxStream;
+    rxDma.Init.Channel = dmaChannel;
+    txDma.Instance = txStream;
+    txDma.Init.Channel = dmaChannel;
+    ::memset(rxBuffers, 0, sizeof(rxBuffers));
+    ::memset(txBuffers, 0, sizeof(txBuffers));
+}
+
+bool ShiftRegisterScanner::start (size_t _inputs, size_t _outputs)
+{
+    if (_inputs > MAX_BITS || _outputs > MAX_BITS || (_inputs == 0 && _outputs == 0))
+    {
+        USART_DEBUG("Invalid chain length: " << _inputs << " inputs, " << _outputs << " outputs");
+        return false;
+    }
+    inputs = _inputs;
+    outputs = _outputs;
+    inputMask = (inputs == MAX_BITS)? ~(Bits)0 : (((Bits)1 << inputs) - 1);
+    outputMask = (outputs == MAX_BITS)? ~(Bits)0 : (((Bits)1 << outputs) - 1);
+
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    initDma(rxDma, DMA_PERIPH_TO_MEMORY);
+    initDma(txDma, DMA_MEMORY_TO_PERIPH);
+    if (HAL_DMA_Init(&rxDma) != HAL_OK || HAL_DMA_Init(&txDma) != HAL_OK)
+    {
+        USART_DEBUG("Can not initialize DMA streams");
+        return false;
+    }
+    SPI_TypeDef * s = spi.getInstance();
+    rxDma.Instance->PAR = (uint32_t)(size_t)&s->DR;
+    txDma.Instance->PAR = (uint32_t)(size_t)&s->DR;
+    s->CR2 |= SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+
+    rxIndex = 0;
+    txIndex = 0;
+    txReady = false;
+    shifting = false;
+    receivedState = 0;
+    receivedChanges = 0;
+    frames = 0;
+    overruns = 0;
+    isrCycles = 0;
+    maxIsrCycles = 0;
+    latch.setHigh();
+    frameLength = (inputs > outputs)? (inputs + 7) / 8 : (outputs + 7) / 8;
+    setOutputs(0);
+    USART_DEBUG("Started: " << inputs << " inputs, " << outputs << " outputs, frame of "
+                << frameLength << " bytes");
+    return true;
+}
+
+void ShiftRegisterScanner::stop ()
+{
+    frameLength = 0;
+    __HAL_DMA_DISABLE(&rxDma);
+    __HAL_DMA_DISABLE(&txDma);
+    spi.getInstance()->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    HAL_DMA_DeInit(&rxDma);
+    HAL_DMA_DeInit(&txDma);
+    // DMA clocks are not disabled since other streams can be still active
+}
+
+void ShiftRegisterScanner::initDma (DMA_HandleTypeDef & dma, uint32_t direction)
+{
+    dma.Init.Direction = direction;
+    dma.Init.PeriphInc = DMA_PINC_DISABLE;
+    dma.Init.MemInc = DMA_MINC_ENABLE;
+    dma.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    dma.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    dma.Init.Mode = DMA_NORMAL;
+    dma.Init.Priority = (direction == DMA_PERIPH_TO_MEMORY)? DMA_PRIORITY_HIGH : DMA_PRIORITY_MEDIUM;
+    dma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    dma.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    dma.Init.MemBurst = DMA_MBURST_SINGLE;
+    dma.Init.PeriphBurst = DMA_PBURST_SINGLE;
+}
+
+void ShiftRegisterScanner::armDma (DMA_HandleTypeDef & dma, uint8_t * buffer)
+{
+    // the stream is disabled by the hardware at the end of the previous frame; the flag
+    // clear register follows the status register and a reserved word (DMA_Base_Registers)
+    dma.Instance->CR &= ~DMA_SxCR_EN;
+    volatile uint32_t * ifcr = (volatile uint32_t *)(size_t)(dma.StreamBaseAddress + 8);
+    *ifcr = 0x3FU << dma.StreamIndex;
+    dma.Instance->M0AR = (uint32_t)(size_t)buffer;
+    dma.Instance->NDTR = frameLength;
+    dma.Instance->CR |= DMA_SxCR_EN;
+}
+
+void ShiftRegisterScanner::onTimerUpdate (const Timer *)
+{
+    if (frameLength == 0)
+    {
+        return;
+    }
+    uint32_t startCycles = CycleCounter::getValue();
+    if (shifting && rxDma.Instance->NDTR != 0)
+    {
+        ++overruns;
+        return;
+    }
+
+    // the latch is held low while the received frame is published: the 74HC165 load their inputs
+    GPIO_TypeDef * latchPort = latch.getPort();
+    uint32_t latchPin = latch.getPins();
+    latchPort->BSRR = latchPin << 16;
+    if (shifting)
+    {
+        Bits bits = 0;
+        ::memcpy(&bits, rxBuffers[rxIndex], sizeof(bits));
+        bits &= inputMask;
+        receivedChanges |= bits ^ receivedState;
+        receivedState = bits;
+        rxIndex ^= 1;
+    }
+    if (txReady)
+    {
+        txIndex ^= 1;
+        txReady = false;
+    }
+    // rising edge: the 74HC595 outputs take the frame shifted by the previous tick
+    latchPort->BSRR = latchPin;
+
+    // RX first: the TX stream starts the transfer
+    armDma(rxDma, rxBuffers[rxIndex]);
+    armDma(txDma, txBuffers[txIndex]);
+    shifting = true;
+
+    ++frames;
+    uint32_t cycles = CycleCounter::getValue() - startCycles;
+    isrCycles += cycles;
+    if (cycles > maxIsrCycles)
+    {
+        maxIsrCycles = cycles;
+    }
+}
+
+ShiftRegisterScanner::Bits ShiftRegisterScanner::scan ()
+{
+    uint32_t primask = System::enterCritical();
+    state = receivedState;
+    changes = receivedChanges;
+    receivedChanges = 0;
+    System::leaveCritical(primask);
+    return changes;
+}
+
+void ShiftRegisterScanner::setOutputs (Bits bits)
+{
+    outputBits = bits & outputMask;
+
+    // the back buffer is not used by the DMA; a pending swap is cancelled while it is written
+    uint32_t primask = System::enterCritical();
+    txReady = false;
+    uint8_t * frame = txBuffers[txIndex ^ 1];
+    System::leaveCritical(primask);
+
+    // the first bytes shifted out end in the last 74HC595 of the chain
+    ::memset(frame, 0, frameLength);
+    for (size_t i = 0; i < (outputs + 7) / 8; ++i)
+    {
+        frame[frameLength - 1 - i] = (uint8_t)(outputBits >> (8 * i));
+    }
+
+    primask = System::enterCritical();
+    txReady = true;
+    System::leaveCritical(primask);
+}
+
+#endif
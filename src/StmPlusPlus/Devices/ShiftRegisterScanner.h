@@ -0,0 +1,190 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef SHIFTREGISTERSCANNER_H_
+#define SHIFTREGISTERSCANNER_H_
+
+#include "../StmPlusPlus.h"
+
+#ifdef STM32F4
+
+namespace StmPlusPlus {
+namespace Devices {
+
+/** 
+ * @brief Class that scans a chain of 74HC165 input shift registers and refreshes a chain of 74HC595
+ *        output shift registers over a single SPI bus using DMA
+ *
+ * Both chains share SCK and a latch line: MISO is connected to QH of the first 74HC165, MOSI to
+ * SER of the first 74HC595, the latch line to PL of all 74HC165 and RCLK of all 74HC595. The SPI
+ * shall be started in mode 0 (CPOL low, first edge), 8 bit, MSB first.
+ *
+ * The scan is triggered by a timer: onTimerUpdate() shall be called from the timer interrupt.
+ * On every tick, the handler publishes the frame received by the previous tick, pulls the latch
+ * line low (the 74HC165 load the inputs) and high again (the 74HC595 outputs take the bits shifted
+ * by the previous frame), and re-arms the RX and TX DMA streams for the next full-duplex frame.
+ * The shifting itself runs without CPU: no DMA interrupt is used. If the previous frame is still
+ * being shifted, the tick is skipped and counted as an overrun.
+ *
+ * Both directions are double-buffered. The received inputs are collected by the interrupt and
+ * fetched by scan() as a packed bit mask with change flags: a pulse shorter than the scan
+ * interval is still reported as a change. The outputs are encoded by setOutputs() into the back
+ * buffer that is swapped with the DMA buffer on the next tick: a frame is never shifted while
+ * it is modified.
+ *
+ * Bit i of the inputs is the pin D(i % 8) of the 74HC165 number i / 8, counted from MISO. Bit i
+ * of the outputs is the pin Q(i % 8) of the 74HC595 number i / 8, counted from MOSI. Inputs appear
+ * after one tick, outputs after one or two ticks.
+ */
+class ShiftRegisterScanner final : public Timer::EventHandler
+{
+public:
+
+    typedef uint64_t Bits;
+
+    static const size_t MAX_BITS = 64;
+    static const size_t MAX_BYTES = MAX_BITS / 8;
+
+    /**
+     * @brief Default constructor: the DMA streams and their channel shall serve the RX and TX
+     *        requests of the given SPI.
+     */
+    ShiftRegisterScanner (Spi & _spi, IOPin & _latch,
+                          DMA_Stream_TypeDef * rxStream, DMA_Stream_TypeDef * txStream, uint32_t dmaChannel);
+
+    /**
+     * @brief Initializes the DMA streams for the given numbers of inputs and outputs. The timer
+     *        that calls onTimerUpdate() shall be started after this method.
+     */
+    bool start (size_t _inputs, size_t _outputs);
+
+    void stop ();
+
+    inline bool isActive () const
+    {
+        return frameLength != 0;
+    }
+
+    virtual void onTimerUpdate (const Timer *);
+
+    /**
+     * @brief Fetches the inputs received since the previous scan and stores them. Returns the
+     *        bit mask of the inputs changed since the previous scan.
+     */
+    Bits scan ();
+
+    /**
+     * @brief Returns the inputs stored by the last scan.
+     */
+    inline Bits getState () const
+    {
+        return state;
+    }
+
+    /**
+     * @brief Returns the changes detected by the last scan.
+     */
+    inline Bits getChanges () const
+    {
+        return changes;
+    }
+
+    inline bool getBit (size_t i) const
+    {
+        return (state >> i) & 1;
+    }
+
+    inline size_t getInputs () const
+    {
+        return inputs;
+    }
+
+    inline size_t getOutputs () const
+    {
+        return outputs;
+    }
+
+    /**
+     * @brief Sets all outputs. They are shifted out by the next tick.
+     */
+    void setOutputs (Bits bits);
+
+    inline Bits getOutputBits () const
+    {
+        return outputBits;
+    }
+
+    inline uint32_t getFrames () const
+    {
+        return frames;
+    }
+
+    inline uint32_t getOverruns () const
+    {
+        return overruns;
+    }
+
+    /**
+     * @brief Returns the CycleCounter cycles spent in the interrupt handler since the start.
+     */
+    inline uint64_t getIsrCycles () const
+    {
+        return isrCycles;
+    }
+
+    inline uint32_t getMaxIsrCycles () const
+    {
+        return maxIsrCycles;
+    }
+
+private:
+
+    Spi & spi;
+    IOPin & latch;
+    DMA_HandleTypeDef rxDma, txDma;
+
+    size_t inputs, outputs, frameLength;
+    Bits inputMask, outputMask;
+
+    // Frame buffers: the interrupt and DMA own rxBuffers[rxIndex] and txBuffers[txIndex]
+    uint8_t rxBuffers[2][MAX_BYTES];
+    uint8_t txBuffers[2][MAX_BYTES];
+    size_t rxIndex;
+    volatile size_t txIndex;
+    volatile bool txReady, shifting;
+
+    // Inputs collected by the interrupt and by the last scan
+    volatile Bits receivedState, receivedChanges;
+    Bits state, changes, outputBits;
+
+    // Statistics
+    volatile uint32_t frames, overruns;
+    volatile uint64_t isrCycles;
+    volatile uint32_t maxIsrCycles;
+
+    void initDma (DMA_HandleTypeDef & dma, uint32_t direction);
+    void armDma (DMA_HandleTypeDef & dma, uint8_t * buffer);
+};
+
+} // end of namespace Devices
+} // end of namespace StmPlusPlus
+
+#endif
+#endif
@@ -20,9 +20,13 @@
 
 #include "Ssd.h"
 
+#include <cstring>
+
 using namespace StmPlusPlus;
 using namespace StmPlusPlus::Devices;
 
+constexpr uint8_t Ssd::FONT[];
+
 /************************************************************************
  * Class SegmentsMask
  ************************************************************************/
@@ -40,65 +44,30 @@ Ssd::SegmentsMask::SegmentsMask ()
 
 char Ssd::getBits (char c, bool dot) const
 {
-    char bits = 0;
-    switch (c)
-    {
-        case '.':
-            bits |= (1 << sm.dot);
-            break;
-        case '-':
-            bits |= (1 << sm.center);
-            break;
-        case 0: case '0':
-            bits = (1 << sm.top) | (1 << sm.rightTop) | (1 << sm.rightBottom)
-            | (1 << sm.bottom) | (1 << sm.leftBottom) | (1 << sm.leftTop);
-            break;
-        case 1: case '1':
-            bits = (1 << sm.rightTop) | (1 << sm.rightBottom);
-            break;
-        case 2: case '2':
-            bits = (1 << sm.top) | (1 << sm.rightTop) | (1 << sm.center)
-            | (1 << sm.leftBottom) | (1 << sm.bottom);
-            break;
-        case 3: case '3':
-            bits = (1 << sm.top) | (1 << sm.rightTop) | (1 << sm.center)
-            | (1 << sm.rightBottom) | (1 << sm.bottom);
-            break;
-        case 4: case '4':
-            bits = (1 << sm.leftTop) | (1 << sm.center) | (1 << sm.rightTop)
-            | (1 << sm.rightBottom);
-            break;
-        case 5: case '5':
-            bits = (1 << sm.top) | (1 << sm.leftTop) | (1 << sm.center)
-            | (1 << sm.rightBottom) | (1 << sm.bottom);
-            break;
-        case 6: case '6':
-            bits = (1 << sm.top) | (1 << sm.leftTop) | (1 << sm.center)
-            | (1 << sm.rightBottom) | (1 << sm.bottom) | (1 << sm.leftBottom);
-            break;
-        case 7: case '7':
-            bits = (1 << sm.top) | (1 << sm.rightTop) | (1 << sm.rightBottom);
-            break;
-        case 8: case '8':
-            bits = (1 << sm.top) | (1 << sm.rightTop) | (1 << sm.center)
-            | (1 << sm.rightBottom) | (1 << sm.bottom) | (1 << sm.leftBottom) | (1 << sm.leftTop);
-            break;
-        case 9: case '9':
-            bits = (1 << sm.top) | (1 << sm.rightTop) | (1 << sm.center)
-            | (1 << sm.rightBottom) | (1 << sm.bottom) | (1 << sm.leftTop);
-            break;
-        default:
-            break;
-    }
-    if (dot)
-    {
-        bits |= (1 << sm.dot);
+    return toWiring(FONT[c & 0x7F] | (dot? DOT : 0));
+}
+
+
+uint8_t Ssd::toWiring (uint8_t font) const
+{
+    if (canonical)
+    {
+        return font;
+    }
+    const uint8_t positions[8] = { sm.top, sm.rightTop, sm.rightBottom, sm.bottom, sm.leftBottom,
+                                   sm.leftTop, sm.center, sm.dot };
+    uint8_t bits = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        if (font & (1 << i))
+        {
+            bits |= (1 << positions[i]);
+        }
     }
     return bits;
 }
 
 
-
 /************************************************************************
  * Class Ssd_74HC595_SPI
  ************************************************************************/
@@ -155,3 +124,189 @@ void Ssd_74HC595_SPI::putDots (const bool * dots, uint16_t segNumbers)
     spi.writeBuffer(&segData[0], segNumbers);
     pinCs.setHigh();
 }
+
+
+/************************************************************************
+ * Class SsdDisplay
+ ************************************************************************/
+SsdDisplay::SsdDisplay (Spi & _spi, IOPin & _pinCs, size_t _digits, bool _inverse):
+    spi(_spi),
+    pinCs(_pinCs),
+    digits(_digits),
+    inverse(_inverse),
+    segments{},
+    brightness{},
+    blinkMask(0),
+    modified(true),
+    frames{},
+    activeBank(0),
+    pwmPhase(0),
+    blinkOff(false),
+    blinkTicks(0),
+    blinkCounter(0),
+    resendTicks(RESEND_TICKS),
+    resendCounter(0),
+    txBuffer{},
+    txValid(false),
+    transfers(0),
+    overruns(0)
+{
+    if (digits > MAX_DIGITS)
+    {
+        digits = MAX_DIGITS;
+    }
+    ::memset(brightness, BRIGHTNESS_LEVELS, sizeof(brightness));
+    transaction.cs = &pinCs;
+    transaction.txData = txBuffer;
+    transaction.size = digits;
+    transaction.handler = this;
+}
+
+
+void SsdDisplay::start (uint32_t prescaler, uint32_t _blinkTicks, uint32_t polarity, uint32_t phase)
+{
+    transaction.prescaler = prescaler;
+    transaction.polarity = polarity;
+    transaction.phase = phase;
+    blinkTicks = _blinkTicks;
+    modified = true;
+    update();
+    txValid = false;
+}
+
+
+void SsdDisplay::setChar (size_t digit, char c, bool dot)
+{
+    if (digit < digits)
+    {
+        segments[digit] = FONT[c & 0x7F] | (dot? DOT : 0);
+        modified = true;
+    }
+}
+
+
+void SsdDisplay::setString (const char * str, const bool * dots, size_t n, size_t first)
+{
+    for (size_t i = 0; i < n && first + i < digits; ++i)
+    {
+        setChar(first + i, str[i], dots != NULL && dots[i]);
+    }
+}
+
+
+void SsdDisplay::setDot (size_t digit, bool dot)
+{
+    if (digit < digits)
+    {
+        segments[digit] = dot? (segments[digit] | DOT) : (segments[digit] & ~DOT);
+        modified = true;
+    }
+}
+
+
+void SsdDisplay::setBrightness (size_t digit, uint8_t level)
+{
+    if (digit < digits)
+    {
+        if (level > BRIGHTNESS_LEVELS)
+        {
+            level = BRIGHTNESS_LEVELS;
+        }
+        brightness[digit] = level;
+        modified = true;
+    }
+}
+
+
+void SsdDisplay::setBrightness (uint8_t level)
+{
+    for (size_t i = 0; i < digits; ++i)
+    {
+        setBrightness(i, level);
+    }
+}
+
+
+void SsdDisplay::setBlink (size_t digit, bool blink)
+{
+    if (digit < digits)
+    {
+        blinkMask = blink? (blinkMask | (1 << digit)) : (blinkMask & ~(1 << digit));
+        modified = true;
+    }
+}
+
+
+void SsdDisplay::update ()
+{
+    if (!modified)
+    {
+        return;
+    }
+    modified = false;
+
+    // the last digit is shifted first since its register is the farthest from MOSI
+    uint8_t lit[MAX_DIGITS], blank = inverse? 0xFF : 0x00;
+    for (size_t k = 0; k < digits; ++k)
+    {
+        lit[k] = toWiring(segments[digits - 1 - k]) ^ blank;
+    }
+
+    // the interrupt only reads the active bank: the other one is free
+    uint8_t bank = activeBank ^ 1;
+    for (uint8_t off = 0; off < 2; ++off)
+    {
+        for (uint8_t p = 0; p < BRIGHTNESS_LEVELS; ++p)
+        {
+            uint8_t * frame = frames[bank][off][p];
+            for (size_t k = 0; k < digits; ++k)
+            {
+                size_t d = digits - 1 - k;
+                bool on = p < brightness[d] && !(off && (blinkMask & (1 << d)));
+                frame[k] = on? lit[k] : blank;
+            }
+        }
+    }
+    activeBank = bank;
+}
+
+
+void SsdDisplay::onTimerUpdate (const Timer *)
+{
+    if (++pwmPhase >= BRIGHTNESS_LEVELS)
+    {
+        pwmPhase = 0;
+    }
+    if (blinkTicks != 0 && ++blinkCounter >= blinkTicks)
+    {
+        blinkCounter = 0;
+        blinkOff = !blinkOff;
+    }
+
+    const uint8_t * frame = frames[activeBank][blinkOff][pwmPhase];
+    bool resend = resendTicks != 0 && ++resendCounter >= resendTicks;
+    if (txValid && !resend && ::memcmp(frame, txBuffer, digits) == 0)
+    {
+        return;
+    }
+    if (!transaction.isFinished())
+    {
+        ++overruns;
+        return;
+    }
+    ::memcpy(txBuffer, frame, digits);
+    txValid = true;
+    resendCounter = 0;
+    ++transfers;
+    spi.enqueue(transaction);
+}
+
+
+void SsdDisplay::onSpiTransaction (Spi::Transaction & t)
+{
+    if (t.status != HAL_OK)
+    {
+        // shift the frame again on the next tick
+        txValid = false;
+    }
+}
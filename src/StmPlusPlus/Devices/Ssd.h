@@ -33,6 +33,25 @@ class Ssd
 {
 public:
 
+    /**
+     * @brief Segments of the ASCII characters 0x00-0x7F: bit 0 is the top segment, followed
+     *        clockwise by right top, right bottom, bottom, left bottom, left top, then the center
+     *        segment and the dot (bit 7). The codes 0-9 are the digits as well. Characters without
+     *        a readable form are blank.
+     */
+    static constexpr uint8_t FONT[128] = {
+        0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x00
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x10
+        0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x00, 0x02, 0x39, 0x0F, 0x00, 0x00, 0x00, 0x40, 0x80, 0x00,  // 0x20
+        0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F, 0x00, 0x00, 0x00, 0x48, 0x00, 0x53,  // 0x30
+        0x00, 0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71, 0x3D, 0x76, 0x30, 0x1E, 0x00, 0x38, 0x00, 0x54, 0x3F,  // 0x40
+        0x73, 0x67, 0x50, 0x6D, 0x78, 0x3E, 0x00, 0x00, 0x00, 0x6E, 0x5B, 0x39, 0x00, 0x0F, 0x23, 0x08,  // 0x50
+        0x00, 0x5F, 0x7C, 0x58, 0x5E, 0x79, 0x71, 0x6F, 0x74, 0x10, 0x0E, 0x00, 0x30, 0x00, 0x54, 0x5C,  // 0x60
+        0x73, 0x67, 0x50, 0x6D, 0x78, 0x1C, 0x00, 0x00, 0x00, 0x6E, 0x5B, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x70
+    };
+
+    static const uint8_t DOT = 0x80;
+
     class SegmentsMask
     {
     public:
@@ -50,10 +69,11 @@ public:
 protected:
 
     SegmentsMask sm;
+    bool canonical; // the segments are wired in the FONT bit order
     
 public:
     
-    Ssd (): sm()
+    Ssd (): sm(), canonical(true)
     {
         // empty
     };
@@ -61,9 +81,16 @@ public:
     inline void setSegmentsMask (const SegmentsMask & sm)
     {
         this->sm = sm;
+        canonical = sm.top == 0 && sm.rightTop == 1 && sm.rightBottom == 2 && sm.bottom == 3
+                    && sm.leftBottom == 4 && sm.leftTop == 5 && sm.center == 6 && sm.dot == 7;
     };
     
     char getBits (char c, bool dot) const;
+
+    /**
+     * @brief Converts a FONT code into the bits of the wired segments given by the segments mask.
+     */
+    uint8_t toWiring (uint8_t font) const;
 };
 
 
@@ -92,6 +119,119 @@ private:
 
 };
 
+
+/**
+ * @brief Seven segment display connected to a chain of 74HC595 shift registers (one register
+ *        per digit, the register of the first digit is the nearest to MOSI as for
+ *        Ssd_74HC595_SPI) and refreshed by a timer interrupt.
+ *
+ * The application only modifies the frame buffer (characters, dots, brightness and blink flag
+ * per digit) and calls update(), which prepares the bytes to be shifted for every PWM phase and
+ * blink state. onTimerUpdate() shall be called from the timer interrupt: it selects the prepared
+ * frame of the current phase and shifts it by an SPI transaction, but only if it differs from the
+ * frame that is already latched. An unchanged frame is shifted again every 'resend' ticks, so a
+ * register content corrupted by a glitch does not stay on the display: a display with full
+ * brightness and without blinking digits causes only this bus traffic.
+ *
+ * The brightness of a digit is 0 (off) to BRIGHTNESS_LEVELS (always on): within a PWM period of
+ * BRIGHTNESS_LEVELS timer ticks, the digit is lit during the first 'brightness' ticks. Blinking
+ * digits are blank during every other blink period.
+ */
+class SsdDisplay final : public Ssd, public Timer::EventHandler, public Spi::Transaction::EventHandler
+{
+public:
+
+    static const size_t MAX_DIGITS = 8;
+    static const uint8_t BRIGHTNESS_LEVELS = 8;
+    static const uint32_t RESEND_TICKS = 1000; // default period of the forced resend
+
+    SsdDisplay (Spi & _spi, IOPin & _pinCs, size_t _digits, bool _inverse);
+
+    /**
+     * @brief Set the bus parameters of the refresh transactions and the blink period in timer
+     *        ticks (0: no blinking). The timer calling onTimerUpdate() is started by the
+     *        application after this method.
+     */
+    void start (uint32_t prescaler, uint32_t _blinkTicks,
+                uint32_t polarity = SPI_POLARITY_LOW, uint32_t phase = SPI_PHASE_1EDGE);
+
+    void setChar (size_t digit, char c, bool dot = false);
+
+    /**
+     * @brief Put a string starting at the given digit. The dots array is optional.
+     */
+    void setString (const char * str, const bool * dots, size_t n, size_t first = 0);
+
+    void setDot (size_t digit, bool dot);
+
+    void setBrightness (size_t digit, uint8_t level);
+
+    void setBrightness (uint8_t level);
+
+    void setBlink (size_t digit, bool blink);
+
+    /**
+     * @brief Set the period of the forced resend of an unchanged frame in timer ticks
+     *        (0: never).
+     */
+    inline void setResendTicks (uint32_t _resendTicks)
+    {
+        resendTicks = _resendTicks;
+    }
+
+    inline size_t getDigits () const
+    {
+        return digits;
+    }
+
+    /**
+     * @brief Prepare the refresh frames from the frame buffer, if modified. Shall be called
+     *        from the main loop after the frame buffer modifications.
+     */
+    void update ();
+
+    virtual void onTimerUpdate (const Timer *);
+
+    virtual void onSpiTransaction (Spi::Transaction & t);
+
+    inline uint32_t getTransfers () const
+    {
+        return transfers;
+    }
+
+    inline uint32_t getOverruns () const
+    {
+        return overruns;
+    }
+
+private:
+
+    Spi & spi;
+    IOPin & pinCs;
+    size_t digits;
+    bool inverse;
+
+    // frame buffer: FONT codes with dot, brightness and blink flags
+    uint8_t segments[MAX_DIGITS];
+    uint8_t brightness[MAX_DIGITS];
+    uint8_t blinkMask;
+    bool modified;
+
+    // prepared frames: [bank][blink off][PWM phase][shifted byte], the interrupt reads the active bank
+    uint8_t frames[2][2][BRIGHTNESS_LEVELS][MAX_DIGITS];
+    volatile uint8_t activeBank;
+
+    // refresh state, used by the interrupt
+    uint8_t pwmPhase;
+    bool blinkOff;
+    uint32_t blinkTicks, blinkCounter;
+    uint32_t resendTicks, resendCounter;
+    Spi::Transaction transaction;
+    uint8_t txBuffer[MAX_DIGITS];
+    volatile bool txValid;
+    uint32_t transfers, overruns;
+};
+
 } // end of namespace Devices
 } // end of namespace StmPlusPlus
 
@@ -0,0 +1,415 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "Serializer.h"
+
+#include <cstring>
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class BufferWriter
+ ************************************************************************/
+
+BufferWriter::BufferWriter (void * _buffer, size_t _capacity) :
+    buffer((uint8_t *)_buffer),
+    capacity(_capacity),
+    size(0),
+    overflow(false)
+{
+    // empty
+}
+
+void BufferWriter::write (const void * data, size_t len)
+{
+    size_t n = capacity - size;
+    if (len > n)
+    {
+        overflow = true;
+    }
+    else
+    {
+        n = len;
+    }
+    ::memcpy(buffer + size, data, n);
+    size += n;
+}
+
+void BufferWriter::writeDecimal (uint32_t value)
+{
+    // digits are produced from the end
+    char digits[10];
+    size_t pos = sizeof(digits);
+    do
+    {
+        digits[--pos] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    while (value != 0);
+    write(digits + pos, sizeof(digits) - pos);
+}
+
+void BufferWriter::terminate ()
+{
+    if (size < capacity)
+    {
+        buffer[size] = 0;
+    }
+    else if (capacity > 0)
+    {
+        buffer[capacity - 1] = 0;
+        overflow = true;
+    }
+}
+
+/************************************************************************
+ * Class Encoder
+ ************************************************************************/
+
+void Encoder::putString (const char * str)
+{
+    putString(str, ::strlen(str));
+}
+
+/************************************************************************
+ * Class CborEncoder
+ ************************************************************************/
+
+CborEncoder::CborEncoder (void * _buffer, size_t _capacity) :
+    Encoder(_buffer, _capacity),
+    indefinite(0),
+    depth(0)
+{
+    // empty
+}
+
+void CborEncoder::reset ()
+{
+    writer.reset();
+    indefinite = 0;
+    depth = 0;
+}
+
+void CborEncoder::putHead (uint8_t majorType, uint32_t value)
+{
+    uint8_t mt = majorType << 5;
+    if (value < 24)
+    {
+        writer.put(mt | (uint8_t)value);
+    }
+    else if (value <= 0xFF)
+    {
+        writer.put(mt | 24);
+        writer.put((uint8_t)value);
+    }
+    else if (value <= 0xFFFF)
+    {
+        writer.put(mt | 25);
+        writer.put((uint8_t)(value >> 8));
+        writer.put((uint8_t)value);
+    }
+    else
+    {
+        writer.put(mt | 26);
+        writer.put((uint8_t)(value >> 24));
+        writer.put((uint8_t)(value >> 16));
+        writer.put((uint8_t)(value >> 8));
+        writer.put((uint8_t)value);
+    }
+}
+
+void CborEncoder::beginContainer (uint8_t majorType, size_t count)
+{
+    if (depth < MAX_DEPTH)
+    {
+        if (count == UNKNOWN_COUNT)
+        {
+            indefinite |= (1UL << depth);
+        }
+        else
+        {
+            indefinite &= ~(1UL << depth);
+        }
+    }
+    ++depth;
+    if (count == UNKNOWN_COUNT)
+    {
+        writer.put((majorType << 5) | INDEFINITE);
+    }
+    else
+    {
+        putHead(majorType, (uint32_t)count);
+    }
+}
+
+void CborEncoder::endContainer ()
+{
+    if (depth == 0)
+    {
+        return;
+    }
+    --depth;
+    if (depth < MAX_DEPTH && (indefinite & (1UL << depth)) != 0)
+    {
+        writer.put(CBOR_BREAK);
+    }
+}
+
+void CborEncoder::beginMap (size_t count)
+{
+    beginContainer(MT_MAP, count);
+}
+
+void CborEncoder::endMap ()
+{
+    endContainer();
+}
+
+void CborEncoder::beginArray (size_t count)
+{
+    beginContainer(MT_ARRAY, count);
+}
+
+void CborEncoder::endArray ()
+{
+    endContainer();
+}
+
+void CborEncoder::putKey (uint32_t id, const char * /*name*/)
+{
+    putHead(MT_UINT, id);
+}
+
+void CborEncoder::putUInt (uint32_t value)
+{
+    putHead(MT_UINT, value);
+}
+
+void CborEncoder::putInt (int32_t value)
+{
+    if (value >= 0)
+    {
+        putHead(MT_UINT, (uint32_t)value);
+    }
+    else
+    {
+        // negative integer n is encoded as -1 - n
+        putHead(MT_NEGINT, (uint32_t)(-1 - value));
+    }
+}
+
+void CborEncoder::putBool (bool value)
+{
+    writer.put(value? CBOR_TRUE : CBOR_FALSE);
+}
+
+void CborEncoder::putString (const char * str, size_t len)
+{
+    putHead(MT_TEXT, (uint32_t)len);
+    writer.write(str, len);
+}
+
+void CborEncoder::putTimestamp (uint32_t sec)
+{
+    putHead(MT_TAG, TAG_EPOCH_TIME);
+    putHead(MT_UINT, sec);
+}
+
+void CborEncoder::putRaw (const void * item, size_t len)
+{
+    writer.write(item, len);
+}
+
+/************************************************************************
+ * Class JsonEncoder
+ ************************************************************************/
+
+JsonEncoder::JsonEncoder (void * _buffer, size_t _capacity) :
+    Encoder(_buffer, _capacity),
+    notEmpty(0),
+    depth(0),
+    afterKey(false)
+{
+    // empty
+}
+
+const char * JsonEncoder::getString ()
+{
+    writer.terminate();
+    return (const char *)writer.getData();
+}
+
+void JsonEncoder::reset ()
+{
+    writer.reset();
+    notEmpty = 0;
+    depth = 0;
+    afterKey = false;
+}
+
+void JsonEncoder::beginItem ()
+{
+    if (afterKey)
+    {
+        // the value of a map entry: the separator is already written by the key
+        afterKey = false;
+        return;
+    }
+    if (depth == 0 || depth > MAX_DEPTH)
+    {
+        return;
+    }
+    uint32_t mask = 1UL << (depth - 1);
+    if ((notEmpty & mask) != 0)
+    {
+        writer.put(',');
+    }
+    notEmpty |= mask;
+}
+
+void JsonEncoder::beginContainer (char c)
+{
+    beginItem();
+    writer.put(c);
+    ++depth;
+    if (depth <= MAX_DEPTH)
+    {
+        notEmpty &= ~(1UL << (depth - 1));
+    }
+}
+
+void JsonEncoder::endContainer (char c)
+{
+    if (depth > 0)
+    {
+        --depth;
+    }
+    writer.put(c);
+}
+
+void JsonEncoder::beginMap (size_t /*count*/)
+{
+    beginContainer('{');
+}
+
+void JsonEncoder::endMap ()
+{
+    endContainer('}');
+}
+
+void JsonEncoder::beginArray (size_t /*count*/)
+{
+    beginContainer('[');
+}
+
+void JsonEncoder::endArray ()
+{
+    endContainer(']');
+}
+
+void JsonEncoder::putKey (uint32_t /*id*/, const char * name)
+{
+    beginItem();
+    writeQuoted(name, ::strlen(name));
+    writer.put(':');
+    afterKey = true;
+}
+
+void JsonEncoder::putUInt (uint32_t value)
+{
+    beginItem();
+    writer.writeDecimal(value);
+}
+
+void JsonEncoder::putInt (int32_t value)
+{
+    beginItem();
+    if (value < 0)
+    {
+        writer.put('-');
+        writer.writeDecimal(0 - (uint32_t)value);
+    }
+    else
+    {
+        writer.writeDecimal((uint32_t)value);
+    }
+}
+
+void JsonEncoder::putBool (bool value)
+{
+    beginItem();
+    if (value)
+    {
+        writer.write("true", 4);
+    }
+    else
+    {
+        writer.write("false", 5);
+    }
+}
+
+void JsonEncoder::putString (const char * str, size_t len)
+{
+    beginItem();
+    writeQuoted(str, len);
+}
+
+void JsonEncoder::putTimestamp (uint32_t sec)
+{
+    beginItem();
+    writer.writeDecimal(sec);
+}
+
+void JsonEncoder::putRaw (const void * item, size_t len)
+{
+    beginItem();
+    writer.write(item, len);
+}
+
+void JsonEncoder::writeQuoted (const char * str, size_t len)
+{
+    static const char * HEX_DIGITS = "0123456789abcdef";
+    writer.put('"');
+    // unescaped runs are copied at once
+    size_t start = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        uint8_t c = (uint8_t)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        writer.write(str + start, i - start);
+        start = i + 1;
+        writer.put('\\');
+        if (c == '"' || c == '\\')
+        {
+            writer.put(c);
+        }
+        else
+        {
+            writer.write("u00", 3);
+            writer.put(HEX_DIGITS[c >> 4]);
+            writer.put(HEX_DIGITS[c & 0x0F]);
+        }
+    }
+    writer.write(str + start, len - start);
+    writer.put('"');
+}
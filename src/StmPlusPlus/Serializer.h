@@ -0,0 +1,305 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef SERIALIZER_H_
+#define SERIALIZER_H_
+
+#include <cstdint>
+#include <cstddef>
+
+namespace StmPlusPlus
+{
+
+/************************************************************************
+ * Class BufferWriter
+ ************************************************************************/
+
+/**
+ * @brief Class that appends bytes to a fixed-size buffer and tracks the written length.
+ *
+ * The writer never writes beyond the capacity: the bytes that do not fit are discarded and
+ * the overflow flag is set. The flag is kept until reset().
+ */
+class BufferWriter final
+{
+public:
+
+    BufferWriter (void * _buffer, size_t _capacity);
+
+    inline void reset ()
+    {
+        size = 0;
+        overflow = false;
+    }
+
+    inline const uint8_t * getData () const
+    {
+        return buffer;
+    }
+
+    inline size_t getSize () const
+    {
+        return size;
+    }
+
+    inline size_t getCapacity () const
+    {
+        return capacity;
+    }
+
+    inline bool isOverflow () const
+    {
+        return overflow;
+    }
+
+    inline void put (uint8_t b)
+    {
+        if (size < capacity)
+        {
+            buffer[size++] = b;
+        }
+        else
+        {
+            overflow = true;
+        }
+    }
+
+    void write (const void * data, size_t len);
+
+    /**
+     * @brief Writes a decimal representation of the given number.
+     */
+    void writeDecimal (uint32_t value);
+
+    /**
+     * @brief Puts a zero byte after the written data without counting it in the size.
+     */
+    void terminate ();
+
+private:
+
+    uint8_t * buffer;
+    size_t capacity;
+    size_t size;
+    bool overflow;
+};
+
+/************************************************************************
+ * Class Encoder
+ ************************************************************************/
+
+/**
+ * @brief Base class of a streaming encoder for the structured telemetry data.
+ *
+ * The data model is a tree of maps, arrays and scalar values. A map key is given by both
+ * a numeric identifier and a name: the binary back end uses the identifier, the text back end
+ * the name. This allows an application to describe a schema once for all back ends.
+ *
+ * The encoded data is written into a BufferWriter. The encoding is never interrupted: if the
+ * buffer is too small, the overflow is reported by isOverflow() at the end.
+ */
+class Encoder
+{
+public:
+
+    enum class Format
+    {
+        CBOR = 0,
+        JSON = 1
+    };
+
+    static const size_t UNKNOWN_COUNT = SIZE_MAX;
+    static const size_t MAX_DEPTH = 32; // nesting level, limited by the bit masks of the back ends
+
+    Encoder (void * _buffer, size_t _capacity) :
+        writer(_buffer, _capacity)
+    {
+        // empty
+    }
+
+    inline const uint8_t * getData () const
+    {
+        return writer.getData();
+    }
+
+    inline size_t getSize () const
+    {
+        return writer.getSize();
+    }
+
+    inline bool isOverflow () const
+    {
+        return writer.isOverflow();
+    }
+
+    virtual Format getFormat () const = 0;
+    virtual void reset () = 0;
+
+    /**
+     * @brief Starts a map with the given number of key/value pairs, or UNKNOWN_COUNT.
+     */
+    virtual void beginMap (size_t count) = 0;
+    virtual void endMap () = 0;
+
+    /**
+     * @brief Starts an array with the given number of items, or UNKNOWN_COUNT.
+     */
+    virtual void beginArray (size_t count) = 0;
+    virtual void endArray () = 0;
+
+    virtual void putKey (uint32_t id, const char * name) = 0;
+    virtual void putUInt (uint32_t value) = 0;
+    virtual void putInt (int32_t value) = 0;
+    virtual void putBool (bool value) = 0;
+    virtual void putString (const char * str, size_t len) = 0;
+
+    /**
+     * @brief Puts a time stamp given in seconds since the epoch.
+     */
+    virtual void putTimestamp (uint32_t sec) = 0;
+
+    /**
+     * @brief Embeds a complete item that is already encoded in the same format.
+     */
+    virtual void putRaw (const void * item, size_t len) = 0;
+
+    void putString (const char * str);
+
+protected:
+
+    BufferWriter writer;
+};
+
+/************************************************************************
+ * Class CborEncoder
+ ************************************************************************/
+
+/**
+ * @brief Encoder that produces CBOR (RFC 7049).
+ *
+ * Integers use the shortest encoding, time stamps are tagged by the epoch-based date/time
+ * tag 1. Maps and arrays with UNKNOWN_COUNT use the indefinite-length encoding.
+ */
+class CborEncoder final : public Encoder
+{
+public:
+
+    CborEncoder (void * _buffer, size_t _capacity);
+
+    virtual Format getFormat () const
+    {
+        return Format::CBOR;
+    }
+
+    virtual void reset ();
+    virtual void beginMap (size_t count);
+    virtual void endMap ();
+    virtual void beginArray (size_t count);
+    virtual void endArray ();
+    virtual void putKey (uint32_t id, const char * name);
+    virtual void putUInt (uint32_t value);
+    virtual void putInt (int32_t value);
+    virtual void putBool (bool value);
+    virtual void putString (const char * str, size_t len);
+    virtual void putTimestamp (uint32_t sec);
+    virtual void putRaw (const void * item, size_t len);
+
+    using Encoder::putString;
+
+private:
+
+    // Major types
+    static const uint8_t MT_UINT = 0;
+    static const uint8_t MT_NEGINT = 1;
+    static const uint8_t MT_TEXT = 3;
+    static const uint8_t MT_ARRAY = 4;
+    static const uint8_t MT_MAP = 5;
+    static const uint8_t MT_TAG = 6;
+
+    // Simple values and markers
+    static const uint8_t CBOR_FALSE = 0xF4;
+    static const uint8_t CBOR_TRUE = 0xF5;
+    static const uint8_t CBOR_BREAK = 0xFF;
+    static const uint8_t INDEFINITE = 31;
+    static const uint32_t TAG_EPOCH_TIME = 1;
+
+    // Indefinite-length containers that need a break marker, one bit per level
+    uint32_t indefinite;
+    size_t depth;
+
+    void putHead (uint8_t majorType, uint32_t value);
+    void beginContainer (uint8_t majorType, size_t count);
+    void endContainer ();
+};
+
+/************************************************************************
+ * Class JsonEncoder
+ ************************************************************************/
+
+/**
+ * @brief Encoder that produces a compact JSON text without white spaces.
+ *
+ * The keys are written by name, time stamps as numbers of seconds. The text is not
+ * zero-terminated: use getString() to obtain a C string.
+ */
+class JsonEncoder final : public Encoder
+{
+public:
+
+    JsonEncoder (void * _buffer, size_t _capacity);
+
+    virtual Format getFormat () const
+    {
+        return Format::JSON;
+    }
+
+    const char * getString ();
+
+    virtual void reset ();
+    virtual void beginMap (size_t count);
+    virtual void endMap ();
+    virtual void beginArray (size_t count);
+    virtual void endArray ();
+    virtual void putKey (uint32_t id, const char * name);
+    virtual void putUInt (uint32_t value);
+    virtual void putInt (int32_t value);
+    virtual void putBool (bool value);
+    virtual void putString (const char * str, size_t len);
+    virtual void putTimestamp (uint32_t sec);
+    virtual void putRaw (const void * item, size_t len);
+
+    using Encoder::putString;
+
+private:
+
+    // Containers that already have an item, one bit per level
+    uint32_t notEmpty;
+    size_t depth;
+    bool afterKey;
+
+    void beginItem ();
+    void beginContainer (char c);
+    void endContainer (char c);
+    void writeQuoted (const char * str, size_t len);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,153 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "SoeRecorder.h"
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class SoeRecorder
+ ************************************************************************/
+
+SoeRecorder::SoeRecorder (InputBank & _bank, Journal & _journal) :
+        bank(_bank),
+        active(false),
+        inputs(0),
+        polledMask(0),
+        polledState(0),
+        journal(_journal),
+        head(0),
+        cycles(0),
+        lastCycles(0)
+{
+    for (size_t i = 0; i < JOURNAL_SIZE; ++i)
+    {
+        journal[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+void SoeRecorder::start (InputBank::Bits _inputs, InputBank::Bits levels)
+{
+    active = false;
+    inputs = _inputs & bank.getMask();
+    polledMask = inputs & ~bank.getExtiMask();
+    polledState = levels & polledMask;
+    cycles = 0;
+    lastCycles = CycleCounter::getValue();
+    bank.setEdgeHandler(this);
+    active = true;
+}
+
+void SoeRecorder::stop ()
+{
+    active = false;
+    bank.setEdgeHandler(NULL);
+}
+
+void SoeRecorder::onInputEdge (size_t bit, bool level, uint32_t timestamp)
+{
+    if (active && ((inputs >> bit) & 1) != 0)
+    {
+        record(bit, level, extendTime(timestamp));
+    }
+}
+
+void SoeRecorder::sample (InputBank::Bits levels, uint32_t timestamp)
+{
+    if (!active)
+    {
+        return;
+    }
+    uint64_t time = extendTime(timestamp);
+    InputBank::Bits changed = (levels ^ polledState) & polledMask;
+    polledState ^= changed;
+    while (changed != 0)
+    {
+        size_t bit = __builtin_ctzll(changed);
+        changed &= changed - 1;
+        record(bit, (levels >> bit) & 1, time);
+    }
+}
+
+uint64_t SoeRecorder::extendTime (uint32_t timestamp)
+{
+    // a time stamp older than the latest one (taken before an other producer was called)
+    // gets the latest time: the journal stays monotonic
+    uint32_t elapsed = timestamp - lastCycles;
+    if ((int32_t)elapsed > 0)
+    {
+        lastCycles = timestamp;
+        cycles += elapsed;
+    }
+    return cycles;
+}
+
+void SoeRecorder::record (size_t input, bool level, uint64_t time)
+{
+    uint32_t seq = head.load(std::memory_order_relaxed) + 1;
+    Slot & s = journal[seq & (JOURNAL_SIZE - 1)];
+    s.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.input = (uint8_t)input;
+    s.level = level;
+    s.cycles = time;
+    s.seq.store(seq, std::memory_order_release);
+    head.store(seq, std::memory_order_release);
+}
+
+size_t SoeRecorder::read (uint32_t & seq, Event * events, size_t count) const
+{
+    size_t n = 0;
+    while (n < count)
+    {
+        uint32_t last = head.load(std::memory_order_acquire);
+        uint32_t first = (last > JOURNAL_SIZE)? last - JOURNAL_SIZE + 1 : 1;
+        if (seq < first)
+        {
+            seq = first;
+        }
+        if (seq > last)
+        {
+            break;
+        }
+        const Slot & s = journal[seq & (JOURNAL_SIZE - 1)];
+        uint32_t before = s.seq.load(std::memory_order_acquire);
+        Event & e = events[n];
+        e.input = s.input;
+        e.level = s.level;
+        e.time = s.cycles;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (before != seq || s.seq.load(std::memory_order_relaxed) != seq)
+        {
+            // overwritten by a newer event meanwhile: continue with the oldest available one
+            continue;
+        }
+        e.seq = seq++;
+        e.time = toMicros(e.time);
+        ++n;
+    }
+    return n;
+}
+
+uint64_t SoeRecorder::toMicros (uint64_t cycles)
+{
+    const uint64_t freq = CycleCounter::getFrequency();
+    return (cycles / freq) * 1000000UL + (cycles % freq) * 1000000UL / freq;
+}
@@ -0,0 +1,142 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef SOERECORDER_H_
+#define SOERECORDER_H_
+
+#include "BasicIO.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Sequence-of-events recorder: a circular journal of the input edges with monotonic
+ *        time stamps in microseconds.
+ *
+ * The edges of the pins served by EXTI are received from InputBank in the interrupt context.
+ * The remaining (polled) inputs are compared by sample() that shall be called periodically from
+ * a timer interrupt: their time stamp resolution is the sampling period. The producers extend
+ * the 32-bit CycleCounter to a 64-bit time base, so sample() shall be called at least once per
+ * half of the counter period (12 seconds at 168 MHz). All producers (EXTI and timer interrupts)
+ * shall have the same preemption priority.
+ *
+ * Each event gets a sequence number, the first event has number 1. If the journal is full, the
+ * oldest event is overwritten. The consumers drain the journal incrementally with read(), each one
+ * using its own sequence number cursor: the overwritten events are seen as a gap in the sequence
+ * numbers. The journal is read without disabling the interrupts: an event overwritten while it is
+ * copied is detected by its sequence number and skipped.
+ *
+ * The journal storage is given by the owner: it is large and usually a static object, not a part
+ * of an application object on the stack.
+ */
+class SoeRecorder final : public InputBank::EdgeHandler
+{
+public:
+
+    static const size_t JOURNAL_SIZE = 256; // shall be a power of two
+
+    static_assert((JOURNAL_SIZE & (JOURNAL_SIZE - 1)) == 0, "Journal size shall be a power of two");
+
+    class Event
+    {
+    public:
+
+        uint64_t time;   // microseconds since the recorder start
+        uint32_t seq;    // sequence number
+        uint8_t input;   // bank bit of the input
+        bool level;      // input level after the edge
+    };
+
+    class Slot
+    {
+    public:
+
+        std::atomic<uint32_t> seq; // zero while the slot is written
+        uint8_t input;
+        bool level;
+        uint64_t cycles;
+    };
+
+    typedef Slot Journal[JOURNAL_SIZE];
+
+    SoeRecorder (InputBank & _bank, Journal & _journal);
+
+    /**
+     * @brief Starts the recording of the given bank inputs. The given levels are the initial
+     *        state of the polled inputs.
+     */
+    void start (InputBank::Bits _inputs, InputBank::Bits levels);
+
+    void stop ();
+
+    inline bool isActive () const
+    {
+        return active;
+    }
+
+    virtual void onInputEdge (size_t bit, bool level, uint32_t timestamp);
+
+    /**
+     * @brief Compares the polled inputs with the given levels read at the given CycleCounter time
+     *        stamp. Called from the timer interrupt.
+     */
+    void sample (InputBank::Bits levels, uint32_t timestamp);
+
+    /**
+     * @brief Returns the sequence number of the latest event, or zero if nothing is recorded.
+     */
+    inline uint32_t getLastSeq () const
+    {
+        return head.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Copies up to count events starting with the sequence number seq, and advances seq
+     *        past the copied events. If the event seq is already overwritten, the copy starts
+     *        with the oldest available event. Returns the number of copied events.
+     */
+    size_t read (uint32_t & seq, Event * events, size_t count) const;
+
+    /**
+     * @brief Converts a 64-bit CycleCounter time to microseconds.
+     */
+    static uint64_t toMicros (uint64_t cycles);
+
+private:
+
+    InputBank & bank;
+    volatile bool active;
+    InputBank::Bits inputs, polledMask, polledState;
+
+    // Journal: written by the producers only
+    Slot * journal;
+    std::atomic<uint32_t> head;
+
+    // 64-bit time base, updated by the producers
+    uint64_t cycles;
+    uint32_t lastCycles;
+
+    uint64_t extendTime (uint32_t timestamp);
+    void record (size_t input, bool level, uint64_t time);
+};
+
+} // end namespace
+
+#endif
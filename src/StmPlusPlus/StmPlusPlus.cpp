@@ -363,40 +363,71 @@ Spi::Spi (DeviceName _device,
           IOPort::PortName sckPort,  uint32_t sckPin,
           IOPort::PortName misoPort, uint32_t misoPin,
           IOPort::PortName mosiPort, uint32_t mosiPin,
-          uint32_t pull):
+          uint32_t pull, bool callInit):
     device(_device),
     sck(sckPort,   sckPin,  GPIO_MODE_AF_PP, pull, GPIO_SPEED_HIGH, false),
     miso(misoPort, misoPin, GPIO_MODE_AF_PP, pull, GPIO_SPEED_HIGH, false),
     mosi(mosiPort, mosiPin, GPIO_MODE_AF_PP, pull, GPIO_SPEED_HIGH, false),
-    hspi(NULL)
+    alternate(0),
+    pinsConfigured(false),
+    hspi(NULL),
+    irqStatus(SET),
+    current(NULL),
+    queueHead(NULL),
+    queueTail(NULL)
 {
     switch (device)
     {
     case DeviceName::SPI_1:
         #ifdef SPI1
-        sck.setAlternate(GPIO_AF5_SPI1);
-        miso.setAlternate(GPIO_AF5_SPI1);
-        mosi.setAlternate(GPIO_AF5_SPI1);
+        alternate = GPIO_AF5_SPI1;
         spiParams.Instance = SPI1;
+        #ifdef STM32F4
+        irqName = SPI1_IRQn;
+        rxDma.Instance = DMA2_Stream0;
+        rxDma.Init.Channel = DMA_CHANNEL_3;
+        rxDmaIrq = DMA2_Stream0_IRQn;
+        txDma.Instance = DMA2_Stream5;
+        txDma.Init.Channel = DMA_CHANNEL_3;
+        txDmaIrq = DMA2_Stream5_IRQn;
+        #endif
         #endif
         break;
     case DeviceName::SPI_2:
         #ifdef SPI2
-        sck.setAlternate(GPIO_AF5_SPI2);
-        miso.setAlternate(GPIO_AF5_SPI2);
-        mosi.setAlternate(GPIO_AF5_SPI2);
+        alternate = GPIO_AF5_SPI2;
         spiParams.Instance = SPI2;
+        #ifdef STM32F4
+        irqName = SPI2_IRQn;
+        rxDma.Instance = DMA1_Stream3;
+        rxDma.Init.Channel = DMA_CHANNEL_0;
+        rxDmaIrq = DMA1_Stream3_IRQn;
+        txDma.Instance = DMA1_Stream4;
+        txDma.Init.Channel = DMA_CHANNEL_0;
+        txDmaIrq = DMA1_Stream4_IRQn;
+        #endif
         #endif
         break;
     case DeviceName::SPI_3:
         #ifdef SPI3
-        sck.setAlternate(GPIO_AF6_SPI3);
-        miso.setAlternate(GPIO_AF6_SPI3);
-        mosi.setAlternate(GPIO_AF6_SPI3);
+        alternate = GPIO_AF6_SPI3;
         spiParams.Instance = SPI3;
+        #ifdef STM32F4
+        irqName = SPI3_IRQn;
+        rxDma.Instance = DMA1_Stream0;
+        rxDma.Init.Channel = DMA_CHANNEL_0;
+        rxDmaIrq = DMA1_Stream0_IRQn;
+        txDma.Instance = DMA1_Stream7;
+        txDma.Init.Channel = DMA_CHANNEL_0;
+        txDmaIrq = DMA1_Stream7_IRQn;
+        #endif
         #endif
         break;
     }
+    if (callInit)
+    {
+        configurePins();
+    }
 
     spiParams.Init.Mode = SPI_MODE_MASTER;
     spiParams.Init.DataSize = SPI_DATASIZE_8BIT;
@@ -411,6 +442,39 @@ Spi::Spi (DeviceName _device,
     spiParams.Init.CRCLength = SPI_CRC_LENGTH_DATASIZE;
     spiParams.Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
     #endif
+
+    #ifdef STM32F4
+    rxDma.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    rxDma.Init.PeriphInc = DMA_PINC_DISABLE;
+    rxDma.Init.MemInc = DMA_MINC_ENABLE;
+    rxDma.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    rxDma.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    rxDma.Init.Mode = DMA_NORMAL;
+    rxDma.Init.Priority = DMA_PRIORITY_MEDIUM;
+    rxDma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    rxDma.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    rxDma.Init.MemBurst = DMA_MBURST_SINGLE;
+    rxDma.Init.PeriphBurst = DMA_PBURST_SINGLE;
+    uint32_t txChannel = txDma.Init.Channel;
+    txDma.Init = rxDma.Init;
+    txDma.Init.Channel = txChannel;
+    txDma.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    dmaStarted = false;
+    #endif
+}
+
+
+void Spi::configurePins ()
+{
+    if (alternate == 0)
+    {
+        // the device is not available on this MCU
+        return;
+    }
+    sck.setAlternate(alternate);
+    miso.setAlternate(alternate);
+    mosi.setAlternate(alternate);
+    pinsConfigured = true;
 }
 
 
@@ -456,15 +520,21 @@ void Spi::disableClock()
 }
 
 
-HAL_StatusTypeDef Spi::start (uint32_t direction, uint32_t prescaler, uint32_t dataSize, uint32_t CLKPhase)
+HAL_StatusTypeDef Spi::start (uint32_t direction, uint32_t prescaler, uint32_t dataSize, uint32_t CLKPhase,
+                             uint32_t CLKPolarity)
 {
     hspi = &spiParams;
+    if (!pinsConfigured)
+    {
+        configurePins();
+    }
     enableClock();
 
     spiParams.Init.Direction = direction;
     spiParams.Init.BaudRatePrescaler = prescaler;
     spiParams.Init.DataSize = dataSize;
     spiParams.Init.CLKPhase = CLKPhase;
+    spiParams.Init.CLKPolarity = CLKPolarity;
     HAL_StatusTypeDef status = HAL_SPI_Init(hspi);
     if (status != HAL_OK)
     {
@@ -505,6 +575,219 @@ HAL_StatusTypeDef Spi::stop ()
 }
 
 
+uint32_t Spi::getClockFrequency () const
+{
+    return (device == DeviceName::SPI_1)? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+}
+
+
+#ifdef STM32F4
+HAL_StatusTypeDef Spi::startDma (const InterruptPriority & prio)
+{
+    if (device == DeviceName::SPI_1)
+    {
+        __HAL_RCC_DMA2_CLK_ENABLE();
+    }
+    else
+    {
+        __HAL_RCC_DMA1_CLK_ENABLE();
+    }
+    __HAL_LINKDMA(&spiParams, hdmarx, rxDma);
+    __HAL_LINKDMA(&spiParams, hdmatx, txDma);
+    HAL_StatusTypeDef status = HAL_DMA_Init(&rxDma);
+    if (status == HAL_OK)
+    {
+        status = HAL_DMA_Init(&txDma);
+    }
+    if (status != HAL_OK)
+    {
+        USART_DEBUG("Can not initialize SPI " << (size_t)device << " DMA: " << status);
+        return status;
+    }
+    HAL_NVIC_SetPriority(rxDmaIrq, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(rxDmaIrq);
+    HAL_NVIC_SetPriority(txDmaIrq, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(txDmaIrq);
+    // error interrupt
+    HAL_NVIC_SetPriority(irqName, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(irqName);
+    dmaStarted = true;
+    return HAL_OK;
+}
+
+
+void Spi::stopDma ()
+{
+    if (!dmaStarted)
+    {
+        return;
+    }
+    HAL_NVIC_DisableIRQ(irqName);
+    HAL_NVIC_DisableIRQ(rxDmaIrq);
+    HAL_NVIC_DisableIRQ(txDmaIrq);
+    HAL_DMA_DeInit(&rxDma);
+    HAL_DMA_DeInit(&txDma);
+    dmaStarted = false;
+}
+
+
+HAL_StatusTypeDef Spi::transmitDma (const uint8_t * data, uint16_t size)
+{
+    irqStatus = RESET;
+    return HAL_SPI_Transmit_DMA(hspi, const_cast<uint8_t *>(data), size);
+}
+
+
+HAL_StatusTypeDef Spi::receiveDma (uint8_t * data, uint16_t size)
+{
+    irqStatus = RESET;
+    return HAL_SPI_Receive_DMA(hspi, data, size);
+}
+
+
+HAL_StatusTypeDef Spi::transmitReceiveDma (const uint8_t * txData, uint8_t * rxData, uint16_t size)
+{
+    irqStatus = RESET;
+    return HAL_SPI_TransmitReceive_DMA(hspi, const_cast<uint8_t *>(txData), rxData, size);
+}
+#endif
+
+
+void Spi::processCallback (HAL_StatusTypeDef status)
+{
+    irqStatus = SET;
+    if (current != NULL)
+    {
+        finishTransaction(status);
+        startTransaction();
+    }
+}
+
+
+void Spi::enqueue (Transaction & transaction)
+{
+    transaction.status = HAL_BUSY;
+    transaction.next = NULL;
+    uint32_t primask = System::enterCritical();
+    if (queueTail == NULL)
+    {
+        queueHead = &transaction;
+    }
+    else
+    {
+        queueTail->next = &transaction;
+    }
+    queueTail = &transaction;
+    System::leaveCritical(primask);
+    startTransaction();
+}
+
+
+void Spi::startTransaction ()
+{
+    while (true)
+    {
+        // claim the bus: enqueue() can be called from an interrupt
+        uint32_t primask = System::enterCritical();
+        Transaction * t = (current == NULL)? queueHead : NULL;
+        if (t != NULL)
+        {
+            current = t;
+            queueHead = t->next;
+            if (queueHead == NULL)
+            {
+                queueTail = NULL;
+            }
+        }
+        System::leaveCritical(primask);
+        if (t == NULL)
+        {
+            return;
+        }
+
+        configure(*t);
+        if (t->cs != NULL)
+        {
+            t->cs->setLow();
+        }
+        HAL_StatusTypeDef status = transfer(*t);
+        #ifdef STM32F4
+        if (dmaStarted && status == HAL_OK)
+        {
+            // finished in processCallback()
+            return;
+        }
+        #endif
+        finishTransaction(status);
+    }
+}
+
+
+void Spi::finishTransaction (HAL_StatusTypeDef status)
+{
+    Transaction * t = current;
+    if (t->cs != NULL)
+    {
+        t->cs->setHigh();
+    }
+    // HAL_BUSY marks a pending transaction: a transfer refused by a busy HAL is failed
+    t->status = (status == HAL_BUSY)? HAL_ERROR : status;
+    // the bus is still owned while the handler runs: transactions enqueued by the handler are appended
+    if (t->handler != NULL)
+    {
+        t->handler->onSpiTransaction(*t);
+    }
+    current = NULL;
+}
+
+
+void Spi::configure (const Transaction & t)
+{
+    if (t.polarity == spiParams.Init.CLKPolarity && t.phase == spiParams.Init.CLKPhase
+        && t.prescaler == spiParams.Init.BaudRatePrescaler)
+    {
+        return;
+    }
+    // the clock mode and the baud rate can only be changed while the peripheral is disabled
+    __HAL_SPI_DISABLE(hspi);
+    MODIFY_REG(spiParams.Instance->CR1, SPI_CR1_CPOL | SPI_CR1_CPHA | SPI_CR1_BR, t.polarity | t.phase | t.prescaler);
+    spiParams.Init.CLKPolarity = t.polarity;
+    spiParams.Init.CLKPhase = t.phase;
+    spiParams.Init.BaudRatePrescaler = t.prescaler;
+    __HAL_SPI_ENABLE(hspi);
+}
+
+
+HAL_StatusTypeDef Spi::transfer (Transaction & t)
+{
+    uint8_t * txData = const_cast<uint8_t *>(t.txData);
+    #ifdef STM32F4
+    if (dmaStarted)
+    {
+        irqStatus = RESET;
+        if (t.txData != NULL && t.rxData != NULL)
+        {
+            return HAL_SPI_TransmitReceive_DMA(hspi, txData, t.rxData, t.size);
+        }
+        else if (t.txData != NULL)
+        {
+            return HAL_SPI_Transmit_DMA(hspi, txData, t.size);
+        }
+        return HAL_SPI_Receive_DMA(hspi, t.rxData, t.size);
+    }
+    #endif
+    if (t.txData != NULL && t.rxData != NULL)
+    {
+        return HAL_SPI_TransmitReceive(hspi, txData, t.rxData, t.size, TIMEOUT);
+    }
+    else if (t.txData != NULL)
+    {
+        return HAL_SPI_Transmit(hspi, txData, t.size, TIMEOUT);
+    }
+    return HAL_SPI_Receive(hspi, t.rxData, t.size, TIMEOUT);
+}
+
+
 /************************************************************************
  * Class PeriodicalEvent
  ************************************************************************/
@@ -780,7 +1063,7 @@ void I2S::stop ()
     HAL_NVIC_DisableIRQ(I2S_IRQ);
     HAL_NVIC_DisableIRQ(DMA_TX_IRQ);
     HAL_DMA_DeInit(&i2sDmaTx);
-    __HAL_RCC_DMA1_CLK_DISABLE();
+    // DMA1 clock is not disabled since other streams (USART2 RX) can be still active
     HAL_I2S_DeInit(&i2s);
     __HAL_RCC_SPI2_CLK_DISABLE();
     setMode(GPIO_MODE_INPUT);
@@ -114,6 +114,24 @@ public:
 
     static void setClock (const ClockDiv & clkDiv, uint32_t FLatency, RtcType rtcType, int32_t msAdjustment = 0);
 
+    /**
+     * @brief Disables interrupts and returns the previous interrupt mask.
+     */
+    static inline uint32_t enterCritical ()
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        return primask;
+    }
+
+    /**
+     * @brief Restores the interrupt mask returned by enterCritical().
+     */
+    static inline void leaveCritical (uint32_t primask)
+    {
+        __set_PRIMASK(primask);
+    }
+
 };
 
 /**
@@ -214,6 +232,19 @@ public:
         timeSec = sec;
     }
 
+    /**
+     * @brief Backup registers: they keep their values over a reset while VDD or VBAT is present.
+     */
+    inline void setBackupRegister (uint32_t reg, uint32_t value)
+    {
+        HAL_RTCEx_BKUPWrite(&rtcParameters, reg, value);
+    }
+
+    inline uint32_t getBackupRegister (uint32_t reg)
+    {
+        return HAL_RTCEx_BKUPRead(&rtcParameters, reg);
+    }
+
     HAL_StatusTypeDef start (uint32_t counterMode, uint32_t prescaler, const InterruptPriority & prio, RealTimeClock::EventHandler * _handler = NULL);
 
     void onMilliSecondInterrupt ();
@@ -255,15 +286,76 @@ public:
     };
 
     /**
-     * @brief Default constructor.
+     * @brief A transfer executed by the transaction queue, see enqueue().
+     *
+     * Before the transfer, the bus is switched to the clock mode and the prescaler of the
+     * transaction and the chip select pin is driven low. It is driven high after the last byte.
+     * The transaction and its buffers shall be valid until the completion handler is called.
+     */
+    class Transaction
+    {
+    public:
+
+        class EventHandler
+        {
+        public:
+
+            /**
+             * @brief Called from the SPI/DMA interrupt when the transaction is finished
+             *        (or from enqueue() if DMA is not started). A new transaction can be
+             *        enqueued from this method.
+             */
+            virtual void onSpiTransaction (Transaction & transaction) =0;
+        };
+
+        IOPin * cs;                         // chip select pin, active low, or NULL
+        uint32_t polarity;                  // SPI_POLARITY_LOW or SPI_POLARITY_HIGH
+        uint32_t phase;                     // SPI_PHASE_1EDGE or SPI_PHASE_2EDGE
+        uint32_t prescaler;                 // SPI_BAUDRATEPRESCALER_x
+        const uint8_t * txData;             // transmitted bytes, or NULL for a receive-only transfer
+        uint8_t * rxData;                   // received bytes, or NULL for a transmit-only transfer
+        uint16_t size;                      // number of bytes
+        EventHandler * handler;             // completion handler, or NULL
+        volatile HAL_StatusTypeDef status;  // HAL_BUSY while queued or running
+
+        Transaction () :
+            cs(NULL),
+            polarity(SPI_POLARITY_HIGH),
+            phase(SPI_PHASE_1EDGE),
+            prescaler(SPI_BAUDRATEPRESCALER_2),
+            txData(NULL),
+            rxData(NULL),
+            size(0),
+            handler(NULL),
+            status(HAL_OK),
+            next(NULL)
+        {
+            // empty
+        }
+
+        inline bool isFinished () const
+        {
+            return status != HAL_BUSY;
+        }
+
+    private:
+
+        friend class Spi;
+        Transaction * next;
+    };
+
+    /**
+     * @brief Default constructor. If callInit is false, the pins are configured by start():
+     *        an optional bus does not occupy its pins until it is used.
      */
     Spi (DeviceName _device,
          IOPort::PortName sckPort, uint32_t sckPin,
          IOPort::PortName misoPort, uint32_t misoPin,
          IOPort::PortName mosiPort, uint32_t mosiPin,
-         uint32_t pull = GPIO_NOPULL);
+         uint32_t pull = GPIO_NOPULL, bool callInit = true);
 
-    HAL_StatusTypeDef start (uint32_t direction, uint32_t prescaler, uint32_t dataSize = SPI_DATASIZE_8BIT, uint32_t CLKPhase = SPI_PHASE_1EDGE);
+    HAL_StatusTypeDef start (uint32_t direction, uint32_t prescaler, uint32_t dataSize = SPI_DATASIZE_8BIT, uint32_t CLKPhase = SPI_PHASE_1EDGE,
+                             uint32_t CLKPolarity = SPI_POLARITY_HIGH);
 
     HAL_StatusTypeDef stop ();
 
@@ -286,15 +378,105 @@ public:
         return HAL_SPI_Transmit(hspi, pData, pSize, TIMEOUT);
     }
 
+    inline SPI_TypeDef * getInstance ()
+    {
+        return spiParams.Instance;
+    }
+
+    /**
+     * @brief Returns the frequency of the peripheral clock (APB) the baud rate prescaler divides.
+     */
+    uint32_t getClockFrequency () const;
+
+    #ifdef STM32F4
+    /**
+     * @brief Prepare the DMA streams used by the DMA transfers and the transaction queue.
+     *        The bus shall be started in the SPI_DIRECTION_2LINES mode for the transfers
+     *        that receive data.
+     */
+    HAL_StatusTypeDef startDma (const InterruptPriority & prio);
+
+    /**
+     * @brief Release the DMA streams prepared by startDma().
+     */
+    void stopDma ();
+
+    /**
+     * @brief Send, receive, or send and receive an amount of bytes in DMA mode. The buffers
+     *        shall be valid until the transfer is finished, see isFinished().
+     */
+    HAL_StatusTypeDef transmitDma (const uint8_t * data, uint16_t size);
+    HAL_StatusTypeDef receiveDma (uint8_t * data, uint16_t size);
+    HAL_StatusTypeDef transmitReceiveDma (const uint8_t * txData, uint8_t * rxData, uint16_t size);
+
+    inline void processInterrupt ()
+    {
+        HAL_SPI_IRQHandler(&spiParams);
+    }
+
+    inline void processDmaRxInterrupt ()
+    {
+        HAL_DMA_IRQHandler(&rxDma);
+    }
+
+    inline void processDmaTxInterrupt ()
+    {
+        HAL_DMA_IRQHandler(&txDma);
+    }
+    #endif
+
+    /**
+     * @brief Shall be called from HAL_SPI_TxCpltCallback, HAL_SPI_RxCpltCallback and
+     *        HAL_SPI_TxRxCpltCallback with HAL_OK, and from HAL_SPI_ErrorCallback with HAL_ERROR.
+     */
+    void processCallback (HAL_StatusTypeDef status);
+
+    inline bool isFinished () const
+    {
+        return irqStatus == SET;
+    }
+
+    /**
+     * @brief Append a transaction to the queue. The transaction is started immediately if
+     *        the bus is idle. If DMA is not started, the transaction is executed in blocking
+     *        mode before this method returns. Shall not be mixed with the direct transfer
+     *        methods above while the queue is not empty.
+     */
+    void enqueue (Transaction & transaction);
+
+    inline bool isQueueEmpty () const
+    {
+        return current == NULL;
+    }
+
 private:
 
     DeviceName device;
     IOPin sck, miso, mosi;
+    uint32_t alternate;
+    bool pinsConfigured;
     SPI_HandleTypeDef *hspi;
     SPI_HandleTypeDef spiParams;
+    __IO ITStatus irqStatus;
+
+    // transaction queue: the running transaction and the waiting ones
+    Transaction * volatile current;
+    Transaction * queueHead;
+    Transaction * queueTail;
+
+    #ifdef STM32F4
+    DMA_HandleTypeDef rxDma, txDma;
+    IRQn_Type irqName, rxDmaIrq, txDmaIrq;
+    bool dmaStarted;
+    #endif
 
+    void configurePins ();
     void enableClock();
     void disableClock();
+    void configure (const Transaction & t);
+    void startTransaction ();
+    void finishTransaction (HAL_StatusTypeDef status);
+    HAL_StatusTypeDef transfer (Transaction & t);
 };
 
 
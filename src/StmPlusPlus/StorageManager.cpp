@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "StorageManager.h"
+
+#ifdef STM32F405xx
+#ifdef HAL_SD_MODULE_ENABLED
+
+using namespace StmPlusPlus;
+
+#define USART_DEBUG_MODULE "STOR: "
+
+/************************************************************************
+ * Class StorageManager
+ ************************************************************************/
+
+StorageManager::StorageManager (Devices::SdCard & _sdCard, IOPin & _pinPower, bool _powerOnLevel, uint32_t _clockDiv) :
+        sdCard(_sdCard),
+        pinPower(_pinPower),
+        powerOnLevel(_powerOnLevel),
+        clockDiv(_clockDiv),
+        state(State::OFF),
+        users(0),
+        handlersNumber(0),
+        coldStartLatency(0),
+        warmStartLatency(0)
+{
+    for (auto & h : handlers)
+    {
+        h = NULL;
+    }
+}
+
+bool StorageManager::addHandler (EventHandler * handler)
+{
+    if (handlersNumber >= MAX_HANDLERS)
+    {
+        return false;
+    }
+    handlers[handlersNumber++] = handler;
+    return true;
+}
+
+bool StorageManager::acquire ()
+{
+    if (!sdCard.isCardInserted())
+    {
+        USART_DEBUG("SD Card is not inserted");
+        return false;
+    }
+
+    if (state != State::OFF && sdCard.isErrorOccurred())
+    {
+        USART_DEBUG("SD Card error detected, re-initializing");
+        notifyStorageLost();
+        if (users > 0)
+        {
+            USART_DEBUG("Re-initialization postponed: " << users << " user(s) still hold open files");
+            return false;
+        }
+        powerOff();
+    }
+
+    if (state == State::OFF)
+    {
+        if (users > 0)
+        {
+            // the files of the previous session are still held by a user
+            USART_DEBUG("Can not mount SD Card: " << users << " user(s) of the previous session are not released");
+            return false;
+        }
+        uint32_t startTime = HAL_GetTick();
+        if (!powerOn())
+        {
+            powerOff();
+            return false;
+        }
+        coldStartLatency = HAL_GetTick() - startTime;
+        USART_DEBUG("Storage started (cold): " << coldStartLatency << " ms");
+    }
+    else if (state == State::IDLE)
+    {
+        uint32_t startCycles = CycleCounter::getValue();
+        sdCard.setClockPowerSave(false);
+        state = State::READY;
+        warmStartLatency = CycleCounter::toMicros(CycleCounter::getValue() - startCycles);
+        USART_DEBUG("Storage started (warm): " << warmStartLatency << " us");
+    }
+
+    ++users;
+    return true;
+}
+
+void StorageManager::release ()
+{
+    if (users == 0)
+    {
+        return;
+    }
+    --users;
+    if (users == 0 && state == State::READY)
+    {
+        sdCard.setClockPowerSave(true);
+        state = State::IDLE;
+    }
+}
+
+void StorageManager::periodic ()
+{
+    if (state != State::OFF && !sdCard.isCardInserted())
+    {
+        USART_DEBUG("SD Card removed");
+        powerOff();
+        notifyStorageLost();
+    }
+}
+
+void StorageManager::notifyStorageLost ()
+{
+    for (size_t i = 0; i < handlersNumber && users > 0; ++i)
+    {
+        handlers[i]->onStorageLost();
+    }
+}
+
+bool StorageManager::powerOn ()
+{
+    sdCard.clearPort();
+    pinPower.putBit(powerOnLevel);
+    HAL_Delay(POWER_UP_DELAY);
+    const bool autoClock = (clockDiv == Devices::SdCard::AUTO_CLOCK_DIV);
+    const uint32_t startClockDiv = autoClock? (uint32_t)Devices::SdCard::SAFE_CLOCK_DIV : clockDiv;
+    if (!sdCard.start(startClockDiv)
+        || (autoClock && !sdCard.tuneBus())
+        || !sdCard.mountFatFs())
+    {
+        sdCard.stop();
+        return false;
+    }
+    state = State::READY;
+    return true;
+}
+
+void StorageManager::powerOff ()
+{
+    if (state != State::OFF)
+    {
+        sdCard.stop();
+    }
+    pinPower.putBit(!powerOnLevel);
+    state = State::OFF;
+}
+
+#endif
+#endif
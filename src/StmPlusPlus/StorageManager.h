@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * StmPlusPlus: object-oriented library implementing device drivers for 
+ * STM32F3 and STM32F4 MCU
+ * *****************************************************************************
+ * Copyright (C) 2016-2017 Mikhail Kulesh
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef STORAGEMANAGER_H_
+#define STORAGEMANAGER_H_
+
+#include "StmPlusPlus.h"
+#include "Devices/SdCard.h"
+
+#ifdef STM32F405xx
+#ifdef HAL_SD_MODULE_ENABLED
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Class that manages a storage session on the SD card.
+ *
+ * The class counts the users of the card. The card is initialized and the FAT FS is mounted
+ * on the first use. While no user is active, the card stays mounted in a low-power idle state.
+ * Re-initialization only happens after the card was removed or an error occurred.
+ *
+ * A re-initialization invalidates all open files. Therefore, the users that keep files open
+ * register an EventHandler: before the card is re-initialized or after it was removed, the
+ * handlers are notified and shall drop their files without accessing the card and release
+ * the storage. The card is never re-mounted while a user still holds the storage: acquire()
+ * fails until all users of the previous session are released.
+ */
+class StorageManager final
+{
+public:
+
+    static const uint32_t POWER_UP_DELAY = 250;
+    static const size_t MAX_HANDLERS = 4;
+
+    class EventHandler
+    {
+    public:
+
+        /**
+         * @brief The open files of this user became invalid: the card was removed or will be
+         *        re-initialized. The handler shall forget its files and call release().
+         */
+        virtual void onStorageLost () =0;
+    };
+
+    enum class State
+    {
+        OFF   = 0,
+        IDLE  = 1,
+        READY = 2
+    };
+
+    StorageManager (Devices::SdCard & _sdCard, IOPin & _pinPower, bool _powerOnLevel = false, uint32_t _clockDiv = Devices::SdCard::AUTO_CLOCK_DIV);
+
+    inline Devices::SdCard & getSdCard ()
+    {
+        return sdCard;
+    }
+
+    inline State getState () const
+    {
+        return state;
+    }
+
+    inline uint32_t getUsers () const
+    {
+        return users;
+    }
+
+    inline uint32_t getColdStartLatency () const
+    {
+        return coldStartLatency;
+    }
+
+    inline uint32_t getWarmStartLatency () const
+    {
+        return warmStartLatency;
+    }
+
+    bool addHandler (EventHandler * handler);
+    bool acquire ();
+    void release ();
+    void periodic ();
+    void powerOff ();
+
+private:
+
+    Devices::SdCard & sdCard;
+    IOPin & pinPower;
+    bool powerOnLevel;
+    uint32_t clockDiv;
+    State state;
+    uint32_t users;
+    EventHandler * handlers[MAX_HANDLERS];
+    size_t handlersNumber;
+
+    // Statistics
+    uint32_t coldStartLatency; // in milliseconds
+    uint32_t warmStartLatency; // in microseconds
+
+    bool powerOn ();
+    void notifyStorageLost ();
+};
+
+} // end namespace
+
+#endif
+#endif
+#endif
@@ -23,6 +23,7 @@
 #ifdef STM32F405xx
 #ifdef HAL_SD_MODULE_ENABLED
 
+#include <algorithm>
 #include <cstring>
 
 using namespace StmPlusPlus;
@@ -35,18 +36,23 @@ using namespace StmPlusPlus;
 
 #define WAV_HEADER_LENGTH sizeof(wavHeader)
 
-WavStreamer::WavStreamer (Devices::SdCard & _sdCard, Devices::AudioDac_UDA1334 & _audioDac) :
+WavStreamer::WavStreamer (StorageManager & _storage, Devices::AudioDac_UDA1334 & _audioDac) :
         handler(NULL),
         audioDac(_audioDac),
-        sdCard(_sdCard),
+        storage(_storage),
+        sdCard(_storage.getSdCard()),
         sdCardBlock(),
         wavHeader(),
         totalBytes(0),
         totalBytesRead(0),
+        fileOpened(false),
+        rawMode(false),
+        currSector(0),
         volume(1.0),
+        readCycles(0),
         testPin(NULL)
 {
-    // empty
+    storage.addHandler(this);
 }
 
 bool WavStreamer::start (Devices::AudioDac_UDA1334::SourceType s, const char * fileName)
@@ -62,9 +68,14 @@ bool WavStreamer::start (Devices::AudioDac_UDA1334::SourceType s, const char * f
     uint32_t standard, audioFreq;
     if (s == Devices::AudioDac_UDA1334::SourceType::STREAM)
     {
+        if (!storage.acquire())
+        {
+            return false;
+        }
         if (!startSdCard(fileName))
         {
-            sdCard.stop();
+            closeFile();
+            storage.release();
             return false;
         }
         standard = I2S_STANDARD_PHILIPS; //I2S_STANDARD_PCM_SHORT;
@@ -83,7 +94,11 @@ void WavStreamer::stop ()
 {
     if (audioDac.getSourceType() == Devices::AudioDac_UDA1334::SourceType::STREAM)
     {
-        sdCard.stop();
+        if (fileOpened)
+        {
+            closeFile();
+            storage.release();
+        }
     }
     audioDac.stop();
     totalBytes = totalBytesRead = 0;
@@ -102,9 +117,10 @@ void WavStreamer::periodic ()
     }
     if (audioDac.getSourceType() == Devices::AudioDac_UDA1334::SourceType::STREAM)
     {
-        if (!sdCard.isCardInserted())
+        if (!fileOpened || !sdCard.isCardInserted())
         {
             stop();
+            return;
         }
         if (audioDac.isBlockRequested())
         {
@@ -121,6 +137,17 @@ void WavStreamer::periodic ()
     }
 }
 
+void WavStreamer::onStorageLost ()
+{
+    if (fileOpened)
+    {
+        // the file handle is invalid: the streaming is stopped by periodic()
+        fileOpened = false;
+        storage.release();
+        USART_DEBUG("WAV file lost");
+    }
+}
+
 void WavStreamer::readBlock ()
 {
     if (testPin != NULL)
@@ -129,9 +156,12 @@ void WavStreamer::readBlock ()
     }
     
     UINT bytesRead = 0;
-    uint8_t * ptr = &(sdCardBlock.bytes[0]);
-    FRESULT code = f_read(&wavFile, ptr, BLOCK_SIZE, &bytesRead);
-    totalBytesRead += bytesRead;
+    // in raw mode, the first block starts with the header that is not a part of the audio data
+    UINT headerBytes = (rawMode && currSector == 0)? WAV_HEADER_LENGTH : 0;
+    uint32_t startCycles = CycleCounter::getValue();
+    FRESULT code = rawMode? readRawBlock(bytesRead) : f_read(&wavFile.file, &(sdCardBlock.bytes[0]), BLOCK_SIZE, &bytesRead);
+    readCycles += CycleCounter::getValue() - startCycles;
+    totalBytesRead += (bytesRead > headerBytes)? bytesRead - headerBytes : 0;
     if (code != FR_OK)
     {
         USART_DEBUG("Can not read next block: err=" << code);
@@ -165,19 +195,66 @@ void WavStreamer::readBlock ()
     }
 }
 
-bool WavStreamer::startSdCard (const char * fileName)
+FRESULT WavStreamer::readRawBlock (UINT & bytesRead)
 {
-    if (!sdCard.start())
+    const uint32_t fileSize = f_size(&wavFile.file);
+    const uint32_t offset = currSector * Devices::SdCard::SDHC_BLOCK_SIZE;
+    bytesRead = 0;
+    if (offset >= fileSize)
     {
-        return false;
+        return FR_OK;
     }
-    
-    if (!sdCard.mountFatFs())
+
+    uint32_t sectors = BLOCK_SIZE / Devices::SdCard::SDHC_BLOCK_SIZE;
+    if (currSector + sectors > wavFile.sectorCount)
     {
-        return false;
+        sectors = wavFile.sectorCount - currSector;
+    }
+    if (sdCard.readSectors(wavFile, currSector, &(sdCardBlock.block[0]), sectors) != SD_OK)
+    {
+        return FR_DISK_ERR;
+    }
+
+    bytesRead = std::min(sectors * Devices::SdCard::SDHC_BLOCK_SIZE, fileSize - offset);
+    if (currSector == 0)
+    {
+        // the first block starts with the WAV header: replace it by silence
+        ::memset(&(sdCardBlock.bytes[0]), 0, WAV_HEADER_LENGTH);
+    }
+    currSector += sectors;
+    return FR_OK;
+}
+
+void WavStreamer::closeFile ()
+{
+    if (!fileOpened)
+    {
+        return;
+    }
+    if (rawMode)
+    {
+        sdCard.closeContiguous(wavFile);
+    }
+    else
+    {
+        f_close(&wavFile.file);
+    }
+    fileOpened = false;
+    char throughput[16];
+    USART_DEBUG("Read throughput (" << (rawMode? "raw sectors" : "FAT FS") << "): "
+             << CycleCounter::formatThroughput(totalBytesRead, readCycles, throughput) << " MB/s");
+    sdCard.getStatistics().dump();
+}
+
+bool WavStreamer::startSdCard (const char * fileName)
+{
+    FRESULT code = sdCard.openContiguous(wavFile, fileName, FA_READ);
+    rawMode = (code == FR_OK);
+    if (code == FR_DENIED)
+    {
+        USART_DEBUG("WAV file " << fileName << " is fragmented, reading it using FAT FS");
+        code = f_open(&wavFile.file, fileName, FA_READ);
     }
-    
-    FRESULT code = f_open(&wavFile, fileName, FA_READ);
     if (code != FR_OK)
     {
         USART_DEBUG("Can not open WAV file " << fileName << ": " << code);
@@ -186,8 +263,12 @@ bool WavStreamer::startSdCard (const char * fileName)
         return false;
     }
     
+    fileOpened = true;
+    currSector = 0;
+    readCycles = 0;
+
     UINT bytesRead = 0;
-    code = f_read(&wavFile, &(sdCardBlock.block[0]), BLOCK_SIZE, &bytesRead);
+    code = rawMode? readRawBlock(bytesRead) : f_read(&wavFile.file, &(sdCardBlock.block[0]), BLOCK_SIZE, &bytesRead);
     if (code != FR_OK || bytesRead != BLOCK_SIZE)
     {
         USART_DEBUG("Can not read WAV header from file " << fileName << ": " << code);
@@ -235,7 +316,15 @@ bool WavStreamer::startSdCard (const char * fileName)
                     << "  total samples = " << totalBytes / bytesPerSample);
     }
     
-    f_lseek(&wavFile, WAV_HEADER_LENGTH);
+    if (rawMode)
+    {
+        // raw sectors are read from the file begin, the header is replaced by silence
+        currSector = 0;
+    }
+    else
+    {
+        f_lseek(&wavFile.file, WAV_HEADER_LENGTH);
+    }
     totalBytesRead = 0;
     
     USART_DEBUG("WAV streaming from file started: " << fileName);
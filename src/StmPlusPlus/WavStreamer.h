@@ -22,7 +22,7 @@
 #define WAVSTREAMER_H_
 
 #include "StmPlusPlus.h"
-#include "Devices/SdCard.h"
+#include "StorageManager.h"
 #include "Devices/AudioDac_UDA1334.h"
 
 #ifdef STM32F405xx
@@ -31,7 +31,7 @@
 namespace StmPlusPlus
 {
 
-class WavStreamer final
+class WavStreamer final : public StorageManager::EventHandler
 {
 public:
     
@@ -76,7 +76,7 @@ public:
         uint8_t bytes[BLOCK_SIZE];
     } Block;
 
-    WavStreamer (Devices::SdCard & _sdCard, Devices::AudioDac_UDA1334 & _audioDac);
+    WavStreamer (StorageManager & _storage, Devices::AudioDac_UDA1334 & _audioDac);
 
     inline void setTestPin (IOPin * pin)
     {
@@ -104,6 +104,8 @@ public:
 
     void periodic ();
 
+    virtual void onStorageLost ();
+
 private:
     
     // Interfaces
@@ -111,21 +113,31 @@ private:
     Devices::AudioDac_UDA1334 & audioDac;
 
     // SD card handling
+    StorageManager & storage;
     Devices::SdCard & sdCard;
     Block sdCardBlock;
     WavHeader wavHeader;
     uint32_t totalBytes, totalBytesRead;
 
     // File handling
-    FIL wavFile;
+    Devices::SdCard::ContiguousFile wavFile;
+    bool fileOpened, rawMode;
+    uint32_t currSector;
     float volume;
 
+    // Statistics
+    uint64_t readCycles;
+
     // Test
     IOPin *testPin;
 
     bool startSdCard (const char * fileName);
 
+    void closeFile ();
+
     void readBlock ();
+
+    FRESULT readRawBlock (UINT & bytesRead);
 };
 
 } // end namespace